@@ -0,0 +1,1696 @@
+#include "../include/mos6502.h"
+#include "../include/mos6502_batch.h"
+#include "../include/mos6502_lockstep.h"
+#include "../include/mos6502_replay.h"
+#include "../include/mos6502_trace.h"
+#include "../include/mos6502_via.h"
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+
+// Fill a page with its index, sum it with ADC and loop forever
+//
+// 0200: A2 00     LDX #$00
+// 0202: 8A        TXA
+// 0203: 9D 00 03  STA $0300,X
+// 0206: 18        CLC
+// 0207: 7D 00 03  ADC $0300,X
+// 020A: 85 10     STA $10
+// 020C: E8        INX
+// 020D: D0 F3     BNE $0202
+// 020F: 4C 00 02  JMP $0200
+static const uint8_t mixedLoop[] = {
+    0xA2, 0x00,
+    0x8A,
+    0x9D, 0x00, 0x03,
+    0x18,
+    0x7D, 0x00, 0x03,
+    0x85, 0x10,
+    0xE8,
+    0xD0, 0xF3,
+    0x4C, 0x00, 0x02};
+
+// Tight accumulator arithmetic, 256 rounds per pass
+//
+// 0200: A9 00     LDA #$00
+// 0202: A2 00     LDX #$00
+// 0204: 18        CLC
+// 0205: 69 03     ADC #$03
+// 0207: 49 5A     EOR #$5A
+// 0209: 0A        ASL A
+// 020A: 6A        ROR A
+// 020B: 29 7F     AND #$7F
+// 020D: 09 01     ORA #$01
+// 020F: CA        DEX
+// 0210: D0 F2     BNE $0204
+// 0212: 4C 00 02  JMP $0200
+static const uint8_t aluLoop[] = {
+    0xA9, 0x00,
+    0xA2, 0x00,
+    0x18,
+    0x69, 0x03,
+    0x49, 0x5A,
+    0x0A,
+    0x6A,
+    0x29, 0x7F,
+    0x09, 0x01,
+    0xCA,
+    0xD0, 0xF2,
+    0x4C, 0x00, 0x02};
+
+// Copy 1 KB from $1000 to $2000 through two zero page pointers
+//
+// 0200: A9 00     LDA #$00
+// 0202: 85 F0     STA $F0
+// 0204: 85 F2     STA $F2
+// 0206: A9 10     LDA #$10
+// 0208: 85 F1     STA $F1
+// 020A: A9 20     LDA #$20
+// 020C: 85 F3     STA $F3
+// 020E: A2 04     LDX #$04
+// 0210: A0 00     LDY #$00
+// 0212: B1 F0     LDA ($F0),Y
+// 0214: 91 F2     STA ($F2),Y
+// 0216: C8        INY
+// 0217: D0 F9     BNE $0212
+// 0219: E6 F1     INC $F1
+// 021B: E6 F3     INC $F3
+// 021D: CA        DEX
+// 021E: D0 F2     BNE $0212
+// 0220: 4C 00 02  JMP $0200
+static const uint8_t copyLoop[] = {
+    0xA9, 0x00,
+    0x85, 0xF0,
+    0x85, 0xF2,
+    0xA9, 0x10,
+    0x85, 0xF1,
+    0xA9, 0x20,
+    0x85, 0xF3,
+    0xA2, 0x04,
+    0xA0, 0x00,
+    0xB1, 0xF0,
+    0x91, 0xF2,
+    0xC8,
+    0xD0, 0xF9,
+    0xE6, 0xF1,
+    0xE6, 0xF3,
+    0xCA,
+    0xD0, 0xF2,
+    0x4C, 0x00, 0x02};
+
+// 16-bit BCD counter up and a BCD countdown in decimal mode
+//
+// 0200: F8        SED
+// 0201: A2 00     LDX #$00
+// 0203: 18        CLC
+// 0204: A5 10     LDA $10
+// 0206: 69 01     ADC #$01
+// 0208: 85 10     STA $10
+// 020A: A5 11     LDA $11
+// 020C: 69 00     ADC #$00
+// 020E: 85 11     STA $11
+// 0210: 38        SEC
+// 0211: A5 12     LDA $12
+// 0213: E9 07     SBC #$07
+// 0215: 85 12     STA $12
+// 0217: CA        DEX
+// 0218: D0 E9     BNE $0203
+// 021A: D8        CLD
+// 021B: 4C 00 02  JMP $0200
+static const uint8_t bcdLoop[] = {
+    0xF8,
+    0xA2, 0x00,
+    0x18,
+    0xA5, 0x10,
+    0x69, 0x01,
+    0x85, 0x10,
+    0xA5, 0x11,
+    0x69, 0x00,
+    0x85, 0x11,
+    0x38,
+    0xA5, 0x12,
+    0xE9, 0x07,
+    0x85, 0x12,
+    0xCA,
+    0xD0, 0xE9,
+    0xD8,
+    0x4C, 0x00, 0x02};
+
+// Recurse 16 levels deep through JSR/RTS, saving A on the stack at every level
+//
+// 0200: A2 FF     LDX #$FF
+// 0202: 9A        TXS
+// 0203: A9 10     LDA #$10
+// 0205: 20 0B 02  JSR $020B
+// 0208: 4C 00 02  JMP $0200
+// 020B: 48        PHA
+// 020C: 38        SEC
+// 020D: E9 01     SBC #$01
+// 020F: F0 03     BEQ $0214
+// 0211: 20 0B 02  JSR $020B
+// 0214: 68        PLA
+// 0215: 60        RTS
+static const uint8_t recursionLoop[] = {
+    0xA2, 0xFF,
+    0x9A,
+    0xA9, 0x10,
+    0x20, 0x0B, 0x02,
+    0x4C, 0x00, 0x02,
+    0x48,
+    0x38,
+    0xE9, 0x01,
+    0xF0, 0x03,
+    0x20, 0x0B, 0x02,
+    0x68,
+    0x60};
+
+// Data dependent branches on a Galois LFSR, hard to predict for the host
+//
+// 0200: A9 A5     LDA #$A5
+// 0202: 85 20     STA $20
+// 0204: A5 20     LDA $20
+// 0206: 4A        LSR A
+// 0207: 90 02     BCC $020B
+// 0209: 49 B8     EOR #$B8
+// 020B: 85 20     STA $20
+// 020D: 30 04     BMI $0213
+// 020F: E8        INX
+// 0210: 4C 14 02  JMP $0214
+// 0213: 88        DEY
+// 0214: C9 40     CMP #$40
+// 0216: B0 02     BCS $021A
+// 0218: E6 21     INC $21
+// 021A: C6 22     DEC $22
+// 021C: D0 E6     BNE $0204
+// 021E: 4C 00 02  JMP $0200
+static const uint8_t branchLoop[] = {
+    0xA9, 0xA5,
+    0x85, 0x20,
+    0xA5, 0x20,
+    0x4A,
+    0x90, 0x02,
+    0x49, 0xB8,
+    0x85, 0x20,
+    0x30, 0x04,
+    0xE8,
+    0x4C, 0x14, 0x02,
+    0x88,
+    0xC9, 0x40,
+    0xB0, 0x02,
+    0xE6, 0x21,
+    0xC6, 0x22,
+    0xD0, 0xE6,
+    0x4C, 0x00, 0x02};
+
+static const uint16_t programStart = 0x0200;
+
+/**
+ * @brief A self-contained program looping forever from programStart.
+ */
+struct Workload
+{
+    const char *name;
+    const uint8_t *program;
+    size_t length;
+};
+
+static const Workload workloads[] = {
+    {"mixed", mixedLoop, sizeof(mixedLoop)},
+    {"alu", aluLoop, sizeof(aluLoop)},
+    {"copy", copyLoop, sizeof(copyLoop)},
+    {"bcd", bcdLoop, sizeof(bcdLoop)},
+    {"recursion", recursionLoop, sizeof(recursionLoop)},
+    {"branch", branchLoop, sizeof(branchLoop)}};
+
+// Klaus Dormann's 6502_functional_test.bin is loaded at $0000 and started at $0400
+static const uint16_t klausStart = 0x0400;
+static const uint16_t klausSuccess = 0x3469;
+static const uint64_t klausMaxCycles = 1000000000;
+
+enum output_format
+{
+    FORMAT_TABLE,
+    FORMAT_CSV,
+    FORMAT_JSON
+};
+
+/**
+ * @brief Command line settings of the benchmark.
+ */
+struct Options
+{
+    output_format format;
+    uint64_t cycles;
+    std::string filter;
+    std::string label;
+    std::string klausPath;
+    uint16_t klausSuccess;
+};
+
+/**
+ * @brief One line of benchmark output.
+ *
+ * @param workload The program that ran.
+ * @param engine How it was run: step, run, fork or batch.
+ * @param threads The number of host threads used.
+ * @param runs The number of separate CPUs that ran the program.
+ * @param instructions The number of emulated instructions executed.
+ * @param cycles The number of emulated cycles executed.
+ * @param seconds The host wall time taken.
+ */
+struct Measurement
+{
+    std::string workload;
+    std::string engine;
+    unsigned threads;
+    uint64_t runs;
+    uint64_t instructions;
+    uint64_t cycles;
+    double seconds;
+};
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool selected(const Options &options, const std::string &workload, const std::string &engine)
+{
+    return options.filter.empty() ||
+           workload.find(options.filter) != std::string::npos ||
+           engine.find(options.filter) != std::string::npos;
+}
+
+static void printHeader(const Options &options)
+{
+    if (options.format == FORMAT_CSV)
+    {
+        std::cout << "label,workload,engine,threads,runs,instructions,cycles,seconds,"
+                  << "instructions_per_second,cycles_per_second,ns_per_instruction" << std::endl;
+    }
+    else if (options.format == FORMAT_TABLE)
+    {
+        std::cout << std::left << std::setw(11) << "workload" << std::setw(7) << "engine" << std::right
+                  << std::setw(8) << "threads" << std::setw(14) << "M instr/s"
+                  << std::setw(14) << "MHz emulated" << std::setw(12) << "ns/instr" << std::endl;
+    }
+}
+
+static void report(const Options &options, const Measurement &measurement)
+{
+    double instructionsPerSecond = measurement.seconds > 0 ? measurement.instructions / measurement.seconds : 0;
+    double cyclesPerSecond = measurement.seconds > 0 ? measurement.cycles / measurement.seconds : 0;
+    double nsPerInstruction = measurement.instructions ? measurement.seconds * 1e9 / measurement.instructions : 0;
+
+    if (options.format == FORMAT_CSV)
+    {
+        std::cout << options.label << ',' << measurement.workload << ',' << measurement.engine << ','
+                  << measurement.threads << ',' << measurement.runs << ','
+                  << measurement.instructions << ',' << measurement.cycles << ','
+                  << std::fixed << std::setprecision(6) << measurement.seconds << ','
+                  << std::setprecision(0) << instructionsPerSecond << ',' << cyclesPerSecond << ','
+                  << std::setprecision(3) << nsPerInstruction << std::endl;
+    }
+    else if (options.format == FORMAT_JSON)
+    {
+        std::cout << "{\"label\":\"" << options.label << "\",\"workload\":\"" << measurement.workload
+                  << "\",\"engine\":\"" << measurement.engine << "\",\"threads\":" << measurement.threads
+                  << ",\"runs\":" << measurement.runs << ",\"instructions\":" << measurement.instructions
+                  << ",\"cycles\":" << measurement.cycles
+                  << std::fixed << std::setprecision(6) << ",\"seconds\":" << measurement.seconds
+                  << std::setprecision(0) << ",\"instructions_per_second\":" << instructionsPerSecond
+                  << ",\"cycles_per_second\":" << cyclesPerSecond
+                  << std::setprecision(3) << ",\"ns_per_instruction\":" << nsPerInstruction << "}" << std::endl;
+    }
+    else
+    {
+        std::cout << std::left << std::setw(11) << measurement.workload << std::setw(7) << measurement.engine << std::right
+                  << std::setw(8) << measurement.threads << std::fixed << std::setprecision(2)
+                  << std::setw(14) << instructionsPerSecond / 1e6
+                  << std::setw(14) << cyclesPerSecond / 1e6
+                  << std::setw(12) << nsPerInstruction << std::endl;
+    }
+}
+
+/**
+ * @brief Run a CPU through one of the two dispatchers.
+ *
+ * The step() loop stops on self loops like run() does, so both engines do the same work.
+ */
+static mos6502::run_status runEngine(mos6502 &cpu, bool useStep, uint64_t maxCycles)
+{
+    if (!useStep)
+        return cpu.run(maxCycles);
+
+    uint64_t endCycles = cpu.getCycles() + maxCycles;
+    while (cpu.getCycles() < endCycles)
+    {
+        uint16_t address = cpu.getPC();
+        cpu.step();
+        if (cpu.getPC() == address)
+            return mos6502::RUN_TRAPPED;
+    }
+
+    return mos6502::RUN_BUDGET_EXHAUSTED;
+}
+
+static Measurement measure(mos6502 &cpu, const char *workload, bool useStep, uint64_t maxCycles, mos6502::run_status &status)
+{
+    Measurement measurement = {workload, useStep ? "step" : "run", 1, 1, 0, 0, 0};
+
+    uint64_t startInstructions = cpu.getInstructionCount();
+    uint64_t startCycles = cpu.getCycles();
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    status = runEngine(cpu, useStep, maxCycles);
+    measurement.seconds = secondsSince(start);
+
+    measurement.instructions = cpu.getInstructionCount() - startInstructions;
+    measurement.cycles = cpu.getCycles() - startCycles;
+    return measurement;
+}
+
+// The shared instruction implementation on a bus of flat RAM, checked against step() on mos6502
+static bool benchFlat(const Options &options, const Workload &workload, mos6502 *reference)
+{
+    if (!selected(options, workload.name, "flat"))
+        return true;
+
+    Core6502<FlatBus> cpu;
+    for (size_t i = 0; i < workload.length; i++)
+        cpu.writeByte(programStart + i, workload.program[i]);
+    cpu.setPC(programStart);
+
+    Measurement measurement = {workload.name, "flat", 1, 1, 0, 0, 0};
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    Core6502<FlatBus>::run_status status = cpu.run(options.cycles);
+    measurement.seconds = secondsSince(start);
+    measurement.instructions = cpu.getInstructionCount();
+    measurement.cycles = cpu.getCycles();
+    report(options, measurement);
+
+    if (status != Core6502<FlatBus>::RUN_BUDGET_EXHAUSTED)
+    {
+        std::cerr << "Error: workload " << workload.name << " stopped early at $" << std::hex << cpu.getPC() << std::dec << " on the flat bus." << std::endl;
+        return false;
+    }
+
+    if (!reference)
+        return true;
+
+    bool same = reference->getPC() == cpu.getPC() &&
+                reference->getSP() == cpu.getSP() &&
+                reference->getSR() == cpu.getSR() &&
+                reference->getAC() == cpu.getAC() &&
+                reference->getXR() == cpu.getXR() &&
+                reference->getYR() == cpu.getYR() &&
+                reference->getCycles() == cpu.getCycles() &&
+                reference->getInstructionCount() == cpu.getInstructionCount();
+    for (uint32_t address = 0; same && address < 0x10000; address++)
+        same = reference->readByte(address) == cpu.readByte(address);
+
+    if (!same)
+    {
+        std::cerr << "Error: flat and step disagree on the final machine state of " << workload.name << "." << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+static bool benchWorkload(const Options &options, const Workload &workload)
+{
+    // Host driven step() through the Instructions table, the switch inside run() on its own,
+    // with opcode pairs fused into superinstructions, from the cache of decoded blocks and
+    // with the blocks translated to host code
+    const char *engines[5] = {"step", "run", "fused", "blocks", "jit"};
+    const mos6502::run_engine runEngines[5] = {mos6502::ENGINE_SWITCH, mos6502::ENGINE_SWITCH, mos6502::ENGINE_SWITCH,
+                                               mos6502::ENGINE_BLOCKS, mos6502::ENGINE_JIT};
+    mos6502 cpus[5];
+    bool ran[5] = {false, false, false, false, false};
+
+    for (int engine = 0; engine < 5; engine++)
+    {
+        if (!selected(options, workload.name, engines[engine]))
+            continue;
+
+        mos6502 &cpu = cpus[engine];
+        cpu.loadMemory(workload.program, workload.length, programStart);
+        cpu.setPC(programStart);
+        cpu.setFusion(engine == 2);
+        cpu.setEngine(runEngines[engine]);
+
+        mos6502::run_status status;
+        Measurement measurement = measure(cpu, workload.name, engine == 0, options.cycles, status);
+        measurement.engine = engines[engine];
+        report(options, measurement);
+        ran[engine] = true;
+
+        if (status != mos6502::RUN_BUDGET_EXHAUSTED)
+        {
+            std::cerr << "Error: workload " << workload.name << " stopped early at $" << std::hex << cpu.getPC() << std::dec << "." << std::endl;
+            return false;
+        }
+    }
+
+    // Every engine must leave the machine in the same state
+    for (int engine = 1; engine < 5; engine++)
+    {
+        if (!ran[0] || !ran[engine])
+            continue;
+
+        bool same = cpus[0].getPC() == cpus[engine].getPC() &&
+                    cpus[0].getSP() == cpus[engine].getSP() &&
+                    cpus[0].getSR() == cpus[engine].getSR() &&
+                    cpus[0].getAC() == cpus[engine].getAC() &&
+                    cpus[0].getXR() == cpus[engine].getXR() &&
+                    cpus[0].getYR() == cpus[engine].getYR() &&
+                    cpus[0].getCycles() == cpus[engine].getCycles() &&
+                    cpus[0].getInstructionCount() == cpus[engine].getInstructionCount() &&
+                    cpus[0].digestMemory() == cpus[engine].digestMemory();
+
+        if (!same)
+        {
+            std::cerr << "Error: " << engines[engine] << " and step disagree on the final machine state of " << workload.name << "." << std::endl;
+            return false;
+        }
+    }
+
+    return benchFlat(options, workload, ran[0] ? &cpus[0] : NULL);
+}
+
+// Expected accumulator and status register of ADC, or SBC when subtracting, on an NMOS 6502.
+// Decimal mode works digit by digit as in the truth tables of Bruce Clark's "Decimal Mode"
+// tutorial: N and V come from the ADC sum before the high digit is adjusted, every other flag
+// from the binary result.
+static void referenceArithmetic(bool subtract, bool decimal, uint8_t a, uint8_t b, bool carry, uint8_t &result, uint8_t &status)
+{
+    int binary = subtract ? a + (b ^ 0xFF) + carry : a + b + carry;
+    uint8_t operand = subtract ? b ^ 0xFF : b;
+    uint8_t signs = binary & 0xFF;
+
+    status = (binary > 0xFF ? 0x01 : 0) | ((binary & 0xFF) == 0 ? 0x02 : 0);
+    result = binary & 0xFF;
+
+    if (decimal && !subtract)
+    {
+        int low = (a & 0x0F) + (b & 0x0F) + carry;
+        bool halfCarry = low > 9;
+        int high = (a >> 4) + (b >> 4) + halfCarry;
+        low = halfCarry ? (low + 6) & 0x0F : low;
+
+        signs = ((high << 4) | low) & 0xFF;
+        if (high > 9)
+            high += 6;
+
+        status = (status & 0x02) | (high > 15 ? 0x01 : 0);
+        result = ((high << 4) | low) & 0xFF;
+    }
+    else if (decimal)
+    {
+        int low = (a & 0x0F) - (b & 0x0F) - !carry;
+        bool halfBorrow = low < 0;
+        int high = (a >> 4) - (b >> 4) - halfBorrow;
+        low = halfBorrow ? (low - 6) & 0x0F : low;
+        if (high < 0)
+            high -= 6;
+
+        result = ((high << 4) | low) & 0xFF;
+    }
+
+    status |= (signs & 0x80) | ((~(a ^ operand) & (a ^ signs) & 0x80) ? 0x40 : 0);
+}
+
+static bool benchArithmetic(const Options &options)
+{
+    if (!selected(options, "adc/sbc", "check"))
+        return true;
+
+    // ADC #$00 and SBC #$00, the operand is patched for every case
+    const uint8_t programs[2][2] = {{0x69, 0x00}, {0xE9, 0x00}};
+
+    mos6502 cpu;
+    Measurement measurement = {"adc/sbc", "check", 1, 1, 0, 0, 0};
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    uint64_t failures = 0;
+
+    // Every operation, mode, carry, accumulator and operand: 2 x 2 x 2 x 256 x 256 cases
+    for (int subtract = 0; subtract < 2; subtract++)
+    {
+        cpu.loadMemory(programs[subtract], 2, programStart);
+
+        for (int decimal = 0; decimal < 2; decimal++)
+            for (int carry = 0; carry < 2; carry++)
+                for (int a = 0; a < 256; a++)
+                    for (int b = 0; b < 256; b++)
+                    {
+                        uint8_t statusIn = 0x20 | (decimal ? 0x08 : 0) | carry;
+                        cpu.writeByte(programStart + 1, b);
+                        cpu.setPC(programStart);
+                        cpu.setAC(a);
+                        cpu.setSR(statusIn);
+                        cpu.step();
+
+                        uint8_t result, flags;
+                        referenceArithmetic(subtract, decimal, a, b, carry, result, flags);
+                        uint8_t expected = (statusIn & 0x3C) | flags;
+
+                        if (cpu.getAC() != result || cpu.getSR() != expected)
+                        {
+                            if (failures++ < 8)
+                                std::cerr << "Error: " << (subtract ? "SBC" : "ADC") << (decimal ? " decimal" : " binary")
+                                          << std::hex << " A=$" << a << " M=$" << b << " C=" << carry
+                                          << " gave A=$" << static_cast<int>(cpu.getAC()) << " SR=$" << static_cast<int>(cpu.getSR())
+                                          << ", expected A=$" << static_cast<int>(result) << " SR=$" << static_cast<int>(expected)
+                                          << std::dec << "." << std::endl;
+                        }
+                    }
+    }
+
+    measurement.seconds = secondsSince(start);
+    measurement.instructions = cpu.getInstructionCount();
+    measurement.cycles = cpu.getCycles();
+    report(options, measurement);
+
+    if (failures)
+    {
+        std::cerr << "Error: " << failures << " ADC/SBC results differ from the reference." << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+// Next value of a xorshift generator, so the random programs are the same on every run
+static uint32_t nextRandom(uint32_t &state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// Fill 64 KB with random bytes
+static void randomMemory(uint32_t &state, std::vector<uint8_t> &memory)
+{
+    memory.resize(0x10000);
+    for (size_t i = 0; i < memory.size(); i++)
+        memory[i] = nextRandom(state) >> 24;
+}
+
+/**
+ * @brief A plain NMOS 6502 keeping its status register as one byte that every instruction updates.
+ *
+ * The flags are set the way the core set them before they went lazy, so step() on random programs
+ * is checked against it. Like the core, illegal opcodes are one byte long and do nothing, PLP clears
+ * B and bit 5 while RTI keeps them, and JMP ($xxFF) reads its high byte from the next page.
+ */
+struct ReferenceCpu
+{
+    uint8_t memory[0x10000];
+    uint16_t PC;
+    uint8_t SP;
+    uint8_t SR;
+    uint8_t AC;
+    uint8_t XR;
+    uint8_t YR;
+
+    uint8_t read(uint16_t address) { return memory[address]; }
+    uint16_t readWord(uint16_t address) { return read(address) | read(address + 1) << 8; }
+    uint16_t readZeroWord(uint8_t address) { return read(address) | read((address + 1) & 0xFF) << 8; }
+    void push(uint8_t data) { memory[0x100 | SP--] = data; }
+    uint8_t pop() { return memory[0x100 | ++SP]; }
+
+    void setFlag(uint8_t flag, bool state) { SR = state ? SR | flag : SR & ~flag; }
+    void setNZ(uint8_t value) { SR = (SR & 0x7D) | (value & 0x80) | (value ? 0 : 0x02); }
+    void compare(uint8_t reg, uint8_t value) { setNZ(reg - value); setFlag(0x01, reg >= value); }
+    void branch(bool taken, uint16_t target) { PC = taken ? target : PC; }
+
+    void arithmetic(bool subtract, uint16_t address)
+    {
+        uint8_t result, flags;
+        referenceArithmetic(subtract, SR & 0x08, AC, read(address), SR & 0x01, result, flags);
+        AC = result;
+        SR = (SR & 0x3C) | flags;
+    }
+    uint8_t shift(uint8_t value, bool left, bool rotate)
+    {
+        uint8_t carryIn = rotate ? SR & 0x01 : 0;
+        setFlag(0x01, left ? value & 0x80 : value & 0x01);
+        value = left ? value << 1 | carryIn : value >> 1 | carryIn << 7;
+        setNZ(value);
+        return value;
+    }
+
+    // Addressing modes, returning the effective address
+    uint16_t addressingIMP() { return 0; }
+    uint16_t addressingIMM() { return PC++; }
+    uint16_t addressingABS() { PC += 2; return readWord(PC - 2); }
+    uint16_t addressingABX() { return addressingABS() + XR; }
+    uint16_t addressingABY() { return addressingABS() + YR; }
+    uint16_t addressingZER() { return read(PC++); }
+    uint16_t addressingZEX() { return (read(PC++) + XR) & 0xFF; }
+    uint16_t addressingZEY() { return (read(PC++) + YR) & 0xFF; }
+    uint16_t addressingIND() { return readWord(addressingABS()); }
+    uint16_t addressingINX() { return readZeroWord(read(PC++) + XR); }
+    uint16_t addressingINY() { return readZeroWord(read(PC++)) + YR; }
+    uint16_t addressingREL() { int8_t offset = read(PC++); return PC + offset; }
+
+    void ADC(uint16_t address) { arithmetic(false, address); }
+    void SBC(uint16_t address) { arithmetic(true, address); }
+    void AND(uint16_t address) { setNZ(AC &= read(address)); }
+    void EOR(uint16_t address) { setNZ(AC ^= read(address)); }
+    void ORA(uint16_t address) { setNZ(AC |= read(address)); }
+    void ASL(uint16_t address) { memory[address] = shift(read(address), true, false); }
+    void LSR(uint16_t address) { memory[address] = shift(read(address), false, false); }
+    void ROL(uint16_t address) { memory[address] = shift(read(address), true, true); }
+    void ROR(uint16_t address) { memory[address] = shift(read(address), false, true); }
+    void ASL_ACC(uint16_t) { AC = shift(AC, true, false); }
+    void LSR_ACC(uint16_t) { AC = shift(AC, false, false); }
+    void ROL_ACC(uint16_t) { AC = shift(AC, true, true); }
+    void ROR_ACC(uint16_t) { AC = shift(AC, false, true); }
+    void BIT(uint16_t address)
+    {
+        uint8_t value = read(address);
+        SR = (SR & 0x3D) | (value & 0xC0) | ((AC & value) ? 0 : 0x02);
+    }
+    void CMP(uint16_t address) { compare(AC, read(address)); }
+    void CPX(uint16_t address) { compare(XR, read(address)); }
+    void CPY(uint16_t address) { compare(YR, read(address)); }
+    void DEC(uint16_t address) { setNZ(--memory[address]); }
+    void INC(uint16_t address) { setNZ(++memory[address]); }
+    void DEX(uint16_t) { setNZ(--XR); }
+    void DEY(uint16_t) { setNZ(--YR); }
+    void INX(uint16_t) { setNZ(++XR); }
+    void INY(uint16_t) { setNZ(++YR); }
+    void LDA(uint16_t address) { setNZ(AC = read(address)); }
+    void LDX(uint16_t address) { setNZ(XR = read(address)); }
+    void LDY(uint16_t address) { setNZ(YR = read(address)); }
+    void STA(uint16_t address) { memory[address] = AC; }
+    void STX(uint16_t address) { memory[address] = XR; }
+    void STY(uint16_t address) { memory[address] = YR; }
+    void TAX(uint16_t) { setNZ(XR = AC); }
+    void TAY(uint16_t) { setNZ(YR = AC); }
+    void TXA(uint16_t) { setNZ(AC = XR); }
+    void TYA(uint16_t) { setNZ(AC = YR); }
+    void TSX(uint16_t) { setNZ(XR = SP); }
+    void TXS(uint16_t) { SP = XR; }
+    void PHA(uint16_t) { push(AC); }
+    void PHP(uint16_t) { push(SR | 0x30); }
+    void PLA(uint16_t) { setNZ(AC = pop()); }
+    void PLP(uint16_t) { SR = pop() & ~0x30; }
+    void BCC(uint16_t address) { branch(!(SR & 0x01), address); }
+    void BCS(uint16_t address) { branch(SR & 0x01, address); }
+    void BNE(uint16_t address) { branch(!(SR & 0x02), address); }
+    void BEQ(uint16_t address) { branch(SR & 0x02, address); }
+    void BVC(uint16_t address) { branch(!(SR & 0x40), address); }
+    void BVS(uint16_t address) { branch(SR & 0x40, address); }
+    void BPL(uint16_t address) { branch(!(SR & 0x80), address); }
+    void BMI(uint16_t address) { branch(SR & 0x80, address); }
+    void CLC(uint16_t) { setFlag(0x01, false); }
+    void CLD(uint16_t) { setFlag(0x08, false); }
+    void CLI(uint16_t) { setFlag(0x04, false); }
+    void CLV(uint16_t) { setFlag(0x40, false); }
+    void SEC(uint16_t) { setFlag(0x01, true); }
+    void SED(uint16_t) { setFlag(0x08, true); }
+    void SEI(uint16_t) { setFlag(0x04, true); }
+    void NOP(uint16_t) {}
+    void JMP(uint16_t address) { PC = address; }
+    void JSR(uint16_t address)
+    {
+        PC--;
+        push(PC >> 8);
+        push(PC & 0xFF);
+        PC = address;
+    }
+    void RTS(uint16_t)
+    {
+        PC = pop();
+        PC = (PC | pop() << 8) + 1;
+    }
+    void RTI(uint16_t)
+    {
+        SR = pop();
+        PC = pop();
+        PC |= pop() << 8;
+    }
+    void BRK(uint16_t)
+    {
+        PC++;
+        push(PC >> 8);
+        push(PC & 0xFF);
+        push(SR | 0x30);
+        setFlag(0x04, true);
+        PC = readWord(0xFFFE);
+    }
+
+    void step()
+    {
+        uint8_t opcode = read(PC++);
+
+        switch (opcode)
+        {
+#define MOS6502_OPCODE(opcode, alias, code, mode, cycles, bytes, pageCycles) \
+    case opcode:                                                             \
+        code(addressing##mode());                                            \
+        break;
+#define MOS6502_ILLEGAL(opcode)
+#include "../include/mos6502_opcodes.h"
+#undef MOS6502_OPCODE
+#undef MOS6502_ILLEGAL
+        default:
+            break;
+        }
+    }
+};
+
+// Random programs stepped on the core and on ReferenceCpu, the registers and flags compared after every
+// instruction and the memory after every program. Random bytes cover every opcode, flag and decimal mode.
+static bool benchFlags(const Options &options)
+{
+    const int programs = 256;
+    const int steps = 4096;
+
+    if (!selected(options, "random", "flags"))
+        return true;
+
+    std::vector<uint8_t> memory;
+    std::unique_ptr<ReferenceCpu> reference(new ReferenceCpu());
+    uint32_t seed = 0x6502;
+    uint64_t failures = 0;
+
+    Measurement measurement = {"random", "flags", 1, programs, 0, 0, 0};
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for (int program = 0; program < programs; program++)
+    {
+        randomMemory(seed, memory);
+        uint32_t registers = nextRandom(seed);
+
+        mos6502 cpu;
+        cpu.loadMemory(memory.data(), memory.size(), 0x0000);
+        cpu.setPC(memory[0xFFFC] | memory[0xFFFD] << 8);
+        cpu.setSP(registers);
+        cpu.setSR(registers >> 8);
+        cpu.setAC(registers >> 16);
+        cpu.setXR(registers >> 24);
+        cpu.setYR(registers >> 4);
+
+        std::copy(memory.begin(), memory.end(), reference->memory);
+        reference->PC = cpu.getPC();
+        reference->SP = cpu.getSP();
+        reference->SR = cpu.getSR();
+        reference->AC = cpu.getAC();
+        reference->XR = cpu.getXR();
+        reference->YR = cpu.getYR();
+
+        bool same = true;
+        for (int i = 0; same && i < steps; i++)
+        {
+            uint16_t address = cpu.getPC();
+            cpu.step();
+            reference->step();
+
+            same = reference->PC == cpu.getPC() && reference->SP == cpu.getSP() && reference->SR == cpu.getSR() &&
+                   reference->AC == cpu.getAC() && reference->XR == cpu.getXR() && reference->YR == cpu.getYR();
+            if (!same && failures < 8)
+                std::cerr << "Error: random program " << program << " differs after $" << std::hex << address
+                          << " opcode $" << static_cast<int>(memory[address]) << ": SR=$" << static_cast<int>(cpu.getSR())
+                          << " PC=$" << cpu.getPC() << ", expected SR=$" << static_cast<int>(reference->SR)
+                          << " PC=$" << reference->PC << std::dec << "." << std::endl;
+        }
+
+        for (uint32_t address = 0; same && address < 0x10000; address++)
+        {
+            same = reference->memory[address] == cpu.readByte(address);
+            if (!same && failures < 8)
+                std::cerr << "Error: random program " << program << " differs in memory at $" << std::hex << address << std::dec << "." << std::endl;
+        }
+
+        failures += !same;
+        measurement.instructions += cpu.getInstructionCount();
+        measurement.cycles += cpu.getCycles();
+    }
+
+    measurement.seconds = secondsSince(start);
+    report(options, measurement);
+
+    if (failures)
+    {
+        std::cerr << "Error: " << failures << " random programs differ from the reference flags." << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+// Random programs run() through every engine from the same state, alone and with IRQ and NMI edges
+// at random cycles. Fusion, the blocks and the native code must all end where the switch ends.
+static bool benchEngines(const Options &options)
+{
+    const int programs = 128;
+    const uint64_t programCycles = 50000;
+    const char *engines[5] = {"switch", "fused", "blocks", "jit", "jit+fusion"};
+    const mos6502::run_engine runEngines[5] = {mos6502::ENGINE_SWITCH, mos6502::ENGINE_SWITCH, mos6502::ENGINE_BLOCKS, mos6502::ENGINE_JIT, mos6502::ENGINE_JIT};
+
+    if (!selected(options, "random", "engines"))
+        return true;
+
+    std::vector<uint8_t> memory;
+    uint32_t seed = 0x2A03;
+    uint64_t failures = 0;
+
+    Measurement measurement = {"random", "engines", 1, 0, 0, 0, 0};
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for (int program = 0; program < programs; program++)
+    {
+        for (int interrupts = 0; interrupts < 2; interrupts++)
+        {
+            randomMemory(seed, memory);
+            uint32_t registers = nextRandom(seed);
+
+            mos6502 prototype;
+            prototype.loadMemory(memory.data(), memory.size(), 0x0000);
+            prototype.setPC(memory[0xFFFC] | memory[0xFFFD] << 8);
+            prototype.setSP(registers);
+            prototype.setSR(registers >> 8);
+            prototype.setAC(registers >> 16);
+            prototype.setXR(registers >> 24);
+            prototype.setYR(registers >> 4);
+
+            // A few IRQ pulses and NMI edges, every fork gets the same events
+            for (int i = 0; interrupts && i < 4; i++)
+            {
+                uint64_t cycle = nextRandom(seed) % programCycles;
+                prototype.scheduleIRQLine(cycle, 0, true);
+                prototype.scheduleIRQLine(cycle + nextRandom(seed) % 2000, 0, false);
+
+                cycle = nextRandom(seed) % programCycles;
+                prototype.scheduleNMILine(cycle, true);
+                prototype.scheduleNMILine(cycle + 50, false);
+            }
+
+            mos6502 reference;
+            mos6502::run_status referenceStatus = mos6502::RUN_BUDGET_EXHAUSTED;
+            for (int engine = 0; engine < 5; engine++)
+            {
+                mos6502 cpu(prototype);
+                cpu.setEngine(runEngines[engine]);
+                cpu.setFusion(engine == 1 || engine == 4);
+
+                // Illegal opcodes are skipped by the host the way step() skips them, until the budget or a trap
+                mos6502::run_status status = mos6502::RUN_BUDGET_EXHAUSTED;
+                while (cpu.getCycles() < programCycles)
+                {
+                    status = cpu.run(programCycles - cpu.getCycles());
+                    if (status == mos6502::RUN_ILLEGAL_OPCODE)
+                        cpu.setPC(cpu.getPC() + 1);
+                    else if (status != mos6502::RUN_BUDGET_EXHAUSTED)
+                        break;
+                }
+
+                measurement.runs++;
+                measurement.instructions += cpu.getInstructionCount();
+                measurement.cycles += cpu.getCycles();
+
+                if (engine == 0)
+                {
+                    reference = cpu;
+                    referenceStatus = status;
+                    continue;
+                }
+
+                bool same = status == referenceStatus &&
+                            reference.getPC() == cpu.getPC() &&
+                            reference.getSP() == cpu.getSP() &&
+                            reference.getSR() == cpu.getSR() &&
+                            reference.getAC() == cpu.getAC() &&
+                            reference.getXR() == cpu.getXR() &&
+                            reference.getYR() == cpu.getYR() &&
+                            reference.getCycles() == cpu.getCycles() &&
+                            reference.getInstructionCount() == cpu.getInstructionCount() &&
+                            reference.digestMemory() == cpu.digestMemory();
+                if (!same && failures++ < 8)
+                    std::cerr << "Error: random program " << program << (interrupts ? " with interrupts" : "")
+                              << " ends at $" << std::hex << cpu.getPC() << " after " << std::dec << cpu.getCycles()
+                              << " cycles under " << engines[engine] << ", at $" << std::hex << reference.getPC()
+                              << " after " << std::dec << reference.getCycles() << " under switch." << std::endl;
+            }
+        }
+    }
+
+    measurement.seconds = secondsSince(start);
+    report(options, measurement);
+
+    if (failures)
+    {
+        std::cerr << "Error: " << failures << " random program runs differ between the engines." << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+static bool benchKlaus(const Options &options)
+{
+    std::ifstream file(options.klausPath.c_str(), std::ios::binary);
+    if (!file)
+    {
+        std::cerr << "Error: could not open " << options.klausPath << "." << std::endl;
+        return false;
+    }
+
+    std::vector<uint8_t> image((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (image.size() > 0x10000)
+        image.resize(0x10000);
+
+    const char *engines[4] = {"step", "run", "blocks", "jit"};
+    const mos6502::run_engine runEngines[4] = {mos6502::ENGINE_SWITCH, mos6502::ENGINE_SWITCH, mos6502::ENGINE_BLOCKS, mos6502::ENGINE_JIT};
+
+    bool ok = true;
+    for (int engine = 0; engine < 4; engine++)
+    {
+        if (!selected(options, "klaus", engines[engine]))
+            continue;
+
+        mos6502 cpu;
+        cpu.loadMemory(image.data(), image.size(), 0x0000);
+        cpu.setPC(klausStart);
+        cpu.setEngine(runEngines[engine]);
+
+        // The test ends in a jump to itself, at the success address unless a check failed
+        mos6502::run_status status;
+        Measurement measurement = measure(cpu, "klaus", engine == 0, klausMaxCycles, status);
+        measurement.engine = engines[engine];
+        report(options, measurement);
+
+        if (status != mos6502::RUN_TRAPPED || cpu.getPC() != options.klausSuccess)
+        {
+            std::cerr << "Error: functional test failed under " << engines[engine]
+                      << ", stopped at $" << std::hex << std::setw(4) << std::setfill('0') << cpu.getPC()
+                      << std::setfill(' ') << std::dec << "." << std::endl;
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+static bool benchTrace(const Options &options)
+{
+    if (!selected(options, "mixed", "trace"))
+        return true;
+
+    TraceBuffer trace(65536);
+
+    mos6502 cpu;
+    cpu.loadMemory(mixedLoop, sizeof(mixedLoop), programStart);
+    cpu.setPC(programStart);
+    cpu.setTrace(&trace);
+
+    mos6502::run_status status;
+    Measurement measurement = measure(cpu, "mixed", false, options.cycles, status);
+    measurement.engine = "trace";
+    report(options, measurement);
+
+    // The newest record must be the last instruction executed
+    std::vector<TraceRecord> last;
+    trace.copyLast(last, 1);
+    if (trace.getCount() != cpu.getInstructionCount() || last.size() != 1 ||
+        last[0].AC != cpu.getAC() || last[0].XR != cpu.getXR() || last[0].SR != cpu.getSR())
+    {
+        std::cerr << "Error: trace does not match the executed instructions." << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+static bool benchDebugger(const Options &options)
+{
+    if (!selected(options, "mixed", "debug"))
+        return true;
+
+    mos6502 cpu;
+    cpu.loadMemory(mixedLoop, sizeof(mixedLoop), programStart);
+    cpu.setPC(programStart);
+
+    // Armed but never hit: a breakpoint outside the loop and a watchpoint on an unused page
+    cpu.addBreakpoint(0xFFF0);
+    cpu.addWatchpoint(0xC000, 0xC0FF, true, true);
+
+    mos6502::run_status status;
+    Measurement measurement = measure(cpu, "mixed", false, options.cycles, status);
+    measurement.engine = "debug";
+    report(options, measurement);
+
+    if (status != mos6502::RUN_BUDGET_EXHAUSTED)
+    {
+        std::cerr << "Error: armed breakpoints stopped a run they do not cover." << std::endl;
+        return false;
+    }
+
+    // A breakpoint inside the loop must stop it before the instruction runs
+    cpu.addBreakpoint(programStart + 10);
+    status = cpu.run(options.cycles);
+    if (status != mos6502::RUN_BREAKPOINT || cpu.getPC() != programStart + 10)
+    {
+        std::cerr << "Error: breakpoint was not taken." << std::endl;
+        return false;
+    }
+
+    // Breakpoints on the first instruction of the IRQ and NMI handlers, RTI at $0400 and $0500
+    const uint8_t handler = 0x40;
+    const uint16_t handlers[2] = {0x0400, 0x0500};
+    cpu.loadMemory(&handler, 1, handlers[0]);
+    cpu.loadMemory(&handler, 1, handlers[1]);
+    cpu.writeByte(0xFFFE, handlers[0] & 0xFF);
+    cpu.writeByte(0xFFFF, handlers[0] >> 8);
+    cpu.writeByte(0xFFFA, handlers[1] & 0xFF);
+    cpu.writeByte(0xFFFB, handlers[1] >> 8);
+    cpu.removeBreakpoint(programStart + 10);
+    cpu.addBreakpoint(handlers[0]);
+    cpu.addBreakpoint(handlers[1]);
+    cpu.setFlag(mos6502::INTDISABLE_FLAG_BIT, false);
+
+    for (int nmi = 0; nmi < 2; nmi++)
+    {
+        if (nmi)
+            cpu.scheduleNMILine(cpu.getCycles() + 100, true);
+        else
+            cpu.scheduleIRQLine(cpu.getCycles() + 100, 0, true);
+
+        status = cpu.run(options.cycles);
+        if (status != mos6502::RUN_BREAKPOINT || cpu.getPC() != handlers[nmi])
+        {
+            std::cerr << "Error: breakpoint on the " << (nmi ? "NMI" : "IRQ") << " handler was not taken." << std::endl;
+            return false;
+        }
+
+        cpu.setIRQLine(0, false);
+    }
+
+    return true;
+}
+
+static bool benchDevices(const Options &options)
+{
+    const int deviceCounts[] = {0, 1, 8};
+    mos6502 reference;
+    bool haveReference = false;
+
+    for (size_t run = 0; run < sizeof(deviceCounts) / sizeof(deviceCounts[0]); run++)
+    {
+        int count = deviceCounts[run];
+        std::string engine = "via" + std::to_string(count);
+        if (!selected(options, "mixed", engine))
+            continue;
+
+        mos6502 cpu;
+        cpu.loadMemory(mixedLoop, sizeof(mixedLoop), programStart);
+        cpu.setPC(programStart);
+
+        // Free-running timers with their interrupt masked, so they cost events but leave the program alone
+        std::vector<std::unique_ptr<Via6522> > vias;
+        for (int i = 0; i < count; i++)
+        {
+            uint16_t latch = 1000 + 100 * i;
+            vias.push_back(std::unique_ptr<Via6522>(new Via6522(cpu, i)));
+            vias[i]->map(0xD0 + i);
+            vias[i]->write(0xB, 0x40);
+            vias[i]->write(0x4, latch & 0xFF);
+            vias[i]->write(0x5, latch >> 8);
+        }
+
+        mos6502::run_status status;
+        Measurement measurement = measure(cpu, "mixed", false, options.cycles, status);
+        measurement.engine = engine;
+        report(options, measurement);
+
+        for (int i = 0; i < count; i++)
+        {
+            if (!(vias[i]->getInterruptFlags() & Via6522::VIA_TIMER1))
+            {
+                std::cerr << "Error: VIA timer " << i << " never ran out." << std::endl;
+                return false;
+            }
+        }
+
+        // Masked timers must not change what the program does
+        if (!haveReference)
+        {
+            reference = cpu;
+            haveReference = true;
+        }
+        else if (status != mos6502::RUN_BUDGET_EXHAUSTED || cpu.getPC() != reference.getPC() ||
+                 cpu.getAC() != reference.getAC() || cpu.getXR() != reference.getXR() ||
+                 cpu.getCycles() != reference.getCycles() || cpu.digestMemory() != reference.digestMemory())
+        {
+            std::cerr << "Error: VIA timers changed the run of " << engine << "." << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Wait for a flag the timer interrupt handler sets, clear it and count in $11
+//
+// 0200: 58        CLI
+// 0201: A5 10     LDA $10
+// 0203: F0 FC     BEQ $0201
+// 0205: A9 00     LDA #$00
+// 0207: 85 10     STA $10
+// 0209: E6 11     INC $11
+// 020B: 4C 01 02  JMP $0201
+static const uint8_t pollLoop[] = {
+    0x58,
+    0xA5, 0x10,
+    0xF0, 0xFC,
+    0xA9, 0x00,
+    0x85, 0x10,
+    0xE6, 0x11,
+    0x4C, 0x01, 0x02};
+
+// Spin on JMP * and leave all the work to the interrupt handler
+//
+// 0200: 58        CLI
+// 0201: 4C 01 02  JMP $0201
+static const uint8_t haltLoop[] = {
+    0x58,
+    0x4C, 0x01, 0x02};
+
+// Acknowledge VIA timer 1 at $D000, set the flag in $10 and count in $11 when $12 is set
+//
+// 0300: 48        PHA
+// 0301: AD 04 D0  LDA $D004
+// 0304: E6 10     INC $10
+// 0306: A5 12     LDA $12
+// 0308: F0 02     BEQ $030C
+// 030A: E6 11     INC $11
+// 030C: 68        PLA
+// 030D: 40        RTI
+static const uint8_t timerHandler[] = {
+    0x48,
+    0xAD, 0x04, 0xD0,
+    0xE6, 0x10,
+    0xA5, 0x12,
+    0xF0, 0x02,
+    0xE6, 0x11,
+    0x68,
+    0x40};
+
+static bool benchIdle(const Options &options)
+{
+    const Workload programs[] = {
+        {"poll", pollLoop, sizeof(pollLoop)},
+        {"halt", haltLoop, sizeof(haltLoop)}};
+    const uint16_t timerPeriod = 20000;
+
+    for (size_t program = 0; program < sizeof(programs) / sizeof(programs[0]); program++)
+    {
+        const Workload &workload = programs[program];
+        if (!selected(options, workload.name, "idle") && !selected(options, workload.name, "spin"))
+            continue;
+
+        // Every pass is interpreted with the fast-forward off, the runs must end in the same state
+        mos6502 cpus[2];
+        Measurement measurements[2];
+        for (int skip = 0; skip < 2; skip++)
+        {
+            mos6502 &cpu = cpus[skip];
+            cpu.loadMemory(workload.program, workload.length, programStart);
+            cpu.loadMemory(timerHandler, sizeof(timerHandler), 0x0300);
+            cpu.writeByte(0xFFFE, 0x00);
+            cpu.writeByte(0xFFFF, 0x03);
+            cpu.writeByte(0x12, workload.program == haltLoop);
+            cpu.setPC(programStart);
+            cpu.setSP(0xFF);
+            cpu.setIdleSkip(skip);
+
+            Via6522 via(cpu, 0);
+            via.map(0xD0);
+            via.write(0xB, 0x40);
+            via.write(0xE, 0xC0);
+            via.write(0x4, timerPeriod & 0xFF);
+            via.write(0x5, timerPeriod >> 8);
+
+            mos6502::run_status status;
+            measurements[skip] = measure(cpu, workload.name, false, options.cycles, status);
+            measurements[skip].engine = skip ? "idle" : "spin";
+            report(options, measurements[skip]);
+
+            if (status != mos6502::RUN_BUDGET_EXHAUSTED)
+            {
+                std::cerr << "Error: " << workload.name << " stopped before its budget." << std::endl;
+                return false;
+            }
+        }
+
+        mos6502 &reference = cpus[0];
+        mos6502 &idle = cpus[1];
+
+        if (options.format == FORMAT_TABLE && measurements[1].seconds > 0)
+        {
+            std::cout << "  " << std::fixed << std::setprecision(1) << 100.0 * idle.getIdleCycles() / measurements[1].cycles
+                      << "% of the cycles skipped, " << measurements[0].seconds / measurements[1].seconds << "x the spin" << std::endl;
+        }
+
+        if (reference.getIdleCycles() != 0 || idle.getIdleCycles() == 0 || reference.readByte(0x10) + reference.readByte(0x11) == 0)
+        {
+            std::cerr << "Error: " << workload.name << " did not wait for the timer as expected." << std::endl;
+            return false;
+        }
+
+        if (idle.getPC() != reference.getPC() || idle.getAC() != reference.getAC() || idle.getSR() != reference.getSR() ||
+            idle.getSP() != reference.getSP() || idle.getCycles() != reference.getCycles() ||
+            idle.getInstructionCount() != reference.getInstructionCount() || idle.digestMemory() != reference.digestMemory())
+        {
+            std::cerr << "Error: skipping idle loops changed the run of " << workload.name << "." << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool benchReplay(const Options &options)
+{
+    const uint16_t timerPeriod = 2000;
+    const int chunks = 64;
+
+    if (!selected(options, "poll", "record") && !selected(options, "poll", "replay"))
+        return true;
+
+    mos6502 cpu;
+    cpu.loadMemory(pollLoop, sizeof(pollLoop), programStart);
+    cpu.loadMemory(timerHandler, sizeof(timerHandler), 0x0300);
+    cpu.writeByte(0xFFFE, 0x00);
+    cpu.writeByte(0xFFFF, 0x03);
+    cpu.setPC(programStart);
+    cpu.setSP(0xFF);
+
+    Via6522 via(cpu, 0);
+    via.map(0xD0);
+    via.write(0xB, 0x40);
+    via.write(0xE, 0xC0);
+    via.write(0x4, timerPeriod & 0xFF);
+    via.write(0x5, timerPeriod >> 8);
+
+    // The replay starts from the state recording starts from
+    mos6502 replay(cpu);
+
+    // Between runs the host turns counting on and off and reads the timer, which acknowledges it
+    ReplayLog log;
+    cpu.setRecorder(&log);
+
+    Measurement record = {"poll", "record", 1, 1, 0, 0, 0};
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int chunk = 0; chunk < chunks; chunk++)
+    {
+        cpu.writeByte(0x12, chunk & 1);
+        if (chunk % 4 == 3)
+            cpu.readByte(0xD004);
+        cpu.run(options.cycles / chunks);
+    }
+    record.seconds = secondsSince(start);
+    record.instructions = cpu.getInstructionCount() - replay.getInstructionCount();
+    record.cycles = cpu.getCycles() - replay.getCycles();
+    report(options, record);
+
+    cpu.setRecorder(NULL);
+    uint8_t flags = via.getInterruptFlags();
+
+    // One run through the whole recording, the devices must not be called
+    replay.setReplay(&log);
+    mos6502::run_status status;
+    Measurement measurement = measure(replay, "poll", false, record.cycles, status);
+    measurement.engine = "replay";
+    report(options, measurement);
+
+    if (options.format == FORMAT_TABLE)
+    {
+        std::cout << "  " << log.getCount() << " inputs in " << log.getSize() << " bytes, a trace takes "
+                  << record.instructions * sizeof(TraceRecord) << " bytes" << std::endl;
+    }
+
+    if (log.getDiverged() || log.getReplayed() != log.getCount() || status != mos6502::RUN_BUDGET_EXHAUSTED ||
+        via.getInterruptFlags() != flags || replay.readByte(0x11) == 0)
+    {
+        std::cerr << "Error: poll did not replay all of its " << log.getCount() << " inputs." << std::endl;
+        return false;
+    }
+
+    if (replay.getPC() != cpu.getPC() || replay.getAC() != cpu.getAC() || replay.getXR() != cpu.getXR() ||
+        replay.getYR() != cpu.getYR() || replay.getSR() != cpu.getSR() || replay.getSP() != cpu.getSP() ||
+        replay.getCycles() != cpu.getCycles() || replay.getInstructionCount() != cpu.getInstructionCount() ||
+        replay.digestMemory() != cpu.digestMemory())
+    {
+        std::cerr << "Error: the replay of poll does not end in the recorded state." << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+static bool benchFork(const Options &options)
+{
+    const int children = 100000;
+    const uint64_t childCycles = 2000;
+
+    if (!selected(options, "mixed", "fork"))
+        return true;
+
+    // A parent with 32 KB of live data and the program warmed up
+    mos6502 parent;
+    parent.loadMemory(mixedLoop, sizeof(mixedLoop), programStart);
+    parent.setPC(programStart);
+    for (int address = 0x4000; address < 0xC000; address++)
+        parent.writeByte(address, address * 7);
+    parent.run(100000);
+
+    // Every child forks the parent, runs a little and is thrown away
+    Measurement measurement = {"mixed", "fork", 1, children, 0, 0, 0};
+    uint64_t checksum = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < children; i++)
+    {
+        mos6502 child = parent.fork();
+        child.setXR(i);
+        child.run(childCycles);
+        checksum += child.readByte(0x10);
+        measurement.instructions += child.getInstructionCount() - parent.getInstructionCount();
+        measurement.cycles += child.getCycles() - parent.getCycles();
+    }
+    measurement.seconds = secondsSince(start);
+
+    report(options, measurement);
+
+    // Children must not have written through to the parent
+    if (parent.readByte(0x4001) != 7 || checksum == 0)
+    {
+        std::cerr << "Error: forked children changed the parent." << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+static bool benchSnapshot(const Options &options)
+{
+    const int rounds = 1000;
+    const uint64_t roundCycles = 2000;
+    const char *const engines[] = {"save", "save+rle"};
+
+    for (int compress = 0; compress < 2; compress++)
+    {
+        if (!selected(options, "mixed", engines[compress]))
+            continue;
+
+        // 32 KB of live data so the compressed form has pages of every kind
+        mos6502 cpu;
+        cpu.loadMemory(mixedLoop, sizeof(mixedLoop), programStart);
+        cpu.setPC(programStart);
+        for (int address = 0x4000; address < 0xC000; address++)
+            cpu.writeByte(address, address < 0x8000 ? address * 7 : 0x55);
+
+        // Every round runs a little, saves and carries on from the restored copy
+        Measurement measurement = {"mixed", engines[compress], 1, rounds, 0, 0, 0};
+        std::vector<uint8_t> buffer;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int round = 0; round < rounds; round++)
+        {
+            uint64_t instructions = cpu.getInstructionCount();
+            uint64_t cycles = cpu.getCycles();
+            cpu.run(roundCycles);
+            measurement.instructions += cpu.getInstructionCount() - instructions;
+            measurement.cycles += cpu.getCycles() - cycles;
+
+            buffer.clear();
+            cpu.saveSnapshot(buffer, compress);
+
+            mos6502 restored;
+            if (!restored.loadSnapshot(buffer.data(), buffer.size()) ||
+                restored.getPC() != cpu.getPC() || restored.getAC() != cpu.getAC() ||
+                restored.getXR() != cpu.getXR() || restored.getYR() != cpu.getYR() ||
+                restored.getSR() != cpu.getSR() || restored.getSP() != cpu.getSP() ||
+                restored.getCycles() != cpu.getCycles() || restored.getInstructionCount() != cpu.getInstructionCount() ||
+                restored.digestMemory() != cpu.digestMemory())
+            {
+                std::cerr << "Error: " << engines[compress] << " round " << round << " does not restore the saved state." << std::endl;
+                return false;
+            }
+            cpu = restored;
+        }
+        measurement.seconds = secondsSince(start);
+
+        report(options, measurement);
+
+        if (options.format == FORMAT_TABLE)
+            std::cout << "  " << buffer.size() << " bytes per snapshot" << std::endl;
+
+        // A flipped byte in the memory image and a trailing byte must both be refused, leaving the CPU alone
+        std::vector<uint8_t> flipped(buffer);
+        flipped[flipped.size() - 1] ^= 0x01;
+        std::vector<uint8_t> extended(buffer);
+        extended.push_back(0);
+
+        mos6502 target;
+        std::streambuf *errors = std::cerr.rdbuf(NULL);
+        bool loaded = target.loadSnapshot(flipped.data(), flipped.size()) ||
+                      target.loadSnapshot(extended.data(), extended.size());
+        std::cerr.rdbuf(errors);
+
+        if (loaded || target.getCycles() != 0)
+        {
+            std::cerr << "Error: " << engines[compress] << " accepted a corrupt snapshot." << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool benchBatch(const Options &options, unsigned threads)
+{
+    const int programs = 4096;
+    const uint64_t programCycles = 200000;
+
+    if (!selected(options, "mixed", "batch"))
+        return true;
+
+    BatchRunner batch(threads);
+
+    // The same program with a different starting X in every job
+    for (int i = 0; i < programs; i++)
+    {
+        BatchJob job = {NULL, mixedLoop, sizeof(mixedLoop), programStart, programStart, 0xFF, 0x36, 0, 0, 0, programCycles, 0};
+        job.XR = i;
+        batch.addJob(job);
+    }
+
+    batch.run();
+
+    Measurement measurement = {"mixed", "batch", batch.getThreadCount(), programs,
+                               batch.getInstructions(), batch.getCycles(), batch.getSeconds()};
+    report(options, measurement);
+
+    // Every job runs the same loop, so they must all end on the same memory
+    const std::vector<BatchResult> &results = batch.getResults();
+    for (size_t i = 1; i < results.size(); i++)
+    {
+        if (results[i].memoryDigest != results[0].memoryDigest)
+        {
+            std::cerr << "Error: batch job " << i << " ended with different memory." << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Copies of a workload as independent step() loops and in the lanes of a LockstepRunner. With seeds
+// every copy starts its LFSR from a different value, so the lanes take different sides of the branches.
+static bool benchLockstep(const Options &options, const Workload &workload, const char *name, bool seeds)
+{
+    const int programs = 64;
+
+    if (!selected(options, name, "simd"))
+        return true;
+
+    uint64_t programCycles = options.cycles / programs ? options.cycles / programs : 1;
+
+    std::vector<std::vector<uint8_t> > images(programs, std::vector<uint8_t>(workload.program, workload.program + workload.length));
+    for (int i = 0; seeds && i < programs; i++)
+        images[i][1] = i * 37 + 1;
+
+    std::vector<BatchJob> jobs;
+    for (int i = 0; i < programs; i++)
+    {
+        BatchJob job = {NULL, images[i].data(), images[i].size(), programStart, programStart, 0xFF, 0x36, 0, 0, 0, programCycles, 0};
+        jobs.push_back(job);
+    }
+
+    // The baseline, one CPU after the other through step()
+    Measurement steps = {name, "steps", 1, programs, 0, 0, 0};
+    std::vector<BatchResult> expected(programs);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < programs; i++)
+    {
+        mos6502 cpu;
+        cpu.loadMemory(jobs[i].image, jobs[i].length, jobs[i].base);
+        cpu.setPC(jobs[i].PC);
+        cpu.setSP(jobs[i].SP);
+        cpu.setSR(jobs[i].SR);
+
+        BatchResult &result = expected[i];
+        result.status = runEngine(cpu, true, programCycles);
+        result.PC = cpu.getPC();
+        result.SP = cpu.getSP();
+        result.SR = cpu.getSR();
+        result.AC = cpu.getAC();
+        result.XR = cpu.getXR();
+        result.YR = cpu.getYR();
+        result.cycles = cpu.getCycles();
+        result.instructions = cpu.getInstructionCount();
+        result.memoryDigest = cpu.digestMemory();
+    }
+    steps.seconds = secondsSince(start);
+
+    LockstepRunner lockstep;
+    for (int i = 0; i < programs; i++)
+        lockstep.addJob(jobs[i]);
+    lockstep.run();
+
+    Measurement simd = {name, "simd", 1, programs, lockstep.getInstructions(), lockstep.getCycles(), lockstep.getSeconds()};
+    for (int i = 0; i < programs; i++)
+    {
+        steps.instructions += expected[i].instructions;
+        steps.cycles += expected[i].cycles;
+    }
+
+    report(options, steps);
+    report(options, simd);
+
+    // Both ran the same instructions, so the speedup is the ratio of the times
+    if (options.format == FORMAT_TABLE && simd.seconds > 0)
+    {
+        std::cout << "  " << LockstepRunner::getVectorISA() << ": " << std::fixed << std::setprecision(2)
+                  << steps.seconds / simd.seconds << "x the steps, " << lockstep.getActiveLanes() << " of "
+                  << LockstepRunner::LANES << " lanes active, " << lockstep.getScalarJobs() << " jobs finished scalar" << std::endl;
+    }
+
+    const std::vector<BatchResult> &results = lockstep.getResults();
+    for (int i = 0; i < programs; i++)
+    {
+        const BatchResult &a = expected[i];
+        const BatchResult &b = results[i];
+
+        bool same = a.status == b.status && a.PC == b.PC && a.SP == b.SP && a.SR == b.SR &&
+                    a.AC == b.AC && a.XR == b.XR && a.YR == b.YR && a.cycles == b.cycles &&
+                    a.instructions == b.instructions && a.memoryDigest == b.memoryDigest;
+        if (!same)
+        {
+            std::cerr << "Error: simd and step disagree on the final machine state of " << name << " copy " << i << "." << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void usage(const char *program)
+{
+    std::cerr << "Usage: " << program << " [options]" << std::endl
+              << "  --csv                 print comma separated values" << std::endl
+              << "  --json                print one JSON object per line" << std::endl
+              << "  --cycles N            cycle budget of every workload (default 100000000)" << std::endl
+              << "  --filter TEXT         only run workloads or engines whose name contains TEXT" << std::endl
+              << "  --label TEXT          tag every CSV or JSON record, e.g. with a version" << std::endl
+              << "  --klaus PATH          also run 6502_functional_test.bin from PATH" << std::endl
+              << "  --klaus-success ADDR  hex address the functional test traps at on success (default 3469)" << std::endl;
+}
+
+static bool parseOptions(int argc, char **argv, Options &options)
+{
+    options.format = FORMAT_TABLE;
+    options.cycles = 100000000;
+    options.klausSuccess = klausSuccess;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string argument = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        char *end = NULL;
+
+        if (argument == "--csv")
+            options.format = FORMAT_CSV;
+        else if (argument == "--json")
+            options.format = FORMAT_JSON;
+        else if (value && argument == "--cycles")
+        {
+            options.cycles = strtoull(value, &end, 10);
+            if (*end != '\0' || options.cycles == 0)
+                return false;
+            i++;
+        }
+        else if (value && argument == "--filter")
+            options.filter = argv[++i];
+        else if (value && argument == "--label")
+            options.label = argv[++i];
+        else if (value && argument == "--klaus")
+            options.klausPath = argv[++i];
+        else if (value && argument == "--klaus-success")
+        {
+            unsigned long address = strtoul(value, &end, 16);
+            if (*end != '\0' || address > 0xFFFF)
+                return false;
+            options.klausSuccess = address;
+            i++;
+        }
+        else
+            return false;
+    }
+
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    printHeader(options);
+
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++)
+        ok = benchWorkload(options, workloads[i]) && ok;
+
+    ok = benchArithmetic(options) && ok;
+    ok = benchFlags(options) && ok;
+    ok = benchEngines(options) && ok;
+
+    if (!options.klausPath.empty())
+        ok = benchKlaus(options) && ok;
+
+    ok = benchTrace(options) && ok;
+    ok = benchDebugger(options) && ok;
+    ok = benchDevices(options) && ok;
+    ok = benchIdle(options) && ok;
+    ok = benchReplay(options) && ok;
+    ok = benchFork(options) && ok;
+    ok = benchSnapshot(options) && ok;
+    ok = benchBatch(options, 1) && ok;
+    ok = benchBatch(options, 0) && ok;
+
+    for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++)
+        ok = benchLockstep(options, workloads[i], workloads[i].name, false) && ok;
+    ok = benchLockstep(options, workloads[5], "diverge", true) && ok;
+
+    return ok ? 0 : 1;
+}
@@ -4,1143 +4,1352 @@
 #include <vector>
 #include <iostream>
 #include <fstream>
+#include <memory>
+#include <string>
 #include <stdint.h>
 #include <stdlib.h>
 #include <iomanip>
 
+#include <map>
+#include <queue>
+
+#include "mos6502_core.h"
+
 #define TEST_MODE_ENABLED // This is to be used when testing with 6502_65C02_functional_tests by Klaus2m5
 
-#define NMI_VECTOR_L 0xFFFA
-#define NMI_VECTOR_H 0xFFFB
-#define RESET_VECTOR_L 0xFFFC
-#define RESET_VECTOR_H 0xFFFD
-#define IRQ_VECTOR_L 0xFFFE
-#define IRQ_VECTOR_H 0xFFFF
+#define SNAPSHOT_VERSION 2
+
+class TraceBuffer;
+class ReplayLog;
+class mos6502;
 
-class mos6502
+/**
+ * @brief The bus of mos6502, mapping every 256-byte page to RAM, host memory or I/O handlers.
+ *
+ * Pages backed by host memory are read and written with one indexed load or
+ * store. I/O, ROM writes, shared RAM and pages with watched addresses or
+ * cached code have no fast path entry and go through the CPU's slow path.
+ */
+class PagedBus
 {
 private:
-    uint16_t programCounter;
-    uint8_t stackPointer;
-    uint8_t statusRegister;
-    uint8_t accumulator;
-    uint8_t xRegister;
-    uint8_t yRegister;
+    friend class mos6502;
 
-    std::vector<uint8_t> Memory;
+    // Fast path of the bus, one entry per page pointing at its host memory or NULL to take the slow path
+    uint8_t *readPages[256];
+    uint8_t *writePages[256];
 
-    /**
-     * @brief Pop a byte from the stack.
-     *
-     * This function pops a byte from the stack and returns it.
-     *
-     * @return The byte popped from the stack.
-     */
-    uint8_t popStack();
+    // The CPU whose page mappings the slow path looks up
+    mos6502 *cpu;
+
+public:
+    uint8_t read(uint16_t address);
+    void write(uint16_t address, uint8_t data);
+};
+
+class mos6502 : public Core6502<PagedBus>
+{
+private:
+    friend class PagedBus;
+    friend class LockstepRunner;
 
     /**
-     * @brief Push a byte onto the stack.
-     *
-     * This function pushes a byte onto the stack.
-     *
-     * @param byte The byte to push onto the stack.
+     * @brief A 256-byte page of RAM.
      */
-    void pushStack(uint8_t byte);
+    struct RamPage
+    {
+        uint8_t bytes[256];
+    };
 
-#pragma region addressing + Opcodes
+    // RAM, one block per page shared copy-on-write between forked CPUs, NULL while the page is all zero
+    std::shared_ptr<RamPage> ram[256];
 
     /**
-     * @brief Typedef for a method pointer used to execute an instruction in the MOS 6502 processor.
+     * @brief What a 256-byte page of the address space is mapped to.
      *
-     * This typedef represents a pointer to a member function of the `mos6502` class that takes a `uint16_t` parameter.
-     * It is used to point to the method responsible for executing an instruction.
+     * @param data Host memory backing the page, NULL for memory-mapped I/O.
+     * @param writable Whether writes reach data, false for ROM.
+     * @param internal Whether the page is backed by the internal RAM page at the same address.
+     * @param read Handler for reads when data is NULL.
+     * @param write Handler for writes when the page is not writable memory.
+     * @param context Pointer passed through to the handlers.
      */
-    typedef void (mos6502::*CodeExec)(uint16_t);
+    struct Page
+    {
+        uint8_t *data;
+        bool writable;
+        bool internal;
+        uint8_t (*read)(void *context, uint16_t address);
+        void (*write)(void *context, uint16_t address, uint8_t data);
+        void *context;
+    };
+
+    Page pages[256];
+
+    // Image files mapped into the address space, released when the last CPU using them goes away
+    std::vector<std::shared_ptr<const uint8_t> > images;
+
+    bool stopRequested;
+
+    // Whether run() executes the opcode pairs of mos6502_fusion.h as superinstructions
+    bool fusion;
+
+    // Whether run() fast-forwards loops that only wait for an event
+    bool idleSkip;
 
     /**
-     * @brief Typedef for a method pointer used to calculate an address for an instruction in the MOS 6502 processor.
+     * @brief The machine state at the last backward jump or branch run() took, to spot idle loops.
      *
-     * This typedef represents a pointer to a member function of the `mos6502` class that returns a `uint16_t` value.
-     * It is used to point to the method responsible for calculating the address for an instruction.
+     * @param branch The address of the jump or branch, -1 when nothing is recorded.
+     * @param head The address it jumped to.
+     * @param registers The registers and the lazy flags.
+     * @param cycles The cycle count after the jump.
+     * @param instructions The instruction count after the jump.
+     * @param slowAccesses slowAccesses after the jump.
+     * @param rejected Whether the loop was already found to have side effects.
      */
-    typedef uint16_t (mos6502::*AddressExec)();
+    struct IdleLoop
+    {
+        int32_t branch;
+        uint16_t head;
+        uint8_t registers[9];
+        uint64_t cycles;
+        uint64_t instructions;
+        uint64_t slowAccesses;
+        bool rejected;
+    };
+
+    IdleLoop idle;
+
+    // Accesses that took the slow path, an idle loop may not make any
+    uint64_t slowAccesses;
+
+    // Cycles run() skipped in idle loops
+    uint64_t idleCycles;
 
     /**
-     * @brief Represents an instruction in the MOS 6502 processor.
+     * @brief One instruction of a cached basic block, decoded once.
      *
-     * @param alias The mnemonic or alias of the instruction.
-     * @param code A function pointer to the method responsible for executing the instruction.
-     * @param addr A function pointer to the method responsible for addressing modes.
-     * @param cycles The number of clock cycles required to execute the instruction.
-     * @param bytes The number of bytes occupied by the instruction in memory.
+     * @param execute Runs the addressing mode and the operation, instantiated per opcode.
+     * @param operand The operand bytes, little endian.
+     * @param address The address of the opcode.
+     * @param next The address of the next instruction, PC while the instruction executes.
+     * @param cycles The base number of clock cycles.
+     * @param pageCycles The extra cycles taken when an indexed read crosses a page.
      */
-    struct Instruction
+    struct DecodedInstruction
     {
-        const char *alias;
-        CodeExec code;
-        AddressExec addr;
+        void (*execute)(mos6502 &cpu, uint16_t operand);
+        uint16_t operand;
+        uint16_t address;
+        uint16_t next;
         uint8_t cycles;
-        uint8_t bytes;
+        uint8_t pageCycles;
     };
 
     /**
-     * @brief Addressing mode: Accumulator (ACC)
+     * @brief Entry point of a block translated to host code by the JIT.
      *
-     * This addressing mode uses the accumulator register as the operand.
+     * Runs the block, and again while it branches back to its start and the
+     * cycle count is below loopLimit, then leaves PC and the counters after the
+     * last instruction it executed.
      *
-     * @param The operand address.
+     * @return The address of the last instruction executed.
      */
-    uint16_t addressingACC();
+    typedef uint32_t (*NativeBlock)(mos6502 *cpu, uint64_t loopLimit);
+
     /**
-     * @brief Addressing mode: Immediate (IMM)
+     * @brief A straight-line run of instructions ending in a jump, branch, return or page boundary.
      *
-     * This addressing mode uses an immediate value as the operand.
-     *
-     * @return The operand address.
+     * @param start The address of the first opcode.
+     * @param length The number of bytes the instructions occupy.
+     * @param first The index of the first instruction in BlockCache::instructions.
+     * @param count The number of instructions.
+     * @param maxCycles The most cycles one pass through the block can take.
+     * @param native The block translated by the JIT, NULL when it runs from the instructions.
      */
-    uint16_t addressingIMM();
+    struct Block
+    {
+        uint16_t start;
+        uint16_t length;
+        uint32_t first;
+        uint32_t count;
+        uint32_t maxCycles;
+        NativeBlock native;
+    };
+
     /**
-     * @brief Addressing mode: Absolute (ABS)
+     * @brief Basic blocks decoded by the block engine, keyed by start address.
      *
-     * This addressing mode provides the 16-bit address of a memory location.
-     * The contents of this location are used as the operand.
-     *
-     * @return The operand address.
+     * Every byte holding cached code has a bit in codeBits, and pages with any
+     * such bit take the slow write path so a write to code drops the blocks
+     * covering it. Dropped blocks keep their instructions until the cache is
+     * flushed, as a block may still be executing when its code is written.
      */
-    uint16_t addressingABS();
+    struct BlockCache
+    {
+        std::vector<int32_t> blockAt;
+        std::vector<Block> blocks;
+        std::vector<DecodedInstruction> instructions;
+        std::vector<uint32_t> pageBlocks[256];
+        uint64_t codeBits[1024];
+
+        // Set when blocks were dropped, the executing block stops after the current instruction
+        bool invalidated;
+
+        // Executable buffer the JIT appends translated blocks to, reused from the start on a flush
+        uint8_t *code;
+        size_t codeCapacity;
+        size_t codeUsed;
+        bool codeFull;
+        bool jitUnavailable;
+
+        // nextEventCycle when native code was entered, a change means it has to return to run()
+        uint64_t eventCycle;
+
+        BlockCache() : blockAt(65536, -1), codeBits(), invalidated(false), code(NULL), codeCapacity(0), codeUsed(0),
+                       codeFull(false), jitUnavailable(false), eventCycle(0) {}
+        ~BlockCache();
+    };
+
+    // The run_engine run() uses
+    uint8_t engine;
+
+    // Allocated on the first run() with the block engine, forks start without one
+    std::unique_ptr<BlockCache> blockCache;
+
+    // Ring buffer every executed instruction is recorded into, NULL when not tracing
+    TraceBuffer *trace;
+
+    // Logs the external inputs are appended to and fed back from, NULL when not recording or replaying
+    ReplayLog *recorder;
+    ReplayLog *replayer;
+
+    // The cycle the replay event is scheduled for, UINT64_MAX when none is
+    uint64_t replayScheduled;
+
+    // Set while the host reads through readByte(), its I/O reads are logged apart from the program's
+    bool hostRead;
+
     /**
-     * @brief Addressing mode: Zero-Page (ZER)
-     *
-     * This addressing mode provides a single-byte address for the operand,
-     * with the high-byte assumed to be zero.
+     * @brief A change of an interrupt line or a device callback scheduled for a future cycle.
      *
-     * @return The operand address.
+     * @param cycle The cycle the event happens on.
+     * @param sequence Orders events on the same cycle by the time they were scheduled.
+     * @param nmi Whether the NMI line changes, otherwise an IRQ source.
+     * @param source The IRQ source.
+     * @param asserted The new state of the line.
+     * @param callback Function to call instead of changing a line, NULL for line changes.
+     * @param context Pointer passed through to the callback.
      */
-    uint16_t addressingZER();
+    struct Event
+    {
+        uint64_t cycle;
+        uint64_t sequence;
+        bool nmi;
+        uint8_t source;
+        bool asserted;
+        void (*callback)(mos6502 &cpu, void *context, uint64_t cycle);
+        void *context;
+
+        bool operator>(const Event &other) const
+        {
+            return cycle != other.cycle ? cycle > other.cycle : sequence > other.sequence;
+        }
+    };
+
+    // Scheduled events, earliest first
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event> > events;
+    uint64_t eventSequence;
+
+    // The run loop only looks at the lines and events once cycleCount reaches this
+    uint64_t nextEventCycle;
+
+    // One bit per IRQ source holding the line asserted, the line is their wired OR
+    uint32_t irqLines;
+
+    // The NMI line level and whether a rising edge is waiting to be serviced
+    bool nmiLine;
+    bool nmiPending;
+
     /**
-     * @brief Addressing mode: Zero-Page,X (ZEX)
-     *
-     * This addressing mode adds the X-register to a zero-page address
-     * to calculate the operand address.
-     *
-     * @return The operand address.
+     * @brief A breakpoint at one address, optionally only taken when a register matches.
      */
-    uint16_t addressingZEX();
+    struct Breakpoint
+    {
+        bool conditional;
+        uint8_t reg;
+        uint8_t compare;
+        uint8_t value;
+    };
+
     /**
-     * @brief Addressing mode: Zero-Page,Y (ZEY)
-     *
-     * This addressing mode adds the Y-register to a zero-page address
-     * to calculate the operand address.
-     *
-     * @return The operand address.
+     * @brief Breakpoints and watchpoints, one bit per address of the 64 KB address space.
      */
-    uint16_t addressingZEY();
+    struct Debugger
+    {
+        uint64_t breakpointBits[1024];
+        uint64_t readWatchBits[1024];
+        uint64_t writeWatchBits[1024];
+        std::map<uint16_t, std::vector<Breakpoint> > breakpoints;
+    };
+
+    // Allocated when the first breakpoint or watchpoint is added, forks get their own copy
+    std::unique_ptr<Debugger> debugger;
+
+    // Whether any breakpoint or watchpoint is set, the run loop skips all checks otherwise
+    bool debugArmed;
+
+    // The last watched access, set by the slow memory path and reported after the instruction
+    bool watchHit;
+    bool watchWrite;
+    uint16_t watchAddress;
+
+#ifdef MOS6502_PROFILE
     /**
-     * @brief Addressing mode: Absolute,X (ABX)
-     *
-     * This addressing mode adds the X-register to an absolute address
-     * to calculate the operand address.
+     * @brief Execution counters gathered while profiling.
      *
-     * @return The operand address.
+     * Subroutine calls are tracked as a tree of JSR targets. Every instruction's
+     * cycles are charged to the node of the subroutine it ran in, which is what
+     * the flame graph output is built from.
      */
-    uint16_t addressingABX();
+    struct Profile
+    {
+        /**
+         * @brief A subroutine reached through one particular chain of calls.
+         */
+        struct CallNode
+        {
+            uint16_t address;
+            size_t parent;
+            uint64_t cycles;
+            std::map<uint16_t, size_t> children;
+        };
+
+        /**
+         * @brief A subroutine call that has not returned yet.
+         *
+         * @param node The call tree node of the subroutine.
+         * @param stackPointer The stack pointer right after the JSR pushed its return address.
+         * @param startCycles The cycle count when the subroutine was entered.
+         * @param childCycles The inclusive cycles of the calls it made that already returned.
+         */
+        struct CallFrame
+        {
+            size_t node;
+            uint8_t stackPointer;
+            uint64_t startCycles;
+            uint64_t childCycles;
+        };
+
+        /**
+         * @brief Totals of all calls to one JSR target.
+         */
+        struct CallTotals
+        {
+            uint64_t calls;
+            uint64_t inclusiveCycles;
+            uint64_t exclusiveCycles;
+        };
+
+        uint64_t instructions;
+        uint64_t cycles;
+        uint64_t opcodeCounts[256];
+        uint64_t opcodeCycles[256];
+        std::vector<uint64_t> addressCounts;
+        std::vector<uint64_t> addressCycles;
+        std::vector<uint8_t> addressOpcodes;
+
+        // Executions of every opcode pair, indexed by first << 8 | second
+        std::vector<uint64_t> pairCounts;
+        int previousOpcode;
+
+        std::map<uint16_t, CallTotals> calls;
+        std::vector<CallNode> nodes;
+        std::vector<CallFrame> frames;
+    };
+
+    // The last profile started, NULL if there was none. Forked CPUs start without one.
+    std::unique_ptr<Profile> profile;
+    bool profiling;
+
     /**
-     * @brief Addressing mode: Absolute,Y (ABY)
+     * @brief Count an executed instruction in the profile.
      *
-     * This addressing mode adds the Y-register to an absolute address
-     * to calculate the operand address.
-     *
-     * @return The operand address.
+     * @param address The address of the opcode.
+     * @param opcode The opcode.
+     * @param cycles The cycles the instruction took.
      */
-    uint16_t addressingABY();
+    void profileInstruction(uint16_t address, uint8_t opcode, uint64_t cycles);
+
     /**
-     * @brief Addressing mode: Implied (IMP)
+     * @brief Close the open calls whose return address has been popped off the stack.
      *
-     * This addressing mode implies the operand from the instruction itself
-     * rather than from an address in memory.
-     *
-     * @return The operand address.
+     * @param limit Calls whose frame stack pointer is below this are closed.
      */
-    uint16_t addressingIMP();
+    void profileReturn(uint16_t limit);
+
+// Whether instructions are being counted, the run loops only watch boundaries for the profiler while it is
+#define MOS6502_PROFILING_ACTIVE profiling
+#else
+#define MOS6502_PROFILING_ACTIVE false
+#endif
+
     /**
-     * @brief Addressing mode: Relative (REL)
-     *
-     * This addressing mode provides a relative offset to the program counter (PC),
-     * which is used to calculate the operand address.
+     * @brief Rebuild the fast path entries of a page from its mapping.
      *
-     * @return The operand address.
+     * @param page The page number.
      */
-    uint16_t addressingREL();
+    void refreshPage(uint8_t page);
+
     /**
-     * @brief Addressing mode: Indexed Indirect (INX)
-     *
-     * This addressing mode performs indexed indirect addressing using the X-register.
+     * @brief Get a RAM page for writing, copying it first if it is shared with another CPU.
      *
-     * @return The operand address.
+     * @param page The page number.
+     * @return The bytes of the page, owned by this CPU only.
      */
-    uint16_t addressingINX();
+    uint8_t *ownRamPage(uint8_t page);
+
     /**
-     * @brief Addressing mode: Indirect Indexed (INY)
+     * @brief Get a RAM page for reading.
      *
-     * This addressing mode performs indirect indexed addressing using the Y-register.
-     *
-     * @return The operand address.
+     * @param page The page number.
+     * @return The bytes of the page.
      */
-    uint16_t addressingINY();
+    const uint8_t *ramPage(uint8_t page) const;
+
     /**
-     * @brief Addressing mode: Indirect (IND)
+     * @brief Read a byte from a page without a fast path entry.
      *
-     * This addressing mode performs indirect addressing, looking up a 16-bit address
-     * in memory to use as the operand.
-     *
-     * @return The operand address.
+     * @param address The memory address to read from.
+     * @return The byte read from the memory address.
      */
-    uint16_t addressingIND();
+    uint8_t readSlow(uint16_t address);
 
-    // Opcodes
     /**
-     * @brief Add with Carry (ADC)
-     *
-     * Add the contents of a memory location to the accumulator,
-     * along with the carry bit.
-     *
-     *  @param The memory address containing the operand.
+     * @brief Write a byte to a page without a fast path entry.
      *
+     * @param address The memory address to write to.
+     * @param data The byte to write to the memory address.
      */
-    void ADC(uint16_t address);
+    void writeSlow(uint16_t address, uint8_t data);
+
     /**
-     * @brief And (AND)
-     *
-     * Perform a logical AND between the accumulator and
-     * a memory location.
+     * @brief Read a byte without side effects, I/O pages read as 0xFF.
      *
-     *  @param The memory address containing the operand.
+     * @param address The memory address to read from.
+     * @return The byte at the memory address.
      */
-    void AND(uint16_t address);
+    uint8_t peekByte(uint16_t address);
+
     /**
+     * @brief Record an executed instruction in the trace buffer.
      *
-     * @brief Arithmetic Shift Left (ASL)
-     *
-     * Shift all bits in a memory location or the accumulator
-     * one position to the left.
-     *
-     * @param address The memory address containing the operand.
+     * @param opcodeAddress The address of the opcode.
+     * @param opcode The opcode.
+     * @param address The effective address of the instruction.
+     * @param startCycles The cycle count when the instruction started.
      */
-    void ASL(uint16_t address);
+    void traceInstruction(uint16_t opcodeAddress, uint8_t opcode, uint16_t address, uint64_t startCycles);
+
     /**
-     * @brief Arithmetic Shift Left Accumulator (ASL_ACC)
+     * @brief Append an external input to the recorder at the current cycle.
      *
-     * Shift all bits in the accumulator one position to the left.
-     *
-     * @param address Unused parameter for consistency with other instruction signatures.
+     * @param kind The replay_input.
+     * @param index The IRQ source, register or flag.
+     * @param address The address or the new PC.
+     * @param value The byte or the new state.
      */
-    void ASL_ACC(uint16_t address);
+    void recordInput(uint8_t kind, uint8_t index, uint16_t address, uint8_t value);
+
     /**
-     * @brief Branch if Carry Clear (BCC)
+     * @brief Apply the replayed inputs due on the current cycle and schedule the next one.
      *
-     * Branch to a relative location if the carry flag is clear.
-     *
-     * @param address The relative address to branch to.
+     * Stops at the next I/O read or trap of the program, those are taken from
+     * the log when the program gets to them.
      */
-    void BCC(uint16_t address);
+    void replayInputs();
+
     /**
-     * @brief Branch if Carry Set (BCS)
-     *
-     * Branch to a relative location if the carry flag is set.
+     * @brief Event callback feeding the replayed inputs of its cycle.
      *
-     * @param address The relative address to branch to.
+     * @param cpu The replaying CPU.
+     * @param context The log, events of a log no longer replayed are ignored.
+     * @param cycle The cycle the event was scheduled for.
      */
-    void BCS(uint16_t address);
+    static void replayEvent(mos6502 &cpu, void *context, uint64_t cycle);
+
     /**
-     * @brief Branch if Equal (BEQ)
-     *
-     * Branch to a relative location if the zero flag is set.
+     * @brief Take an I/O read from the log instead of calling the handler.
      *
-     * @param address The relative address to branch to.
+     * @param address The address read.
+     * @return The byte read when recording, 0xFF once the log ended or diverged.
      */
-    void BEQ(uint16_t address);
+    uint8_t replayRead(uint16_t address);
+
     /**
-     * @brief Bit Test (BIT)
-     *
-     * Test the bits of a memory location with the accumulator.
-     *
-     * @param address The memory address to test.
+     * @brief Report the replay no longer matching the log and stop the run.
      */
-    void BIT(uint16_t address);
+    void replayDiverged();
+
     /**
-     * @brief Bracnh if Minus (BMI)
-     *
-     * Branch to a relative location if the negative flag is set.
+     * @brief Log a trap while recording, or check it against the log while replaying.
      *
-     * @param address The relative address to branch to.
+     * @return true, a replay that did not trap here diverged and stops too.
      */
-    void BMI(uint16_t address);
+    bool replayTrap();
+
     /**
-     * @brief Bracnh if Not Equal (BNE)
+     * @brief Apply the events that are due and service a pending interrupt.
      *
-     * Branch to a relative location if the zero falg is clear.
-     *
-     * @param address The relative address to branch to.
+     * Called at instruction boundaries. An event scheduled for cycle T is seen by
+     * an instruction whose last cycle is at or after T, and its interrupt is
+     * serviced before the next instruction.
      */
-    void BNE(uint16_t address);
+    void serviceEvents();
+
     /**
-     * @brief Branch on Result Plus (BPL)
-     *
-     * Branch to a relative location if the negative flag is clear.
-     *
-     * @param address The relative address to branch to.
+     * @brief Recompute nextEventCycle after the lines or the event queue changed.
      */
-    void BPL(uint16_t address);
+    void updateNextEvent();
+
     /**
-     * @brief Force Break (BRK)
+     * @brief Check whether a watched access to an address stops execution.
      *
-     * Initiates a software interrupt similar to a hardware interrupt (IRQ).
-     * The return address pushed to the stack is PC+2, providing an extra byte of spacing
-     * for a break mark (identifying a reason for the break). The status register wil be
-     * pushed to the stack with the break flag set to 1. However, when retrieved during
-     * RTI or by a PLP instruction, the break flag will be ignored. The interrupt disable
-     * flag is not set automatically.
-     *
-     * @param address Unused parameter for consistency with other instruction signatures.
+     * @param address The address accessed.
+     * @param write Whether the access is a write.
      */
-    void BRK(uint16_t address);
+    void checkWatchpoint(uint16_t address, bool write);
+
     /**
-     * @brief Branch on Overflow Clear (BVC)
-     *
-     * Branch to a relative location if the overflow flag is clear.
+     * @brief Check the breakpoints at an address against the registers.
      *
-     * @param address The relative address to branch to.
+     * @param address The address about to be executed.
+     * @return true if a breakpoint there is taken.
      */
-    void BVC(uint16_t address);
+    bool hitBreakpoint(uint16_t address);
+
     /**
-     * @brief Branch on Overflow Set (BVS)
-     *
-     * Branch to a relative location if the overflow flag is set.
-     *
-     * @param address The relative address to branch to.
+     * @brief Update debugArmed after breakpoints or watchpoints were removed.
      */
-    void BVS(uint16_t address);
+    void updateDebugger();
+
+#pragma region Block cache
+
     /**
-     * @brief Clear Carry Flag (CLC)
+     * @brief Effective address of a predecoded instruction, one per addressing mode.
      *
-     * Clears the carry flag in the status register.
+     * Same as the addressing modes, but the operand bytes were read when the
+     * block was decoded and PC already points at the next instruction, so
+     * immediate and relative operands are found from PC.
      *
-     * @param address Unused parameter for consistency with other instruction signatures.
+     * @param operand The operand from the DecodedInstruction.
+     * @return The operand address.
      */
-    void CLC(uint16_t address);
+    uint16_t decodedACC(uint16_t operand);
+    uint16_t decodedIMM(uint16_t operand);
+    uint16_t decodedABS(uint16_t operand);
+    uint16_t decodedZER(uint16_t operand);
+    uint16_t decodedZEX(uint16_t operand);
+    uint16_t decodedZEY(uint16_t operand);
+    uint16_t decodedABX(uint16_t operand);
+    uint16_t decodedABY(uint16_t operand);
+    uint16_t decodedIMP(uint16_t operand);
+    uint16_t decodedREL(uint16_t operand);
+    uint16_t decodedINX(uint16_t operand);
+    uint16_t decodedINY(uint16_t operand);
+    uint16_t decodedIND(uint16_t operand);
+
     /**
-     * @brief Clear Decimal Mode Flag (CLD)
+     * @brief Execute one predecoded instruction, instantiated for every legal opcode.
      *
-     * Clears the decimal mode flag in the status register.
-     *
-     * @param address Unused parameter for consistency with other instruction signatures.
+     * @param cpu The CPU to execute on.
+     * @param operand The operand from the DecodedInstruction.
      */
-    void CLD(uint16_t address);
+    template <uint8_t opcode>
+    static void executeDecoded(mos6502 &cpu, uint16_t operand);
+
     /**
-     * @brief Clear Interrupt Disable Flag (CLI)
-     *
-     * Clears the interrupt disable flag in the status register.
+     * @brief Decode the basic block starting at an address into the block cache.
      *
-     * @param address Unused parameter for consistency with other instruction signatures.
+     * @param address The address of the first opcode.
+     * @return The index of the block, -1 if the code there cannot be cached.
      */
-    void CLI(uint16_t address);
+    int32_t decodeBlock(uint16_t address);
+
     /**
-     * @brief Clear Overflow Flag (CLV)
-     *
-     * Clears the overflow flag in the status register.
+     * @brief Drop the cached blocks covering an address after it was written.
      *
-     * @param address Unused parameter for consistency with other instruction signatures.
+     * @param address The address written.
      */
-    void CLV(uint16_t address);
+    void invalidateCode(uint16_t address);
+
     /**
-     * @brief Compare Memory with Accumulator (CMP)
-     *
-     * Compares the value in memory with the value in the accumulator and sets the status register
-     * flags based on the result.
+     * @brief Drop every cached block with code on a page, e.g. when it is remapped.
      *
-     * @param address The memory address containing the operand.
+     * @param page The page number.
      */
-    void CMP(uint16_t address);
+    void invalidatePage(uint8_t page);
+
     /**
-     * @brief Compare Memory and Index X (CPX)
+     * @brief Recompute the code bits of a page from the blocks still cached.
      *
-     * Compares the value in memory with the value in the X register and sets the status register
-     * flags based on the result.
+     * Gives the page its fast write path back once no code is left on it.
      *
-     * @param address The memory address containing the operand.
+     * @param page The page number.
      */
-    void CPX(uint16_t address);
+    void rebuildCodeBits(uint8_t page);
+
     /**
-     * @brief Compare Memory and Index Y (CPY)
-     *
-     * Compares the value in memory with the value in the Y register and sets the status register
-     * flags based on the result.
-     *
-     * @param address The memory address containing the operand.
+     * @brief Drop every cached block.
      */
-    void CPY(uint16_t address);
+    void flushBlocks();
+
     /**
-     * @brief Decrement Memory (DEC)
-     *
-     * Decrements the value stored at the specified memory address by one.
+     * @brief Translate a decoded block to x86-64 code, see mos6502_jit.cpp.
      *
-     * @param address The memory address containing the operand.
+     * @param block The block, its instructions are already decoded.
+     * @return The entry point, NULL if the JIT is not available on this host or its buffer is full.
      */
-    void DEC(uint16_t address);
+    NativeBlock translateBlock(const Block &block);
+
     /**
-     * @brief Decrement X Register (DEX)
-     *
-     * Decrements the X register by one.
+     * @brief Check whether native code has to return to run() after the current instruction.
      *
-     * @param address Unused parameter for consistency with other instruction signatures.
+     * @return true once cached code was written, a stop was requested or an event was scheduled.
      */
-    void DEX(uint16_t address);
+    bool jitMustExit();
+
     /**
-     * @brief Decrement Y Register (DEY)
-     *
-     * Decrements the Y register by one.
+     * @brief Calls out of native code: slow path reads and writes and instructions it does not translate.
      *
-     * @param address Unused parameter for consistency with other instruction signatures.
+     * @return jitMustExit() in bit 8 above the value read, or in bit 0.
      */
-    void DEY(uint16_t address);
+    static uint32_t jitRead(mos6502 *cpu, uint32_t address);
+    static uint32_t jitWrite(mos6502 *cpu, uint32_t address, uint32_t data);
+    static uint32_t jitExecute(mos6502 *cpu, uint32_t operand, uint32_t opcode);
+
     /**
-     * @brief Exclusive OR (EOR)
+     * @brief Check whether an instruction that landed on itself can never make progress.
      *
-     * Performs an exclusive OR operation between the accumulator and the value stored at the specified memory address.
-     *
-     * @param addressThe memory address containing the operand.
+     * @param opcodeAddress The address of the instruction that just executed.
+     * @return true if PC did not move and no event or interrupt can still come.
      */
-    void EOR(uint16_t address);
+    bool trapped(uint16_t opcodeAddress);
+
     /**
-     * @brief Increment Memory (INC)
+     * @brief Check that every pass through a short loop only reads plain memory and changes registers.
      *
-     * Increments the value stored at the specified memory address by one.
-     *
-     * @param address The memory address containing the operand.
+     * @param head The first instruction of the loop.
+     * @param branchAddress The jump or branch back to the head.
+     * @return true if the loop has no stores, stack, interrupt flag or subroutine instructions
+     *         and none of its branches leave it.
      */
-    void INC(uint16_t address);
+    bool idleBody(uint16_t head, uint16_t branchAddress);
+
     /**
-     * @brief Increment X Register (INX)
+     * @brief Fast-forward an idle loop to the next event or the end of the budget.
      *
-     * Increments the X register by one.
+     * Called by run() after every backward jump or branch. Once a loop comes
+     * back to the same jump with the same registers without touching I/O, every
+     * later pass does the same, so whole passes are skipped by adding their
+     * cycles and instructions, stopping short of the first cycle an event,
+     * interrupt or the budget could be seen.
      *
-     * @param address Unused parameter for consistency with other instruction signatures.
+     * @param branchAddress The address of the jump or branch that just executed.
+     * @param endCycles The cycle count the run stops at.
      */
-    void INX(uint16_t address);
+    void skipIdleLoop(uint16_t branchAddress, uint64_t endCycles);
+
     /**
-     * @brief Increment Y Register (INY)
-     *
-     * Increments the Y register by one.
-     *
-     * @param address Unused parameter for consistency with other instruction signatures.
+     * @brief The registers, flags and cycle count runLocals() works on.
      */
-    void INY(uint16_t address);
+    struct LocalRegisters
+    {
+        uint16_t pc;
+        uint8_t a;
+        uint8_t x;
+        uint8_t y;
+        uint8_t s;
+        uint8_t status;
+        uint8_t c;
+        uint8_t z;
+        uint8_t n;
+        uint8_t v;
+        uint64_t clock;
+    };
+
     /**
-     * @brief Jump to New Location (JMP)
-     *
-     * Sets the program counter to the specified address.
+     * @brief Run one instruction for runLocals(), specialized for every opcode.
      *
-     * @param address The address to jump to.
+     * @param registers The state to run it on, PC points at the opcode.
+     * @param instruction The instruction bytes.
+     * @return false, with the state unchanged, if it has to go through the switch.
      */
-    void JMP(uint16_t address);
+    template <int opcode>
+    bool runLocal(LocalRegisters &registers, const uint8_t *instruction);
+
     /**
-     * @brief Jump to Subroutine (JSR)
+     * @brief Run instructions with the registers, flags and counters held in locals.
      *
-     * Pushes the address of the next instruction onto the stack and then sets the program counter to thespecified address.
+     * Used by run() while nothing looks at the machine between instructions.
+     * Covers the opcodes that only touch plain memory pages and stops, with
+     * the state written back, before the first instruction that needs the
+     * switch: I/O, the interrupt flag, BRK, RTI, PHP, PLP, JMP indirect and
+     * jumps or branches landing on themselves.
      *
-     * @param address The address to jump to.
+     * @param endCycles The cycle count the run stops at.
+     * @param fusing Whether to run the opcode pairs of mos6502_fusion.h as superinstructions.
+     * @param idling Whether to call skipIdleLoop() after backward jumps and branches.
      */
-    void JSR(uint16_t address);
+    void runLocals(uint64_t endCycles, bool fusing, bool idling);
+
     /**
-     * @brief Load Accumulator (LDA)
-     *
-     * Loads the accumulator with the value stored at the specified memory address.
-     *
-     * @param address The memory address containing the operand.
+     * @brief executeDecoded() for every opcode, NULL for illegal opcodes.
      */
-    void LDA(uint16_t address);
+    static void (*const DecodedHandlers[256])(mos6502 &cpu, uint16_t operand);
+
+#pragma endregion
+
+public:
+    mos6502();
+
     /**
-     * @brief Load X Register (LDX)
+     * @brief Copy a CPU without touching the original.
      *
-     * Loads the X register with the value stored at the specified memory address.
+     * RAM pages the original can no longer write in place are shared
+     * copy-on-write, the ones it still writes directly are copied. The original
+     * is only read, so several threads may copy it at the same time as long as
+     * it is not running. Use fork() to share all of its RAM.
      *
-     * @param address The memory address containing the operand.
+     * @param other The CPU to copy.
      */
-    void LDX(uint16_t address);
+    mos6502(const mos6502 &other);
+    mos6502 &operator=(const mos6502 &other);
+
     /**
-     * @brief Load Y Register (LDY)
+     * @brief Fork the CPU, sharing every RAM page with the fork copy-on-write.
      *
-     * Loads the Y register with the value stored at the specified memory address.
+     * Forking costs a few pointer tables plus one reference per RAM page in
+     * use, and each side only pays for the pages it writes afterwards. Not
+     * thread-safe: it moves this CPU's RAM writes to the slow path, so nothing
+     * may run or copy this CPU meanwhile. Until this CPU writes to its RAM again,
+     * plain copies of it share every page as well.
      *
-     * @param address The memory address containing the operand.
+     * @return The fork.
      */
-    void LDY(uint16_t address);
+    mos6502 fork();
+
     /**
-     * @brief Logical Shift Right (LSR)
+     * @brief Check whether copies of the CPU share mutable state with it.
      *
-     * Shifts the bits of the value stored at the specified memory address one bit to the right.
+     * Every copy calls the same I/O handlers and event callbacks with the same
+     * contexts and writes the same mapped host memory, so such CPUs must not
+     * be copied to run on several threads.
      *
-     * @param address The memory address containing the operand.
+     * @return true if the CPU has I/O pages, writable host memory or scheduled events.
      */
-    void LSR(uint16_t address);
+    bool sharesDevices() const;
+
     /**
-     * @brief Logical Shift Right (LSR) Accumulator
+     * @brief Handler for reads from a memory-mapped I/O page.
      *
-     * Shifts the bits of the accumulator one bit to the right.
+     * @param context The context pointer given to mapIO().
+     * @param address The full 16-bit address being read.
+     * @return The byte on the data bus.
+     */
+    typedef uint8_t (*ReadHandler)(void *context, uint16_t address);
+
+    /**
+     * @brief Handler for writes to a memory-mapped I/O page.
      *
-     * @param address Unused parameter for consistency with other instruction signatures.
+     * @param context The context pointer given to mapIO().
+     * @param address The full 16-bit address being written.
+     * @param data The byte being written.
      */
-    void LSR_ACC(uint16_t address);
+    typedef void (*WriteHandler)(void *context, uint16_t address, uint8_t data);
+
     /**
-     * @brief No Operation (NOP)
+     * @brief Registers a conditional breakpoint can test.
+     */
+    enum break_register : uint8_t
+    {
+        BREAK_AC = 0, ///< The accumulator
+        BREAK_XR = 1, ///< The X register
+        BREAK_YR = 2, ///< The Y register
+        BREAK_SP = 3, ///< The stack pointer
+        BREAK_SR = 4, ///< The status register
+    };
+
+    /**
+     * @brief How a conditional breakpoint compares the register with its value.
+     */
+    enum break_compare : uint8_t
+    {
+        BREAK_EQUAL = 0,     ///< register == value
+        BREAK_NOT_EQUAL = 1, ///< register != value
+        BREAK_LESS = 2,      ///< register < value
+        BREAK_GREATER = 3,   ///< register > value
+        BREAK_ALL_SET = 4,   ///< (register & value) == value, e.g. to test flags in SR
+    };
+
+    /**
+     * @brief How run() and runUntil() execute instructions.
+     */
+    enum run_engine : uint8_t
+    {
+        ENGINE_SWITCH = 0, ///< Fetch, decode and dispatch every instruction through one switch
+        ENGINE_BLOCKS = 1, ///< Decode straight-line blocks once and execute them from a cache
+        ENGINE_JIT = 2,    ///< Translate the cached blocks to x86-64 code, elsewhere the same as ENGINE_BLOCKS
+    };
+
+    /**
+     * @brief Predicate used by runUntil() to decide when to stop.
      *
-     * Does nothing. A placeholder instruction.
+     * Called after every executed instruction.
      *
-     * @param address Unused parameter for consistency with other instruction signatures.
+     * @param cpu The CPU being run.
+     * @param context The context pointer passed to runUntil().
+     * @return true to stop execution.
      */
-    void NOP(uint16_t address);
+    typedef bool (*StopPredicate)(mos6502 &cpu, void *context);
+
     /**
-     * @brief Logical OR (ORA)
+     * @brief Map host memory into the address space.
      *
-     * Performs a logical OR operation between the accumulator and the value stored at the specified memory address.
+     * Reads and writes to the pages go straight to the host memory without a call.
+     * Writes to pages mapped read-only (ROM) are ignored.
      *
-     * @param address The memory address containing the operand.
+     * @param firstPage The first page to map (address >> 8).
+     * @param pageCount The number of 256-byte pages to map.
+     * @param data Host memory of at least pageCount * 256 bytes, must outlive the mapping.
+     * @param writable false to map the memory as ROM.
      */
-    void ORA(uint16_t address);
+    void mapMemory(uint8_t firstPage, uint16_t pageCount, uint8_t *data, bool writable);
+
     /**
-     * @brief Push Accumulator on Stack (PHA)
+     * @brief Map memory-mapped I/O handlers into the address space.
      *
-     * Pushes the value of the accumulator onto the stack.
+     * @param firstPage The first page to map (address >> 8).
+     * @param pageCount The number of 256-byte pages to map.
+     * @param read Handler for reads, NULL reads return 0xFF.
+     * @param write Handler for writes, NULL ignores writes.
+     * @param context Pointer passed through to the handlers.
+     */
+    void mapIO(uint8_t firstPage, uint16_t pageCount, ReadHandler read, WriteHandler write, void *context);
+
+    /**
+     * @brief Map pages back to the internal RAM.
      *
-     * @param address Unused parameter for consistency with other instruction signatures.
+     * @param firstPage The first page to unmap (address >> 8).
+     * @param pageCount The number of 256-byte pages to unmap.
      */
-    void PHA(uint16_t address);
+    void unmap(uint8_t firstPage, uint16_t pageCount);
+
     /**
-     * @brief Push Processor Status (PHP)
+     * @brief Load memory with the provided data.
      *
-     * Pushes the current status register onto the stack.
+     * Copies the data to the start of RAM, the rest of memory is left untouched.
      *
-     * @param address Unused parameter for consistency with other instruction signatures.
+     * @param data The data to load into memory.
      */
-    void PHP(uint16_t address);
+    void loadMemory(const std::vector<uint8_t> &data);
+
     /**
-     * @brief Pull Accumulator (PLA)
+     * @brief Load memory with the provided data at a base address.
      *
-     * Pulls the top byte from the stack and stores it into the accumulator register,
-     * effectively restoring the value of the accumulator prior to an interrupt.
+     * Copies the data into RAM starting at base with a single copy.
      *
-     * @param address Unused parameter for consistency with other instruction signatures.
+     * @param data The data to load into memory.
+     * @param length The number of bytes to load.
+     * @param base The address to load the first byte at.
      */
-    void PLA(uint16_t address);
+    void loadMemory(const uint8_t *data, size_t length, uint16_t base);
+
     /**
-     * @brief Pull Processor Status (PLP)
+     * @brief Map a ROM image into the address space without copying it.
      *
-     * Pulls the processor status (flags) from the stack into the status register,
-     * effectively restoring the state of the flags prior to an interrupt.
+     * Whole pages are read straight from the caller's buffer, which must outlive
+     * the mapping. A trailing partial page is copied into a padded read-only page.
      *
-     * @param address Unused parameter for consistency with other instruction signatures.
+     * @param data The ROM image.
+     * @param length The size of the image in bytes.
+     * @param base The page aligned address to map the image at.
+     * @return true if the image was mapped.
      */
-    void PLP(uint16_t address);
+    bool mapROM(const uint8_t *data, size_t length, uint16_t base);
+
     /**
-     * @brief Rotate Left (ROL)
+     * @brief Map a ROM image file into the address space.
      *
-     * Rotate the bits of a memory location or accumulator one position to the left,
-     * with the carry bit being shifted into bit 0 and the original bit 7 shifted into the carry.
+     * The file is memory mapped read-only where the platform supports it, so
+     * loading only costs page faults on the pages that are actually read.
+     * The mapping is shared by copies of the CPU and released with the last one.
      *
-     * @param address The memory address containing the operand.
+     * @param path The path of the image file.
+     * @param base The page aligned address to map the image at.
+     * @return true if the image was mapped.
      */
-    void ROL(uint16_t address);
+    bool mapROMFile(const std::string &path, uint16_t base);
+
     /**
-     * @brief Rotate Left Accumulator (ROL_ACC)
-     *
-     * Rotate the bits of the accumulator (A register) one position to the left,
-     * with the carry bit being shifted into bit 7 and the original bit 0 shifted into the carry.
+     * @brief Dump memory to a file in the specified directory.
      *
-     * @param address The memory address containing the operand.
+     * @param localDir The directory to dump memory contents to.
      */
-    void ROL_ACC(uint16_t address);
+    void dumpMemory(std::string localDir);
+
     /**
-     * @brief Rotate Right (ROR)
+     * @brief Save the machine state to a binary snapshot.
      *
-     * Rotate the bits of a memory location one position to the right,
-     * with the carry bit being shifted into bit 0 and the original bit 7 shifted into the carry.
+     * The snapshot holds the registers, flags, cycle and instruction counts and
+     * the 64 KB of RAM. Memory-mapped ROM and I/O are configuration, not state,
+     * and are not included. With compression, zero-filled pages cost one byte
+     * and other pages are run-length encoded when that is smaller.
      *
-     * @param address The memory address containing the operand.
+     * @param buffer The buffer to append the snapshot to.
+     * @param compress Whether to compress the memory image.
      */
-    void ROR(uint16_t address);
+    void saveSnapshot(std::vector<uint8_t> &buffer, bool compress);
+
     /**
-     * @brief Rotate Right Accumulator (ROR_ACC)
-     *
-     * Rotate the bits of the accumulator one position to the right,
-     * with the carry bit being shifted into bit 7 and the original bit 0 shifted into the carry.
+     * @brief Save the machine state to a binary snapshot file with a single write.
      *
-     * @param address Unused parameter for consistency with other instruction signatures.
+     * @param path The file to write.
+     * @param compress Whether to compress the memory image.
+     * @return true if the snapshot was written.
      */
-    void ROR_ACC(uint16_t address);
+    bool saveSnapshot(const std::string &path, bool compress);
+
     /**
-     * @brief Return from Interrupt (RTI)
+     * @brief Restore the machine state from a binary snapshot.
      *
-     * Restores the processor state from the stack after an interrupt service routine,
-     * including the program counter and status register, and resumes execution.
+     * The state is only changed if the whole snapshot is valid: its checksum
+     * matches and its length is exactly that of the encoded memory image.
      *
-     * @param address The return address from the interrupt service routine.
+     * @param data The snapshot.
+     * @param length The size of the snapshot in bytes.
+     * @return true if the snapshot was restored.
      */
-    void RTI(uint16_t address);
+    bool loadSnapshot(const uint8_t *data, size_t length);
+
     /**
-     * @brief Return from Subroutine (RTS)
+     * @brief Restore the machine state from a binary snapshot file.
      *
-     * Restores the program counter from the stack after a subroutine call,
-     * allowing execution to resume at the instruction following the one that called the subroutine.
-     *
-     * @param address The return address from the subroutine call.
+     * @param path The file to read.
+     * @return true if the snapshot was restored.
      */
-    void RTS(uint16_t address);
+    bool loadSnapshot(const std::string &path);
+
     /**
-     * @brief Subtract With Carry (SBC)
+     * @brief Compute a 64-bit digest of the 64 KB of RAM.
      *
-     * Subtracts the value stored at the memory address from the accumulator,
-     * along with the carry bit if it is set, and stores the result in the accumulator.
+     * Two CPUs with the same RAM contents have the same digest, no matter how
+     * their pages are shared or allocated.
      *
-     * @param address The memory address containing the operand.
+     * @return The digest.
      */
-    void SBC(uint16_t address);
+    uint64_t digestMemory();
+
     /**
-     * @brief Set Carry Flag (SEC)
-     *
-     * Sets the Carry Flag to 1.
+     * @brief Execute one instruction.
      *
-     * @param address Unused parameter for consistency with other instruction signatures.
+     * @return The number of cycles the instruction took.
      */
-    void SEC(uint16_t address);
+    uint8_t step();
+
     /**
-     * @brief Set Decimal Flag (SED)
+     * @brief Execute instructions until the budget is used up or execution halts.
      *
-     * Sets the Decimal Flag to 1.
+     * Runs the fetch/decode/execute loop internally instead of returning to the
+     * host after every instruction. Execution halts before an illegal opcode and
+     * after an instruction that jumps or branches to itself. The last instruction
+     * may finish past the budget, the overshoot is visible through getCycles().
      *
-     * @param address Unused parameter for consistency with other instruction signatures.
+     * @param maxCycles The number of cycles to run for.
+     * @return The reason execution stopped.
      */
-    void SED(uint16_t address);
+    run_status run(uint64_t maxCycles);
+
     /**
-     * @brief Set Interrupt Disable Flag (SEI)
-     *
-     * Sets the Interrupt Disable Flag to 1.
+     * @brief Execute instructions until the predicate returns true, the budget is used up or execution halts.
      *
-     * @param address Unused parameter for consistency with other instruction signatures.
+     * @param predicate Function checked after every instruction, may be NULL.
+     * @param context Pointer passed through to the predicate.
+     * @param maxCycles The number of cycles to run for.
+     * @return The reason execution stopped.
+     */
+    run_status runUntil(StopPredicate predicate, void *context, uint64_t maxCycles);
+
+    /**
+     * @brief Ask a running run()/runUntil() to return after the current instruction.
      */
-    void SEI(uint16_t address);
+    void requestStop();
+
     /**
-     * @brief Store Accumulator to Memory (STA)
+     * @brief Turn superinstruction fusion in run() and runUntil() on or off, it is off by default.
      *
-     * Stores value in the Accumulator into memory.
+     * Fusion never changes the results, only how fast they are reached. The
+     * pairs of mos6502_fusion.h, such as DEX followed by BNE, then run in one
+     * case of the switch wherever both bytes sit in plain memory.
      *
-     * @param address The location to store to in memory.
+     * @param enabled Whether opcode pairs are fused.
      */
-    void STA(uint16_t address);
+    void setFusion(bool enabled);
+
     /**
-     * @brief Store Index X to Memory (STX)
+     * @brief Get whether superinstruction fusion is enabled.
      *
-     * Stores value in the X register into memory.
-     *
-     * @param address The location to store to in memory.
+     * @return true if opcode pairs are fused.
      */
-    void STX(uint16_t address);
+    bool getFusion();
+
     /**
-     * @brief Store Index Y to Memory (STY)
+     * @brief Turn fast-forwarding idle loops in run() and runUntil() on or off, it is on by default.
      *
-     * Stores value in the Y register into memory.
+     * A short loop that only reads plain memory and comes back to its jump with
+     * the same registers, like JMP * or LDA flag / BEQ back while waiting for an
+     * interrupt, is not interpreted pass by pass. run() adds the cycles and
+     * instructions of the passes up to the next scheduled event or the end of
+     * the budget at once, so the counters, registers and interrupt timing are
+     * exactly what running every pass gives. Loops are not skipped while
+     * breakpoints, watchpoints, a trace, a profile or a stop predicate are
+     * active.
      *
-     * @param address The location to store to in memory.
+     * @param enabled Whether idle loops are skipped.
      */
-    void STY(uint16_t address);
+    void setIdleSkip(bool enabled);
+
     /**
-     * @brief Transfer Accumulator to Index X (TAX)
+     * @brief Get whether idle loops are skipped.
      *
-     * Transfers value in the Accumulator into the X register.
+     * @return true if idle loops are fast-forwarded.
+     */
+    bool getIdleSkip();
+
+    /**
+     * @brief Get the number of cycles run() fast-forwarded through idle loops since construction.
      *
-     * @param address Unused parameter for consistency with other instruction signatures.
+     * @return The skipped cycles, included in getCycles().
      */
-    void TAX(uint16_t address);
+    uint64_t getIdleCycles();
+
     /**
-     * @brief Transfer Accumulator to Index Y (TAY)
+     * @brief Select how run() and runUntil() execute instructions, the switch by default.
      *
-     * Transfers value in Accumulator to Y regsister.
+     * The block engine decodes each straight-line run of code once and keeps it
+     * in a cache, writes to cached code through the CPU drop the blocks they
+     * touch so self-modifying code stays correct. Host memory mapped with
+     * mapMemory() and changed by the host behind the CPU's back is not seen:
+     * call setEngine() again afterwards to drop the cache. Instructions the
+     * blocks cannot cover, on I/O pages or while breakpoints, watchpoints, a
+     * trace, a profile or a stop predicate are active, go through the switch.
      *
-     * @param address Unused parameter for consistency with other instruction signatures.
+     * @param engine The engine to use.
      */
-    void TAY(uint16_t address);
+    void setEngine(run_engine engine);
+
     /**
-     * @brief Transfer Stack Pointer to Index X (TSX)
-     *
-     * Transfers value in the Stack Pointer into the X register.
+     * @brief Get the engine run() and runUntil() use.
      *
-     * @param address Unused parameter for consistency with other instruction signatures.
+     * @return The engine.
      */
-    void TSX(uint16_t address);
+    run_engine getEngine();
+
     /**
-     * @brief Transfer Index X to Accumulator
+     * @brief Stop run() and runUntil() before executing the instruction at an address.
      *
-     * Transfers value in the X register into the Accumulator
+     * Breakpoints are checked inside the run loop after every instruction and
+     * after entering an interrupt handler, so the instruction a run starts on
+     * never stops it and a run can be resumed from a breakpoint. step() does
+     * not check breakpoints.
      *
-     * @param address Unused parameter for consistency with other instruction signatures.
+     * @param address The address of the instruction.
      */
-    void TXA(uint16_t address);
+    void addBreakpoint(uint16_t address);
+
     /**
-     * @brief Transfer Index X to Stack Register (TXS)
+     * @brief Stop before executing the instruction at an address if a register matches.
      *
-     * Transfers value in the X register into the Status Register.
+     * Several breakpoints at one address are taken if any of them matches.
      *
-     * @param address Unused parameter for consistency with other instruction signatures.
+     * @param address The address of the instruction.
+     * @param reg The register to test.
+     * @param compare How to compare the register with the value.
+     * @param value The value to compare with.
      */
-    void TXS(uint16_t address);
+    void addBreakpoint(uint16_t address, break_register reg, break_compare compare, uint8_t value);
+
     /**
-     * @brief Transfer Index Y to Accumulator (TYA)
-     *
-     * Transfers value in the Y register into the Accumulator.
+     * @brief Remove every breakpoint at an address.
      *
-     * @param address Unused parameter for consistency with other instruction signatures.
+     * @param address The address of the instruction.
      */
-    void TYA(uint16_t address);
+    void removeBreakpoint(uint16_t address);
+
     /**
-     * @brief ILLEGAL opcode
+     * @brief Stop run() and runUntil() after an instruction that reads or writes a range of addresses.
      *
-     * Handler for illigal opcodes.
+     * Only pages containing a watched address leave the fast path, every
+     * other page is accessed at full speed.
      *
-     * @param address Unused parameter for consistency with other instruction signatures.
+     * @param first The first address of the range.
+     * @param last The last address of the range, inclusive.
+     * @param onRead Whether reads stop execution.
+     * @param onWrite Whether writes stop execution.
      */
-    void ILLEGAL(uint16_t address);
+    void addWatchpoint(uint16_t first, uint16_t last, bool onRead, bool onWrite);
 
     /**
-     * @brief List of all opcodes supported by the MOS 6502 processor.
+     * @brief Stop watching a range of addresses for reads and writes.
      *
+     * @param first The first address of the range.
+     * @param last The last address of the range, inclusive.
      */
-    Instruction Instructions[256] = {
-        {"BRK", &mos6502::BRK, &mos6502::addressingIMP, 7, 1},
-        {"ORA", &mos6502::ORA, &mos6502::addressingINX, 6, 2},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"NOP", &mos6502::NOP, &mos6502::addressingZER, 3, 1},
-        {"ORA", &mos6502::ORA, &mos6502::addressingZER, 3, 2},
-        {"ASL", &mos6502::ASL, &mos6502::addressingZER, 5, 1},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"PHP", &mos6502::PHP, &mos6502::addressingIMP, 3, 1},
-        {"ORA", &mos6502::ORA, &mos6502::addressingIMM, 2, 2},
-        {"ASL_ACC", &mos6502::ASL_ACC, &mos6502::addressingIMP, 2, 1},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"NOP", &mos6502::NOP, &mos6502::addressingABS, 4, 1},
-        {"ORA", &mos6502::ORA, &mos6502::addressingABS, 4, 2},
-        {"ASL", &mos6502::ASL, &mos6502::addressingABS, 6, 3},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"BPL", &mos6502::BPL, &mos6502::addressingREL, 2, 2},
-        {"ORA", &mos6502::ORA, &mos6502::addressingINY, 5, 1},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"NOP", &mos6502::NOP, &mos6502::addressingZEX, 4, 1},
-        {"ORA", &mos6502::ORA, &mos6502::addressingZEX, 4, 2},
-        {"ASL", &mos6502::ASL, &mos6502::addressingZEX, 6, 2},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"CLC", &mos6502::CLC, &mos6502::addressingIMP, 2, 1},
-        {"ORA", &mos6502::ORA, &mos6502::addressingABY, 4, 3},
-        {"NOP", &mos6502::NOP, &mos6502::addressingIMP, 2, 1},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"NOP", &mos6502::NOP, &mos6502::addressingABX, 4, 1},
-        {"ORA", &mos6502::ORA, &mos6502::addressingABX, 4, 3},
-        {"ASL", &mos6502::ASL, &mos6502::addressingABX, 7, 3},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"JSR", &mos6502::JSR, &mos6502::addressingABS, 6, 3},
-        {"AND", &mos6502::AND, &mos6502::addressingINX, 6, 2},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"BIT", &mos6502::BIT, &mos6502::addressingZER, 3, 2},
-        {"AND", &mos6502::AND, &mos6502::addressingZER, 3, 2},
-        {"ROL", &mos6502::ROL, &mos6502::addressingZER, 5, 2},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"PLP", &mos6502::PLP, &mos6502::addressingIMP, 4, 1},
-        {"AND", &mos6502::AND, &mos6502::addressingIMM, 2, 2},
-        {"ROL_ACC", &mos6502::ROL_ACC, &mos6502::addressingIMP, 2, 1},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"BIT", &mos6502::BIT, &mos6502::addressingABS, 4, 3},
-        {"AND", &mos6502::AND, &mos6502::addressingABS, 4, 3},
-        {"ROL", &mos6502::ROL, &mos6502::addressingABS, 6, 3},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"BMI", &mos6502::BMI, &mos6502::addressingREL, 2, 2},
-        {"AND", &mos6502::AND, &mos6502::addressingINY, 5, 2},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"NOP", &mos6502::NOP, &mos6502::addressingZEX, 4, 1},
-        {"AND", &mos6502::AND, &mos6502::addressingZEX, 4, 2},
-        {"ROL", &mos6502::ROL, &mos6502::addressingZEX, 6, 2},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"SEC", &mos6502::SEC, &mos6502::addressingIMP, 2, 1},
-        {"AND", &mos6502::AND, &mos6502::addressingABY, 4, 3},
-        {"NOP", &mos6502::NOP, &mos6502::addressingIMP, 2, 1},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"NOP", &mos6502::NOP, &mos6502::addressingABX, 4, 1},
-        {"AND", &mos6502::AND, &mos6502::addressingABX, 4, 3},
-        {"ROL", &mos6502::ROL, &mos6502::addressingABX, 7, 3},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"RTI", &mos6502::RTI, &mos6502::addressingIMP, 6, 1},
-        {"EOR", &mos6502::EOR, &mos6502::addressingINX, 6, 2},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"NOP", &mos6502::NOP, &mos6502::addressingZER, 3, 1},
-        {"EOR", &mos6502::EOR, &mos6502::addressingZER, 3, 2},
-        {"LSR", &mos6502::LSR, &mos6502::addressingZER, 5, 2},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"PHA", &mos6502::PHA, &mos6502::addressingIMP, 3, 1},
-        {"EOR", &mos6502::EOR, &mos6502::addressingIMM, 2, 2},
-        {"LSR_ACC", &mos6502::LSR_ACC, &mos6502::addressingIMP, 2, 1},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"JMP", &mos6502::JMP, &mos6502::addressingABS, 3, 3},
-        {"EOR", &mos6502::EOR, &mos6502::addressingABS, 4, 3},
-        {"LSR", &mos6502::LSR, &mos6502::addressingABS, 6, 3},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"BVC", &mos6502::BVC, &mos6502::addressingREL, 2, 2},
-        {"EOR", &mos6502::EOR, &mos6502::addressingINY, 5, 2},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"NOP", &mos6502::NOP, &mos6502::addressingZEX, 4, 1},
-        {"EOR", &mos6502::EOR, &mos6502::addressingZEX, 4, 2},
-        {"LSR", &mos6502::LSR, &mos6502::addressingZEX, 6, 2},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"CLI", &mos6502::CLI, &mos6502::addressingIMP, 2, 1},
-        {"EOR", &mos6502::EOR, &mos6502::addressingABY, 4, 3},
-        {"NOP", &mos6502::NOP, &mos6502::addressingIMP, 2, 1},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"NOP", &mos6502::NOP, &mos6502::addressingABX, 4, 1},
-        {"EOR", &mos6502::EOR, &mos6502::addressingABX, 4, 1},
-        {"LSR", &mos6502::LSR, &mos6502::addressingABX, 7, 3},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"RTS", &mos6502::RTS, &mos6502::addressingIMP, 6, 1},
-        {"ADC", &mos6502::ADC, &mos6502::addressingINX, 6, 2},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"NOP", &mos6502::NOP, &mos6502::addressingZER, 3, 1},
-        {"ADC", &mos6502::ADC, &mos6502::addressingZER, 3, 2},
-        {"ROR", &mos6502::ROR, &mos6502::addressingZER, 5, 2},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"PLA", &mos6502::PLA, &mos6502::addressingIMP, 4, 1},
-        {"ADC", &mos6502::ADC, &mos6502::addressingIMM, 2, 2},
-        {"ROR_ACC", &mos6502::ROR_ACC, &mos6502::addressingIMP, 2, 1},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"JMP", &mos6502::JMP, &mos6502::addressingIND, 6, 3},
-        {"ADC", &mos6502::ADC, &mos6502::addressingABS, 4, 3},
-        {"ROR", &mos6502::ROR, &mos6502::addressingABS, 6, 3},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"BVS", &mos6502::BVS, &mos6502::addressingREL, 2, 2},
-        {"ADC", &mos6502::ADC, &mos6502::addressingINY, 5, 2},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"NOP", &mos6502::NOP, &mos6502::addressingZEX, 4, 1},
-        {"ADC", &mos6502::ADC, &mos6502::addressingZEX, 4, 2},
-        {"ROR", &mos6502::ROR, &mos6502::addressingZEX, 6, 2},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"SEI", &mos6502::SEI, &mos6502::addressingIMP, 2, 1},
-        {"ADC", &mos6502::ADC, &mos6502::addressingABY, 4, 3},
-        {"NOP", &mos6502::NOP, &mos6502::addressingIMP, 2, 1},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"NOP", &mos6502::NOP, &mos6502::addressingABX, 4, 1},
-        {"ROC", &mos6502::ADC, &mos6502::addressingABX, 4, 3},
-        {"ROR", &mos6502::ROR, &mos6502::addressingABX, 7, 3},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"NOP", &mos6502::NOP, &mos6502::addressingIMM, 2, 1},
-        {"STA", &mos6502::STA, &mos6502::addressingINX, 6, 2},
-        {"NOP", &mos6502::NOP, &mos6502::addressingIMM, 2, 1},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"STY", &mos6502::STY, &mos6502::addressingZER, 3, 2},
-        {"STA", &mos6502::STA, &mos6502::addressingZER, 3, 2},
-        {"STX", &mos6502::STX, &mos6502::addressingZER, 3, 2},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"DEY", &mos6502::DEY, &mos6502::addressingIMP, 2, 1},
-        {"NOP", &mos6502::NOP, &mos6502::addressingIMM, 2, 1},
-        {"TXA", &mos6502::TXA, &mos6502::addressingIMP, 2, 1},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"STY", &mos6502::STY, &mos6502::addressingABS, 4, 3},
-        {"STA", &mos6502::STA, &mos6502::addressingABS, 4, 3},
-        {"STX", &mos6502::STX, &mos6502::addressingABS, 4, 3},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"BCC", &mos6502::BCC, &mos6502::addressingREL, 2, 2},
-        {"STA", &mos6502::STA, &mos6502::addressingINY, 6, 2},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"STY", &mos6502::STY, &mos6502::addressingZEX, 4, 2},
-        {"STA", &mos6502::STA, &mos6502::addressingZEX, 4, 2},
-        {"STX", &mos6502::STX, &mos6502::addressingZEY, 4, 2},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"TYA", &mos6502::TYA, &mos6502::addressingIMP, 2, 1},
-        {"STA", &mos6502::STA, &mos6502::addressingABY, 5, 3},
-        {"TXS", &mos6502::TXS, &mos6502::addressingIMP, 2, 1},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"STA", &mos6502::STA, &mos6502::addressingABX, 5, 3},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"LDY", &mos6502::LDY, &mos6502::addressingIMM, 2, 2},
-        {"LDA", &mos6502::LDA, &mos6502::addressingINX, 6, 2},
-        {"LDX", &mos6502::LDX, &mos6502::addressingIMM, 2, 2},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"LDY", &mos6502::LDY, &mos6502::addressingZER, 3, 2},
-        {"LDA", &mos6502::LDA, &mos6502::addressingZER, 3, 2},
-        {"LDX", &mos6502::LDX, &mos6502::addressingZER, 3, 2},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"TAY", &mos6502::TAY, &mos6502::addressingIMP, 2, 1},
-        {"LDA", &mos6502::LDA, &mos6502::addressingIMM, 2, 2},
-        {"TAX", &mos6502::TAX, &mos6502::addressingIMP, 2, 1},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"LDY", &mos6502::LDY, &mos6502::addressingABS, 4, 3},
-        {"LDA", &mos6502::LDA, &mos6502::addressingABS, 4, 3},
-        {"LDX", &mos6502::LDX, &mos6502::addressingABS, 4, 3},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"BCS", &mos6502::BCS, &mos6502::addressingREL, 2, 2},
-        {"LDA", &mos6502::LDA, &mos6502::addressingINY, 5, 2},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"LDY", &mos6502::LDY, &mos6502::addressingZEX, 4, 2},
-        {"LDA", &mos6502::LDA, &mos6502::addressingZEX, 4, 2},
-        {"LDX", &mos6502::LDX, &mos6502::addressingZEY, 4, 2},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"CLV", &mos6502::CLV, &mos6502::addressingIMP, 2, 1},
-        {"LDA", &mos6502::LDA, &mos6502::addressingABY, 4, 3},
-        {"TSX", &mos6502::TSX, &mos6502::addressingIMP, 2, 1},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"LDY", &mos6502::LDY, &mos6502::addressingABX, 4, 3},
-        {"LDA", &mos6502::LDA, &mos6502::addressingABX, 4, 3},
-        {"LDX", &mos6502::LDX, &mos6502::addressingABY, 4, 3},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"CPY", &mos6502::CPY, &mos6502::addressingIMM, 2, 2},
-        {"CMP", &mos6502::CMP, &mos6502::addressingINX, 6, 2},
-        {"NOP", &mos6502::NOP, &mos6502::addressingIMM, 2, 1},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"CPY", &mos6502::CPY, &mos6502::addressingZER, 3, 2},
-        {"CMP", &mos6502::CMP, &mos6502::addressingZER, 3, 2},
-        {"DEC", &mos6502::DEC, &mos6502::addressingZER, 5, 2},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"INY", &mos6502::INY, &mos6502::addressingIMP, 2, 1},
-        {"CMP", &mos6502::CMP, &mos6502::addressingIMM, 2, 2},
-        {"DEX", &mos6502::DEX, &mos6502::addressingIMP, 2, 1},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"CPY", &mos6502::CPY, &mos6502::addressingABS, 4, 3},
-        {"CMP", &mos6502::CMP, &mos6502::addressingABS, 4, 3},
-        {"DEC", &mos6502::DEC, &mos6502::addressingABS, 6, 3},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"BNE", &mos6502::BNE, &mos6502::addressingREL, 2, 2},
-        {"CMP", &mos6502::CMP, &mos6502::addressingINY, 5, 2},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"NOP", &mos6502::NOP, &mos6502::addressingZEX, 4, 1},
-        {"CMP", &mos6502::CMP, &mos6502::addressingZEX, 4, 2},
-        {"DEC", &mos6502::DEC, &mos6502::addressingZEX, 6, 2},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"CLD", &mos6502::CLD, &mos6502::addressingIMP, 2, 1},
-        {"CMP", &mos6502::CMP, &mos6502::addressingABY, 4, 3},
-        {"NOP", &mos6502::NOP, &mos6502::addressingIMP, 2, 1},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"NOP", &mos6502::NOP, &mos6502::addressingABX, 4, 1},
-        {"CMP", &mos6502::CMP, &mos6502::addressingABX, 4, 3},
-        {"DEC", &mos6502::DEC, &mos6502::addressingABX, 7, 3},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"CPX", &mos6502::CPX, &mos6502::addressingIMM, 2, 2},
-        {"SBC", &mos6502::SBC, &mos6502::addressingINX, 6, 2},
-        {"NOP", &mos6502::NOP, &mos6502::addressingIMM, 2, 1},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"CPX", &mos6502::CPX, &mos6502::addressingZER, 3, 2},
-        {"SBC", &mos6502::SBC, &mos6502::addressingZER, 3, 2},
-        {"INC", &mos6502::INC, &mos6502::addressingZER, 5, 2},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"INX", &mos6502::INX, &mos6502::addressingIMP, 2, 1},
-        {"SBC", &mos6502::SBC, &mos6502::addressingIMM, 2, 2},
-        {"NOP", &mos6502::NOP, &mos6502::addressingIMP, 2, 1},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"CPX", &mos6502::CPX, &mos6502::addressingABS, 4, 3},
-        {"SBC", &mos6502::SBC, &mos6502::addressingABS, 4, 3},
-        {"INC", &mos6502::INC, &mos6502::addressingABS, 6, 3},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"BEQ", &mos6502::BEQ, &mos6502::addressingREL, 2, 2},
-        {"SBC", &mos6502::SBC, &mos6502::addressingINY, 5, 2},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"NOP", &mos6502::NOP, &mos6502::addressingZEX, 4, 1},
-        {"SBC", &mos6502::SBC, &mos6502::addressingZEX, 4, 2},
-        {"INC", &mos6502::INC, &mos6502::addressingZEX, 6, 2},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"SED", &mos6502::SED, &mos6502::addressingIMP, 2, 1},
-        {"SBC", &mos6502::SBC, &mos6502::addressingABY, 4, 3},
-        {"NOP", &mos6502::NOP, &mos6502::addressingIMP, 2, 1},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-        {"NOP", &mos6502::NOP, &mos6502::addressingABX, 4, 1},
-        {"SBC", &mos6502::SBC, &mos6502::addressingABX, 4, 3},
-        {"INC", &mos6502::INC, &mos6502::addressingABX, 7, 3},
-        {"ILG", &mos6502::ILLEGAL, &mos6502::addressingIMP, 0, 1},
-    };
+    void removeWatchpoint(uint16_t first, uint16_t last);
 
-#pragma endregion
-
-public:
-    mos6502();
-
-    /***
-     * @brief Get the value of the program counter (PC).
-     *
-     * @return The value of the program counter.
+    /**
+     * @brief Remove every breakpoint and watchpoint.
      */
-    uint16_t getPC();
+    void clearDebugger();
 
-    /***
-     * @brief Set the value of the program counter (PC).
+    /**
+     * @brief Check whether a breakpoint is taken at the current PC.
      *
-     * @param data The value to set the program counter to.
+     * run() skips this for the instruction it starts on, so that it can be
+     * resumed from a breakpoint. A host starting a program afresh can call it
+     * first to stop before the program's first instruction as well.
+     *
+     * @return true if a breakpoint at PC matches the registers.
      */
-    void setPC(uint16_t data);
+    bool atBreakpoint();
 
-    /***
-     * @brief Get the value of the stack pointer (SP).
+    /**
+     * @brief Get the address of the access that returned RUN_WATCHPOINT.
      *
-     * @return The value of the stack pointer.
+     * @return The watched address.
      */
-    uint8_t getSP();
+    uint16_t getWatchAddress();
 
-    /***
-     * @brief Set the value of the stack pointer (SP).
+    /**
+     * @brief Get whether the access that returned RUN_WATCHPOINT was a write.
      *
-     * @param data The value to set the stack pointer to.
+     * @return true for a write, false for a read.
      */
-    void setSP(uint8_t data);
+    bool getWatchWrite();
 
-    /***
-     * @brief Get the value of the status register (SR).
+    /**
+     * @brief Record every executed instruction into a trace buffer.
+     *
+     * The buffer is not owned and must outlive the tracing. Forked CPUs start
+     * without a trace, as a buffer only takes records from one CPU.
      *
-     * @return The value of the status register.
+     * @param buffer The buffer to record into, NULL to stop tracing.
      */
-    uint8_t getSR();
+    void setTrace(TraceBuffer *buffer);
 
-    /***
-     * @brief Set the value of the status register (SR).
+    /**
+     * @brief Record every external input into a replay log.
      *
-     * @param data The value to set the status register to.
+     * The log is cleared, then every I/O read, interrupt line change, IRQ(),
+     * NMI() and reset() call and register, flag and memory change made through
+     * the CPU's methods is appended with its cycle count, whether it comes from
+     * the host or a device. The log is not owned and must outlive the
+     * recording. Forked CPUs start without a recorder.
+     *
+     * @param log The log to record into, NULL to stop recording.
      */
-    void setSR(uint8_t data);
+    void setRecorder(ReplayLog *log);
 
-    /***
-     * @brief Get the value of the accumulator (AC).
+    /**
+     * @brief Feed a recorded log back into a copy of the CPU taken when recording started.
+     *
+     * Drops the scheduled events, as what they did is in the log, and rewinds
+     * the log. run() then applies every input on the cycle it was recorded on:
+     * I/O reads return the recorded bytes without calling the read handlers and
+     * I/O writes do not call the write handlers, so the devices are left alone.
+     * The host must not drive the CPU while it replays, and host reads are not
+     * replayed: readByte() returns 0xFF for I/O pages and the bytes the host
+     * read while recording are skipped. If the program does anything the log
+     * did not expect, an error is printed, the run stops and
+     * ReplayLog::getDiverged() is set. Past the end of the log I/O reads
+     * return 0xFF.
      *
-     * @return The value of the accumulator.
+     * @param log The log to replay, NULL to stop replaying.
      */
-    uint8_t getAC();
+    void setReplay(ReplayLog *log);
 
-    /***
-     * @brief Set the value of the accumulator (AC).
-     *
-     * @param data The value to set the accumulator to.
+    /**
+     * @brief Core6502's register, memory and interrupt methods, which also log what the host does while recording.
      */
+    void setPC(uint16_t data);
+    void setSP(uint8_t data);
+    void setSR(uint8_t data);
     void setAC(uint8_t data);
+    void setXR(uint8_t data);
+    void setYR(uint8_t data);
+    void setFlag(flag_bits flag, bool state);
+    uint8_t readByte(uint16_t address);
+    void writeByte(uint16_t address, uint8_t data);
+    void reset();
+    void IRQ();
+    void NMI();
 
-    /***
-     * @brief Get the value of the X register (XR).
+    /**
+     * @brief Get the length of an instruction from the opcode table.
      *
-     * @return The value of the X register.
+     * @param opcode The opcode.
+     * @return The number of bytes of the instruction, 1 for illegal opcodes.
      */
-    uint8_t getXR();
+    static uint8_t getInstructionLength(uint8_t opcode);
 
-    /***
-     * @brief Set the value of the X register (XR).
+    /**
+     * @brief Disassemble one instruction.
      *
-     * @param data The value to set the X register to.
+     * @param address The address of the opcode, used to resolve branch targets.
+     * @param bytes The opcode followed by its operand bytes, getInstructionLength() of them.
+     * @return The instruction in assembler syntax, e.g. "LDA ($10),Y".
      */
-    void setXR(uint8_t data);
+    static std::string disassemble(uint16_t address, const uint8_t *bytes);
 
-    /***
-     * @brief Get the value of the Y register (YR).
+    /**
+     * @brief Clear the profile and start counting executed instructions.
      *
-     * @return The value of the Y register.
-     */
-    uint8_t getYR();
-
-    /***
-     * @brief Set the value of the Y register (YR).
+     * Only available when built with MOS6502_PROFILE defined (make PROFILE=1).
      *
-     * @param data The value to set the Y register to.
+     * @return false if profiling is not compiled in.
      */
-    void setYR(uint8_t data);
+    bool startProfile();
 
     /**
-     * @brief Enumeration of flag bits in the status register.
+     * @brief Stop counting, the profile gathered so far is kept for the reports.
      */
-    enum flag_bits : const uint8_t
-    {
-        CARRY_FLAG_BIT = 0,      ///< Carry flag bit index
-        ZERO_FLAG_BIT = 1,       ///< Zero flag bit index
-        INTDISABLE_FLAG_BIT = 2, ///< Interrupt disable flag bit index
-        DECIMAL_FLAG_BIT = 3,    ///< Decimal mode flag bit index
-        BREAK_FLAG_BIT = 4,      ///< Break command flag bit index
-        UNUSED_FLAG_BIT = 5,     ///< Unused flag bit index
-        OVERFLOW_FLAG_BIT = 6,   ///< Overflow flag bit index
-        NEGATIVE_FLAG_BIT = 7,   ///< Negative flag bit index
-    };
+    void stopProfile();
 
     /**
-     * @brief Set the specified flag to the given state.
+     * @brief Write the profile as a flat text report.
      *
-     * @param flag The flag to set.
-     * @param state The state to set the flag to (true for set, false for clear).
+     * Lists the executions and cycles per opcode, per mnemonic and per address,
+     * and the calls with inclusive and exclusive cycles per JSR target, each
+     * sorted by cycles.
+     *
+     * @param out The stream to write to.
+     * @return false if there is no profile.
      */
-    void setFlag(flag_bits flag, bool state);
+    bool writeProfile(std::ostream &out);
 
     /**
-     * @brief Get the value of the specified flag.
+     * @brief Write the cycles per call stack in the folded format of flame graph tools.
      *
-     * @param flag The flag to get.
-     * @return The value of the flag (1 if set, 0 if clear).
+     * One line per call stack, "main;$C000;$C100 1234", which flamegraph.pl,
+     * speedscope and inferno read directly.
+     *
+     * @param out The stream to write to.
+     * @return false if there is no profile.
      */
-    uint8_t getFlag(flag_bits flag);
+    bool writeFlameGraph(std::ostream &out);
 
     /**
-     * @brief Read a byte from the specified memory address.
+     * @brief Drive the level-sensitive IRQ line from one of 32 sources.
      *
-     * @param address The memory address to read from.
-     * @return The byte read from the memory address.
+     * The line is asserted while any source asserts it. It is sampled at
+     * instruction boundaries by step(), run() and runUntil(), and an IRQ is
+     * taken whenever it is asserted and interrupts are enabled.
+     *
+     * @param source The source driving the line, 0 to 31.
+     * @param asserted Whether the source asserts the line.
      */
-    uint8_t readByte(uint16_t address);
+    void setIRQLine(uint8_t source, bool asserted);
 
     /**
-     * @brief Write a byte to the specified memory address.
+     * @brief Drive the edge-triggered NMI line.
      *
-     * @param address The memory address to write to.
-     * @param data The byte to write to the memory address.
+     * Asserting the line latches one NMI, serviced at the next instruction
+     * boundary. The line has to be released before it can trigger again.
+     *
+     * @param asserted Whether the line is asserted.
      */
-    void writeByte(uint16_t address, uint8_t data);
+    void setNMILine(bool asserted);
 
     /**
-     * @brief Load memory with the provided data.
+     * @brief Change an IRQ source at a future cycle.
      *
-     * @param data The data to load into memory.
+     * @param cycle The cycle count at which the source changes.
+     * @param source The source driving the line, 0 to 31.
+     * @param asserted Whether the source asserts the line.
      */
-    void loadMemory(std::vector<uint8_t> data);
+    void scheduleIRQLine(uint64_t cycle, uint8_t source, bool asserted);
 
     /**
-     * @brief Dump memory to a file in the specified directory.
+     * @brief Change the NMI line at a future cycle.
      *
-     * @param localDir The directory to dump memory contents to.
+     * @param cycle The cycle count at which the line changes.
+     * @param asserted Whether the line is asserted.
      */
-    void dumpMemory(std::string localDir);
+    void scheduleNMILine(uint64_t cycle, bool asserted);
 
     /**
-     * @brief Execute one instruction.
+     * @brief Get whether any source asserts the IRQ line.
+     *
+     * @return true if the line is asserted.
      */
-    void step();
+    bool getIRQLine();
 
     /**
-     * @brief Reset the CPU.
+     * @brief Callback of an event scheduled with scheduleEvent().
+     *
+     * Called at the end of the instruction that ran through the cycle it was
+     * scheduled for, before a pending interrupt is serviced. It may schedule
+     * further events and drive the interrupt lines.
+     *
+     * @param cpu The CPU the event was scheduled on.
+     * @param context The context pointer given to scheduleEvent().
+     * @param cycle The cycle the event was scheduled for, getCycles() may already be past it.
      */
-    void reset();
+    typedef void (*EventCallback)(mos6502 &cpu, void *context, uint64_t cycle);
 
     /**
-     * @brief Trigger an Interrupt Request (IRQ).
+     * @brief Call a function once the CPU has run through a cycle.
+     *
+     * Devices such as timers use this instead of being ticked after every
+     * instruction: run() executes straight through until the earliest event
+     * is due. Events on the same cycle run in the order they were scheduled.
+     * A forked CPU keeps the events, and calls them with the same context.
+     *
+     * @param cycle The cycle the callback is due on.
+     * @param callback The function to call.
+     * @param context Pointer passed through to the callback.
      */
-    void IRQ();
+    void scheduleEvent(uint64_t cycle, EventCallback callback, void *context);
 
     /**
-     * @brief Trigger a Non-Maskable Interrupt (NMI).
+     * @brief Remove every scheduled callback with a context, e.g. when a device goes away.
+     *
+     * @param context The context pointer given to scheduleEvent().
      */
-    void NMI();
+    void cancelEvents(void *context);
 };
 
+inline uint8_t PagedBus::read(uint16_t address)
+{
+    // Fast path, RAM and ROM pages are a single indexed load
+    uint8_t *page = readPages[address >> 8];
+    if (page)
+        return page[address & 0xFF];
+
+    return cpu->readSlow(address);
+}
+inline void PagedBus::write(uint16_t address, uint8_t data)
+{
+    // Fast path, RAM pages are a single indexed store
+    uint8_t *page = writePages[address >> 8];
+    if (page)
+    {
+        page[address & 0xFF] = data;
+        return;
+    }
+
+    cpu->writeSlow(address, data);
+}
+
 #endif
\ No newline at end of file
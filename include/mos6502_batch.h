@@ -0,0 +1,195 @@
+#ifndef mos6502_batch_H
+#define mos6502_batch_H
+
+#include "mos6502.h"
+
+#include <deque>
+#include <mutex>
+
+/**
+ * @brief One independent program to run in a batch.
+ *
+ * @param prototype CPU to copy the job from, NULL for a freshly constructed CPU. Copies share the
+ *                  RAM the prototype no longer writes in place, see mos6502::fork().
+ * @param image Program image copied into RAM before the run, may be NULL. Not owned, must outlive the batch.
+ * @param length The size of the image in bytes.
+ * @param base The address to load the image at.
+ * @param PC The program counter to start at.
+ * @param SP The stack pointer to start with.
+ * @param SR The status register to start with.
+ * @param AC The accumulator to start with.
+ * @param XR The X register to start with.
+ * @param YR The Y register to start with.
+ * @param maxCycles The cycle budget of the job.
+ * @param maxInstructions The most instructions the job may execute, 0 for no limit.
+ */
+struct BatchJob
+{
+    const mos6502 *prototype;
+    const uint8_t *image;
+    size_t length;
+    uint16_t base;
+    uint16_t PC;
+    uint8_t SP;
+    uint8_t SR;
+    uint8_t AC;
+    uint8_t XR;
+    uint8_t YR;
+    uint64_t maxCycles;
+    uint64_t maxInstructions;
+};
+
+/**
+ * @brief Final state of a job once it has run.
+ *
+ * @param status Why the job stopped.
+ * @param PC The final program counter.
+ * @param SP The final stack pointer.
+ * @param SR The final status register.
+ * @param AC The final accumulator.
+ * @param XR The final X register.
+ * @param YR The final Y register.
+ * @param cycles The number of cycles the job ran for.
+ * @param instructions The number of instructions the job executed.
+ * @param memoryDigest The digestMemory() of the final RAM contents.
+ */
+struct BatchResult
+{
+    mos6502::run_status status;
+    uint16_t PC;
+    uint8_t SP;
+    uint8_t SR;
+    uint8_t AC;
+    uint8_t XR;
+    uint8_t YR;
+    uint64_t cycles;
+    uint64_t instructions;
+    uint64_t memoryDigest;
+};
+
+/**
+ * @brief Runs many independent mos6502 programs on a work-stealing thread pool.
+ *
+ * Jobs are dealt out to per-thread queues up front. Each thread works through
+ * its own queue from the back and steals from the front of the others once it
+ * runs dry, so a few long jobs do not leave the other threads idle.
+ *
+ * Jobs whose prototype shares devices with its copies (mos6502::sharesDevices())
+ * run one after another on the calling thread once the pool has finished, as
+ * their handlers and contexts are not safe to call from several threads.
+ */
+class BatchRunner
+{
+private:
+    /**
+     * @brief The queue of job indices owned by one worker thread.
+     */
+    struct WorkQueue
+    {
+        std::mutex lock;
+        std::deque<size_t> jobs;
+    };
+
+    unsigned threadCount;
+
+    std::vector<BatchJob> jobs;
+    std::vector<BatchResult> results;
+
+    double seconds;
+    uint64_t totalInstructions;
+    uint64_t totalCycles;
+
+    /**
+     * @brief Take the next job for a worker, stealing from other workers when its own queue is empty.
+     *
+     * @param queues The queues of all workers.
+     * @param worker The index of the worker asking.
+     * @param job Set to the index of the job to run.
+     * @return false once every queue is empty.
+     */
+    static bool takeJob(std::vector<WorkQueue> &queues, unsigned worker, size_t &job);
+
+    /**
+     * @brief Main loop of a worker thread.
+     *
+     * @param queues The queues of all workers.
+     * @param worker The index of this worker.
+     */
+    void work(std::vector<WorkQueue> &queues, unsigned worker);
+
+public:
+    /**
+     * @brief Run a single job on its own CPU.
+     *
+     * A breakpoint of the prototype at the job's start address stops the job
+     * before its first instruction.
+     *
+     * @param job The job to run.
+     * @param result Set to the final state of the job.
+     */
+    static void runJob(const BatchJob &job, BatchResult &result);
+
+    /**
+     * @brief Create a batch runner.
+     *
+     * @param threads The number of worker threads, 0 to use one per hardware thread.
+     */
+    BatchRunner(unsigned threads);
+
+    /**
+     * @brief Add a job to the batch.
+     *
+     * @param job The job to add.
+     * @return The index of the job's result.
+     */
+    size_t addJob(const BatchJob &job);
+
+    /**
+     * @brief Run every job added so far and wait for all of them to finish.
+     */
+    void run();
+
+    /**
+     * @brief Get the results of the last run, in the order the jobs were added.
+     *
+     * @return The results.
+     */
+    const std::vector<BatchResult> &getResults();
+
+    /**
+     * @brief Get the number of worker threads.
+     *
+     * @return The number of worker threads.
+     */
+    unsigned getThreadCount();
+
+    /**
+     * @brief Get the wall time of the last run in seconds.
+     *
+     * @return The wall time in seconds.
+     */
+    double getSeconds();
+
+    /**
+     * @brief Get the number of instructions executed by all jobs of the last run.
+     *
+     * @return The number of instructions.
+     */
+    uint64_t getInstructions();
+
+    /**
+     * @brief Get the number of cycles executed by all jobs of the last run.
+     *
+     * @return The number of cycles.
+     */
+    uint64_t getCycles();
+
+    /**
+     * @brief Get the aggregate emulated instructions per second of the last run.
+     *
+     * @return The instructions per second.
+     */
+    double getInstructionsPerSecond();
+};
+
+#endif
@@ -0,0 +1,2183 @@
+#ifndef mos6502_core_H
+#define mos6502_core_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define NMI_VECTOR_L 0xFFFA
+#define NMI_VECTOR_H 0xFFFB
+#define RESET_VECTOR_L 0xFFFC
+#define RESET_VECTOR_H 0xFFFD
+#define IRQ_VECTOR_L 0xFFFE
+#define IRQ_VECTOR_H 0xFFFF
+
+// Packed results of the decimal ADC and SBC tables: the accumulator in bits 0-7
+// and the flags as the NMOS 6502 leaves them above it
+#define ALU_CARRY 0x100
+#define ALU_NEGATIVE 0x200
+#define ALU_OVERFLOW 0x400
+#define ALU_ZERO 0x800
+
+/**
+ * @brief Decimal mode ADC and SBC for every carry, accumulator and operand.
+ *
+ * Built once at startup following the NMOS sequences in Bruce Clark's
+ * "Decimal Mode" tutorial, which also define the result for invalid BCD.
+ * ADC sets N and V from the sum before the high digit is adjusted and Z from
+ * the binary sum, SBC sets every flag from the binary difference.
+ */
+struct DecimalTables
+{
+    uint16_t adc[2 * 65536];
+    uint16_t sbc[2 * 65536];
+
+    DecimalTables();
+
+    /**
+     * @brief Get the tables shared by every bus, built on their first use.
+     *
+     * A local static rather than a global, so decimal code run from another
+     * static initializer never sees them unbuilt.
+     *
+     * @return The tables.
+     */
+    static const DecimalTables &get()
+    {
+        static const DecimalTables tables;
+        return tables;
+    }
+};
+
+// Decimal mode ADC and SBC, following the NMOS sequences in Bruce Clark's "Decimal Mode" tutorial
+inline DecimalTables::DecimalTables()
+{
+    for (int carry = 0; carry < 2; carry++)
+        for (int a = 0; a < 256; a++)
+            for (int b = 0; b < 256; b++)
+            {
+                int index = (carry << 16) | (a << 8) | b;
+
+                int low = (a & 0x0F) + (b & 0x0F) + carry;
+                if (low >= 0x0A)
+                    low = ((low + 0x06) & 0x0F) + 0x10;
+                int sum = (a & 0xF0) + (b & 0xF0) + low;
+                int signedSum = static_cast<int8_t>(a & 0xF0) + static_cast<int8_t>(b & 0xF0) + low;
+                uint16_t flags = (sum & 0x80 ? ALU_NEGATIVE : 0) |
+                                 (signedSum < -128 || signedSum > 127 ? ALU_OVERFLOW : 0) |
+                                 (((a + b + carry) & 0xFF) == 0 ? ALU_ZERO : 0);
+                if (sum >= 0xA0)
+                    sum += 0x60;
+                adc[index] = (sum & 0xFF) | (sum >= 0x100 ? ALU_CARRY : 0) | flags;
+
+                int difference = a - b - (carry ^ 1);
+                low = (a & 0x0F) - (b & 0x0F) - (carry ^ 1);
+                if (low < 0)
+                    low = ((low - 0x06) & 0x0F) - 0x10;
+                int adjusted = (a & 0xF0) - (b & 0xF0) + low;
+                if (adjusted < 0)
+                    adjusted -= 0x60;
+                flags = (difference & 0x80 ? ALU_NEGATIVE : 0) |
+                        ((a ^ b) & (a ^ difference) & 0x80 ? ALU_OVERFLOW : 0) |
+                        ((difference & 0xFF) == 0 ? ALU_ZERO : 0) |
+                        (difference >= 0 ? ALU_CARRY : 0);
+                sbc[index] = (adjusted & 0xFF) | flags;
+            }
+}
+
+/**
+ * @brief A bus of 64 KB of flat RAM with nothing else on it.
+ *
+ * Every access is a single load or store into the array, for hosts that only
+ * need the CPU and want no per-access cost from mappings or devices.
+ */
+class FlatBus
+{
+private:
+    uint8_t memory[65536];
+
+public:
+    FlatBus()
+    {
+        memset(memory, 0, sizeof(memory));
+    }
+
+    uint8_t read(uint16_t address)
+    {
+        return memory[address];
+    }
+
+    void write(uint16_t address, uint8_t data)
+    {
+        memory[address] = data;
+    }
+};
+
+/**
+ * @brief The registers and the instruction set of the 6502, templated on the bus it runs on.
+ *
+ * Every memory access goes through the Bus policy, any type with
+ *
+ *     uint8_t read(uint16_t address);
+ *     void write(uint16_t address, uint8_t data);
+ *
+ * The calls are resolved at compile time and inlined into the addressing modes
+ * and opcodes, so FlatBus compiles down to direct array accesses while a bus
+ * with devices pays only for its own dispatch. Every bus shares the one
+ * instruction implementation below.
+ *
+ * step() and run() here are the plain engines. mos6502 is Core6502<PagedBus>
+ * with interrupt lines, events, the debugger and the other run engines on top.
+ */
+template <class Bus>
+class Core6502
+{
+protected:
+    uint16_t programCounter;
+    uint8_t stackPointer;
+    uint8_t statusRegister;
+    uint8_t accumulator;
+    uint8_t xRegister;
+    uint8_t yRegister;
+
+    // N, V, Z and C are kept as the values they derive from and only composed into
+    // the status register when it is observed, statusRegister holds the other bits
+    uint8_t carryFlag;      // C, always 0 or 1
+    uint8_t zeroResult;     // Z is set while this is 0
+    uint8_t negativeResult; // N is bit 7
+    uint8_t overflowResult; // V is bit 7
+
+    // The status register bits that are kept lazily
+    static const uint8_t lazyFlags = 0xC3;
+
+    // The bus every access goes through
+    Bus bus;
+
+    uint64_t instructionCount;
+    uint64_t cycleCount;
+
+    // Set by the indexed addressing modes when the index carried into the high byte
+    bool pageCrossed;
+
+    /**
+     * @brief Pop a byte from the stack.
+     *
+     * This function pops a byte from the stack and returns it.
+     *
+     * @return The byte popped from the stack.
+     */
+    uint8_t popStack();
+
+    /**
+     * @brief Push a byte onto the stack.
+     *
+     * This function pushes a byte onto the stack.
+     *
+     * @param byte The byte to push onto the stack.
+     */
+    void pushStack(uint8_t byte);
+
+    /**
+     * @brief Push PC and status and jump through an interrupt vector.
+     *
+     * @param vectorLow The address of the low byte of the vector.
+     * @param vectorHigh The address of the high byte of the vector.
+     */
+    void interrupt(uint16_t vectorLow, uint16_t vectorHigh);
+
+    /**
+     * @brief Binary add with carry into the accumulator, shared by ADC and SBC.
+     *
+     * @param value The operand, inverted by SBC.
+     */
+    void addBinary(uint8_t value);
+
+    /**
+     * @brief Decimal mode ADC or SBC through a precomputed result and flags table.
+     *
+     * @param table The ADC or SBC table, indexed by carry, accumulator and operand.
+     * @param value The operand.
+     */
+    void addDecimal(const uint16_t *table, uint8_t value);
+
+    /**
+     * @brief Take a branch.
+     *
+     * Sets the program counter to the branch target and charges the extra
+     * cycle for a taken branch, plus one more if the target is on another page.
+     *
+     * @param address The branch target.
+     */
+    void branch(uint16_t address);
+
+#pragma region addressing + Opcodes
+
+    /**
+     * @brief Typedef for a method pointer used to execute an instruction in the MOS 6502 processor.
+     *
+     * This typedef represents a pointer to a member function of the `Core6502` class that takes a `uint16_t` parameter.
+     * It is used to point to the method responsible for executing an instruction.
+     */
+    typedef void (Core6502::*CodeExec)(uint16_t);
+
+    /**
+     * @brief Typedef for a method pointer used to calculate an address for an instruction in the MOS 6502 processor.
+     *
+     * This typedef represents a pointer to a member function of the `Core6502` class that returns a `uint16_t` value.
+     * It is used to point to the method responsible for calculating the address for an instruction.
+     */
+    typedef uint16_t (Core6502::*AddressExec)();
+
+    /**
+     * @brief Represents an instruction in the MOS 6502 processor.
+     *
+     * @param alias The mnemonic or alias of the instruction.
+     * @param code A function pointer to the method responsible for executing the instruction.
+     * @param addr A function pointer to the method responsible for addressing modes.
+     * @param cycles The number of clock cycles required to execute the instruction.
+     * @param bytes The number of bytes occupied by the instruction in memory.
+     * @param pageCycles The extra cycles taken when an indexed read crosses a page boundary.
+     */
+    struct Instruction
+    {
+        const char *alias;
+        CodeExec code;
+        AddressExec addr;
+        uint8_t cycles;
+        uint8_t bytes;
+        uint8_t pageCycles;
+    };
+
+    /**
+     * @brief Addressing mode: Accumulator (ACC)
+     *
+     * This addressing mode uses the accumulator register as the operand.
+     *
+     * @param The operand address.
+     */
+    uint16_t addressingACC();
+    /**
+     * @brief Addressing mode: Immediate (IMM)
+     *
+     * This addressing mode uses an immediate value as the operand.
+     *
+     * @return The operand address.
+     */
+    uint16_t addressingIMM();
+    /**
+     * @brief Addressing mode: Absolute (ABS)
+     *
+     * This addressing mode provides the 16-bit address of a memory location.
+     * The contents of this location are used as the operand.
+     *
+     * @return The operand address.
+     */
+    uint16_t addressingABS();
+    /**
+     * @brief Addressing mode: Zero-Page (ZER)
+     *
+     * This addressing mode provides a single-byte address for the operand,
+     * with the high-byte assumed to be zero.
+     *
+     * @return The operand address.
+     */
+    uint16_t addressingZER();
+    /**
+     * @brief Addressing mode: Zero-Page,X (ZEX)
+     *
+     * This addressing mode adds the X-register to a zero-page address
+     * to calculate the operand address.
+     *
+     * @return The operand address.
+     */
+    uint16_t addressingZEX();
+    /**
+     * @brief Addressing mode: Zero-Page,Y (ZEY)
+     *
+     * This addressing mode adds the Y-register to a zero-page address
+     * to calculate the operand address.
+     *
+     * @return The operand address.
+     */
+    uint16_t addressingZEY();
+    /**
+     * @brief Addressing mode: Absolute,X (ABX)
+     *
+     * This addressing mode adds the X-register to an absolute address
+     * to calculate the operand address.
+     *
+     * @return The operand address.
+     */
+    uint16_t addressingABX();
+    /**
+     * @brief Addressing mode: Absolute,Y (ABY)
+     *
+     * This addressing mode adds the Y-register to an absolute address
+     * to calculate the operand address.
+     *
+     * @return The operand address.
+     */
+    uint16_t addressingABY();
+    /**
+     * @brief Addressing mode: Implied (IMP)
+     *
+     * This addressing mode implies the operand from the instruction itself
+     * rather than from an address in memory.
+     *
+     * @return The operand address.
+     */
+    uint16_t addressingIMP();
+    /**
+     * @brief Addressing mode: Relative (REL)
+     *
+     * This addressing mode provides a relative offset to the program counter (PC),
+     * which is used to calculate the operand address.
+     *
+     * @return The operand address.
+     */
+    uint16_t addressingREL();
+    /**
+     * @brief Addressing mode: Indexed Indirect (INX)
+     *
+     * This addressing mode performs indexed indirect addressing using the X-register.
+     *
+     * @return The operand address.
+     */
+    uint16_t addressingINX();
+    /**
+     * @brief Addressing mode: Indirect Indexed (INY)
+     *
+     * This addressing mode performs indirect indexed addressing using the Y-register.
+     *
+     * @return The operand address.
+     */
+    uint16_t addressingINY();
+    /**
+     * @brief Addressing mode: Indirect (IND)
+     *
+     * This addressing mode performs indirect addressing, looking up a 16-bit address
+     * in memory to use as the operand.
+     *
+     * @return The operand address.
+     */
+    uint16_t addressingIND();
+
+    // Opcodes
+    /**
+     * @brief Add with Carry (ADC)
+     *
+     * Add the contents of a memory location to the accumulator,
+     * along with the carry bit.
+     *
+     *  @param The memory address containing the operand.
+     *
+     */
+    void ADC(uint16_t address);
+    /**
+     * @brief And (AND)
+     *
+     * Perform a logical AND between the accumulator and
+     * a memory location.
+     *
+     *  @param The memory address containing the operand.
+     */
+    void AND(uint16_t address);
+    /**
+     *
+     * @brief Arithmetic Shift Left (ASL)
+     *
+     * Shift all bits in a memory location or the accumulator
+     * one position to the left.
+     *
+     * @param address The memory address containing the operand.
+     */
+    void ASL(uint16_t address);
+    /**
+     * @brief Arithmetic Shift Left Accumulator (ASL_ACC)
+     *
+     * Shift all bits in the accumulator one position to the left.
+     *
+     * @param address Unused parameter for consistency with other instruction signatures.
+     */
+    void ASL_ACC(uint16_t address);
+    /**
+     * @brief Branch if Carry Clear (BCC)
+     *
+     * Branch to a relative location if the carry flag is clear.
+     *
+     * @param address The relative address to branch to.
+     */
+    void BCC(uint16_t address);
+    /**
+     * @brief Branch if Carry Set (BCS)
+     *
+     * Branch to a relative location if the carry flag is set.
+     *
+     * @param address The relative address to branch to.
+     */
+    void BCS(uint16_t address);
+    /**
+     * @brief Branch if Equal (BEQ)
+     *
+     * Branch to a relative location if the zero flag is set.
+     *
+     * @param address The relative address to branch to.
+     */
+    void BEQ(uint16_t address);
+    /**
+     * @brief Bit Test (BIT)
+     *
+     * Test the bits of a memory location with the accumulator.
+     *
+     * @param address The memory address to test.
+     */
+    void BIT(uint16_t address);
+    /**
+     * @brief Bracnh if Minus (BMI)
+     *
+     * Branch to a relative location if the negative flag is set.
+     *
+     * @param address The relative address to branch to.
+     */
+    void BMI(uint16_t address);
+    /**
+     * @brief Bracnh if Not Equal (BNE)
+     *
+     * Branch to a relative location if the zero falg is clear.
+     *
+     * @param address The relative address to branch to.
+     */
+    void BNE(uint16_t address);
+    /**
+     * @brief Branch on Result Plus (BPL)
+     *
+     * Branch to a relative location if the negative flag is clear.
+     *
+     * @param address The relative address to branch to.
+     */
+    void BPL(uint16_t address);
+    /**
+     * @brief Force Break (BRK)
+     *
+     * Initiates a software interrupt similar to a hardware interrupt (IRQ).
+     * The return address pushed to the stack is PC+2, providing an extra byte of spacing
+     * for a break mark (identifying a reason for the break). The status register wil be
+     * pushed to the stack with the break flag set to 1. However, when retrieved during
+     * RTI or by a PLP instruction, the break flag will be ignored. The interrupt disable
+     * flag is not set automatically.
+     *
+     * @param address Unused parameter for consistency with other instruction signatures.
+     */
+    void BRK(uint16_t address);
+    /**
+     * @brief Branch on Overflow Clear (BVC)
+     *
+     * Branch to a relative location if the overflow flag is clear.
+     *
+     * @param address The relative address to branch to.
+     */
+    void BVC(uint16_t address);
+    /**
+     * @brief Branch on Overflow Set (BVS)
+     *
+     * Branch to a relative location if the overflow flag is set.
+     *
+     * @param address The relative address to branch to.
+     */
+    void BVS(uint16_t address);
+    /**
+     * @brief Clear Carry Flag (CLC)
+     *
+     * Clears the carry flag in the status register.
+     *
+     * @param address Unused parameter for consistency with other instruction signatures.
+     */
+    void CLC(uint16_t address);
+    /**
+     * @brief Clear Decimal Mode Flag (CLD)
+     *
+     * Clears the decimal mode flag in the status register.
+     *
+     * @param address Unused parameter for consistency with other instruction signatures.
+     */
+    void CLD(uint16_t address);
+    /**
+     * @brief Clear Interrupt Disable Flag (CLI)
+     *
+     * Clears the interrupt disable flag in the status register.
+     *
+     * @param address Unused parameter for consistency with other instruction signatures.
+     */
+    void CLI(uint16_t address);
+    /**
+     * @brief Clear Overflow Flag (CLV)
+     *
+     * Clears the overflow flag in the status register.
+     *
+     * @param address Unused parameter for consistency with other instruction signatures.
+     */
+    void CLV(uint16_t address);
+    /**
+     * @brief Compare Memory with Accumulator (CMP)
+     *
+     * Compares the value in memory with the value in the accumulator and sets the status register
+     * flags based on the result.
+     *
+     * @param address The memory address containing the operand.
+     */
+    void CMP(uint16_t address);
+    /**
+     * @brief Compare Memory and Index X (CPX)
+     *
+     * Compares the value in memory with the value in the X register and sets the status register
+     * flags based on the result.
+     *
+     * @param address The memory address containing the operand.
+     */
+    void CPX(uint16_t address);
+    /**
+     * @brief Compare Memory and Index Y (CPY)
+     *
+     * Compares the value in memory with the value in the Y register and sets the status register
+     * flags based on the result.
+     *
+     * @param address The memory address containing the operand.
+     */
+    void CPY(uint16_t address);
+    /**
+     * @brief Decrement Memory (DEC)
+     *
+     * Decrements the value stored at the specified memory address by one.
+     *
+     * @param address The memory address containing the operand.
+     */
+    void DEC(uint16_t address);
+    /**
+     * @brief Decrement X Register (DEX)
+     *
+     * Decrements the X register by one.
+     *
+     * @param address Unused parameter for consistency with other instruction signatures.
+     */
+    void DEX(uint16_t address);
+    /**
+     * @brief Decrement Y Register (DEY)
+     *
+     * Decrements the Y register by one.
+     *
+     * @param address Unused parameter for consistency with other instruction signatures.
+     */
+    void DEY(uint16_t address);
+    /**
+     * @brief Exclusive OR (EOR)
+     *
+     * Performs an exclusive OR operation between the accumulator and the value stored at the specified memory address.
+     *
+     * @param addressThe memory address containing the operand.
+     */
+    void EOR(uint16_t address);
+    /**
+     * @brief Increment Memory (INC)
+     *
+     * Increments the value stored at the specified memory address by one.
+     *
+     * @param address The memory address containing the operand.
+     */
+    void INC(uint16_t address);
+    /**
+     * @brief Increment X Register (INX)
+     *
+     * Increments the X register by one.
+     *
+     * @param address Unused parameter for consistency with other instruction signatures.
+     */
+    void INX(uint16_t address);
+    /**
+     * @brief Increment Y Register (INY)
+     *
+     * Increments the Y register by one.
+     *
+     * @param address Unused parameter for consistency with other instruction signatures.
+     */
+    void INY(uint16_t address);
+    /**
+     * @brief Jump to New Location (JMP)
+     *
+     * Sets the program counter to the specified address.
+     *
+     * @param address The address to jump to.
+     */
+    void JMP(uint16_t address);
+    /**
+     * @brief Jump to Subroutine (JSR)
+     *
+     * Pushes the address of the next instruction onto the stack and then sets the program counter to thespecified address.
+     *
+     * @param address The address to jump to.
+     */
+    void JSR(uint16_t address);
+    /**
+     * @brief Load Accumulator (LDA)
+     *
+     * Loads the accumulator with the value stored at the specified memory address.
+     *
+     * @param address The memory address containing the operand.
+     */
+    void LDA(uint16_t address);
+    /**
+     * @brief Load X Register (LDX)
+     *
+     * Loads the X register with the value stored at the specified memory address.
+     *
+     * @param address The memory address containing the operand.
+     */
+    void LDX(uint16_t address);
+    /**
+     * @brief Load Y Register (LDY)
+     *
+     * Loads the Y register with the value stored at the specified memory address.
+     *
+     * @param address The memory address containing the operand.
+     */
+    void LDY(uint16_t address);
+    /**
+     * @brief Logical Shift Right (LSR)
+     *
+     * Shifts the bits of the value stored at the specified memory address one bit to the right.
+     *
+     * @param address The memory address containing the operand.
+     */
+    void LSR(uint16_t address);
+    /**
+     * @brief Logical Shift Right (LSR) Accumulator
+     *
+     * Shifts the bits of the accumulator one bit to the right.
+     *
+     * @param address Unused parameter for consistency with other instruction signatures.
+     */
+    void LSR_ACC(uint16_t address);
+    /**
+     * @brief No Operation (NOP)
+     *
+     * Does nothing. A placeholder instruction.
+     *
+     * @param address Unused parameter for consistency with other instruction signatures.
+     */
+    void NOP(uint16_t address);
+    /**
+     * @brief Logical OR (ORA)
+     *
+     * Performs a logical OR operation between the accumulator and the value stored at the specified memory address.
+     *
+     * @param address The memory address containing the operand.
+     */
+    void ORA(uint16_t address);
+    /**
+     * @brief Push Accumulator on Stack (PHA)
+     *
+     * Pushes the value of the accumulator onto the stack.
+     *
+     * @param address Unused parameter for consistency with other instruction signatures.
+     */
+    void PHA(uint16_t address);
+    /**
+     * @brief Push Processor Status (PHP)
+     *
+     * Pushes the current status register onto the stack.
+     *
+     * @param address Unused parameter for consistency with other instruction signatures.
+     */
+    void PHP(uint16_t address);
+    /**
+     * @brief Pull Accumulator (PLA)
+     *
+     * Pulls the top byte from the stack and stores it into the accumulator register,
+     * effectively restoring the value of the accumulator prior to an interrupt.
+     *
+     * @param address Unused parameter for consistency with other instruction signatures.
+     */
+    void PLA(uint16_t address);
+    /**
+     * @brief Pull Processor Status (PLP)
+     *
+     * Pulls the processor status (flags) from the stack into the status register,
+     * effectively restoring the state of the flags prior to an interrupt.
+     *
+     * @param address Unused parameter for consistency with other instruction signatures.
+     */
+    void PLP(uint16_t address);
+    /**
+     * @brief Rotate Left (ROL)
+     *
+     * Rotate the bits of a memory location or accumulator one position to the left,
+     * with the carry bit being shifted into bit 0 and the original bit 7 shifted into the carry.
+     *
+     * @param address The memory address containing the operand.
+     */
+    void ROL(uint16_t address);
+    /**
+     * @brief Rotate Left Accumulator (ROL_ACC)
+     *
+     * Rotate the bits of the accumulator (A register) one position to the left,
+     * with the carry bit being shifted into bit 7 and the original bit 0 shifted into the carry.
+     *
+     * @param address The memory address containing the operand.
+     */
+    void ROL_ACC(uint16_t address);
+    /**
+     * @brief Rotate Right (ROR)
+     *
+     * Rotate the bits of a memory location one position to the right,
+     * with the carry bit being shifted into bit 0 and the original bit 7 shifted into the carry.
+     *
+     * @param address The memory address containing the operand.
+     */
+    void ROR(uint16_t address);
+    /**
+     * @brief Rotate Right Accumulator (ROR_ACC)
+     *
+     * Rotate the bits of the accumulator one position to the right,
+     * with the carry bit being shifted into bit 7 and the original bit 0 shifted into the carry.
+     *
+     * @param address Unused parameter for consistency with other instruction signatures.
+     */
+    void ROR_ACC(uint16_t address);
+    /**
+     * @brief Return from Interrupt (RTI)
+     *
+     * Restores the processor state from the stack after an interrupt service routine,
+     * including the program counter and status register, and resumes execution.
+     *
+     * @param address The return address from the interrupt service routine.
+     */
+    void RTI(uint16_t address);
+    /**
+     * @brief Return from Subroutine (RTS)
+     *
+     * Restores the program counter from the stack after a subroutine call,
+     * allowing execution to resume at the instruction following the one that called the subroutine.
+     *
+     * @param address The return address from the subroutine call.
+     */
+    void RTS(uint16_t address);
+    /**
+     * @brief Subtract With Carry (SBC)
+     *
+     * Subtracts the value stored at the memory address from the accumulator,
+     * along with the carry bit if it is set, and stores the result in the accumulator.
+     *
+     * @param address The memory address containing the operand.
+     */
+    void SBC(uint16_t address);
+    /**
+     * @brief Set Carry Flag (SEC)
+     *
+     * Sets the Carry Flag to 1.
+     *
+     * @param address Unused parameter for consistency with other instruction signatures.
+     */
+    void SEC(uint16_t address);
+    /**
+     * @brief Set Decimal Flag (SED)
+     *
+     * Sets the Decimal Flag to 1.
+     *
+     * @param address Unused parameter for consistency with other instruction signatures.
+     */
+    void SED(uint16_t address);
+    /**
+     * @brief Set Interrupt Disable Flag (SEI)
+     *
+     * Sets the Interrupt Disable Flag to 1.
+     *
+     * @param address Unused parameter for consistency with other instruction signatures.
+     */
+    void SEI(uint16_t address);
+    /**
+     * @brief Store Accumulator to Memory (STA)
+     *
+     * Stores value in the Accumulator into memory.
+     *
+     * @param address The location to store to in memory.
+     */
+    void STA(uint16_t address);
+    /**
+     * @brief Store Index X to Memory (STX)
+     *
+     * Stores value in the X register into memory.
+     *
+     * @param address The location to store to in memory.
+     */
+    void STX(uint16_t address);
+    /**
+     * @brief Store Index Y to Memory (STY)
+     *
+     * Stores value in the Y register into memory.
+     *
+     * @param address The location to store to in memory.
+     */
+    void STY(uint16_t address);
+    /**
+     * @brief Transfer Accumulator to Index X (TAX)
+     *
+     * Transfers value in the Accumulator into the X register.
+     *
+     * @param address Unused parameter for consistency with other instruction signatures.
+     */
+    void TAX(uint16_t address);
+    /**
+     * @brief Transfer Accumulator to Index Y (TAY)
+     *
+     * Transfers value in Accumulator to Y regsister.
+     *
+     * @param address Unused parameter for consistency with other instruction signatures.
+     */
+    void TAY(uint16_t address);
+    /**
+     * @brief Transfer Stack Pointer to Index X (TSX)
+     *
+     * Transfers value in the Stack Pointer into the X register.
+     *
+     * @param address Unused parameter for consistency with other instruction signatures.
+     */
+    void TSX(uint16_t address);
+    /**
+     * @brief Transfer Index X to Accumulator
+     *
+     * Transfers value in the X register into the Accumulator
+     *
+     * @param address Unused parameter for consistency with other instruction signatures.
+     */
+    void TXA(uint16_t address);
+    /**
+     * @brief Transfer Index X to Stack Register (TXS)
+     *
+     * Transfers value in the X register into the Status Register.
+     *
+     * @param address Unused parameter for consistency with other instruction signatures.
+     */
+    void TXS(uint16_t address);
+    /**
+     * @brief Transfer Index Y to Accumulator (TYA)
+     *
+     * Transfers value in the Y register into the Accumulator.
+     *
+     * @param address Unused parameter for consistency with other instruction signatures.
+     */
+    void TYA(uint16_t address);
+    /**
+     * @brief ILLEGAL opcode
+     *
+     * Handler for illigal opcodes.
+     *
+     * @param address Unused parameter for consistency with other instruction signatures.
+     */
+    void ILLEGAL(uint16_t address);
+
+    /**
+     * @brief List of all opcodes supported by the MOS 6502 processor.
+     *
+     * Shared by every instance of a bus, built from mos6502_opcodes.h.
+     */
+    static const Instruction Instructions[256];
+
+#pragma endregion
+
+public:
+    /**
+     * @brief Create a CPU with cleared registers, the stack pointer at $FF and interrupts disabled.
+     */
+    Core6502();
+
+    /**
+     * @brief Reasons returned by run() and runUntil() when execution stops.
+     *
+     * Core6502::run() only stops on the budget, an illegal opcode or a trap, the
+     * others come from the stop requests and the debugger of mos6502.
+     */
+    enum run_status : uint8_t
+    {
+        RUN_BUDGET_EXHAUSTED = 0, ///< The cycle budget was used up
+        RUN_ILLEGAL_OPCODE = 1,   ///< An illegal opcode was fetched, PC points at it
+        RUN_TRAPPED = 2,          ///< An instruction branched or jumped to itself (e.g. JMP *)
+        RUN_STOP_REQUESTED = 3,   ///< requestStop() was called or the stop predicate returned true
+        RUN_BREAKPOINT = 4,       ///< PC reached a breakpoint, the instruction there has not run yet
+        RUN_WATCHPOINT = 5,       ///< The last instruction accessed a watched address
+    };
+
+    /***
+     * @brief Get the value of the program counter (PC).
+     *
+     * @return The value of the program counter.
+     */
+    uint16_t getPC();
+
+    /***
+     * @brief Set the value of the program counter (PC).
+     *
+     * @param data The value to set the program counter to.
+     */
+    void setPC(uint16_t data);
+
+    /***
+     * @brief Get the value of the stack pointer (SP).
+     *
+     * @return The value of the stack pointer.
+     */
+    uint8_t getSP();
+
+    /***
+     * @brief Set the value of the stack pointer (SP).
+     *
+     * @param data The value to set the stack pointer to.
+     */
+    void setSP(uint8_t data);
+
+    /***
+     * @brief Get the value of the status register (SR).
+     *
+     * @return The value of the status register.
+     */
+    uint8_t getSR();
+
+    /***
+     * @brief Set the value of the status register (SR).
+     *
+     * @param data The value to set the status register to.
+     */
+    void setSR(uint8_t data);
+
+    /***
+     * @brief Get the value of the accumulator (AC).
+     *
+     * @return The value of the accumulator.
+     */
+    uint8_t getAC();
+
+    /***
+     * @brief Set the value of the accumulator (AC).
+     *
+     * @param data The value to set the accumulator to.
+     */
+    void setAC(uint8_t data);
+
+    /***
+     * @brief Get the value of the X register (XR).
+     *
+     * @return The value of the X register.
+     */
+    uint8_t getXR();
+
+    /***
+     * @brief Set the value of the X register (XR).
+     *
+     * @param data The value to set the X register to.
+     */
+    void setXR(uint8_t data);
+
+    /***
+     * @brief Get the value of the Y register (YR).
+     *
+     * @return The value of the Y register.
+     */
+    uint8_t getYR();
+
+    /***
+     * @brief Set the value of the Y register (YR).
+     *
+     * @param data The value to set the Y register to.
+     */
+    void setYR(uint8_t data);
+
+    /**
+     * @brief Enumeration of flag bits in the status register.
+     */
+    enum flag_bits : const uint8_t
+    {
+        CARRY_FLAG_BIT = 0,      ///< Carry flag bit index
+        ZERO_FLAG_BIT = 1,       ///< Zero flag bit index
+        INTDISABLE_FLAG_BIT = 2, ///< Interrupt disable flag bit index
+        DECIMAL_FLAG_BIT = 3,    ///< Decimal mode flag bit index
+        BREAK_FLAG_BIT = 4,      ///< Break command flag bit index
+        UNUSED_FLAG_BIT = 5,     ///< Unused flag bit index
+        OVERFLOW_FLAG_BIT = 6,   ///< Overflow flag bit index
+        NEGATIVE_FLAG_BIT = 7,   ///< Negative flag bit index
+    };
+
+    /**
+     * @brief Set the specified flag to the given state.
+     *
+     * @param flag The flag to set.
+     * @param state The state to set the flag to (true for set, false for clear).
+     */
+    void setFlag(flag_bits flag, bool state);
+
+    /**
+     * @brief Get the value of the specified flag.
+     *
+     * @param flag The flag to get.
+     * @return The value of the flag (1 if set, 0 if clear).
+     */
+    uint8_t getFlag(flag_bits flag);
+
+    /**
+     * @brief Read a byte from the specified memory address.
+     *
+     * @param address The memory address to read from.
+     * @return The byte read from the memory address.
+     */
+    uint8_t readByte(uint16_t address)
+    {
+        return bus.read(address);
+    }
+
+    /**
+     * @brief Write a byte to the specified memory address.
+     *
+     * @param address The memory address to write to.
+     * @param data The byte to write to the memory address.
+     */
+    void writeByte(uint16_t address, uint8_t data)
+    {
+        bus.write(address, data);
+    }
+
+    /**
+     * @brief Execute one instruction.
+     *
+     * @return The number of cycles the instruction took.
+     */
+    uint8_t step();
+
+    /**
+     * @brief Execute instructions until the budget is used up or execution halts.
+     *
+     * Execution halts before an illegal opcode and after an instruction that
+     * jumps or branches to itself. The last instruction may finish past the
+     * budget, the overshoot is visible through getCycles().
+     *
+     * @param maxCycles The number of cycles to run for.
+     * @return The reason execution stopped.
+     */
+    run_status run(uint64_t maxCycles);
+
+    /**
+     * @brief Get the total number of instructions executed since construction.
+     *
+     * @return The number of executed instructions.
+     */
+    uint64_t getInstructionCount();
+
+    /**
+     * @brief Get the total number of clock cycles executed since construction.
+     *
+     * Includes page crossing and taken branch penalties, interrupts and resets.
+     *
+     * @return The number of elapsed cycles.
+     */
+    uint64_t getCycles();
+
+    /**
+     * @brief Reset the CPU.
+     */
+    void reset();
+
+    /**
+     * @brief Trigger an Interrupt Request (IRQ) right away, unless interrupts are disabled.
+     */
+    void IRQ();
+
+    /**
+     * @brief Trigger a Non-Maskable Interrupt (NMI) right away.
+     */
+    void NMI();
+
+    /**
+     * @brief Get the bus, e.g. to load a program into it.
+     *
+     * @return The bus.
+     */
+    Bus &getBus()
+    {
+        return bus;
+    }
+};
+
+// Opcode table, constant initialised so it lives in read-only data and costs nothing at construction
+template <class Bus>
+const typename Core6502<Bus>::Instruction Core6502<Bus>::Instructions[256] = {
+#define MOS6502_OPCODE(opcode, alias, code, mode, cycles, bytes, pageCycles) \
+    {alias, &Core6502<Bus>::code, &Core6502<Bus>::addressing##mode, cycles, bytes, pageCycles},
+#define MOS6502_ILLEGAL(opcode) \
+    {"ILG", &Core6502<Bus>::ILLEGAL, &Core6502<Bus>::addressingIMP, 0, 1, 0},
+#include "mos6502_opcodes.h"
+#undef MOS6502_OPCODE
+#undef MOS6502_ILLEGAL
+};
+
+#pragma region Private functions
+
+// Addressing modes
+template <class Bus>
+uint16_t Core6502<Bus>::addressingACC()
+{
+    return 0x00;
+};
+template <class Bus>
+uint16_t Core6502<Bus>::addressingIMM()
+{
+    return programCounter++;
+};
+template <class Bus>
+uint16_t Core6502<Bus>::addressingABS()
+{
+    // Read low byte from memory
+    uint8_t lowByte = readByte(programCounter);
+    programCounter++;
+
+    // Read high byte from memory
+    uint8_t highByte = readByte(programCounter);
+    programCounter++;
+
+    // Combine bytes to form the address
+    uint16_t address = (highByte << 8) | lowByte;
+
+    return address;
+}
+template <class Bus>
+uint16_t Core6502<Bus>::addressingZER()
+{
+    uint16_t address = readByte(programCounter);
+
+    programCounter++;
+
+    return address;
+};
+template <class Bus>
+uint16_t Core6502<Bus>::addressingZEX()
+{
+    uint16_t baseAddress = readByte(programCounter);
+
+    programCounter++;
+
+    uint16_t address = (baseAddress + xRegister) & 0xFF;
+
+    return address;
+};
+template <class Bus>
+uint16_t Core6502<Bus>::addressingZEY()
+{
+    uint16_t baseAddress = readByte(programCounter);
+
+    programCounter++;
+
+    uint16_t address = (baseAddress + yRegister) & 0xFF;
+
+    return address;
+};
+template <class Bus>
+uint16_t Core6502<Bus>::addressingABX()
+{
+    uint16_t lowByte = readByte(programCounter);
+    programCounter++;
+
+    uint16_t highByte = readByte(programCounter);
+    programCounter++;
+
+    uint16_t baseAddress = (highByte << 8) | lowByte;
+
+    uint16_t address = baseAddress + xRegister;
+
+    pageCrossed = (baseAddress ^ address) > 0xFF;
+
+    return address;
+};
+template <class Bus>
+uint16_t Core6502<Bus>::addressingABY()
+{
+    uint16_t lowByte = readByte(programCounter);
+    programCounter++;
+
+    uint16_t highByte = readByte(programCounter);
+    programCounter++;
+
+    uint16_t baseAddress = (highByte << 8) | lowByte;
+
+    uint16_t address = baseAddress + yRegister;
+
+    pageCrossed = (baseAddress ^ address) > 0xFF;
+
+    return address;
+};
+template <class Bus>
+uint16_t Core6502<Bus>::addressingIMP()
+{
+    return 0;
+};
+template <class Bus>
+uint16_t Core6502<Bus>::addressingREL()
+{
+    int8_t offset = readByte(programCounter);
+
+    programCounter++;
+
+    uint16_t targetAddress = programCounter + offset;
+
+    return targetAddress;
+};
+template <class Bus>
+uint16_t Core6502<Bus>::addressingINX()
+{
+    uint16_t baseAddress = readByte(programCounter);
+
+    programCounter++;
+
+    baseAddress += xRegister;
+
+    baseAddress &= 0xFF;
+
+    uint8_t lowByte = readByte(baseAddress);
+
+    uint8_t highByte = readByte((baseAddress + 1) & 0xFF);
+
+    uint16_t address = (highByte << 8) | lowByte;
+
+    return address;
+};
+template <class Bus>
+uint16_t Core6502<Bus>::addressingINY()
+{
+    uint16_t baseAddress = readByte(programCounter);
+
+    programCounter++;
+
+    uint8_t lowByte = readByte(baseAddress);
+
+    uint8_t highByte = readByte((baseAddress + 1) & 0xFF);
+
+    uint16_t pointer = (highByte << 8) | lowByte;
+
+    uint16_t address = pointer + yRegister;
+
+    pageCrossed = (pointer ^ address) > 0xFF;
+
+    return address;
+};
+template <class Bus>
+uint16_t Core6502<Bus>::addressingIND()
+{
+
+    uint16_t addrL;
+    uint16_t addrH;
+    uint16_t effL;
+    uint16_t effH;
+    uint16_t abs;
+    uint16_t addr;
+
+    addrL = readByte(programCounter);
+    programCounter++;
+    addrH = readByte(programCounter);
+    programCounter++;
+
+    abs = (addrH << 8) | addrL;
+
+    effL = readByte(abs);
+    effH = readByte(abs + 1);
+
+    addr = effL + 0x100 * effH;
+
+    return addr;
+};
+
+// Arithmetic shared by ADC and SBC
+template <class Bus>
+void Core6502<Bus>::addBinary(uint8_t value)
+{
+    uint16_t result = accumulator + value + carryFlag;
+
+    carryFlag = result >> 8;
+    overflowResult = ~(accumulator ^ value) & (accumulator ^ result);
+
+    accumulator = result & 0xFF;
+    zeroResult = negativeResult = accumulator;
+}
+template <class Bus>
+void Core6502<Bus>::addDecimal(const uint16_t *table, uint8_t value)
+{
+    uint16_t entry = table[(carryFlag << 16) | (accumulator << 8) | value];
+
+    // Move the packed flags to where the lazy flag bytes keep them
+    accumulator = entry & 0xFF;
+    carryFlag = (entry >> 8) & 1;
+    negativeResult = (entry & ALU_NEGATIVE) >> 2;
+    overflowResult = (entry & ALU_OVERFLOW) >> 3;
+    zeroResult = (~entry & ALU_ZERO) >> 11;
+}
+
+// Opcodes
+template <class Bus>
+void Core6502<Bus>::ADC(uint16_t address)
+{
+    uint8_t value = readByte(address);
+
+    if (statusRegister & (1 << static_cast<uint8_t>(DECIMAL_FLAG_BIT)))
+        addDecimal(DecimalTables::get().adc, value);
+    else
+        addBinary(value);
+};
+template <class Bus>
+void Core6502<Bus>::AND(uint16_t address)
+{
+    // Fetch the value from memory
+    uint8_t value = readByte(address);
+
+    // Perform the exclusive-OR operation
+    accumulator &= value;
+
+    // Update the zero and negative flags
+    zeroResult = negativeResult = accumulator;
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::ASL(uint16_t address)
+{
+    uint8_t value = readByte(address);
+    carryFlag = value >> 7;
+    value <<= 1;
+    value &= 0xFF;
+
+    zeroResult = negativeResult = value;
+
+    writeByte(address, value);
+};
+template <class Bus>
+void Core6502<Bus>::ASL_ACC(uint16_t address)
+{
+
+    uint8_t value = accumulator;
+
+    carryFlag = value >> 7;
+    value <<= 1;
+    value &= 0xFF;
+
+    zeroResult = negativeResult = value;
+
+    accumulator = value;
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::BCC(uint16_t address)
+{
+    if (!carryFlag)
+    {
+        branch(address);
+    }
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::BCS(uint16_t address)
+{
+    if (carryFlag)
+    {
+        branch(address);
+    }
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::BEQ(uint16_t address)
+{
+    if (!zeroResult)
+    {
+        branch(address);
+    }
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::BIT(uint16_t address)
+{
+
+    uint8_t value = readByte(address);
+
+    uint8_t result = accumulator & value;
+
+    // N and V come straight from bits 7 and 6 of the operand
+    negativeResult = value;
+    overflowResult = value << 1;
+
+    zeroResult = result;
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::BMI(uint16_t address)
+{
+    if (negativeResult & 0x80)
+    {
+        branch(address);
+    }
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::BNE(uint16_t address)
+{
+    if (zeroResult)
+    {
+        branch(address);
+    }
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::BPL(uint16_t address)
+{
+    if (!(negativeResult & 0x80))
+    {
+        branch(address);
+    }
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::BRK(uint16_t address)
+{
+    programCounter++;
+    pushStack((programCounter >> 8) & 0xFF);
+    pushStack(programCounter & 0xFF);
+    pushStack(getSR() | (1 << static_cast<uint8_t>(BREAK_FLAG_BIT)) | (1 << static_cast<uint8_t>(UNUSED_FLAG_BIT)));
+    statusRegister |= (1 << static_cast<uint8_t>(INTDISABLE_FLAG_BIT));
+
+    programCounter = (readByte(IRQ_VECTOR_H) << 8) + readByte(IRQ_VECTOR_L);
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::BVC(uint16_t address)
+{
+    if (!(overflowResult & 0x80))
+    {
+        branch(address);
+    }
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::BVS(uint16_t address)
+{
+    if (overflowResult & 0x80)
+    {
+        branch(address);
+    }
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::CLC(uint16_t address)
+{
+    carryFlag = 0;
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::CLD(uint16_t address)
+{
+    statusRegister &= ~(1 << static_cast<uint8_t>(DECIMAL_FLAG_BIT));
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::CLI(uint16_t address)
+{
+    statusRegister &= ~(1 << static_cast<uint8_t>(INTDISABLE_FLAG_BIT));
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::CLV(uint16_t address)
+{
+    overflowResult = 0;
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::CMP(uint16_t address)
+{
+
+    uint8_t value = readByte(address);
+    uint8_t result = accumulator - value;
+
+    carryFlag = accumulator >= value;
+    zeroResult = negativeResult = result;
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::CPX(uint16_t address)
+{
+    uint8_t value = readByte(address);
+    uint8_t result = xRegister - value;
+
+    carryFlag = xRegister >= value;
+    zeroResult = negativeResult = result;
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::CPY(uint16_t address)
+{
+    uint8_t value = readByte(address);
+    uint8_t result = yRegister - value;
+
+    carryFlag = yRegister >= value;
+    zeroResult = negativeResult = result;
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::DEC(uint16_t address)
+{
+    uint8_t value = readByte(address);
+    value = (value - 1) & 0xFF;
+    zeroResult = negativeResult = value;
+    writeByte(address, value);
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::DEX(uint16_t address)
+{
+    xRegister--;
+
+    zeroResult = negativeResult = xRegister;
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::DEY(uint16_t address)
+{
+    yRegister--;
+
+    zeroResult = negativeResult = yRegister;
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::EOR(uint16_t address)
+{
+
+    uint8_t value = readByte(address);
+    uint8_t solution = accumulator ^ value;
+
+    zeroResult = negativeResult = solution;
+
+    accumulator = solution;
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::INC(uint16_t address)
+{
+    uint8_t value = readByte(address);
+    value++;
+    zeroResult = negativeResult = value;
+    writeByte(address, value);
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::INX(uint16_t address)
+{
+    xRegister++;
+    zeroResult = negativeResult = xRegister;
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::INY(uint16_t address)
+{
+    yRegister++;
+    zeroResult = negativeResult = yRegister;
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::JMP(uint16_t address)
+{
+    programCounter = address;
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::JSR(uint16_t address)
+{
+    programCounter--;
+
+    pushStack((programCounter >> 8) & 0xFF);
+    pushStack(programCounter & 0xFF);
+
+    programCounter = address;
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::LDA(uint16_t address)
+{
+    accumulator = readByte(address);
+    zeroResult = negativeResult = accumulator;
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::LDX(uint16_t address)
+{
+    xRegister = readByte(address);
+    zeroResult = negativeResult = xRegister;
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::LDY(uint16_t address)
+{
+    yRegister = readByte(address);
+    zeroResult = negativeResult = yRegister;
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::LSR(uint16_t address)
+{
+    uint8_t value = readByte(address);
+
+    carryFlag = value & 0x01;
+
+    value >>= 1;
+
+    // Bit 7 of the result is always clear, so N is too
+    zeroResult = negativeResult = value;
+    writeByte(address, value);
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::LSR_ACC(uint16_t address)
+{
+
+    carryFlag = accumulator & 0x01;
+    accumulator >>= 1;
+    zeroResult = negativeResult = accumulator;
+};
+template <class Bus>
+void Core6502<Bus>::NOP(uint16_t address)
+{
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::ORA(uint16_t address)
+{
+    // Fetch the value from memory
+    uint8_t value = readByte(address);
+
+    // Perform the exclusive-OR operation
+    accumulator |= value;
+
+    // Update the zero and negative flags
+    zeroResult = negativeResult = accumulator;
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::PHA(uint16_t address)
+{
+    pushStack(accumulator);
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::PHP(uint16_t address)
+{
+    // Push status register onto the stack with Break flag (bit 4) and bit 5 set to 1
+    pushStack(getSR() | (1 << static_cast<uint8_t>(BREAK_FLAG_BIT)) | (1 << static_cast<uint8_t>(UNUSED_FLAG_BIT)));
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::PLA(uint16_t address)
+{
+    uint8_t value = popStack();
+
+    accumulator = value;
+    zeroResult = negativeResult = accumulator;
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::PLP(uint16_t address)
+{
+    uint8_t value = popStack();
+
+    // Ignore the break flag (bit 4) and bit 5
+    value &= ~(1 << static_cast<uint8_t>(BREAK_FLAG_BIT));
+    value &= ~(1 << static_cast<uint8_t>(UNUSED_FLAG_BIT));
+    setSR(value);
+}
+template <class Bus>
+void Core6502<Bus>::ROL(uint16_t address)
+{
+    uint16_t value = readByte(address);
+
+    value <<= 1;
+    value |= carryFlag;
+    carryFlag = value >> 8;
+    value &= 0xFF;
+    zeroResult = negativeResult = value;
+
+    writeByte(address, value);
+};
+template <class Bus>
+void Core6502<Bus>::ROL_ACC(uint16_t address)
+{
+    uint16_t value;
+    value = accumulator << 1;
+    value |= carryFlag;
+    carryFlag = value >> 8;
+    value &= 0xFF;
+    zeroResult = negativeResult = value;
+
+    accumulator = value;
+};
+template <class Bus>
+void Core6502<Bus>::ROR(uint16_t address)
+{
+    uint8_t value = readByte(address);
+    uint8_t oldCarry = carryFlag;
+
+    carryFlag = value & 0x01;
+    value = (value >> 1) | (oldCarry << 7);
+
+    zeroResult = negativeResult = value;
+
+    writeByte(address, value);
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::ROR_ACC(uint16_t address)
+{
+    uint8_t oldCarry = carryFlag;
+
+    carryFlag = accumulator & 0x01;
+
+    accumulator = (accumulator >> 1) | (oldCarry << 7);
+
+    zeroResult = negativeResult = accumulator;
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::RTI(uint16_t address)
+{
+    // Get old status
+    setSR(popStack());
+
+    // Get return address
+    uint8_t lowByte = popStack();
+    uint8_t highByte = popStack();
+    uint16_t returnAddress = (highByte << 8) | lowByte;
+    programCounter = returnAddress;
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::RTS(uint16_t address)
+{
+    uint8_t lowByte = popStack();
+    uint8_t highByte = popStack();
+
+    uint16_t returnAddress = (highByte << 8) | lowByte;
+    returnAddress++;
+
+    programCounter = returnAddress;
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::SBC(uint16_t address)
+{
+    uint8_t value = readByte(address);
+
+    // A - M - borrow is A + ~M + carry
+    if (statusRegister & (1 << static_cast<uint8_t>(DECIMAL_FLAG_BIT)))
+        addDecimal(DecimalTables::get().sbc, value);
+    else
+        addBinary(value ^ 0xFF);
+};
+template <class Bus>
+void Core6502<Bus>::SEC(uint16_t address)
+{
+    carryFlag = 1;
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::SED(uint16_t address)
+{
+    statusRegister |= (1 << static_cast<uint8_t>(DECIMAL_FLAG_BIT));
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::SEI(uint16_t address)
+{
+    statusRegister |= (1 << static_cast<uint8_t>(INTDISABLE_FLAG_BIT));
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::STA(uint16_t address)
+{
+    writeByte(address, accumulator);
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::STX(uint16_t address)
+{
+    writeByte(address, xRegister);
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::STY(uint16_t address)
+{
+    writeByte(address, yRegister);
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::TAX(uint16_t address)
+{
+    xRegister = accumulator;
+    zeroResult = negativeResult = xRegister;
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::TAY(uint16_t address)
+{
+    yRegister = accumulator;
+    zeroResult = negativeResult = yRegister;
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::TSX(uint16_t address)
+{
+    xRegister = stackPointer;
+    zeroResult = negativeResult = xRegister;
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::TXA(uint16_t address)
+{
+    accumulator = xRegister;
+    zeroResult = negativeResult = accumulator;
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::TXS(uint16_t address)
+{
+    stackPointer = xRegister;
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::TYA(uint16_t address)
+{
+    accumulator = yRegister;
+    zeroResult = negativeResult = accumulator;
+
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::ILLEGAL(uint16_t address) {};
+
+#pragma endregion
+#pragma region Public helper functons
+
+template <class Bus>
+Core6502<Bus>::Core6502()
+{
+    programCounter = 0x0000;
+    stackPointer = 0xFF;
+    setSR(0x36);
+    accumulator = 0x00;
+    xRegister = 0x00;
+    yRegister = 0x00;
+
+    instructionCount = 0;
+    cycleCount = 0;
+    pageCrossed = false;
+}
+
+// Register helper functions
+
+template <class Bus>
+uint16_t Core6502<Bus>::getPC()
+{
+    return programCounter;
+};
+template <class Bus>
+void Core6502<Bus>::setPC(uint16_t data)
+{
+    programCounter = data;
+};
+template <class Bus>
+uint8_t Core6502<Bus>::getSP()
+{
+    return stackPointer;
+};
+template <class Bus>
+void Core6502<Bus>::setSP(uint8_t data)
+{
+    stackPointer = data;
+};
+template <class Bus>
+uint8_t Core6502<Bus>::getSR()
+{
+    // Compose the lazily kept N, V, Z and C with the flags stored as bits
+    return (negativeResult & 0x80) |
+           (overflowResult & 0x80) >> 1 |
+           (statusRegister & ~lazyFlags) |
+           (zeroResult ? 0 : 1) << static_cast<uint8_t>(ZERO_FLAG_BIT) |
+           carryFlag;
+};
+template <class Bus>
+void Core6502<Bus>::setSR(uint8_t data)
+{
+    statusRegister = data & ~lazyFlags;
+    carryFlag = data & 0x01;
+    zeroResult = (data & (1 << static_cast<uint8_t>(ZERO_FLAG_BIT))) ? 0 : 1;
+    negativeResult = data;
+    overflowResult = data << 1;
+};
+template <class Bus>
+uint8_t Core6502<Bus>::getAC()
+{
+    return accumulator;
+};
+template <class Bus>
+void Core6502<Bus>::setAC(uint8_t data)
+{
+    accumulator = data;
+};
+template <class Bus>
+uint8_t Core6502<Bus>::getXR()
+{
+    return xRegister;
+};
+template <class Bus>
+void Core6502<Bus>::setXR(uint8_t data)
+{
+    xRegister = data;
+};
+template <class Bus>
+uint8_t Core6502<Bus>::getYR()
+{
+    return yRegister;
+};
+template <class Bus>
+void Core6502<Bus>::setYR(uint8_t data)
+{
+    yRegister = data;
+};
+
+// Flag helper functions
+
+template <class Bus>
+void Core6502<Bus>::setFlag(flag_bits flag, bool state)
+{
+    switch (flag)
+    {
+    case flag_bits::CARRY_FLAG_BIT:
+        carryFlag = state;
+        return;
+    case flag_bits::ZERO_FLAG_BIT:
+        zeroResult = !state;
+        return;
+    case flag_bits::OVERFLOW_FLAG_BIT:
+        overflowResult = state ? 0x80 : 0x00;
+        return;
+    case flag_bits::NEGATIVE_FLAG_BIT:
+        negativeResult = state ? 0x80 : 0x00;
+        return;
+    default:
+        break;
+    }
+
+    if (state)
+    {
+        statusRegister |= (1 << static_cast<uint8_t>(flag));
+    }
+    else
+    {
+        statusRegister &= ~(1 << static_cast<uint8_t>(flag));
+    }
+};
+template <class Bus>
+uint8_t Core6502<Bus>::getFlag(flag_bits flag)
+{
+    return (getSR() >> static_cast<uint8_t>(flag)) & 0x01;
+};
+
+// Stack helper functions
+
+template <class Bus>
+void Core6502<Bus>::pushStack(uint8_t byte)
+{
+    writeByte(0x0100 + stackPointer, byte);
+    stackPointer = (stackPointer - 1) & 0xFF;
+
+    return;
+}
+template <class Bus>
+uint8_t Core6502<Bus>::popStack()
+{
+    stackPointer = (stackPointer + 1) & 0xFF;
+    return readByte(0x0100 + stackPointer);
+}
+
+// Branch helper function
+
+template <class Bus>
+void Core6502<Bus>::branch(uint16_t address)
+{
+    // One extra cycle for a taken branch, two if it lands on another page
+    cycleCount += ((programCounter ^ address) > 0xFF) ? 2 : 1;
+
+    programCounter = address;
+}
+
+template <class Bus>
+uint8_t Core6502<Bus>::step()
+{
+    uint64_t startCycles = cycleCount;
+
+    // Get opcode
+    uint8_t opcode = readByte(programCounter++);
+
+    // Decode opcode
+    const Instruction &instruction = Instructions[opcode];
+
+    // Execute opcode
+    uint16_t address = (this->*instruction.addr)();
+    (this->*instruction.code)(address);
+
+    cycleCount += instruction.cycles;
+    if (instruction.pageCycles && pageCrossed)
+        cycleCount += instruction.pageCycles;
+
+    instructionCount++;
+
+    return cycleCount - startCycles;
+}
+template <class Bus>
+typename Core6502<Bus>::run_status Core6502<Bus>::run(uint64_t maxCycles)
+{
+    uint64_t endCycles = cycleCount + maxCycles;
+
+    while (cycleCount < endCycles)
+    {
+        uint16_t opcodeAddress = programCounter;
+
+        // Fetch and dispatch, every case has its addressing mode and operation fused
+        // so the compiler can inline both instead of calling through the table
+        switch (readByte(programCounter++))
+        {
+#define MOS6502_OPCODE(opcode, alias, code, mode, cycles, bytes, pageCycles) \
+    case opcode:                                                             \
+        code(addressing##mode());                                            \
+        cycleCount += cycles;                                                \
+        if (pageCycles && pageCrossed)                                       \
+            cycleCount += pageCycles;                                        \
+        break;
+#define MOS6502_ILLEGAL(opcode)
+#include "mos6502_opcodes.h"
+#undef MOS6502_OPCODE
+#undef MOS6502_ILLEGAL
+        default:
+            // Leave illegal opcodes to the host, PC still points at them
+            programCounter = opcodeAddress;
+            return RUN_ILLEGAL_OPCODE;
+        }
+
+        instructionCount++;
+
+        // Without interrupts an instruction that lands on itself never makes progress
+        if (programCounter == opcodeAddress)
+            return RUN_TRAPPED;
+    }
+
+    return RUN_BUDGET_EXHAUSTED;
+}
+template <class Bus>
+uint64_t Core6502<Bus>::getInstructionCount()
+{
+    return instructionCount;
+}
+template <class Bus>
+uint64_t Core6502<Bus>::getCycles()
+{
+    return cycleCount;
+}
+
+template <class Bus>
+void Core6502<Bus>::reset()
+{
+    accumulator = 0x00;
+    yRegister = 0x00;
+    xRegister = 0x00;
+    stackPointer = 0xFF;
+
+    setSR(0x36); // 00110110 status register
+
+    // load PC from reset vector
+    uint8_t addressLow = readByte(RESET_VECTOR_L);
+    uint8_t addressHigh = readByte(RESET_VECTOR_H);
+    programCounter = (addressHigh << 8) + addressLow;
+
+    cycleCount += 7;
+    return;
+};
+template <class Bus>
+void Core6502<Bus>::IRQ()
+{
+    if (!getFlag(INTDISABLE_FLAG_BIT))
+        interrupt(IRQ_VECTOR_L, IRQ_VECTOR_H);
+};
+template <class Bus>
+void Core6502<Bus>::NMI()
+{
+    interrupt(NMI_VECTOR_L, NMI_VECTOR_H);
+};
+template <class Bus>
+void Core6502<Bus>::interrupt(uint16_t vectorLow, uint16_t vectorHigh)
+{
+    // Save PC and status to stack, the break flag is only set in the copy pushed by BRK
+    pushStack((programCounter >> 8) & 0xFF);
+    pushStack(programCounter & 0xFF);
+    pushStack((getSR() & ~(1 << static_cast<uint8_t>(BREAK_FLAG_BIT))) | (1 << static_cast<uint8_t>(UNUSED_FLAG_BIT)));
+
+    statusRegister |= (1 << static_cast<uint8_t>(INTDISABLE_FLAG_BIT));
+
+    uint8_t addressLow = readByte(vectorLow);
+    uint8_t addressHigh = readByte(vectorHigh);
+    programCounter = (addressHigh << 8) + addressLow;
+
+    cycleCount += 7;
+}
+
+#pragma endregion
+
+#endif
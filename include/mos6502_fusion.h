@@ -0,0 +1,35 @@
+/*
+ * Opcode pairs run() executes as one superinstruction.
+ *
+ * The case of the first opcode of a pair in runLocals() runs the first
+ * opcode, looks at the next opcode byte and, if it is the second one, runs it
+ * in the same case without going back through the dispatch switch. Both
+ * opcode bodies are inlined there, so the compiler optimizes them as one:
+ * DEX followed by BNE branches on X itself. The second opcode is fetched only
+ * after the first one has run, so self-modifying code stays correct. Pairs
+ * are only fused while nothing needs to look at the boundary between them: no
+ * interrupt line or event is due, no breakpoint, watchpoint, trace, profile
+ * or stop predicate is active and the cycle budget is not used up.
+ *
+ * Every opcode can be the first of at most one pair, and the first opcode must
+ * not jump or branch. The pairs are the counters feeding branches, the carry
+ * setups feeding arithmetic and the indirect copy that dominate the pair counts
+ * of writeProfile() on the benchmark workloads.
+ *
+ * MOS6502_FUSION(first, second)
+ *     first   The opcode executed first.
+ *     second  The opcode fused after it.
+ *
+ * There is intentionally no include guard.
+ */
+
+MOS6502_FUSION(0xCA, 0xD0) // DEX      BNE
+MOS6502_FUSION(0x88, 0xD0) // DEY      BNE
+MOS6502_FUSION(0xE8, 0xD0) // INX      BNE
+MOS6502_FUSION(0xC8, 0xD0) // INY      BNE
+MOS6502_FUSION(0xC6, 0xD0) // DEC zp   BNE
+MOS6502_FUSION(0xC9, 0xB0) // CMP #    BCS
+MOS6502_FUSION(0x4A, 0x90) // LSR A    BCC
+MOS6502_FUSION(0x18, 0x69) // CLC      ADC #
+MOS6502_FUSION(0x38, 0xE9) // SEC      SBC #
+MOS6502_FUSION(0xB1, 0x91) // LDA (),Y STA (),Y
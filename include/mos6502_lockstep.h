@@ -0,0 +1,139 @@
+#ifndef mos6502_lockstep_H
+#define mos6502_lockstep_H
+
+#include "mos6502_batch.h"
+
+/**
+ * @brief Runs many independent programs in lockstep, one CPU per SIMD lane.
+ *
+ * The registers, flags and program counters of LANES CPUs are kept as
+ * structure-of-arrays vectors and every instruction is executed for all the
+ * lanes sitting on the same PC with the same opcode and operand bytes at
+ * once. RAM is interleaved so that the same address of every lane is one
+ * vector load or store. Lanes that branch apart wait while the lanes at the
+ * lowest PC catch up, which brings loops back together, and a lane that has
+ * waited too long is handed over to a scalar mos6502 to finish its job.
+ *
+ * Lanes are plain 64 KB of RAM. Jobs with an instruction limit, or whose
+ * prototype maps memory or I/O, has an interrupt line asserted, an event
+ * scheduled, a breakpoint, watchpoint or trace buffer set run on a scalar
+ * mos6502 from the start, so every result matches what BatchRunner gives
+ * for the same job.
+ */
+class LockstepRunner
+{
+private:
+    std::vector<BatchJob> jobs;
+    std::vector<BatchResult> results;
+
+    double seconds;
+    uint64_t totalInstructions;
+    uint64_t totalCycles;
+
+    // Lane instructions executed in vectors and the vector steps they took
+    uint64_t laneInstructions;
+    uint64_t vectorSteps;
+
+    size_t scalarJobs;
+
+    // The interleaved RAM of the lanes, reused by every group
+    std::vector<uint8_t> memory;
+
+    /**
+     * @brief Check if a job can run in a lane.
+     *
+     * @param job The job.
+     * @return true if the job only needs plain RAM.
+     */
+    static bool fitsLane(const BatchJob &job);
+
+    /**
+     * @brief Run up to LANES jobs together and store their results.
+     *
+     * @param group The indices of the jobs.
+     * @param count The number of jobs.
+     */
+    void runGroup(const size_t *group, size_t count);
+
+public:
+    /**
+     * @brief The number of CPUs executing together.
+     */
+    static const unsigned LANES = 32;
+
+    /**
+     * @brief Create a lockstep runner. Groups run one after another on the calling thread.
+     */
+    LockstepRunner();
+
+    /**
+     * @brief Add a job to the batch.
+     *
+     * @param job The job to add.
+     * @return The index of the job's result.
+     */
+    size_t addJob(const BatchJob &job);
+
+    /**
+     * @brief Run every job added so far.
+     */
+    void run();
+
+    /**
+     * @brief Get the results of the last run, in the order the jobs were added.
+     *
+     * @return The results.
+     */
+    const std::vector<BatchResult> &getResults();
+
+    /**
+     * @brief Get the wall time of the last run in seconds.
+     *
+     * @return The wall time in seconds.
+     */
+    double getSeconds();
+
+    /**
+     * @brief Get the number of instructions executed by all jobs of the last run.
+     *
+     * @return The number of instructions.
+     */
+    uint64_t getInstructions();
+
+    /**
+     * @brief Get the number of cycles executed by all jobs of the last run.
+     *
+     * @return The number of cycles.
+     */
+    uint64_t getCycles();
+
+    /**
+     * @brief Get the aggregate emulated instructions per second of the last run.
+     *
+     * @return The instructions per second.
+     */
+    double getInstructionsPerSecond();
+
+    /**
+     * @brief Get the average number of lanes executing each vector step of the last run.
+     *
+     * @return Between 1 and LANES, lower when lanes diverge.
+     */
+    double getActiveLanes();
+
+    /**
+     * @brief Get the number of jobs of the last run finished on a scalar mos6502.
+     *
+     * @return Jobs that could not run in a lane or diverged for too long.
+     */
+    size_t getScalarJobs();
+
+    /**
+     * @brief Get the instruction set the lanes are executed with on this host.
+     *
+     * @return "avx2", "sse2" or "generic".
+     */
+    static const char *getVectorISA();
+};
+
+#endif
@@ -0,0 +1,278 @@
+/*
+ * Opcode list for the MOS 6502 processor.
+ *
+ * This file is included several times with different definitions of the two
+ * macros below, so that the decode table and the interpreter cores are all
+ * generated from the same data and can never disagree.
+ *
+ * MOS6502_OPCODE(opcode, alias, code, mode, cycles, bytes, pageCycles)
+ *     opcode      The opcode byte.
+ *     alias       The mnemonic of the instruction.
+ *     code        The mos6502 method executing the instruction.
+ *     mode        The addressing mode suffix (addressing<mode>).
+ *     cycles      The base number of clock cycles.
+ *     bytes       The number of bytes occupied by the instruction in memory.
+ *     pageCycles  The extra cycles taken when an indexed read crosses a page.
+ *
+ * MOS6502_ILLEGAL(opcode)
+ *     An opcode that is not supported by the emulator.
+ *
+ * There is intentionally no include guard.
+ */
+
+MOS6502_OPCODE(0x00, "BRK", BRK, IMP, 7, 1, 0)
+MOS6502_OPCODE(0x01, "ORA", ORA, INX, 6, 2, 0)
+MOS6502_ILLEGAL(0x02)
+MOS6502_ILLEGAL(0x03)
+MOS6502_OPCODE(0x04, "NOP", NOP, ZER, 3, 2, 0)
+MOS6502_OPCODE(0x05, "ORA", ORA, ZER, 3, 2, 0)
+MOS6502_OPCODE(0x06, "ASL", ASL, ZER, 5, 2, 0)
+MOS6502_ILLEGAL(0x07)
+MOS6502_OPCODE(0x08, "PHP", PHP, IMP, 3, 1, 0)
+MOS6502_OPCODE(0x09, "ORA", ORA, IMM, 2, 2, 0)
+MOS6502_OPCODE(0x0A, "ASL_ACC", ASL_ACC, IMP, 2, 1, 0)
+MOS6502_ILLEGAL(0x0B)
+MOS6502_OPCODE(0x0C, "NOP", NOP, ABS, 4, 3, 0)
+MOS6502_OPCODE(0x0D, "ORA", ORA, ABS, 4, 3, 0)
+MOS6502_OPCODE(0x0E, "ASL", ASL, ABS, 6, 3, 0)
+MOS6502_ILLEGAL(0x0F)
+MOS6502_OPCODE(0x10, "BPL", BPL, REL, 2, 2, 0)
+MOS6502_OPCODE(0x11, "ORA", ORA, INY, 5, 2, 1)
+MOS6502_ILLEGAL(0x12)
+MOS6502_ILLEGAL(0x13)
+MOS6502_OPCODE(0x14, "NOP", NOP, ZEX, 4, 2, 0)
+MOS6502_OPCODE(0x15, "ORA", ORA, ZEX, 4, 2, 0)
+MOS6502_OPCODE(0x16, "ASL", ASL, ZEX, 6, 2, 0)
+MOS6502_ILLEGAL(0x17)
+MOS6502_OPCODE(0x18, "CLC", CLC, IMP, 2, 1, 0)
+MOS6502_OPCODE(0x19, "ORA", ORA, ABY, 4, 3, 1)
+MOS6502_OPCODE(0x1A, "NOP", NOP, IMP, 2, 1, 0)
+MOS6502_ILLEGAL(0x1B)
+MOS6502_OPCODE(0x1C, "NOP", NOP, ABX, 4, 3, 1)
+MOS6502_OPCODE(0x1D, "ORA", ORA, ABX, 4, 3, 1)
+MOS6502_OPCODE(0x1E, "ASL", ASL, ABX, 7, 3, 0)
+MOS6502_ILLEGAL(0x1F)
+MOS6502_OPCODE(0x20, "JSR", JSR, ABS, 6, 3, 0)
+MOS6502_OPCODE(0x21, "AND", AND, INX, 6, 2, 0)
+MOS6502_ILLEGAL(0x22)
+MOS6502_ILLEGAL(0x23)
+MOS6502_OPCODE(0x24, "BIT", BIT, ZER, 3, 2, 0)
+MOS6502_OPCODE(0x25, "AND", AND, ZER, 3, 2, 0)
+MOS6502_OPCODE(0x26, "ROL", ROL, ZER, 5, 2, 0)
+MOS6502_ILLEGAL(0x27)
+MOS6502_OPCODE(0x28, "PLP", PLP, IMP, 4, 1, 0)
+MOS6502_OPCODE(0x29, "AND", AND, IMM, 2, 2, 0)
+MOS6502_OPCODE(0x2A, "ROL_ACC", ROL_ACC, IMP, 2, 1, 0)
+MOS6502_ILLEGAL(0x2B)
+MOS6502_OPCODE(0x2C, "BIT", BIT, ABS, 4, 3, 0)
+MOS6502_OPCODE(0x2D, "AND", AND, ABS, 4, 3, 0)
+MOS6502_OPCODE(0x2E, "ROL", ROL, ABS, 6, 3, 0)
+MOS6502_ILLEGAL(0x2F)
+MOS6502_OPCODE(0x30, "BMI", BMI, REL, 2, 2, 0)
+MOS6502_OPCODE(0x31, "AND", AND, INY, 5, 2, 1)
+MOS6502_ILLEGAL(0x32)
+MOS6502_ILLEGAL(0x33)
+MOS6502_OPCODE(0x34, "NOP", NOP, ZEX, 4, 2, 0)
+MOS6502_OPCODE(0x35, "AND", AND, ZEX, 4, 2, 0)
+MOS6502_OPCODE(0x36, "ROL", ROL, ZEX, 6, 2, 0)
+MOS6502_ILLEGAL(0x37)
+MOS6502_OPCODE(0x38, "SEC", SEC, IMP, 2, 1, 0)
+MOS6502_OPCODE(0x39, "AND", AND, ABY, 4, 3, 1)
+MOS6502_OPCODE(0x3A, "NOP", NOP, IMP, 2, 1, 0)
+MOS6502_ILLEGAL(0x3B)
+MOS6502_OPCODE(0x3C, "NOP", NOP, ABX, 4, 3, 1)
+MOS6502_OPCODE(0x3D, "AND", AND, ABX, 4, 3, 1)
+MOS6502_OPCODE(0x3E, "ROL", ROL, ABX, 7, 3, 0)
+MOS6502_ILLEGAL(0x3F)
+MOS6502_OPCODE(0x40, "RTI", RTI, IMP, 6, 1, 0)
+MOS6502_OPCODE(0x41, "EOR", EOR, INX, 6, 2, 0)
+MOS6502_ILLEGAL(0x42)
+MOS6502_ILLEGAL(0x43)
+MOS6502_OPCODE(0x44, "NOP", NOP, ZER, 3, 2, 0)
+MOS6502_OPCODE(0x45, "EOR", EOR, ZER, 3, 2, 0)
+MOS6502_OPCODE(0x46, "LSR", LSR, ZER, 5, 2, 0)
+MOS6502_ILLEGAL(0x47)
+MOS6502_OPCODE(0x48, "PHA", PHA, IMP, 3, 1, 0)
+MOS6502_OPCODE(0x49, "EOR", EOR, IMM, 2, 2, 0)
+MOS6502_OPCODE(0x4A, "LSR_ACC", LSR_ACC, IMP, 2, 1, 0)
+MOS6502_ILLEGAL(0x4B)
+MOS6502_OPCODE(0x4C, "JMP", JMP, ABS, 3, 3, 0)
+MOS6502_OPCODE(0x4D, "EOR", EOR, ABS, 4, 3, 0)
+MOS6502_OPCODE(0x4E, "LSR", LSR, ABS, 6, 3, 0)
+MOS6502_ILLEGAL(0x4F)
+MOS6502_OPCODE(0x50, "BVC", BVC, REL, 2, 2, 0)
+MOS6502_OPCODE(0x51, "EOR", EOR, INY, 5, 2, 1)
+MOS6502_ILLEGAL(0x52)
+MOS6502_ILLEGAL(0x53)
+MOS6502_OPCODE(0x54, "NOP", NOP, ZEX, 4, 2, 0)
+MOS6502_OPCODE(0x55, "EOR", EOR, ZEX, 4, 2, 0)
+MOS6502_OPCODE(0x56, "LSR", LSR, ZEX, 6, 2, 0)
+MOS6502_ILLEGAL(0x57)
+MOS6502_OPCODE(0x58, "CLI", CLI, IMP, 2, 1, 0)
+MOS6502_OPCODE(0x59, "EOR", EOR, ABY, 4, 3, 1)
+MOS6502_OPCODE(0x5A, "NOP", NOP, IMP, 2, 1, 0)
+MOS6502_ILLEGAL(0x5B)
+MOS6502_OPCODE(0x5C, "NOP", NOP, ABX, 4, 3, 1)
+MOS6502_OPCODE(0x5D, "EOR", EOR, ABX, 4, 3, 1)
+MOS6502_OPCODE(0x5E, "LSR", LSR, ABX, 7, 3, 0)
+MOS6502_ILLEGAL(0x5F)
+MOS6502_OPCODE(0x60, "RTS", RTS, IMP, 6, 1, 0)
+MOS6502_OPCODE(0x61, "ADC", ADC, INX, 6, 2, 0)
+MOS6502_ILLEGAL(0x62)
+MOS6502_ILLEGAL(0x63)
+MOS6502_OPCODE(0x64, "NOP", NOP, ZER, 3, 2, 0)
+MOS6502_OPCODE(0x65, "ADC", ADC, ZER, 3, 2, 0)
+MOS6502_OPCODE(0x66, "ROR", ROR, ZER, 5, 2, 0)
+MOS6502_ILLEGAL(0x67)
+MOS6502_OPCODE(0x68, "PLA", PLA, IMP, 4, 1, 0)
+MOS6502_OPCODE(0x69, "ADC", ADC, IMM, 2, 2, 0)
+MOS6502_OPCODE(0x6A, "ROR_ACC", ROR_ACC, IMP, 2, 1, 0)
+MOS6502_ILLEGAL(0x6B)
+MOS6502_OPCODE(0x6C, "JMP", JMP, IND, 5, 3, 0)
+MOS6502_OPCODE(0x6D, "ADC", ADC, ABS, 4, 3, 0)
+MOS6502_OPCODE(0x6E, "ROR", ROR, ABS, 6, 3, 0)
+MOS6502_ILLEGAL(0x6F)
+MOS6502_OPCODE(0x70, "BVS", BVS, REL, 2, 2, 0)
+MOS6502_OPCODE(0x71, "ADC", ADC, INY, 5, 2, 1)
+MOS6502_ILLEGAL(0x72)
+MOS6502_ILLEGAL(0x73)
+MOS6502_OPCODE(0x74, "NOP", NOP, ZEX, 4, 2, 0)
+MOS6502_OPCODE(0x75, "ADC", ADC, ZEX, 4, 2, 0)
+MOS6502_OPCODE(0x76, "ROR", ROR, ZEX, 6, 2, 0)
+MOS6502_ILLEGAL(0x77)
+MOS6502_OPCODE(0x78, "SEI", SEI, IMP, 2, 1, 0)
+MOS6502_OPCODE(0x79, "ADC", ADC, ABY, 4, 3, 1)
+MOS6502_OPCODE(0x7A, "NOP", NOP, IMP, 2, 1, 0)
+MOS6502_ILLEGAL(0x7B)
+MOS6502_OPCODE(0x7C, "NOP", NOP, ABX, 4, 3, 1)
+MOS6502_OPCODE(0x7D, "ADC", ADC, ABX, 4, 3, 1)
+MOS6502_OPCODE(0x7E, "ROR", ROR, ABX, 7, 3, 0)
+MOS6502_ILLEGAL(0x7F)
+MOS6502_OPCODE(0x80, "NOP", NOP, IMM, 2, 2, 0)
+MOS6502_OPCODE(0x81, "STA", STA, INX, 6, 2, 0)
+MOS6502_OPCODE(0x82, "NOP", NOP, IMM, 2, 2, 0)
+MOS6502_ILLEGAL(0x83)
+MOS6502_OPCODE(0x84, "STY", STY, ZER, 3, 2, 0)
+MOS6502_OPCODE(0x85, "STA", STA, ZER, 3, 2, 0)
+MOS6502_OPCODE(0x86, "STX", STX, ZER, 3, 2, 0)
+MOS6502_ILLEGAL(0x87)
+MOS6502_OPCODE(0x88, "DEY", DEY, IMP, 2, 1, 0)
+MOS6502_OPCODE(0x89, "NOP", NOP, IMM, 2, 2, 0)
+MOS6502_OPCODE(0x8A, "TXA", TXA, IMP, 2, 1, 0)
+MOS6502_ILLEGAL(0x8B)
+MOS6502_OPCODE(0x8C, "STY", STY, ABS, 4, 3, 0)
+MOS6502_OPCODE(0x8D, "STA", STA, ABS, 4, 3, 0)
+MOS6502_OPCODE(0x8E, "STX", STX, ABS, 4, 3, 0)
+MOS6502_ILLEGAL(0x8F)
+MOS6502_OPCODE(0x90, "BCC", BCC, REL, 2, 2, 0)
+MOS6502_OPCODE(0x91, "STA", STA, INY, 6, 2, 0)
+MOS6502_ILLEGAL(0x92)
+MOS6502_ILLEGAL(0x93)
+MOS6502_OPCODE(0x94, "STY", STY, ZEX, 4, 2, 0)
+MOS6502_OPCODE(0x95, "STA", STA, ZEX, 4, 2, 0)
+MOS6502_OPCODE(0x96, "STX", STX, ZEY, 4, 2, 0)
+MOS6502_ILLEGAL(0x97)
+MOS6502_OPCODE(0x98, "TYA", TYA, IMP, 2, 1, 0)
+MOS6502_OPCODE(0x99, "STA", STA, ABY, 5, 3, 0)
+MOS6502_OPCODE(0x9A, "TXS", TXS, IMP, 2, 1, 0)
+MOS6502_ILLEGAL(0x9B)
+MOS6502_ILLEGAL(0x9C)
+MOS6502_OPCODE(0x9D, "STA", STA, ABX, 5, 3, 0)
+MOS6502_ILLEGAL(0x9E)
+MOS6502_ILLEGAL(0x9F)
+MOS6502_OPCODE(0xA0, "LDY", LDY, IMM, 2, 2, 0)
+MOS6502_OPCODE(0xA1, "LDA", LDA, INX, 6, 2, 0)
+MOS6502_OPCODE(0xA2, "LDX", LDX, IMM, 2, 2, 0)
+MOS6502_ILLEGAL(0xA3)
+MOS6502_OPCODE(0xA4, "LDY", LDY, ZER, 3, 2, 0)
+MOS6502_OPCODE(0xA5, "LDA", LDA, ZER, 3, 2, 0)
+MOS6502_OPCODE(0xA6, "LDX", LDX, ZER, 3, 2, 0)
+MOS6502_ILLEGAL(0xA7)
+MOS6502_OPCODE(0xA8, "TAY", TAY, IMP, 2, 1, 0)
+MOS6502_OPCODE(0xA9, "LDA", LDA, IMM, 2, 2, 0)
+MOS6502_OPCODE(0xAA, "TAX", TAX, IMP, 2, 1, 0)
+MOS6502_ILLEGAL(0xAB)
+MOS6502_OPCODE(0xAC, "LDY", LDY, ABS, 4, 3, 0)
+MOS6502_OPCODE(0xAD, "LDA", LDA, ABS, 4, 3, 0)
+MOS6502_OPCODE(0xAE, "LDX", LDX, ABS, 4, 3, 0)
+MOS6502_ILLEGAL(0xAF)
+MOS6502_OPCODE(0xB0, "BCS", BCS, REL, 2, 2, 0)
+MOS6502_OPCODE(0xB1, "LDA", LDA, INY, 5, 2, 1)
+MOS6502_ILLEGAL(0xB2)
+MOS6502_ILLEGAL(0xB3)
+MOS6502_OPCODE(0xB4, "LDY", LDY, ZEX, 4, 2, 0)
+MOS6502_OPCODE(0xB5, "LDA", LDA, ZEX, 4, 2, 0)
+MOS6502_OPCODE(0xB6, "LDX", LDX, ZEY, 4, 2, 0)
+MOS6502_ILLEGAL(0xB7)
+MOS6502_OPCODE(0xB8, "CLV", CLV, IMP, 2, 1, 0)
+MOS6502_OPCODE(0xB9, "LDA", LDA, ABY, 4, 3, 1)
+MOS6502_OPCODE(0xBA, "TSX", TSX, IMP, 2, 1, 0)
+MOS6502_ILLEGAL(0xBB)
+MOS6502_OPCODE(0xBC, "LDY", LDY, ABX, 4, 3, 1)
+MOS6502_OPCODE(0xBD, "LDA", LDA, ABX, 4, 3, 1)
+MOS6502_OPCODE(0xBE, "LDX", LDX, ABY, 4, 3, 1)
+MOS6502_ILLEGAL(0xBF)
+MOS6502_OPCODE(0xC0, "CPY", CPY, IMM, 2, 2, 0)
+MOS6502_OPCODE(0xC1, "CMP", CMP, INX, 6, 2, 0)
+MOS6502_OPCODE(0xC2, "NOP", NOP, IMM, 2, 2, 0)
+MOS6502_ILLEGAL(0xC3)
+MOS6502_OPCODE(0xC4, "CPY", CPY, ZER, 3, 2, 0)
+MOS6502_OPCODE(0xC5, "CMP", CMP, ZER, 3, 2, 0)
+MOS6502_OPCODE(0xC6, "DEC", DEC, ZER, 5, 2, 0)
+MOS6502_ILLEGAL(0xC7)
+MOS6502_OPCODE(0xC8, "INY", INY, IMP, 2, 1, 0)
+MOS6502_OPCODE(0xC9, "CMP", CMP, IMM, 2, 2, 0)
+MOS6502_OPCODE(0xCA, "DEX", DEX, IMP, 2, 1, 0)
+MOS6502_ILLEGAL(0xCB)
+MOS6502_OPCODE(0xCC, "CPY", CPY, ABS, 4, 3, 0)
+MOS6502_OPCODE(0xCD, "CMP", CMP, ABS, 4, 3, 0)
+MOS6502_OPCODE(0xCE, "DEC", DEC, ABS, 6, 3, 0)
+MOS6502_ILLEGAL(0xCF)
+MOS6502_OPCODE(0xD0, "BNE", BNE, REL, 2, 2, 0)
+MOS6502_OPCODE(0xD1, "CMP", CMP, INY, 5, 2, 1)
+MOS6502_ILLEGAL(0xD2)
+MOS6502_ILLEGAL(0xD3)
+MOS6502_OPCODE(0xD4, "NOP", NOP, ZEX, 4, 2, 0)
+MOS6502_OPCODE(0xD5, "CMP", CMP, ZEX, 4, 2, 0)
+MOS6502_OPCODE(0xD6, "DEC", DEC, ZEX, 6, 2, 0)
+MOS6502_ILLEGAL(0xD7)
+MOS6502_OPCODE(0xD8, "CLD", CLD, IMP, 2, 1, 0)
+MOS6502_OPCODE(0xD9, "CMP", CMP, ABY, 4, 3, 1)
+MOS6502_OPCODE(0xDA, "NOP", NOP, IMP, 2, 1, 0)
+MOS6502_ILLEGAL(0xDB)
+MOS6502_OPCODE(0xDC, "NOP", NOP, ABX, 4, 3, 1)
+MOS6502_OPCODE(0xDD, "CMP", CMP, ABX, 4, 3, 1)
+MOS6502_OPCODE(0xDE, "DEC", DEC, ABX, 7, 3, 0)
+MOS6502_ILLEGAL(0xDF)
+MOS6502_OPCODE(0xE0, "CPX", CPX, IMM, 2, 2, 0)
+MOS6502_OPCODE(0xE1, "SBC", SBC, INX, 6, 2, 0)
+MOS6502_OPCODE(0xE2, "NOP", NOP, IMM, 2, 2, 0)
+MOS6502_ILLEGAL(0xE3)
+MOS6502_OPCODE(0xE4, "CPX", CPX, ZER, 3, 2, 0)
+MOS6502_OPCODE(0xE5, "SBC", SBC, ZER, 3, 2, 0)
+MOS6502_OPCODE(0xE6, "INC", INC, ZER, 5, 2, 0)
+MOS6502_ILLEGAL(0xE7)
+MOS6502_OPCODE(0xE8, "INX", INX, IMP, 2, 1, 0)
+MOS6502_OPCODE(0xE9, "SBC", SBC, IMM, 2, 2, 0)
+MOS6502_OPCODE(0xEA, "NOP", NOP, IMP, 2, 1, 0)
+MOS6502_ILLEGAL(0xEB)
+MOS6502_OPCODE(0xEC, "CPX", CPX, ABS, 4, 3, 0)
+MOS6502_OPCODE(0xED, "SBC", SBC, ABS, 4, 3, 0)
+MOS6502_OPCODE(0xEE, "INC", INC, ABS, 6, 3, 0)
+MOS6502_ILLEGAL(0xEF)
+MOS6502_OPCODE(0xF0, "BEQ", BEQ, REL, 2, 2, 0)
+MOS6502_OPCODE(0xF1, "SBC", SBC, INY, 5, 2, 1)
+MOS6502_ILLEGAL(0xF2)
+MOS6502_ILLEGAL(0xF3)
+MOS6502_OPCODE(0xF4, "NOP", NOP, ZEX, 4, 2, 0)
+MOS6502_OPCODE(0xF5, "SBC", SBC, ZEX, 4, 2, 0)
+MOS6502_OPCODE(0xF6, "INC", INC, ZEX, 6, 2, 0)
+MOS6502_ILLEGAL(0xF7)
+MOS6502_OPCODE(0xF8, "SED", SED, IMP, 2, 1, 0)
+MOS6502_OPCODE(0xF9, "SBC", SBC, ABY, 4, 3, 1)
+MOS6502_OPCODE(0xFA, "NOP", NOP, IMP, 2, 1, 0)
+MOS6502_ILLEGAL(0xFB)
+MOS6502_OPCODE(0xFC, "NOP", NOP, ABX, 4, 3, 1)
+MOS6502_OPCODE(0xFD, "SBC", SBC, ABX, 4, 3, 1)
+MOS6502_OPCODE(0xFE, "INC", INC, ABX, 7, 3, 0)
+MOS6502_ILLEGAL(0xFF)
@@ -0,0 +1,169 @@
+#ifndef mos6502_replay_H
+#define mos6502_replay_H
+
+#include "mos6502.h"
+
+#define REPLAY_VERSION 1
+
+/**
+ * @brief The kinds of external input a CPU takes.
+ */
+enum replay_input : uint8_t
+{
+    REPLAY_READ = 0,       ///< A byte the program read from an I/O page
+    REPLAY_IRQ_LINE = 1,   ///< setIRQLine() or a scheduled IRQ line change
+    REPLAY_NMI_LINE = 2,   ///< setNMILine() or a scheduled NMI line change
+    REPLAY_IRQ = 3,        ///< IRQ()
+    REPLAY_NMI = 4,        ///< NMI()
+    REPLAY_RESET = 5,      ///< reset()
+    REPLAY_PC = 6,         ///< setPC()
+    REPLAY_REGISTER = 7,   ///< setAC(), setXR(), setYR(), setSP() or setSR()
+    REPLAY_FLAG = 8,       ///< setFlag()
+    REPLAY_WRITE = 9,      ///< writeByte() from the host or a device
+    REPLAY_TRAP = 10,      ///< run() stopped on an instruction landing on itself
+    REPLAY_HOST_READ = 11, ///< A byte the host read from an I/O page with readByte(), skipped by a replay
+};
+
+/**
+ * @brief One external input to a CPU.
+ *
+ * @param cycle The cycle count when the input arrived.
+ * @param kind The replay_input.
+ * @param index The IRQ source, the mos6502::break_register or the flag bit.
+ * @param address The address read or written, or the new PC.
+ * @param value The byte read or written, the new register value or the new state of a line or flag.
+ */
+struct ReplayEntry
+{
+    uint64_t cycle;
+    uint8_t kind;
+    uint8_t index;
+    uint16_t address;
+    uint8_t value;
+};
+
+/**
+ * @brief Append-only log of the external inputs of a CPU, to run it again bit for bit.
+ *
+ * Attach it with mos6502::setRecorder() and every input that does not come
+ * from the program itself is appended with its cycle count: the bytes read
+ * from I/O pages, interrupt line changes and IRQ()/NMI()/reset() calls, and
+ * the registers and memory the host or a device callback sets. Entries are
+ * a kind byte, the cycles since the previous entry as a variable-length
+ * number and at most three bytes of payload, so a device read costs a few
+ * bytes where a trace record costs 16 for every instruction.
+ *
+ * Attach it to a copy of the CPU taken when recording started with
+ * mos6502::setReplay() and run it: the inputs are fed back on the same
+ * cycles, I/O reads return the recorded bytes without calling the
+ * handlers, I/O writes are dropped and the events the copy had scheduled
+ * are dropped too, as their effects are in the log. The copy then goes
+ * through exactly the same states as the recorded CPU.
+ */
+class ReplayLog
+{
+private:
+    std::vector<uint8_t> data;
+    uint64_t count;
+
+    // Cycle of the last entry appended, entries store the cycles since the one before
+    uint64_t lastCycle;
+
+    // Where the replay is: the next entry, the cycle of the one before and the entries replayed
+    size_t position;
+    uint64_t positionCycle;
+    uint64_t replayed;
+    bool diverged;
+
+    // The entry at position once decoded, and where the one after it starts
+    bool peeked;
+    ReplayEntry next;
+    size_t nextPosition;
+
+public:
+    /**
+     * @brief Create an empty log.
+     */
+    ReplayLog();
+
+    /**
+     * @brief Append an input. Cycles must not go backwards.
+     *
+     * @param entry The input.
+     */
+    void append(const ReplayEntry &entry);
+
+    /**
+     * @brief Get the next input to replay without consuming it.
+     *
+     * @param entry Set to the input.
+     * @return false once every input was replayed.
+     */
+    bool peek(ReplayEntry &entry);
+
+    /**
+     * @brief Consume the input peek() returned.
+     */
+    void skip();
+
+    /**
+     * @brief Go back to the first input and forget a divergence.
+     */
+    void rewind();
+
+    /**
+     * @brief Mark the replay as no longer following the log.
+     */
+    void setDiverged();
+
+    /**
+     * @brief Check whether the replayed CPU did something the recorded one did not.
+     *
+     * @return true once an input could not be matched, nothing is replayed after that.
+     */
+    bool getDiverged();
+
+    /**
+     * @brief Forget every input.
+     */
+    void clear();
+
+    /**
+     * @brief Get the number of inputs in the log.
+     *
+     * @return The number of inputs.
+     */
+    uint64_t getCount();
+
+    /**
+     * @brief Get the number of inputs replayed since the last rewind().
+     *
+     * @return The number of inputs.
+     */
+    uint64_t getReplayed();
+
+    /**
+     * @brief Get the size of the encoded inputs.
+     *
+     * @return The size in bytes.
+     */
+    size_t getSize();
+
+    /**
+     * @brief Save the log to a binary file.
+     *
+     * @param path The path of the file.
+     * @return true if the file was written.
+     */
+    bool save(const std::string &path);
+
+    /**
+     * @brief Replace the log with the inputs of a binary file.
+     *
+     * @param path The path of the file.
+     * @return true if the file was read.
+     */
+    bool load(const std::string &path);
+};
+
+#endif
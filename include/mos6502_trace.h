@@ -0,0 +1,138 @@
+#ifndef mos6502_trace_H
+#define mos6502_trace_H
+
+#include "mos6502.h"
+
+#include <atomic>
+
+#define TRACE_VERSION 1
+
+/**
+ * @brief One executed instruction, 16 bytes.
+ *
+ * @param cycles The low 32 bits of the cycle count when the instruction started.
+ * @param PC The address of the opcode.
+ * @param address The effective address computed by the addressing mode.
+ * @param opcode The opcode.
+ * @param operands The operand bytes, unused ones are 0.
+ * @param AC The accumulator after the instruction.
+ * @param XR The X register after the instruction.
+ * @param YR The Y register after the instruction.
+ * @param SP The stack pointer after the instruction.
+ * @param SR The status register after the instruction.
+ */
+struct TraceRecord
+{
+    uint32_t cycles;
+    uint16_t PC;
+    uint16_t address;
+    uint8_t opcode;
+    uint8_t operands[2];
+    uint8_t AC;
+    uint8_t XR;
+    uint8_t YR;
+    uint8_t SP;
+    uint8_t SR;
+};
+
+/**
+ * @brief Fixed-size ring buffer of the last executed instructions.
+ *
+ * Attach it to one CPU with mos6502::setTrace(). The CPU is the only writer and
+ * never takes a lock, recording is a 16-byte store and a counter increment.
+ * Any thread may take a copy of the newest records at any time, for example
+ * from a crash handler or when a breakpoint is hit, while the CPU keeps running.
+ */
+class TraceBuffer
+{
+private:
+    std::vector<TraceRecord> records;
+    size_t mask;
+
+    // Number of records ever committed, the next one goes to records[head & mask]
+    std::atomic<uint64_t> head;
+
+public:
+    /**
+     * @brief Create a trace buffer.
+     *
+     * @param capacity The number of records to keep, rounded up to a power of two.
+     */
+    TraceBuffer(size_t capacity);
+
+    /**
+     * @brief Get the slot the next record is written to.
+     *
+     * @return The slot, only visible to readers once committed.
+     */
+    TraceRecord &next()
+    {
+        return records[head.load(std::memory_order_relaxed) & mask];
+    }
+
+    /**
+     * @brief Publish the record written to next().
+     */
+    void commit()
+    {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /**
+     * @brief Get the number of records the buffer holds.
+     *
+     * @return The capacity.
+     */
+    size_t getCapacity();
+
+    /**
+     * @brief Get the number of records written since construction or clear().
+     *
+     * @return The number of records, older ones than the capacity are gone.
+     */
+    uint64_t getCount();
+
+    /**
+     * @brief Forget every record. Only call while the CPU is not running.
+     */
+    void clear();
+
+    /**
+     * @brief Copy the newest records, oldest first.
+     *
+     * Safe to call while the CPU is recording, records overwritten during
+     * the copy are dropped from the front of the result.
+     *
+     * @param out Receives the records.
+     * @param count The maximum number of records to copy.
+     */
+    void copyLast(std::vector<TraceRecord> &out, size_t count);
+
+    /**
+     * @brief Save the newest records to a binary trace file.
+     *
+     * @param path The path of the file.
+     * @param count The maximum number of records to save.
+     * @return true if the file was written.
+     */
+    bool save(const std::string &path, size_t count);
+
+    /**
+     * @brief Read the records of a binary trace file.
+     *
+     * @param path The path of the file.
+     * @param out Receives the records, oldest first.
+     * @return true if the file was read.
+     */
+    static bool load(const std::string &path, std::vector<TraceRecord> &out);
+
+    /**
+     * @brief Print records as disassembly with the registers after each instruction.
+     *
+     * @param out The stream to write to.
+     * @param records The records to print.
+     */
+    static void print(std::ostream &out, const std::vector<TraceRecord> &records);
+};
+
+#endif
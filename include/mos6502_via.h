@@ -0,0 +1,153 @@
+#ifndef mos6502_via_H
+#define mos6502_via_H
+
+#include "mos6502.h"
+
+/**
+ * @brief The timers and interrupt logic of a 6522 Versatile Interface Adapter.
+ *
+ * The 16 registers are mirrored over one I/O page. Timer 1 runs one-shot or
+ * free-running (ACR bit 6), timer 2 one-shot, both count down once per cycle
+ * and raise their interrupt flag when they pass zero. The counters are not
+ * ticked: they are computed from the cycle count when read, and the CPU's
+ * event scheduler calls the device back when a timer runs out.
+ *
+ * The ports, the shift register and the handshake lines are plain storage,
+ * inputs read as pulled high. Accesses are timed at the start of the
+ * instruction making them.
+ */
+class Via6522
+{
+private:
+    mos6502 &cpu;
+    uint8_t irqSource;
+
+    // The I/O page the registers are mapped into, if any
+    bool mapped;
+    uint8_t page;
+
+    // Port, data direction, shift and peripheral control registers, by register number
+    uint8_t registers[16];
+
+    uint8_t auxiliaryControl;
+    uint8_t interruptFlags;
+    uint8_t interruptEnable;
+
+    // Timer 1 counts down from timer1Count starting at timer1Start, reloading from timer1Latch when free-running
+    uint16_t timer1Latch;
+    uint16_t timer1Count;
+    uint64_t timer1Start;
+    uint64_t timer1Deadline;
+
+    // Timer 2 counts down from timer2Count starting at timer2Start, the latch only holds the low byte
+    uint8_t timer2LatchLow;
+    uint16_t timer2Count;
+    uint64_t timer2Start;
+    uint64_t timer2Deadline;
+
+    /**
+     * @brief Get the value of timer 1 at a cycle.
+     */
+    uint16_t timer1At(uint64_t cycle);
+
+    /**
+     * @brief Get the value of timer 2 at a cycle.
+     */
+    uint16_t timer2At(uint64_t cycle);
+
+    /**
+     * @brief Load timer 1 and schedule the cycle it runs out on.
+     *
+     * @param start The first cycle the counter holds count.
+     * @param count The value to count down from.
+     */
+    void startTimer1(uint64_t start, uint16_t count);
+
+    /**
+     * @brief Set or clear interrupt flags and drive the IRQ line to match.
+     */
+    void setFlags(uint8_t set, uint8_t clear);
+
+    static uint8_t readRegister(void *context, uint16_t address);
+    static void writeRegister(void *context, uint16_t address, uint8_t data);
+    static void timer1Expired(mos6502 &cpu, void *context, uint64_t cycle);
+    static void timer2Expired(mos6502 &cpu, void *context, uint64_t cycle);
+
+public:
+    /**
+     * @brief Interrupt flag and enable bits.
+     */
+    enum via_interrupt : uint8_t
+    {
+        VIA_CA2 = 0x01,
+        VIA_CA1 = 0x02,
+        VIA_SHIFT = 0x04,
+        VIA_CB2 = 0x08,
+        VIA_CB1 = 0x10,
+        VIA_TIMER2 = 0x20,
+        VIA_TIMER1 = 0x40,
+    };
+
+    /**
+     * @brief Create a VIA wired to a CPU, with no timer armed and interrupts disabled.
+     *
+     * @param cpu The CPU whose cycles clock the timers.
+     * @param irqSource The IRQ source the VIA drives, 0 to 31.
+     */
+    Via6522(mos6502 &cpu, uint8_t irqSource);
+
+    /**
+     * @brief Cancel the VIA's scheduled events, unmap it and release its IRQ source.
+     */
+    ~Via6522();
+
+    // The CPU holds pointers to the VIA, so it cannot be copied
+    Via6522(const Via6522 &) = delete;
+    Via6522 &operator=(const Via6522 &) = delete;
+
+    /**
+     * @brief Map the registers into an I/O page of the CPU.
+     *
+     * @param page The page, the registers repeat every 16 bytes.
+     */
+    void map(uint8_t page);
+
+    /**
+     * @brief Read a register as the CPU would.
+     *
+     * @param reg The register number, 0 to 15.
+     * @return The value read, with the side effects of the read.
+     */
+    uint8_t read(uint8_t reg);
+
+    /**
+     * @brief Write a register as the CPU would.
+     *
+     * @param reg The register number, 0 to 15.
+     * @param data The value to write.
+     */
+    void write(uint8_t reg, uint8_t data);
+
+    /**
+     * @brief Get the current value of timer 1 without side effects.
+     *
+     * @return The counter.
+     */
+    uint16_t getTimer1();
+
+    /**
+     * @brief Get the current value of timer 2 without side effects.
+     *
+     * @return The counter.
+     */
+    uint16_t getTimer2();
+
+    /**
+     * @brief Get the interrupt flag register without side effects.
+     *
+     * @return The flags, bit 7 is set while an enabled flag is set.
+     */
+    uint8_t getInterruptFlags();
+};
+
+#endif
@@ -1,986 +1,2526 @@
 #include "../include/mos6502.h"
+#include "../include/mos6502_trace.h"
+#include "../include/mos6502_replay.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MOS6502_HAVE_MMAP
+#endif
+
+// Addressing mode of every opcode for the disassembler, NULL for illegal opcodes
+static const char *const opcodeModes[256] = {
+#define MOS6502_OPCODE(opcode, alias, code, mode, cycles, bytes, pageCycles) #mode,
+#define MOS6502_ILLEGAL(opcode) NULL,
+#include "../include/mos6502_opcodes.h"
+#undef MOS6502_OPCODE
+#undef MOS6502_ILLEGAL
+};
+
+// Operations that only read memory and change registers and flags, so a loop of them can be skipped while idle
+enum
+{
+    IDLE_ADC = 1, IDLE_AND = 1, IDLE_ASL = 0, IDLE_ASL_ACC = 1, IDLE_BCC = 0, IDLE_BCS = 0,
+    IDLE_BEQ = 0, IDLE_BIT = 1, IDLE_BMI = 0, IDLE_BNE = 0, IDLE_BPL = 0, IDLE_BRK = 0,
+    IDLE_BVC = 0, IDLE_BVS = 0, IDLE_CLC = 1, IDLE_CLD = 1, IDLE_CLI = 0, IDLE_CLV = 1,
+    IDLE_CMP = 1, IDLE_CPX = 1, IDLE_CPY = 1, IDLE_DEC = 0, IDLE_DEX = 1, IDLE_DEY = 1,
+    IDLE_EOR = 1, IDLE_INC = 0, IDLE_INX = 1, IDLE_INY = 1, IDLE_JMP = 0, IDLE_JSR = 0,
+    IDLE_LDA = 1, IDLE_LDX = 1, IDLE_LDY = 1, IDLE_LSR = 0, IDLE_LSR_ACC = 1, IDLE_NOP = 1,
+    IDLE_ORA = 1, IDLE_PHA = 0, IDLE_PHP = 0, IDLE_PLA = 0, IDLE_PLP = 0, IDLE_ROL = 0,
+    IDLE_ROL_ACC = 1, IDLE_ROR = 0, IDLE_ROR_ACC = 1, IDLE_RTI = 0, IDLE_RTS = 0, IDLE_SBC = 1,
+    IDLE_SEC = 1, IDLE_SED = 1, IDLE_SEI = 0, IDLE_STA = 0, IDLE_STX = 0, IDLE_STY = 0,
+    IDLE_TAX = 1, IDLE_TAY = 1, IDLE_TSX = 0, IDLE_TXA = 1, IDLE_TXS = 0, IDLE_TYA = 1
+};
+
+// Whether each opcode may appear in an idle loop body, false for illegal opcodes
+static const bool idleOpcodes[256] = {
+#define MOS6502_OPCODE(opcode, alias, code, mode, cycles, bytes, pageCycles) IDLE_##code != 0,
+#define MOS6502_ILLEGAL(opcode) false,
+#include "../include/mos6502_opcodes.h"
+#undef MOS6502_OPCODE
+#undef MOS6502_ILLEGAL
+};
+
+// Opcode run() fuses after each opcode, -1 for none
+static constexpr int fusionPartner(int opcode)
+{
+    return
+#define MOS6502_FUSION(first, second) opcode == first ? second:
+#include "../include/mos6502_fusion.h"
+#undef MOS6502_FUSION
+        -1;
+}
 
 #pragma region Private functions
 
-// Addressing modes
-uint16_t mos6502::addressingACC()
+// Addressing modes of predecoded instructions, PC already points past the operand
+uint16_t mos6502::decodedACC(uint16_t operand)
 {
     return 0x00;
-};
-uint16_t mos6502::addressingIMM()
+}
+uint16_t mos6502::decodedIMM(uint16_t operand)
 {
-    return programCounter++;
-};
-uint16_t mos6502::addressingABS()
+    return programCounter - 1;
+}
+uint16_t mos6502::decodedABS(uint16_t operand)
 {
-    // Read low byte from memory
-    uint8_t lowByte = readByte(programCounter);
-    programCounter++;
-
-    // Read high byte from memory
-    uint8_t highByte = readByte(programCounter);
-    programCounter++;
+    return operand;
+}
+uint16_t mos6502::decodedZER(uint16_t operand)
+{
+    return operand;
+}
+uint16_t mos6502::decodedZEX(uint16_t operand)
+{
+    return (operand + xRegister) & 0xFF;
+}
+uint16_t mos6502::decodedZEY(uint16_t operand)
+{
+    return (operand + yRegister) & 0xFF;
+}
+uint16_t mos6502::decodedABX(uint16_t operand)
+{
+    uint16_t address = operand + xRegister;
 
-    // Combine bytes to form the address
-    uint16_t address = (highByte << 8) | lowByte;
+    pageCrossed = (operand ^ address) > 0xFF;
 
     return address;
 }
-uint16_t mos6502::addressingZER()
+uint16_t mos6502::decodedABY(uint16_t operand)
 {
-    uint16_t address = readByte(programCounter);
+    uint16_t address = operand + yRegister;
 
-    programCounter++;
+    pageCrossed = (operand ^ address) > 0xFF;
 
     return address;
-};
-uint16_t mos6502::addressingZEX()
+}
+uint16_t mos6502::decodedIMP(uint16_t operand)
 {
-    uint16_t baseAddress = readByte(programCounter);
-
-    programCounter++;
+    return 0;
+}
+uint16_t mos6502::decodedREL(uint16_t operand)
+{
+    return programCounter + static_cast<int8_t>(operand);
+}
+uint16_t mos6502::decodedINX(uint16_t operand)
+{
+    uint16_t baseAddress = (operand + xRegister) & 0xFF;
 
-    uint16_t address = (baseAddress + xRegister) & 0xFF;
+    uint8_t lowByte = bus.read(baseAddress);
+    uint8_t highByte = bus.read((baseAddress + 1) & 0xFF);
 
-    return address;
-};
-uint16_t mos6502::addressingZEY()
+    return (highByte << 8) | lowByte;
+}
+uint16_t mos6502::decodedINY(uint16_t operand)
 {
-    uint16_t baseAddress = readByte(programCounter);
+    uint8_t lowByte = bus.read(operand);
+    uint8_t highByte = bus.read((operand + 1) & 0xFF);
 
-    programCounter++;
+    uint16_t pointer = (highByte << 8) | lowByte;
+    uint16_t address = pointer + yRegister;
 
-    uint16_t address = (baseAddress + yRegister) & 0xFF;
+    pageCrossed = (pointer ^ address) > 0xFF;
 
     return address;
-};
-uint16_t mos6502::addressingABX()
+}
+uint16_t mos6502::decodedIND(uint16_t operand)
 {
-    uint16_t lowByte = readByte(programCounter);
-    programCounter++;
-
-    uint16_t highByte = readByte(programCounter);
-    programCounter++;
+    // No page wrap on the pointer, same as addressingIND()
+    uint16_t effL = bus.read(operand);
+    uint16_t effH = bus.read(operand + 1);
 
-    uint16_t address = (highByte << 8) | lowByte;
+    return effL + 0x100 * effH;
+}
 
-    address += xRegister;
+#pragma endregion
+#pragma region Public helper functons
 
-    return address;
-};
-uint16_t mos6502::addressingABY()
+// Constructor
+mos6502::mos6502()
 {
-    uint16_t lowByte = readByte(programCounter);
-    programCounter++;
-
-    uint16_t highByte = readByte(programCounter);
-    programCounter++;
+    bus.cpu = this;
 
-    uint16_t address = (highByte << 8) | lowByte;
+    stopRequested = false;
+    fusion = false;
+    idleSkip = true;
+    idle.branch = -1;
+    slowAccesses = 0;
+    idleCycles = 0;
+    engine = ENGINE_SWITCH;
+    trace = NULL;
+    recorder = NULL;
+    replayer = NULL;
+    replayScheduled = UINT64_MAX;
+    hostRead = false;
 
-    address += yRegister;
+    debugArmed = false;
+    watchHit = false;
+    watchWrite = false;
+    watchAddress = 0;
 
-    return address;
-};
-uint16_t mos6502::addressingIMP()
-{
-    return 0;
-};
-uint16_t mos6502::addressingREL()
-{
-    int8_t offset = readByte(programCounter);
+    eventSequence = 0;
+    nextEventCycle = UINT64_MAX;
+    irqLines = 0;
+    nmiLine = false;
+    nmiPending = false;
 
-    programCounter++;
+#ifdef MOS6502_PROFILE
+    profiling = false;
+#endif
 
-    uint16_t targetAddress = programCounter + offset;
+    // Memory starts out as nothing, RAM pages are allocated on their first write
 
-    return targetAddress;
+    // Map the whole address space to RAM
+    unmap(0x00, 256);
 };
-uint16_t mos6502::addressingINX()
+mos6502::mos6502(const mos6502 &other)
 {
-    uint16_t baseAddress = readByte(programCounter);
+    bus.cpu = this;
+
+    *this = other;
+}
+mos6502 &mos6502::operator=(const mos6502 &other)
+{
+    programCounter = other.programCounter;
+    stackPointer = other.stackPointer;
+    statusRegister = other.statusRegister;
+    carryFlag = other.carryFlag;
+    zeroResult = other.zeroResult;
+    negativeResult = other.negativeResult;
+    overflowResult = other.overflowResult;
+    accumulator = other.accumulator;
+    xRegister = other.xRegister;
+    yRegister = other.yRegister;
+
+    instructionCount = other.instructionCount;
+    cycleCount = other.cycleCount;
+    stopRequested = false;
+    pageCrossed = other.pageCrossed;
+    fusion = other.fusion;
+    idleSkip = other.idleSkip;
+    idle.branch = -1;
+    slowAccesses = other.slowAccesses;
+    idleCycles = other.idleCycles;
+    engine = other.engine;
+    trace = NULL;
+    recorder = NULL;
+    replayer = NULL;
+    replayScheduled = UINT64_MAX;
+    hostRead = false;
+
+    // The fork decodes its own blocks, dropped before the pages so none stay on the slow path
+    blockCache.reset();
+
+    // Copied before the pages so refreshPage() keeps watched pages on the slow path
+    debugger.reset(other.debugger ? new Debugger(*other.debugger) : NULL);
+    debugArmed = other.debugArmed;
+    watchHit = false;
+    watchWrite = other.watchWrite;
+    watchAddress = other.watchAddress;
+
+    events = other.events;
+    eventSequence = other.eventSequence;
+    nextEventCycle = other.nextEventCycle;
+    irqLines = other.irqLines;
+    nmiLine = other.nmiLine;
+    nmiPending = other.nmiPending;
+
+#ifdef MOS6502_PROFILE
+    profiling = false;
+    profile.reset();
+#endif
+
+    images = other.images;
+
+    // Share the RAM pages the original writes through the slow path, it writes the others in place
+    for (int page = 0; page < 256; page++)
+    {
+        if (other.pages[page].internal && other.bus.writePages[page])
+            ram[page] = std::make_shared<RamPage>(*other.ram[page]);
+        else
+            ram[page] = other.ram[page];
+        pages[page] = other.pages[page];
 
-    programCounter++;
+        refreshPage(page);
+    }
 
-    baseAddress += xRegister;
+    return *this;
+}
+mos6502 mos6502::fork()
+{
+    // Without a fast path entry every RAM page is shared, both sides copy it on their next write
+    for (int page = 0; page < 256; page++)
+    {
+        if (pages[page].internal)
+            bus.writePages[page] = NULL;
+    }
 
-    baseAddress &= 0xFF;
+    return *this;
+}
+bool mos6502::sharesDevices() const
+{
+    if (!events.empty())
+        return true;
 
-    uint8_t lowByte = readByte(baseAddress);
+    for (int page = 0; page < 256; page++)
+    {
+        if (pages[page].read || pages[page].write || (!pages[page].internal && pages[page].writable))
+            return true;
+    }
 
-    uint8_t highByte = readByte((baseAddress + 1) & 0xFF);
+    return false;
+}
 
-    uint16_t address = (highByte << 8) | lowByte;
+// Memory helper functions
 
-    return address;
-};
-uint16_t mos6502::addressingINY()
+uint8_t mos6502::readSlow(uint16_t address)
 {
-    uint16_t baseAddress = readByte(programCounter);
+    const Page &page = pages[address >> 8];
 
-    programCounter++;
+    slowAccesses++;
 
-    uint8_t lowByte = readByte(baseAddress);
+    if (debugArmed)
+        checkWatchpoint(address, false);
 
-    uint8_t highByte = readByte((baseAddress + 1) & 0xFF);
+    if (page.data)
+        return page.data[address & 0xFF];
 
-    uint16_t address = (highByte << 8) | lowByte;
+    // A replay takes what the devices returned from the log
+    if (replayer)
+        return replayRead(address);
 
-    address += yRegister;
+    // Nothing drives the data bus without a handler
+    uint8_t value = page.read ? page.read(page.context, address) : 0xFF;
 
-    return address;
-};
-uint16_t mos6502::addressingIND()
+    if (recorder)
+        recordInput(hostRead ? REPLAY_HOST_READ : REPLAY_READ, 0, address, value);
+
+    return value;
+}
+void mos6502::writeSlow(uint16_t address, uint8_t data)
 {
+    const Page &page = pages[address >> 8];
+
+    slowAccesses++;
+
+    if (debugArmed)
+        checkWatchpoint(address, true);
 
-    uint16_t addrL;
-    uint16_t addrH;
-    uint16_t effL;
-    uint16_t effH;
-    uint16_t abs;
-    uint16_t addr;
+    if (page.internal)
+        ownRamPage(address >> 8)[address & 0xFF] = data;
+    else if (page.data && page.writable)
+        page.data[address & 0xFF] = data;
+    else
+    {
+        // A replay leaves the devices alone and applies what their handlers did from the log
+        if (replayer)
+            replayInputs();
+        else if (page.write)
+            page.write(page.context, address, data);
+        return;
+    }
 
-    addrL = readByte(programCounter);
-    programCounter++;
-    addrH = readByte(programCounter);
-    programCounter++;
+    if (blockCache && (blockCache->codeBits[address >> 6] >> (address & 63)) & 1)
+        invalidateCode(address);
+}
+uint8_t mos6502::peekByte(uint16_t address)
+{
+    uint8_t *page = bus.readPages[address >> 8];
+    if (page)
+        return page[address & 0xFF];
 
-    abs = (addrH << 8) | addrL;
+    // Never calls an I/O read handler, those may have side effects
+    const Page &mapping = pages[address >> 8];
+    return mapping.data ? mapping.data[address & 0xFF] : 0xFF;
+}
 
-    effL = readByte(abs);
-    effH = readByte(abs + 1);
+// Bus mapping helper functions
 
-    addr = effL + 0x100 * effH;
+// All zero page read by RAM pages that have never been written
+static const uint8_t zeroPage[256] = {0};
 
-    return addr;
-};
-void mos6502::ADC(uint16_t address)
+void mos6502::refreshPage(uint8_t page)
 {
+    Page &mapping = pages[page];
 
-    // Get value and flags
-    uint8_t value = readByte(address);
-    bool carry = getFlag(CARRY_FLAG_BIT);
-    bool decimalMode = getFlag(DECIMAL_FLAG_BIT);
-
-    uint16_t result = accumulator + value + (carry ? 1 : 0);
+    if (mapping.internal)
+    {
+        mapping.data = ram[page] ? ram[page]->bytes : const_cast<uint8_t *>(zeroPage);
 
-    if (decimalMode)
+        // Shared or unallocated RAM pages are written through the slow path
+        bus.readPages[page] = mapping.data;
+        bus.writePages[page] = (ram[page] && ram[page].use_count() == 1) ? mapping.data : NULL;
+    }
+    else
     {
-        // Perform BCD mode adjustment
-        if (((accumulator & 0x0F) + (value & 0x0F) + (carry ? 1 : 0)) > 0x09)
-        {
-            result += 0x06; // Adjust for carry in the least significant nibble
-        }
-        if (result > 0x99)
-        {
-            result += 0x60; // Adjust for carry in the most significant digit
-        }
+        bus.readPages[page] = mapping.data;
+        bus.writePages[page] = mapping.writable ? mapping.data : NULL;
     }
 
-    // Update the flags
-    setFlag(CARRY_FLAG_BIT, result > 0xFF);
-    setFlag(ZERO_FLAG_BIT, !(result & 0xFF));
-    setFlag(OVERFLOW_FLAG_BIT, ~((accumulator ^ value) & 0x80) & ((accumulator ^ result) & 0x80));
-    setFlag(NEGATIVE_FLAG_BIT, result & 0x80);
+    // Pages with a watched address take the slow path, where every access is checked
+    if (debugger)
+    {
+        const uint64_t *readBits = debugger->readWatchBits + page * 4;
+        const uint64_t *writeBits = debugger->writeWatchBits + page * 4;
 
-    accumulator = result & 0xFF;
-};
-void mos6502::AND(uint16_t address)
-{
-    // Fetch the value from memory
-    uint8_t value = readByte(address);
+        if (readBits[0] | readBits[1] | readBits[2] | readBits[3])
+            bus.readPages[page] = NULL;
+        if (writeBits[0] | writeBits[1] | writeBits[2] | writeBits[3])
+            bus.writePages[page] = NULL;
+    }
 
-    // Perform the exclusive-OR operation
-    accumulator &= value;
+    // Pages holding cached code take the slow path, where writes to the code drop its blocks
+    if (blockCache)
+    {
+        const uint64_t *codeBits = blockCache->codeBits + page * 4;
 
-    // Update the zero flag
-    setFlag(ZERO_FLAG_BIT, !accumulator);
+        if (codeBits[0] | codeBits[1] | codeBits[2] | codeBits[3])
+            bus.writePages[page] = NULL;
+    }
+}
+uint8_t *mos6502::ownRamPage(uint8_t page)
+{
+    if (!ram[page] || ram[page].use_count() > 1)
+    {
+        std::shared_ptr<RamPage> copy = std::make_shared<RamPage>();
+        std::memcpy(copy->bytes, ramPage(page), 256);
+        ram[page] = copy;
+    }
 
-    // Update the negative flag
-    setFlag(NEGATIVE_FLAG_BIT,
-            accumulator & 0x80);
+    if (pages[page].internal)
+        refreshPage(page);
 
-    return;
-};
-void mos6502::ASL(uint16_t address)
+    return ram[page]->bytes;
+}
+const uint8_t *mos6502::ramPage(uint8_t page) const
 {
-    uint8_t value = readByte(address);
-    setFlag(CARRY_FLAG_BIT, value & 0x80);
-    value <<= 1;
-    value &= 0xFF;
+    return ram[page] ? ram[page]->bytes : zeroPage;
+}
+void mos6502::mapMemory(uint8_t firstPage, uint16_t pageCount, uint8_t *data, bool writable)
+{
+    for (uint16_t i = 0; i < pageCount && firstPage + i < 256; i++)
+    {
+        Page &page = pages[firstPage + i];
 
-    setFlag(ZERO_FLAG_BIT, !value);
-    setFlag(NEGATIVE_FLAG_BIT, value & 0x80);
+        page.data = data + i * 256;
+        page.writable = writable;
+        page.internal = false;
+        page.read = NULL;
+        page.write = NULL;
+        page.context = NULL;
 
-    writeByte(address, value);
-};
-void mos6502::ASL_ACC(uint16_t address)
+        invalidatePage(firstPage + i);
+        refreshPage(firstPage + i);
+    }
+}
+void mos6502::mapIO(uint8_t firstPage, uint16_t pageCount, ReadHandler read, WriteHandler write, void *context)
 {
+    for (uint16_t i = 0; i < pageCount && firstPage + i < 256; i++)
+    {
+        Page &page = pages[firstPage + i];
 
-    uint8_t value = accumulator;
+        page.data = NULL;
+        page.writable = false;
+        page.internal = false;
+        page.read = read;
+        page.write = write;
+        page.context = context;
 
-    setFlag(CARRY_FLAG_BIT, value & 0x80);
-    value <<= 1;
-    value &= 0xFF;
+        invalidatePage(firstPage + i);
+        refreshPage(firstPage + i);
+    }
+}
+void mos6502::unmap(uint8_t firstPage, uint16_t pageCount)
+{
+    for (uint16_t i = 0; i < pageCount && firstPage + i < 256; i++)
+    {
+        Page &page = pages[firstPage + i];
 
-    setFlag(ZERO_FLAG_BIT, !value);
-    setFlag(NEGATIVE_FLAG_BIT, value & 0x80);
+        page.writable = true;
+        page.internal = true;
+        page.read = NULL;
+        page.write = NULL;
+        page.context = NULL;
 
-    accumulator = value;
+        invalidatePage(firstPage + i);
+        refreshPage(firstPage + i);
+    }
+}
 
-    return;
-};
-void mos6502::BCC(uint16_t address)
+// Emulation helper functions
+void mos6502::loadMemory(const std::vector<uint8_t> &data)
 {
-    if (!getFlag(CARRY_FLAG_BIT))
+    if (data.size() > 65536)
     {
-
-        programCounter = address;
+        std::cerr << "Exceeding max load size of 65536";
+        return;
     }
 
-    return;
+    loadMemory(data.data(), data.size(), 0x0000);
 };
-void mos6502::BCS(uint16_t address)
+void mos6502::loadMemory(const uint8_t *data, size_t length, uint16_t base)
 {
-    if (getFlag(CARRY_FLAG_BIT))
+    if (base + length > 65536)
     {
-
-        programCounter = address;
+        std::cerr << "Exceeding max load size of 65536";
+        return;
     }
 
-    return;
-};
-void mos6502::BEQ(uint16_t address)
-{
-    if (getFlag(ZERO_FLAG_BIT))
+    // Copy page by page, unsharing each page once
+    for (size_t copied = 0; copied < length;)
     {
+        uint16_t address = base + copied;
+        size_t chunk = std::min(length - copied, static_cast<size_t>(256 - (address & 0xFF)));
 
-        programCounter = address;
+        invalidatePage(address >> 8);
+        std::memcpy(ownRamPage(address >> 8) + (address & 0xFF), data + copied, chunk);
+        copied += chunk;
     }
-
-    return;
 };
-void mos6502::BIT(uint16_t address)
+bool mos6502::mapROM(const uint8_t *data, size_t length, uint16_t base)
 {
+    if ((base & 0xFF) || base + length > 65536)
+    {
+        std::cerr << "Error: ROM images must start on a page boundary and fit in 65536 bytes." << std::endl;
+        return false;
+    }
 
-    uint8_t value = readByte(address);
+    uint8_t firstPage = base >> 8;
+    size_t wholePages = length / 256;
 
-    uint8_t result = accumulator & value;
+    // The bus never writes through a read-only page, so the const_cast is safe
+    mapMemory(firstPage, wholePages, const_cast<uint8_t *>(data), false);
 
-    setFlag(NEGATIVE_FLAG_BIT, value & (1 << 7));
-    setFlag(OVERFLOW_FLAG_BIT, value & (1 << 6));
+    // A partial last page would read past the end of the image, map a padded copy instead
+    size_t tail = length % 256;
+    if (tail)
+    {
+        uint8_t *copy = new uint8_t[256]();
+        std::memcpy(copy, data + wholePages * 256, tail);
+        images.push_back(std::shared_ptr<const uint8_t>(copy, std::default_delete<uint8_t[]>()));
 
-    setFlag(ZERO_FLAG_BIT, !result);
+        mapMemory(firstPage + wholePages, 1, copy, false);
+    }
 
-    return;
+    return true;
 };
-void mos6502::BMI(uint16_t address)
+bool mos6502::mapROMFile(const std::string &path, uint16_t base)
 {
-    if (getFlag(NEGATIVE_FLAG_BIT))
+#ifdef MOS6502_HAVE_MMAP
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
     {
+        std::cerr << "Error: Unable to open file " << path << " for reading." << std::endl;
+        return false;
+    }
 
-        programCounter = address;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0)
+    {
+        std::cerr << "Error: Unable to read the size of " << path << "." << std::endl;
+        close(fd);
+        return false;
     }
 
-    return;
-};
-void mos6502::BNE(uint16_t address)
-{
-    if (!getFlag(ZERO_FLAG_BIT))
+    size_t length = info.st_size;
+    void *mapping = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (mapping == MAP_FAILED)
     {
+        std::cerr << "Error: Unable to map file " << path << "." << std::endl;
+        return false;
+    }
+
+    // The mapping is rounded up to whole host pages, so a partial last 6502 page
+    // can be read directly and the tail copy in mapROM() is not needed
+    std::shared_ptr<const uint8_t> image(static_cast<const uint8_t *>(mapping), [length](const uint8_t *data)
+                                         { munmap(const_cast<uint8_t *>(data), length); });
 
-        programCounter = address;
+    if ((base & 0xFF) || base + length > 65536)
+    {
+        std::cerr << "Error: ROM images must start on a page boundary and fit in 65536 bytes." << std::endl;
+        return false;
     }
 
-    return;
-};
-void mos6502::BPL(uint16_t address)
-{
-    if (!getFlag(NEGATIVE_FLAG_BIT))
+    mapMemory(base >> 8, (length + 255) / 256, const_cast<uint8_t *>(image.get()), false);
+#else
+    std::ifstream file(path.c_str(), std::ios::binary);
+    if (!file)
     {
+        std::cerr << "Error: Unable to open file " << path << " for reading." << std::endl;
+        return false;
+    }
 
-        programCounter = address;
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    if (data.empty() || (base & 0xFF) || base + data.size() > 65536)
+    {
+        std::cerr << "Error: ROM images must start on a page boundary and fit in 65536 bytes." << std::endl;
+        return false;
     }
 
-    return;
-};
-void mos6502::BRK(uint16_t address)
-{
-    programCounter++;
-    pushStack((programCounter >> 8) & 0xFF);
-    pushStack(programCounter & 0xFF);
-    pushStack(statusRegister | (1 << static_cast<uint8_t>(BREAK_FLAG_BIT)) | (1 << static_cast<uint8_t>(UNUSED_FLAG_BIT)));
-    setFlag(INTDISABLE_FLAG_BIT, 1);
+    // Without mmap keep a page rounded copy of the file alive for the mapping
+    size_t length = data.size();
+    data.resize((length + 255) & ~static_cast<size_t>(255), 0);
 
-    programCounter = (readByte(IRQ_VECTOR_H) << 8) + readByte(IRQ_VECTOR_L);
-    return;
+    uint8_t *copy = new uint8_t[data.size()];
+    std::memcpy(copy, data.data(), data.size());
+    std::shared_ptr<const uint8_t> image(copy, std::default_delete<uint8_t[]>());
+
+    mapMemory(base >> 8, data.size() / 256, copy, false);
+#endif
+
+    images.push_back(image);
+    return true;
 };
-void mos6502::BVC(uint16_t address)
+void mos6502::dumpMemory(std::string localDir)
 {
-    if (!getFlag(OVERFLOW_FLAG_BIT))
+    std::ofstream dumpFile(localDir); // Open the file for writing
+    if (!dumpFile.is_open())
     {
-
-        programCounter = address;
+        std::cerr << "Error: Unable to open file " << localDir << " for writing." << std::endl;
+        return;
     }
 
-    return;
-};
-void mos6502::BVS(uint16_t address)
-{
-    if (getFlag(OVERFLOW_FLAG_BIT))
+    // Format everything up front and hand the stream a single write
+    static const char hexDigits[] = "0123456789abcdef";
+    std::string text(65536 * 3 - 1, ' ');
+
+    for (size_t i = 0; i < 65536; i++)
     {
+        uint8_t byte = ramPage(i >> 8)[i & 0xFF];
 
-        programCounter = address;
+        text[i * 3] = hexDigits[byte >> 4];
+        text[i * 3 + 1] = hexDigits[byte & 0x0F];
     }
 
-    return;
-};
-void mos6502::CLC(uint16_t address)
-{
-    setFlag(CARRY_FLAG_BIT, 0);
+    dumpFile.write(text.data(), text.size());
+    dumpFile.close();
+}
 
-    return;
-};
-void mos6502::CLD(uint16_t address)
-{
-    setFlag(DECIMAL_FLAG_BIT, 0);
+// Snapshot helper functions
 
-    return;
-};
-void mos6502::CLI(uint16_t address)
+// Snapshot layout, all values little endian:
+//   "M6SN", version (2), flags (1), PC (2), SP, SR, AC, XR, YR (1 each),
+//   cycles (8), instructions (8), CRC-32 (4), then 256 pages of RAM.
+// The CRC-32 covers every other byte of the snapshot.
+// Uncompressed pages are 256 raw bytes. Compressed pages start with a tag:
+//   0 - the page is all zero
+//   1 - 256 raw bytes follow
+//   2 - (length - 1, value) runs follow until the page is filled
+enum snapshot_page_tag : uint8_t
 {
-    setFlag(INTDISABLE_FLAG_BIT, 0);
-
-    return;
+    SNAPSHOT_PAGE_ZERO = 0,
+    SNAPSHOT_PAGE_RAW = 1,
+    SNAPSHOT_PAGE_RLE = 2,
 };
-void mos6502::CLV(uint16_t address)
+
+static const uint8_t SNAPSHOT_FLAG_COMPRESSED = 0x01;
+static const size_t SNAPSHOT_CRC_OFFSET = 4 + 2 + 1 + 2 + 5 + 8 + 8;
+static const size_t SNAPSHOT_HEADER_SIZE = SNAPSHOT_CRC_OFFSET + 4;
+
+static void putLittleEndian(std::vector<uint8_t> &buffer, uint64_t value, int bytes)
 {
-    setFlag(OVERFLOW_FLAG_BIT, 0);
+    for (int i = 0; i < bytes; i++)
+        buffer.push_back((value >> (i * 8)) & 0xFF);
+}
 
-    return;
-};
-void mos6502::CMP(uint16_t address)
+static uint64_t getLittleEndian(const uint8_t *data, int bytes)
 {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++)
+        value |= static_cast<uint64_t>(data[i]) << (i * 8);
+    return value;
+}
 
-    uint8_t value = readByte(address);
-    uint16_t result = accumulator - value;
+// CRC-32 (IEEE 802.3) of a snapshot, leaving out its CRC field
+static uint32_t snapshotCrc(const uint8_t *data, size_t length)
+{
+    struct Table
+    {
+        uint32_t entries[256];
 
-    setFlag(CARRY_FLAG_BIT, accumulator >= value);
-    setFlag(ZERO_FLAG_BIT, accumulator == value);
-    setFlag(NEGATIVE_FLAG_BIT, (result & 0x80) != 0);
+        Table()
+        {
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t crc = i;
+                for (int bit = 0; bit < 8; bit++)
+                    crc = (crc >> 1) ^ (crc & 1 ? 0xEDB88320 : 0);
+                entries[i] = crc;
+            }
+        }
+    };
+    static const Table table;
 
-    return;
-};
-void mos6502::CPX(uint16_t address)
-{
-    uint8_t value = readByte(address);
-    uint16_t result = xRegister - value;
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < length; i++)
+    {
+        if (i >= SNAPSHOT_CRC_OFFSET && i < SNAPSHOT_HEADER_SIZE)
+            continue;
+        crc = (crc >> 8) ^ table.entries[(crc ^ data[i]) & 0xFF];
+    }
+    return ~crc;
+}
 
-    setFlag(CARRY_FLAG_BIT, xRegister >= value);
-    setFlag(ZERO_FLAG_BIT, xRegister == value);
-    setFlag(NEGATIVE_FLAG_BIT, (result & 0x80) != 0);
+void mos6502::saveSnapshot(std::vector<uint8_t> &buffer, bool compress)
+{
+    size_t start = buffer.size();
+    buffer.reserve(start + SNAPSHOT_HEADER_SIZE + (compress ? 256 : 65536));
+
+    buffer.push_back('M');
+    buffer.push_back('6');
+    buffer.push_back('S');
+    buffer.push_back('N');
+    putLittleEndian(buffer, SNAPSHOT_VERSION, 2);
+    buffer.push_back(compress ? SNAPSHOT_FLAG_COMPRESSED : 0);
+
+    putLittleEndian(buffer, programCounter, 2);
+    buffer.push_back(stackPointer);
+    buffer.push_back(getSR());
+    buffer.push_back(accumulator);
+    buffer.push_back(xRegister);
+    buffer.push_back(yRegister);
+    putLittleEndian(buffer, cycleCount, 8);
+    putLittleEndian(buffer, instructionCount, 8);
+    putLittleEndian(buffer, 0, 4);
+
+    if (!compress)
+    {
+        for (int page = 0; page < 256; page++)
+            buffer.insert(buffer.end(), ramPage(page), ramPage(page) + 256);
+    }
+    else
+    {
+        std::vector<uint8_t> runs;
+        for (int page = 0; page < 256; page++)
+        {
+            const uint8_t *data = ramPage(page);
+
+            // Encode the runs first, then keep whichever representation is smallest
+            runs.clear();
+            for (int i = 0; i < 256;)
+            {
+                int length = 1;
+                while (i + length < 256 && data[i + length] == data[i])
+                    length++;
+
+                runs.push_back(length - 1);
+                runs.push_back(data[i]);
+                i += length;
+            }
+
+            if (runs.size() == 2 && data[0] == 0)
+            {
+                buffer.push_back(SNAPSHOT_PAGE_ZERO);
+            }
+            else if (runs.size() < 256)
+            {
+                buffer.push_back(SNAPSHOT_PAGE_RLE);
+                buffer.insert(buffer.end(), runs.begin(), runs.end());
+            }
+            else
+            {
+                buffer.push_back(SNAPSHOT_PAGE_RAW);
+                buffer.insert(buffer.end(), data, data + 256);
+            }
+        }
+    }
 
-    return;
-};
-void mos6502::CPY(uint16_t address)
+    uint32_t crc = snapshotCrc(&buffer[start], buffer.size() - start);
+    for (int i = 0; i < 4; i++)
+        buffer[start + SNAPSHOT_CRC_OFFSET + i] = (crc >> (i * 8)) & 0xFF;
+}
+bool mos6502::saveSnapshot(const std::string &path, bool compress)
 {
-    uint8_t value = readByte(address);
-    uint16_t result = yRegister - value;
+    std::vector<uint8_t> buffer;
+    saveSnapshot(buffer, compress);
 
-    setFlag(CARRY_FLAG_BIT, yRegister >= value);
-    setFlag(ZERO_FLAG_BIT, yRegister == value);
-    setFlag(NEGATIVE_FLAG_BIT, (result & 0x80) != 0);
+    std::ofstream file(path.c_str(), std::ios::binary);
+    if (!file.is_open())
+    {
+        std::cerr << "Error: Unable to open file " << path << " for writing." << std::endl;
+        return false;
+    }
 
-    return;
-};
-void mos6502::DEC(uint16_t address)
-{
-    uint8_t value = readByte(address);
-    value = (value - 1) & 0xFF;
-    setFlag(ZERO_FLAG_BIT, !value);
-    setFlag(NEGATIVE_FLAG_BIT, value & 0x80);
-    writeByte(address, value);
-    return;
-};
-void mos6502::DEX(uint16_t address)
+    file.write(reinterpret_cast<const char *>(buffer.data()), buffer.size());
+    return file.good();
+}
+bool mos6502::loadSnapshot(const uint8_t *data, size_t length)
 {
-    xRegister--;
+    if (length < SNAPSHOT_HEADER_SIZE || std::memcmp(data, "M6SN", 4) != 0)
+    {
+        std::cerr << "Error: Not a snapshot." << std::endl;
+        return false;
+    }
+    if (getLittleEndian(data + 4, 2) != SNAPSHOT_VERSION)
+    {
+        std::cerr << "Error: Unsupported snapshot version " << getLittleEndian(data + 4, 2) << "." << std::endl;
+        return false;
+    }
 
-    setFlag(ZERO_FLAG_BIT, !xRegister);
-    setFlag(NEGATIVE_FLAG_BIT, xRegister & 0x80);
+    bool compressed = data[6] & SNAPSHOT_FLAG_COMPRESSED;
+    const uint8_t *end = data + length;
+    const uint8_t *cursor = data + SNAPSHOT_HEADER_SIZE;
 
-    return;
-};
-void mos6502::DEY(uint16_t address)
-{
-    yRegister--;
+    // Decode into a scratch image so a truncated snapshot leaves the CPU untouched
+    std::vector<uint8_t> image(65536, 0);
 
-    setFlag(ZERO_FLAG_BIT, !yRegister);
-    setFlag(NEGATIVE_FLAG_BIT, yRegister & 0x80);
-    return;
-};
-void mos6502::EOR(uint16_t address)
-{
+    if (!compressed)
+    {
+        if (static_cast<size_t>(end - cursor) < image.size())
+        {
+            std::cerr << "Error: Snapshot is truncated." << std::endl;
+            return false;
+        }
+        std::memcpy(&image[0], cursor, image.size());
+        cursor += image.size();
+    }
+    else
+    {
+        for (int page = 0; page < 256; page++)
+        {
+            uint8_t *target = &image[page * 256];
+
+            if (cursor >= end)
+            {
+                std::cerr << "Error: Snapshot is truncated." << std::endl;
+                return false;
+            }
+
+            uint8_t tag = *cursor++;
+            if (tag == SNAPSHOT_PAGE_ZERO)
+                continue;
+
+            if (tag == SNAPSHOT_PAGE_RAW && end - cursor >= 256)
+            {
+                std::memcpy(target, cursor, 256);
+                cursor += 256;
+                continue;
+            }
+
+            int filled = 0;
+            while (tag == SNAPSHOT_PAGE_RLE && filled < 256 && end - cursor >= 2)
+            {
+                int run = cursor[0] + 1;
+                if (filled + run > 256)
+                    break;
+
+                std::memset(target + filled, cursor[1], run);
+                filled += run;
+                cursor += 2;
+            }
+
+            if (filled != 256)
+            {
+                std::cerr << "Error: Snapshot page " << page << " is corrupt." << std::endl;
+                return false;
+            }
+        }
+    }
 
-    uint8_t value = readByte(address);
-    uint8_t solution = accumulator ^ value;
+    if (cursor != end)
+    {
+        std::cerr << "Error: Snapshot has " << (end - cursor) << " trailing bytes." << std::endl;
+        return false;
+    }
+    if (getLittleEndian(data + SNAPSHOT_CRC_OFFSET, 4) != snapshotCrc(data, length))
+    {
+        std::cerr << "Error: Snapshot checksum mismatch." << std::endl;
+        return false;
+    }
 
-    setFlag(ZERO_FLAG_BIT, !solution);
-    setFlag(NEGATIVE_FLAG_BIT, solution & 0x80);
+    programCounter = getLittleEndian(data + 7, 2);
+    stackPointer = data[9];
+    Core6502<PagedBus>::setSR(data[10]);
+    accumulator = data[11];
+    xRegister = data[12];
+    yRegister = data[13];
+    cycleCount = getLittleEndian(data + 14, 8);
+    instructionCount = getLittleEndian(data + 22, 8);
+
+    // All zero pages go back to being unallocated
+    for (int page = 0; page < 256; page++)
+    {
+        const uint8_t *source = &image[page * 256];
 
-    accumulator = solution;
+        invalidatePage(page);
 
-    return;
-};
-void mos6502::INC(uint16_t address)
-{
-    uint8_t value = readByte(address);
-    value++;
-    setFlag(ZERO_FLAG_BIT, !value);
-    setFlag(NEGATIVE_FLAG_BIT, value & 0x80);
-    writeByte(address, value);
+        if (std::memcmp(source, zeroPage, 256) == 0)
+        {
+            ram[page].reset();
+            if (pages[page].internal)
+                refreshPage(page);
+        }
+        else
+        {
+            std::memcpy(ownRamPage(page), source, 256);
+        }
+    }
 
-    return;
-};
-void mos6502::INX(uint16_t address)
+    return true;
+}
+bool mos6502::loadSnapshot(const std::string &path)
 {
-    xRegister++;
-    setFlag(ZERO_FLAG_BIT, !xRegister);
-    setFlag(NEGATIVE_FLAG_BIT, xRegister & 0x80);
+    std::ifstream file(path.c_str(), std::ios::binary);
+    if (!file)
+    {
+        std::cerr << "Error: Unable to open file " << path << " for reading." << std::endl;
+        return false;
+    }
 
-    return;
-};
-void mos6502::INY(uint16_t address)
-{
-    yRegister++;
-    setFlag(ZERO_FLAG_BIT, !yRegister);
-    setFlag(NEGATIVE_FLAG_BIT, yRegister & 0x80);
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
 
-    return;
-};
-void mos6502::JMP(uint16_t address)
+    return loadSnapshot(data.data(), data.size());
+}
+uint64_t mos6502::digestMemory()
 {
-    programCounter = address;
+    // FNV-1a per page, folded together with the page number
+    static const uint64_t offsetBasis = 0xCBF29CE484222325ULL;
+    static const uint64_t prime = 0x100000001B3ULL;
 
-    return;
-};
-void mos6502::JSR(uint16_t address)
-{
-    programCounter--;
+    uint64_t digest = offsetBasis;
+    for (int page = 0; page < 256; page++)
+    {
+        const uint8_t *data = ramPage(page);
+
+        uint64_t hash = offsetBasis;
+        for (int i = 0; i < 256; i++)
+            hash = (hash ^ data[i]) * prime;
 
-    pushStack((programCounter >> 8) & 0xFF);
-    pushStack(programCounter & 0xFF);
+        digest = (digest ^ hash ^ page) * prime;
+    }
 
-    programCounter = address;
+    return digest;
+}
+// Block cache
 
-    return;
-};
-void mos6502::LDA(uint16_t address)
-{
-    accumulator = readByte(address);
-    setFlag(ZERO_FLAG_BIT, !accumulator);
-    setFlag(NEGATIVE_FLAG_BIT, accumulator & 0x80);
+// Decoded instructions kept before the cache is flushed and decoded again from scratch
+#define BLOCK_CACHE_LIMIT (1 << 18)
 
-    return;
-};
-void mos6502::LDX(uint16_t address)
-{
-    xRegister = readByte(address);
-    setFlag(ZERO_FLAG_BIT, !xRegister);
-    setFlag(NEGATIVE_FLAG_BIT, xRegister & 0x80);
+// Every legal opcode with its addressing mode and operation fused, called from run() through the decoded blocks
+#define MOS6502_OPCODE(opcode, alias, code, mode, cycles, bytes, pageCycles)     \
+    template <>                                                                  \
+    void mos6502::executeDecoded<opcode>(mos6502 & cpu, uint16_t operand)        \
+    {                                                                            \
+        cpu.code(cpu.decoded##mode(operand));                                    \
+    }
+#define MOS6502_ILLEGAL(opcode)
+#include "../include/mos6502_opcodes.h"
+#undef MOS6502_OPCODE
+#undef MOS6502_ILLEGAL
 
-    return;
+void (*const mos6502::DecodedHandlers[256])(mos6502 &cpu, uint16_t operand) = {
+#define MOS6502_OPCODE(opcode, alias, code, mode, cycles, bytes, pageCycles) &mos6502::executeDecoded<opcode>,
+#define MOS6502_ILLEGAL(opcode) NULL,
+#include "../include/mos6502_opcodes.h"
+#undef MOS6502_OPCODE
+#undef MOS6502_ILLEGAL
 };
-void mos6502::LDY(uint16_t address)
-{
-    yRegister = readByte(address);
-    setFlag(ZERO_FLAG_BIT, !yRegister);
-    setFlag(NEGATIVE_FLAG_BIT, yRegister & 0x80);
 
-    return;
-};
-void mos6502::LSR(uint16_t address)
+int32_t mos6502::decodeBlock(uint16_t address)
 {
-    uint8_t value = readByte(address);
+    BlockCache &cache = *blockCache;
 
-    setFlag(CARRY_FLAG_BIT, false);
-    setFlag(CARRY_FLAG_BIT, value & 0x01);
+    // Dropped blocks are only reclaimed here, never while one may be executing
+    if (cache.instructions.size() >= BLOCK_CACHE_LIMIT || cache.blocks.size() >= BLOCK_CACHE_LIMIT || cache.codeFull)
+        flushBlocks();
 
-    value >>= 1;
+    Block block;
+    block.start = address;
+    block.length = 0;
+    block.first = cache.instructions.size();
+    block.count = 0;
+    block.maxCycles = 0;
+    block.native = NULL;
 
-    setFlag(ZERO_FLAG_BIT, !value);
-    setFlag(NEGATIVE_FLAG_BIT, false);
-    writeByte(address, value);
+    uint32_t next = address;
+    for (;;)
+    {
+        // Only plain memory is decoded, code on I/O pages runs through the switch
+        const uint8_t *page = bus.readPages[next >> 8];
+        if (!page)
+            break;
+
+        uint8_t opcode = page[next & 0xFF];
+        const Instruction &instruction = Instructions[opcode];
+        if (!DecodedHandlers[opcode] || next + instruction.bytes > 0x10000)
+            break;
+
+        uint16_t operand = 0;
+        bool readable = true;
+        for (int i = instruction.bytes - 1; i > 0; i--)
+        {
+            const uint8_t *operandPage = bus.readPages[(next + i) >> 8];
+            if (!operandPage)
+                readable = false;
+            else
+                operand = (operand << 8) | operandPage[(next + i) & 0xFF];
+        }
+        if (!readable)
+            break;
+
+        DecodedInstruction decoded;
+        decoded.execute = DecodedHandlers[opcode];
+        decoded.operand = operand;
+        decoded.address = next;
+        decoded.next = next + instruction.bytes;
+        decoded.cycles = instruction.cycles;
+        decoded.pageCycles = instruction.pageCycles;
+        cache.instructions.push_back(decoded);
+        block.count++;
+        block.maxCycles += instruction.cycles + instruction.pageCycles;
+
+        next += instruction.bytes;
+
+        // Blocks end at every change of flow and at the end of the page they start on
+        bool branches = instruction.addr == &mos6502::addressingREL;
+        bool jumps = branches || opcode == 0x00 || opcode == 0x20 || opcode == 0x40 || opcode == 0x4C || opcode == 0x60 || opcode == 0x6C;
+        if (branches)
+            block.maxCycles += 2;
+        if (jumps || (next >> 8) != (address >> 8))
+            break;
+    }
 
-    return;
-};
-void mos6502::LSR_ACC(uint16_t address)
-{
+    if (!block.count)
+        return -1;
 
-    setFlag(CARRY_FLAG_BIT, accumulator & 0x01);
-    accumulator >>= 1;
-    setFlag(ZERO_FLAG_BIT, !accumulator);
-    setFlag(NEGATIVE_FLAG_BIT, false);
-};
-void mos6502::NOP(uint16_t address)
-{
-    return;
-};
-void mos6502::ORA(uint16_t address)
-{
-    // Fetch the value from memory
-    uint8_t value = readByte(address);
+    block.length = next - address;
 
-    // Perform the exclusive-OR operation
-    accumulator |= value;
+    if (engine == ENGINE_JIT)
+        block.native = translateBlock(block);
 
-    // Update the zero flag
-    setFlag(ZERO_FLAG_BIT, !accumulator);
+    int32_t index = cache.blocks.size();
+    cache.blocks.push_back(block);
+    cache.blockAt[address] = index;
 
-    // Update the negative flag
-    setFlag(NEGATIVE_FLAG_BIT, accumulator & 0x80);
+    for (uint32_t byte = address; byte < next; byte++)
+        cache.codeBits[byte >> 6] |= 1ULL << (byte & 63);
 
-    return;
-};
-void mos6502::PHA(uint16_t address)
-{
-    pushStack(accumulator);
-    return;
-};
-void mos6502::PHP(uint16_t address)
-{
-    // Push status register onto the stack with Break flag (bit 4) and bit 5 set to 1
-    pushStack(statusRegister | (1 << static_cast<uint8_t>(BREAK_FLAG_BIT)) | (1 << static_cast<uint8_t>(UNUSED_FLAG_BIT)));
+    // The last instruction may reach into the next page
+    uint8_t lastPage = (next - 1) >> 8;
+    cache.pageBlocks[address >> 8].push_back(index);
+    refreshPage(address >> 8);
+    if (lastPage != address >> 8)
+    {
+        cache.pageBlocks[lastPage].push_back(index);
+        refreshPage(lastPage);
+    }
 
-    return;
-};
-void mos6502::PLA(uint16_t address)
+    return index;
+}
+void mos6502::invalidateCode(uint16_t address)
 {
-    uint8_t value = popStack();
+    BlockCache &cache = *blockCache;
+    uint8_t page = address >> 8;
+
+    for (size_t i = 0; i < cache.pageBlocks[page].size(); i++)
+    {
+        uint32_t index = cache.pageBlocks[page][i];
+        const Block &block = cache.blocks[index];
 
-    accumulator = value;
-    setFlag(ZERO_FLAG_BIT, !accumulator);
-    setFlag(NEGATIVE_FLAG_BIT, accumulator & 0x80);
+        if (cache.blockAt[block.start] == static_cast<int32_t>(index) && static_cast<uint16_t>(address - block.start) < block.length)
+            cache.blockAt[block.start] = -1;
+    }
 
-    return;
-};
-void mos6502::PLP(uint16_t address)
-{
-    uint8_t value = popStack();
+    cache.invalidated = true;
 
-    // Ignore the break flag (bit 4) and bit 5
-    value &= ~(1 << static_cast<uint8_t>(BREAK_FLAG_BIT));
-    value &= ~(1 << static_cast<uint8_t>(UNUSED_FLAG_BIT));
-    statusRegister = value;
+    // Blocks reaching over a page boundary also have code bits on the neighbouring pages
+    rebuildCodeBits(page - 1);
+    rebuildCodeBits(page);
+    rebuildCodeBits(page + 1);
 }
-void mos6502::ROL(uint16_t address)
+void mos6502::invalidatePage(uint8_t page)
 {
-    uint16_t value = readByte(address);
+    if (!blockCache || blockCache->pageBlocks[page].empty())
+        return;
 
-    value <<= 1;
-    if (getFlag(CARRY_FLAG_BIT))
-        value |= 0x01;
-    setFlag(CARRY_FLAG_BIT, value > 0xFF);
-    value &= 0xFF;
-    setFlag(ZERO_FLAG_BIT, !value);
-    setFlag(NEGATIVE_FLAG_BIT, value & 0x80);
+    BlockCache &cache = *blockCache;
 
-    writeByte(address, value);
-};
-void mos6502::ROL_ACC(uint16_t address)
-{
-    uint16_t value;
-    value = accumulator << 1;
-    if (getFlag(CARRY_FLAG_BIT))
-        value |= 0x01;
-    setFlag(CARRY_FLAG_BIT, value > 0xFF);
-    value &= 0xFF;
-    setFlag(ZERO_FLAG_BIT, !value);
-    setFlag(NEGATIVE_FLAG_BIT, value & 0x80);
-
-    accumulator = value;
-};
-void mos6502::ROR(uint16_t address)
+    for (size_t i = 0; i < cache.pageBlocks[page].size(); i++)
+    {
+        uint32_t index = cache.pageBlocks[page][i];
+
+        if (cache.blockAt[cache.blocks[index].start] == static_cast<int32_t>(index))
+            cache.blockAt[cache.blocks[index].start] = -1;
+    }
+
+    cache.invalidated = true;
+
+    rebuildCodeBits(page - 1);
+    rebuildCodeBits(page);
+    rebuildCodeBits(page + 1);
+}
+void mos6502::rebuildCodeBits(uint8_t page)
 {
-    uint8_t value = readByte(address);
-    bool oldCarry = getFlag(CARRY_FLAG_BIT);
+    BlockCache &cache = *blockCache;
+    std::vector<uint32_t> &pageBlocks = cache.pageBlocks[page];
+    uint64_t *codeBits = cache.codeBits + page * 4;
 
-    setFlag(CARRY_FLAG_BIT, value & 0x01);
-    value = (value >> 1) | (oldCarry ? 0x80 : 0);
+    bool hadCode = codeBits[0] | codeBits[1] | codeBits[2] | codeBits[3];
+    codeBits[0] = codeBits[1] = codeBits[2] = codeBits[3] = 0;
 
-    setFlag(ZERO_FLAG_BIT, !value);
-    setFlag(NEGATIVE_FLAG_BIT, value & 0x80);
+    // Forget the dropped blocks while going through the live ones
+    size_t live = 0;
+    for (size_t i = 0; i < pageBlocks.size(); i++)
+    {
+        const Block &block = cache.blocks[pageBlocks[i]];
+        if (cache.blockAt[block.start] != static_cast<int32_t>(pageBlocks[i]))
+            continue;
 
-    writeByte(address, value);
+        pageBlocks[live++] = pageBlocks[i];
 
-    return;
-};
-void mos6502::ROR_ACC(uint16_t address)
+        uint32_t first = std::max<uint32_t>(block.start, page << 8);
+        uint32_t last = std::min<uint32_t>(block.start + block.length, (page + 1) << 8);
+        for (uint32_t byte = first; byte < last; byte++)
+            codeBits[(byte >> 6) & 3] |= 1ULL << (byte & 63);
+    }
+    pageBlocks.resize(live);
+
+    if (hadCode && !live)
+        refreshPage(page);
+}
+void mos6502::flushBlocks()
 {
-    bool oldCarry = getFlag(CARRY_FLAG_BIT);
+    if (!blockCache)
+        return;
 
-    setFlag(CARRY_FLAG_BIT, accumulator & 0x01);
+    BlockCache &cache = *blockCache;
 
-    accumulator = (accumulator >> 1) | (oldCarry ? 0x80 : 0x00);
+    for (int page = 0; page < 256; page++)
+    {
+        if (cache.pageBlocks[page].empty())
+            continue;
 
-    setFlag(ZERO_FLAG_BIT, !accumulator);
-    setFlag(NEGATIVE_FLAG_BIT, accumulator & 0x80);
+        cache.pageBlocks[page].clear();
+        std::fill(cache.codeBits + page * 4, cache.codeBits + page * 4 + 4, 0);
+        refreshPage(page);
+    }
 
-    return;
-};
-void mos6502::RTI(uint16_t address)
+    std::fill(cache.blockAt.begin(), cache.blockAt.end(), -1);
+    cache.blocks.clear();
+    cache.instructions.clear();
+    cache.invalidated = true;
+
+    // Native code still running returns without touching the buffer again
+    cache.codeUsed = 0;
+    cache.codeFull = false;
+}
+bool mos6502::trapped(uint16_t opcodeAddress)
 {
-    // Get old status
-    statusRegister = popStack();
-    statusRegister | (0 << static_cast<uint8_t>(BREAK_FLAG_BIT));
+    return programCounter == opcodeAddress && events.empty() && !nmiPending && !(irqLines && !getFlag(INTDISABLE_FLAG_BIT));
+}
+bool mos6502::idleBody(uint16_t head, uint16_t branchAddress)
+{
+    // Waiting loops are a few instructions long
+    if (branchAddress - head > 32)
+        return false;
 
-    // Get return address
-    uint8_t lowByte = popStack();
-    uint8_t highByte = popStack();
-    uint16_t returnAddress = (highByte << 8) | lowByte;
-    programCounter = returnAddress;
+    uint64_t starts = 0;
+    uint64_t targets = 0;
 
-    return;
-};
-void mos6502::RTS(uint16_t address)
-{
-    uint8_t lowByte = popStack();
-    uint8_t highByte = popStack();
+    uint32_t address = head;
+    for (;;)
+    {
+        const uint8_t *page = bus.readPages[address >> 8];
+        if (!page)
+            return false;
 
-    uint16_t returnAddress = (highByte << 8) | lowByte;
-    returnAddress++;
+        uint8_t opcode = page[address & 0xFF];
+        const Instruction &instruction = Instructions[opcode];
+        if (!DecodedHandlers[opcode])
+            return false;
 
-    programCounter = returnAddress;
+        starts |= 1ULL << (address - head);
 
-    return;
-};
-void mos6502::SBC(uint16_t address)
+        if (instruction.addr == &mos6502::addressingREL)
+        {
+            if (address == branchAddress)
+                break;
+
+            // Branches inside the loop may only skip forward to one of its instructions
+            const uint8_t *operandPage = bus.readPages[(address + 1) >> 8];
+            if (!operandPage)
+                return false;
+
+            uint16_t target = address + 2 + static_cast<int8_t>(operandPage[(address + 1) & 0xFF]);
+            if (target <= address || target > branchAddress)
+                return false;
+
+            targets |= 1ULL << (target - head);
+        }
+        else if (opcode == 0x4C && address == branchAddress)
+            break;
+        else if (!idleOpcodes[opcode])
+            return false;
+
+        address += instruction.bytes;
+        if (address > branchAddress)
+            return false;
+    }
+
+    return (targets & ~starts) == 0;
+}
+void mos6502::skipIdleLoop(uint16_t branchAddress, uint64_t endCycles)
+{
+    IdleLoop last = idle;
+
+    idle.branch = branchAddress;
+    idle.head = programCounter;
+    idle.registers[0] = accumulator;
+    idle.registers[1] = xRegister;
+    idle.registers[2] = yRegister;
+    idle.registers[3] = stackPointer;
+    idle.registers[4] = statusRegister;
+    idle.registers[5] = carryFlag;
+    idle.registers[6] = zeroResult;
+    idle.registers[7] = negativeResult;
+    idle.registers[8] = overflowResult;
+    idle.cycles = cycleCount;
+    idle.instructions = instructionCount;
+    idle.slowAccesses = slowAccesses;
+    idle.rejected = false;
+
+    // Another loop, or the first pass through this one
+    if (last.branch != branchAddress || last.head != programCounter)
+        return;
+
+    idle.rejected = last.rejected;
+    if (idle.rejected || last.slowAccesses != slowAccesses || memcmp(last.registers, idle.registers, sizeof(idle.registers)) != 0)
+        return;
+
+    // An interrupt is taken before the next instruction
+    if (nmiPending || (irqLines && !getFlag(INTDISABLE_FLAG_BIT)))
+        return;
+
+    if (!idleBody(programCounter, branchAddress))
+    {
+        idle.rejected = true;
+        return;
+    }
+
+    // The machine is back in the same state and nothing outside it changed, so every pass
+    // repeats this one. The next stop is seen at the first instruction boundary at or after limit.
+    uint64_t limit = endCycles;
+    if (!events.empty())
+        limit = std::min(limit, events.top().cycle + 1);
+    if (limit <= cycleCount)
+        return;
+
+    uint64_t passCycles = cycleCount - last.cycles;
+    uint64_t passes = (limit - cycleCount) / passCycles;
+
+    cycleCount += passes * passCycles;
+    instructionCount += passes * (instructionCount - last.instructions);
+    idleCycles += passes * passCycles;
+
+    idle.cycles = cycleCount;
+    idle.instructions = instructionCount;
+}
+
+uint8_t mos6502::step()
 {
-    uint8_t value = readByte(address);
-    uint16_t tmp = accumulator - value - (getFlag(CARRY_FLAG_BIT) ? 0 : 1);
-    setFlag(NEGATIVE_FLAG_BIT, tmp & 0x80);
-    setFlag(ZERO_FLAG_BIT, !(tmp & 0xFF));
-    setFlag(OVERFLOW_FLAG_BIT, ((accumulator ^ tmp) & 0x80) && ((accumulator ^ value) & 0x80));
+    // Interrupt lines are sampled between instructions
+    if (cycleCount >= nextEventCycle)
+        serviceEvents();
+
+    uint64_t startCycles = cycleCount;
+    uint16_t opcodeAddress = programCounter;
+
+    // Get opcode
+    uint8_t opcode = bus.read(programCounter++);
+
+    // Decode opcode
+    const Instruction &instruction = Instructions[opcode];
+
+    // Execute opcode
+    uint16_t address = (this->*instruction.addr)();
+    (this->*instruction.code)(address);
+
+    cycleCount += instruction.cycles;
+    if (instruction.pageCycles && pageCrossed)
+        cycleCount += instruction.pageCycles;
 
-    if (getFlag(DECIMAL_FLAG_BIT))
+    instructionCount++;
+
+    if (trace)
+        traceInstruction(opcodeAddress, opcode, address, startCycles);
+
+#ifdef MOS6502_PROFILE
+    if (profiling)
+        profileInstruction(opcodeAddress, opcode, cycleCount - startCycles);
+#endif
+
+    return cycleCount - startCycles;
+}
+
+// runLocal() bodies. They work on the fields of registers and commit PC from next only once they
+// succeed, so the switch can take over the instruction from any LOCAL_SLOW. They are all inlined into
+// runLocals(), where the registers can stay in host registers.
+#if defined(__GNUC__)
+#define LOCAL_INLINE inline __attribute__((always_inline))
+#elif defined(_MSC_VER)
+#define LOCAL_INLINE __forceinline
+#else
+#define LOCAL_INLINE inline
+#endif
+#define LOCAL_SLOW return false;
+
+// Addressing modes, declaring the operand address and, for immediates, where the operand is
+#define LOCAL_MODE_IMP (void)instruction;
+#define LOCAL_MODE_IMM                          \
+    uint16_t address = 0;                       \
+    const uint8_t *immediate = instruction + 1; \
+    (void)address;                              \
+    (void)immediate;
+#define LOCAL_MODE_ZER                 \
+    uint16_t address = instruction[1]; \
+    const uint8_t *immediate = NULL;   \
+    (void)address;                     \
+    (void)immediate;
+#define LOCAL_MODE_ZEX                                        \
+    uint16_t address = (instruction[1] + registers.x) & 0xFF; \
+    const uint8_t *immediate = NULL;                          \
+    (void)address;                                            \
+    (void)immediate;
+#define LOCAL_MODE_ZEY                                        \
+    uint16_t address = (instruction[1] + registers.y) & 0xFF; \
+    const uint8_t *immediate = NULL;                          \
+    (void)address;                                            \
+    (void)immediate;
+#define LOCAL_MODE_ABS                                         \
+    uint16_t address = instruction[1] | (instruction[2] << 8); \
+    const uint8_t *immediate = NULL;                           \
+    (void)address;                                             \
+    (void)immediate;
+#define LOCAL_MODE_ABX                                      \
+    uint16_t base = instruction[1] | (instruction[2] << 8); \
+    uint16_t address = base + registers.x;                  \
+    const uint8_t *immediate = NULL;                        \
+    (void)immediate;                                        \
+    crossed = (base ^ address) > 0xFF;
+#define LOCAL_MODE_ABY                                      \
+    uint16_t base = instruction[1] | (instruction[2] << 8); \
+    uint16_t address = base + registers.y;                  \
+    const uint8_t *immediate = NULL;                        \
+    (void)immediate;                                        \
+    crossed = (base ^ address) > 0xFF;
+#define LOCAL_MODE_REL uint16_t address = next + static_cast<int8_t>(instruction[1]);
+#define LOCAL_MODE_INX                                                           \
+    const uint8_t *zero = bus.readPages[0];                                      \
+    if (!zero)                                                                   \
+        LOCAL_SLOW                                                               \
+    uint8_t base = instruction[1] + registers.x;                                 \
+    uint16_t address = zero[base] | (zero[static_cast<uint8_t>(base + 1)] << 8); \
+    const uint8_t *immediate = NULL;                                             \
+    (void)address;                                                               \
+    (void)immediate;
+#define LOCAL_MODE_INY                                                                            \
+    const uint8_t *zero = bus.readPages[0];                                                       \
+    if (!zero)                                                                                    \
+        LOCAL_SLOW                                                                                \
+    uint16_t base = zero[instruction[1]] | (zero[static_cast<uint8_t>(instruction[1] + 1)] << 8); \
+    uint16_t address = base + registers.y;                                                        \
+    const uint8_t *immediate = NULL;                                                              \
+    (void)immediate;                                                                              \
+    crossed = (base ^ address) > 0xFF;
+#define LOCAL_MODE_IND    \
+    uint16_t address = 0; \
+    (void)instruction;    \
+    (void)address;        \
+    LOCAL_SLOW
+
+// Memory access, operands outside plain memory go back to the switch before anything changed
+#define LOCAL_READ(value)                                    \
+    uint8_t value;                                           \
+    if (immediate)                                           \
+        value = *immediate;                                  \
+    else                                                     \
+    {                                                        \
+        const uint8_t *source = bus.readPages[address >> 8]; \
+        if (!source)                                         \
+            LOCAL_SLOW                                       \
+        value = source[address & 0xFF];                      \
+    }
+#define LOCAL_WRITE(value)                              \
+    {                                                   \
+        uint8_t *target = bus.writePages[address >> 8]; \
+        if (!target)                                    \
+            LOCAL_SLOW                                  \
+        target[address & 0xFF] = (value);               \
+    }
+#define LOCAL_MODIFY(operation)                              \
+    {                                                        \
+        uint8_t *target = bus.writePages[address >> 8];      \
+        const uint8_t *source = bus.readPages[address >> 8]; \
+        if (!target || !source)                              \
+            LOCAL_SLOW                                       \
+        uint8_t value = source[address & 0xFF];              \
+        operation;                                           \
+        registers.z = registers.n = value;                   \
+        target[address & 0xFF] = value;                      \
+    }
+
+// A jump or branch landing on itself is left to the switch, which decides whether it is trapped
+#define LOCAL_JUMP(target)            \
+    {                                 \
+        if ((target) == registers.pc) \
+            LOCAL_SLOW                \
+        next = (target);              \
+    }
+#define LOCAL_BRANCH(condition)                               \
+    if (condition)                                            \
+    {                                                         \
+        if (address == registers.pc)                          \
+            LOCAL_SLOW                                        \
+        registers.clock += ((next ^ address) > 0xFF) ? 2 : 1; \
+        next = address;                                       \
+    }
+
+// Operations, whatever touches the interrupt flag stays in the switch
+#define LOCAL_ADD(value)                                                 \
+    {                                                                    \
+        uint16_t result = registers.a + (value) + registers.c;           \
+        registers.c = result >> 8;                                       \
+        registers.v = ~(registers.a ^ (value)) & (registers.a ^ result); \
+        registers.a = registers.z = registers.n = result & 0xFF;         \
+    }
+#define LOCAL_DECIMAL(table, value)                                                   \
+    {                                                                                 \
+        uint16_t entry = (table)[(registers.c << 16) | (registers.a << 8) | (value)]; \
+        registers.a = entry & 0xFF;                                                   \
+        registers.c = (entry >> 8) & 1;                                               \
+        registers.n = (entry & ALU_NEGATIVE) >> 2;                                    \
+        registers.v = (entry & ALU_OVERFLOW) >> 3;                                    \
+        registers.z = (~entry & ALU_ZERO) >> 11;                                      \
+    }
+#define LOCAL_ADC                                          \
+    {                                                      \
+        LOCAL_READ(value)                                  \
+        if (registers.status & 0x08)                       \
+            LOCAL_DECIMAL(DecimalTables::get().adc, value) \
+        else                                               \
+            LOCAL_ADD(value)                               \
+    }
+#define LOCAL_SBC                                          \
+    {                                                      \
+        LOCAL_READ(value)                                  \
+        if (registers.status & 0x08)                       \
+            LOCAL_DECIMAL(DecimalTables::get().sbc, value) \
+        else                                               \
+            LOCAL_ADD(static_cast<uint8_t>(value ^ 0xFF))  \
+    }
+#define LOCAL_LOGIC(operator)                                                 \
+    {                                                                         \
+        LOCAL_READ(value)                                                     \
+        registers.a = registers.z = registers.n = registers.a operator value; \
+    }
+#define LOCAL_LOAD(target)                                    \
+    {                                                         \
+        LOCAL_READ(value)                                     \
+        registers.target = registers.z = registers.n = value; \
+    }
+#define LOCAL_COMPARE(source)                                 \
+    {                                                         \
+        LOCAL_READ(value)                                     \
+        registers.c = registers.source >= value;              \
+        registers.z = registers.n = registers.source - value; \
+    }
+#define LOCAL_AND LOCAL_LOGIC(&)
+#define LOCAL_ORA LOCAL_LOGIC(|)
+#define LOCAL_EOR LOCAL_LOGIC(^)
+#define LOCAL_LDA LOCAL_LOAD(a)
+#define LOCAL_LDX LOCAL_LOAD(x)
+#define LOCAL_LDY LOCAL_LOAD(y)
+#define LOCAL_CMP LOCAL_COMPARE(a)
+#define LOCAL_CPX LOCAL_COMPARE(x)
+#define LOCAL_CPY LOCAL_COMPARE(y)
+#define LOCAL_BIT                          \
+    {                                      \
+        LOCAL_READ(value)                  \
+        registers.n = value;               \
+        registers.v = value << 1;          \
+        registers.z = registers.a & value; \
+    }
+#define LOCAL_STA LOCAL_WRITE(registers.a)
+#define LOCAL_STX LOCAL_WRITE(registers.x)
+#define LOCAL_STY LOCAL_WRITE(registers.y)
+#define LOCAL_ASL LOCAL_MODIFY(registers.c = value >> 7; value <<= 1)
+#define LOCAL_LSR LOCAL_MODIFY(registers.c = value & 0x01; value >>= 1)
+#define LOCAL_ROL LOCAL_MODIFY(uint8_t carry = registers.c; registers.c = value >> 7; value = (value << 1) | carry)
+#define LOCAL_ROR LOCAL_MODIFY(uint8_t carry = registers.c; registers.c = value & 0x01; value = (value >> 1) | (carry << 7))
+#define LOCAL_INC LOCAL_MODIFY(value++)
+#define LOCAL_DEC LOCAL_MODIFY(value--)
+#define LOCAL_SHIFT(carryOut, result)                     \
+    {                                                     \
+        uint8_t carry = registers.c;                      \
+        registers.c = carryOut;                           \
+        registers.a = registers.z = registers.n = result; \
+        (void)carry;                                      \
+    }
+#define LOCAL_ASL_ACC LOCAL_SHIFT(registers.a >> 7, registers.a << 1)
+#define LOCAL_LSR_ACC LOCAL_SHIFT(registers.a & 0x01, registers.a >> 1)
+#define LOCAL_ROL_ACC LOCAL_SHIFT(registers.a >> 7, (registers.a << 1) | carry)
+#define LOCAL_ROR_ACC LOCAL_SHIFT(registers.a & 0x01, (registers.a >> 1) | (carry << 7))
+#define LOCAL_TRANSFER(source, target) registers.target = registers.z = registers.n = registers.source;
+#define LOCAL_INX LOCAL_TRANSFER(x + 1, x)
+#define LOCAL_INY LOCAL_TRANSFER(y + 1, y)
+#define LOCAL_DEX LOCAL_TRANSFER(x - 1, x)
+#define LOCAL_DEY LOCAL_TRANSFER(y - 1, y)
+#define LOCAL_TAX LOCAL_TRANSFER(a, x)
+#define LOCAL_TAY LOCAL_TRANSFER(a, y)
+#define LOCAL_TXA LOCAL_TRANSFER(x, a)
+#define LOCAL_TYA LOCAL_TRANSFER(y, a)
+#define LOCAL_TSX LOCAL_TRANSFER(s, x)
+#define LOCAL_TXS registers.s = registers.x;
+#define LOCAL_CLC registers.c = 0;
+#define LOCAL_SEC registers.c = 1;
+#define LOCAL_CLV registers.v = 0;
+#define LOCAL_CLD registers.status &= ~0x08;
+#define LOCAL_SED registers.status |= 0x08;
+#define LOCAL_NOP
+#define LOCAL_BCC LOCAL_BRANCH(!registers.c)
+#define LOCAL_BCS LOCAL_BRANCH(registers.c)
+#define LOCAL_BNE LOCAL_BRANCH(registers.z)
+#define LOCAL_BEQ LOCAL_BRANCH(!registers.z)
+#define LOCAL_BPL LOCAL_BRANCH(!(registers.n & 0x80))
+#define LOCAL_BMI LOCAL_BRANCH(registers.n & 0x80)
+#define LOCAL_BVC LOCAL_BRANCH(!(registers.v & 0x80))
+#define LOCAL_BVS LOCAL_BRANCH(registers.v & 0x80)
+#define LOCAL_JMP LOCAL_JUMP(address)
+#define LOCAL_JSR                              \
+    {                                          \
+        uint8_t *stack = bus.writePages[1];    \
+        if (!stack || address == registers.pc) \
+            LOCAL_SLOW                         \
+        uint16_t back = next - 1;              \
+        stack[registers.s--] = back >> 8;      \
+        stack[registers.s--] = back & 0xFF;    \
+        next = address;                        \
+    }
+#define LOCAL_RTS                                                                    \
+    {                                                                                \
+        const uint8_t *stack = bus.readPages[1];                                     \
+        if (!stack)                                                                  \
+            LOCAL_SLOW                                                               \
+        uint16_t target = (stack[static_cast<uint8_t>(registers.s + 1)] |            \
+                           (stack[static_cast<uint8_t>(registers.s + 2)] << 8)) + 1; \
+        LOCAL_JUMP(target)                                                           \
+        registers.s += 2;                                                            \
+    }
+#define LOCAL_PHA                           \
+    {                                       \
+        uint8_t *stack = bus.writePages[1]; \
+        if (!stack)                         \
+            LOCAL_SLOW                      \
+        stack[registers.s--] = registers.a; \
+    }
+#define LOCAL_PLA                                                       \
+    {                                                                   \
+        const uint8_t *stack = bus.readPages[1];                        \
+        if (!stack)                                                     \
+            LOCAL_SLOW                                                  \
+        registers.a = registers.z = registers.n = stack[++registers.s]; \
+    }
+#define LOCAL_BRK LOCAL_SLOW
+#define LOCAL_CLI LOCAL_SLOW
+#define LOCAL_SEI LOCAL_SLOW
+#define LOCAL_PHP LOCAL_SLOW
+#define LOCAL_PLP LOCAL_SLOW
+#define LOCAL_RTI LOCAL_SLOW
+
+template <int opcode>
+LOCAL_INLINE bool mos6502::runLocal(LocalRegisters &, const uint8_t *)
+{
+    // Illegal opcodes, and the partner of opcodes that are not fused
+    return false;
+}
+
+#define MOS6502_OPCODE(opcode, alias, code, mode, cycles, bytes, pageCycles)                           \
+    template <>                                                                                        \
+    LOCAL_INLINE bool mos6502::runLocal<opcode>(LocalRegisters &registers, const uint8_t *instruction) \
+    {                                                                                                  \
+        uint16_t next = registers.pc + bytes;                                                          \
+        bool crossed = false;                                                                          \
+        LOCAL_MODE_##mode                                                                              \
+        LOCAL_##code                                                                                   \
+        registers.pc = next;                                                                           \
+        registers.clock += cycles;                                                                     \
+        if (pageCycles && crossed)                                                                     \
+            registers.clock += pageCycles;                                                             \
+        return true;                                                                                   \
+    }
+#define MOS6502_ILLEGAL(opcode)
+#include "../include/mos6502_opcodes.h"
+#undef MOS6502_OPCODE
+#undef MOS6502_ILLEGAL
+
+void mos6502::runLocals(uint64_t endCycles, bool fusing, bool idling)
+{
+    // Stores to RAM pages could alias the members, so the compiler only keeps these in registers as locals
+    LocalRegisters registers;
+    registers.pc = programCounter;
+    registers.a = accumulator;
+    registers.x = xRegister;
+    registers.y = yRegister;
+    registers.s = stackPointer;
+    registers.status = statusRegister;
+    registers.c = carryFlag;
+    registers.z = zeroResult;
+    registers.n = negativeResult;
+    registers.v = overflowResult;
+    registers.clock = cycleCount;
+    uint64_t count = instructionCount;
+
+    uint64_t limit = std::min(endCycles, nextEventCycle);
+
+#define MOS6502_STORE_LOCALS                 \
+    programCounter = registers.pc;           \
+    accumulator = registers.a;               \
+    xRegister = registers.x;                 \
+    yRegister = registers.y;                 \
+    stackPointer = registers.s;              \
+    statusRegister = registers.status;       \
+    carryFlag = registers.c;                 \
+    zeroResult = registers.z;                \
+    negativeResult = registers.n;            \
+    overflowResult = registers.v;            \
+    cycleCount = registers.clock;            \
+    instructionCount = count;
+
+    while (registers.clock < limit && !stopRequested)
     {
-        if (((accumulator & 0x0F) - (getFlag(CARRY_FLAG_BIT) ? 0 : 1)) < (value & 0x0F))
-            tmp -= 6;
-        if (tmp > 0x99)
+        // The whole instruction has to be in one plain memory page
+        const uint8_t *page = bus.readPages[registers.pc >> 8];
+        if (!page || (registers.pc & 0xFF) > 0xFD)
+            break;
+
+        uint16_t start = registers.pc;
+
+        // The second opcode of a pair runs in the case of the first, unless an event is due in between
+        // or it starts on another page. Both bodies are inlined, so the compiler works on them as one.
+        switch (page[start & 0xFF])
+        {
+#define MOS6502_OPCODE(opcode, alias, code, mode, cycles, bytes, pageCycles)                   \
+    case opcode:                                                                               \
+        if (!runLocal<opcode>(registers, page + (start & 0xFF)))                               \
+            goto slow;                                                                         \
+        if (fusionPartner(opcode) >= 0 && fusing && registers.clock < limit &&                 \
+            (registers.pc ^ start) < 0x100 && (registers.pc & 0xFF) <= 0xFD &&                 \
+            page[registers.pc & 0xFF] == fusionPartner(opcode))                                \
+        {                                                                                      \
+            count++;                                                                           \
+            start = registers.pc;                                                              \
+            if (!runLocal<fusionPartner(opcode) & 0xFF>(registers, page + (start & 0xFF)))     \
+                goto slow;                                                                     \
+        }                                                                                      \
+        break;
+#define MOS6502_ILLEGAL(opcode)
+#include "../include/mos6502_opcodes.h"
+#undef MOS6502_OPCODE
+#undef MOS6502_ILLEGAL
+        default:
+            goto slow;
+        }
+
+        count++;
+
+        // The same check run() makes after every backward jump or branch
+        if (idling && registers.pc <= start)
         {
-            tmp -= 0x60;
+            MOS6502_STORE_LOCALS
+            skipIdleLoop(start, endCycles);
+            registers.clock = cycleCount;
+            count = instructionCount;
         }
+        continue;
+
+    slow:
+        break;
     }
-    setFlag(CARRY_FLAG_BIT, tmp < 0x100);
-    accumulator = (tmp & 0xFF);
-    return;
-};
-void mos6502::SEC(uint16_t address)
-{
-    setFlag(CARRY_FLAG_BIT, 1);
 
-    return;
-};
-void mos6502::SED(uint16_t address)
+    MOS6502_STORE_LOCALS
+}
+mos6502::run_status mos6502::run(uint64_t maxCycles)
 {
-    setFlag(DECIMAL_FLAG_BIT, 1);
-
-    return;
-};
-void mos6502::SEI(uint16_t address)
+    return runUntil(NULL, NULL, maxCycles);
+}
+mos6502::run_status mos6502::runUntil(StopPredicate predicate, void *context, uint64_t maxCycles)
 {
-    setFlag(INTDISABLE_FLAG_BIT, 1);
+    stopRequested = false;
+    watchHit = false;
 
-    return;
-};
-void mos6502::STA(uint16_t address)
-{
-    writeByte(address, accumulator);
+    // The host may have changed anything since the last run
+    idle.branch = -1;
 
-    return;
-};
-void mos6502::STX(uint16_t address)
-{
-    writeByte(address, xRegister);
+    uint64_t endCycles = cycleCount + maxCycles;
 
-    return;
-};
-void mos6502::STY(uint16_t address)
-{
-    writeByte(address, yRegister);
+    // Opcode pairs are fused while nothing watches instruction boundaries, device
+    // callbacks may start watching so this is looked at again after each event
+    bool fusing = fusion && !predicate && !debugArmed && !trace && !MOS6502_PROFILING_ACTIVE;
 
-    return;
-};
-void mos6502::TAX(uint16_t address)
-{
-    xRegister = accumulator;
-    setFlag(ZERO_FLAG_BIT, !xRegister);
-    setFlag(NEGATIVE_FLAG_BIT, xRegister & 0x80);
+    // Cached blocks run under the same conditions, the switch takes over while anything watches
+    bool blocking = engine != ENGINE_SWITCH && !predicate && !debugArmed && !trace && !MOS6502_PROFILING_ACTIVE;
+    if (blocking && !blockCache)
+        blockCache.reset(new BlockCache);
 
-    return;
-};
-void mos6502::TAY(uint16_t address)
-{
-    yRegister = accumulator;
-    setFlag(ZERO_FLAG_BIT, !yRegister);
-    setFlag(NEGATIVE_FLAG_BIT, yRegister & 0x80);
+    // Idle loops are skipped while nothing could tell the passes were not run
+    bool idling = idleSkip && !predicate && !debugArmed && !trace && !MOS6502_PROFILING_ACTIVE;
 
-    return;
-};
-void mos6502::TSX(uint16_t address)
-{
-    xRegister = stackPointer;
-    setFlag(ZERO_FLAG_BIT, !xRegister);
-    setFlag(NEGATIVE_FLAG_BIT, xRegister & 0x80);
+    // The registers live in locals while nothing looks at them between instructions
+    bool localizing = !predicate && !debugArmed && !trace && !MOS6502_PROFILING_ACTIVE;
 
-    return;
-};
-void mos6502::TXA(uint16_t address)
-{
-    accumulator = xRegister;
-    setFlag(ZERO_FLAG_BIT, !accumulator);
-    setFlag(NEGATIVE_FLAG_BIT, accumulator & 0x80);
+    while (cycleCount < endCycles)
+    {
+        // One compare while no line is asserted and no event is due
+        if (cycleCount >= nextEventCycle)
+        {
+            uint16_t interruptedAddress = programCounter;
+            serviceEvents();
+            fusing = fusion && !predicate && !debugArmed && !trace && !MOS6502_PROFILING_ACTIVE;
+            blocking = engine != ENGINE_SWITCH && blockCache && !predicate && !debugArmed && !trace && !MOS6502_PROFILING_ACTIVE;
+            idling = idleSkip && !predicate && !debugArmed && !trace && !MOS6502_PROFILING_ACTIVE;
+            localizing = !predicate && !debugArmed && !trace && !MOS6502_PROFILING_ACTIVE;
+
+            // No instruction ends on the entry of an interrupt handler, so it is checked before its first one runs
+            if (debugArmed)
+            {
+                if (watchHit)
+                    return RUN_WATCHPOINT;
+
+                if (programCounter != interruptedAddress && (debugger->breakpointBits[programCounter >> 6] >> (programCounter & 63)) & 1 && hitBreakpoint(programCounter))
+                    return RUN_BREAKPOINT;
+            }
+        }
 
-    return;
-};
-void mos6502::TXS(uint16_t address)
-{
-    stackPointer = xRegister;
+        if (blocking)
+        {
+            BlockCache &cache = *blockCache;
+
+            int32_t index = cache.blockAt[programCounter];
+            if (index < 0)
+                index = decodeBlock(programCounter);
+
+            if (index >= 0)
+            {
+                const Block block = cache.blocks[index];
+                uint16_t lastAddress = programCounter;
+
+                // Native code does not look at the budget or events between instructions,
+                // it is only entered when the whole block fits before the next stop
+                uint64_t limit = std::min(endCycles, nextEventCycle);
+                cache.invalidated = false;
+
+                if (block.native && cycleCount + block.maxCycles < limit)
+                {
+                    cache.eventCycle = nextEventCycle;
+                    lastAddress = block.native(this, limit - block.maxCycles);
+                }
+                else
+                {
+                    // Stop early where the switch would look between instructions, or when the code changed
+                    for (uint32_t i = 0; i < block.count; i++)
+                    {
+                        const DecodedInstruction instruction = cache.instructions[block.first + i];
+
+                        lastAddress = instruction.address;
+                        programCounter = instruction.next;
+                        instruction.execute(*this, instruction.operand);
+
+                        cycleCount += instruction.cycles;
+                        if (instruction.pageCycles && pageCrossed)
+                            cycleCount += instruction.pageCycles;
+
+                        instructionCount++;
+
+                        if (cache.invalidated || stopRequested || cycleCount >= endCycles || cycleCount >= nextEventCycle)
+                            break;
+                    }
+                }
+
+                // Only the flow changes ending a block can land on themselves
+                if (trapped(lastAddress) && (!(recorder || replayer) || replayTrap()))
+                    return RUN_TRAPPED;
+
+                if (stopRequested)
+                    return RUN_STOP_REQUESTED;
+
+                if (idling && programCounter <= lastAddress)
+                    skipIdleLoop(lastAddress, endCycles);
+
+                continue;
+            }
+        }
 
-    return;
-};
-void mos6502::TYA(uint16_t address)
-{
-    accumulator = yRegister;
-    setFlag(ZERO_FLAG_BIT, !accumulator);
-    setFlag(NEGATIVE_FLAG_BIT, accumulator & 0x80);
+        // Only the instruction runLocals() stopped at goes through the switch. A masked IRQ
+        // line keeps the next event due, then every instruction goes through the switch.
+        if (localizing && cycleCount < nextEventCycle)
+        {
+            runLocals(endCycles, fusing, idling);
 
-    return;
-};
-void mos6502::ILLEGAL(uint16_t address) {};
+            if (stopRequested)
+                return RUN_STOP_REQUESTED;
 
-#pragma endregion
-#pragma region Public helper functons
+            if (cycleCount >= endCycles || cycleCount >= nextEventCycle)
+                continue;
+        }
 
-// Constructor
-mos6502::mos6502()
-{
-    programCounter = 0x0000;
-    stackPointer = 0xFF;
-    statusRegister = 0x36;
-    accumulator = 0x00;
-    xRegister = 0x00;
-    yRegister = 0x00;
+        uint16_t opcodeAddress = programCounter;
+        uint64_t startCycles = cycleCount;
+        uint16_t address;
 
-    // Initialize memory with nothing
-    Memory.resize(65536, 0);
-};
+        // Fetch and dispatch, every case has its addressing mode and operation fused
+        // so the compiler can inline both instead of calling through the table
+        uint8_t opcode = bus.read(programCounter++);
 
-// Register helper functions
+        switch (opcode)
+        {
+#define MOS6502_OPCODE(opcode, alias, code, mode, cycles, bytes, pageCycles) \
+    case opcode:                                                             \
+        address = addressing##mode();                                        \
+        code(address);                                                       \
+        cycleCount += cycles;                                                \
+        if (pageCycles && pageCrossed)                                       \
+            cycleCount += pageCycles;                                        \
+        break;
+#define MOS6502_ILLEGAL(opcode)
+#include "../include/mos6502_opcodes.h"
+#undef MOS6502_OPCODE
+#undef MOS6502_ILLEGAL
+        default:
+            // Leave illegal opcodes to the host, PC still points at them
+            programCounter = opcodeAddress;
+            return RUN_ILLEGAL_OPCODE;
+        }
 
-uint16_t mos6502::getPC()
-{
-    return programCounter;
-};
-void mos6502::setPC(uint16_t data)
+        instructionCount++;
+
+        if (trace)
+            traceInstruction(opcodeAddress, opcode, address, startCycles);
+
+#ifdef MOS6502_PROFILE
+        if (profiling)
+            profileInstruction(opcodeAddress, opcode, cycleCount - startCycles);
+#endif
+
+        // One predictable branch while no breakpoint or watchpoint is set
+        if (debugArmed)
+        {
+            if (watchHit)
+                return RUN_WATCHPOINT;
+
+            if ((debugger->breakpointBits[programCounter >> 6] >> (programCounter & 63)) & 1 && hitBreakpoint(programCounter))
+                return RUN_BREAKPOINT;
+        }
+
+        // An instruction that lands on itself will never make progress, unless an interrupt can still come
+        if (trapped(opcodeAddress) && (!(recorder || replayer) || replayTrap()))
+            return RUN_TRAPPED;
+
+        if (stopRequested || (predicate && predicate(*this, context)))
+            return RUN_STOP_REQUESTED;
+
+        if (idling && programCounter <= opcodeAddress)
+            skipIdleLoop(opcodeAddress, endCycles);
+    }
+
+    return RUN_BUDGET_EXHAUSTED;
+}
+void mos6502::requestStop()
 {
-    programCounter = data;
-};
-uint8_t mos6502::getSP()
+    stopRequested = true;
+}
+void mos6502::setFusion(bool enabled)
 {
-    return stackPointer;
-};
-void mos6502::setSP(uint8_t data)
+    fusion = enabled;
+}
+bool mos6502::getFusion()
 {
-    stackPointer = data;
-};
-uint8_t mos6502::getSR()
+    return fusion;
+}
+void mos6502::setIdleSkip(bool enabled)
 {
-    return statusRegister;
-};
-void mos6502::setSR(uint8_t data)
+    idleSkip = enabled;
+}
+bool mos6502::getIdleSkip()
 {
-    statusRegister = data;
-};
-uint8_t mos6502::getAC()
+    return idleSkip;
+}
+uint64_t mos6502::getIdleCycles()
 {
-    return accumulator;
-};
-void mos6502::setAC(uint8_t data)
+    return idleCycles;
+}
+void mos6502::setEngine(run_engine engine)
 {
-    accumulator = data;
-};
-uint8_t mos6502::getXR()
+    this->engine = engine;
+
+    flushBlocks();
+}
+mos6502::run_engine mos6502::getEngine()
 {
-    return xRegister;
-};
-void mos6502::setXR(uint8_t data)
+    return static_cast<run_engine>(engine);
+}
+
+// Interrupt line helper functions
+
+void mos6502::setIRQLine(uint8_t source, bool asserted)
 {
-    xRegister = data;
-};
-uint8_t mos6502::getYR()
+    if (source >= 32)
+    {
+        std::cerr << "Error: IRQ source " << static_cast<int>(source) << " is out of range." << std::endl;
+        return;
+    }
+
+    if (recorder)
+        recordInput(REPLAY_IRQ_LINE, source, 0, asserted);
+
+    if (asserted)
+        irqLines |= 1u << source;
+    else
+        irqLines &= ~(1u << source);
+
+    updateNextEvent();
+}
+void mos6502::setNMILine(bool asserted)
 {
-    return yRegister;
-};
-void mos6502::setYR(uint8_t data)
+    if (recorder)
+        recordInput(REPLAY_NMI_LINE, 0, 0, asserted);
+
+    // Only the rising edge triggers an NMI
+    if (asserted && !nmiLine)
+        nmiPending = true;
+
+    nmiLine = asserted;
+    updateNextEvent();
+}
+void mos6502::scheduleIRQLine(uint64_t cycle, uint8_t source, bool asserted)
 {
-    yRegister = data;
-};
+    if (source >= 32)
+    {
+        std::cerr << "Error: IRQ source " << static_cast<int>(source) << " is out of range." << std::endl;
+        return;
+    }
 
-// Flag helper functions
+    Event event = {cycle, eventSequence++, false, source, asserted, NULL, NULL};
+    events.push(event);
+    updateNextEvent();
+}
+void mos6502::scheduleNMILine(uint64_t cycle, bool asserted)
+{
+    Event event = {cycle, eventSequence++, true, 0, asserted, NULL, NULL};
+    events.push(event);
+    updateNextEvent();
+}
+bool mos6502::getIRQLine()
+{
+    return irqLines != 0;
+}
+void mos6502::scheduleEvent(uint64_t cycle, EventCallback callback, void *context)
+{
+    if (!callback)
+    {
+        std::cerr << "Error: Event callback is NULL." << std::endl;
+        return;
+    }
 
-void mos6502::setFlag(flag_bits flag, bool state)
+    Event event = {cycle, eventSequence++, false, 0, false, callback, context};
+    events.push(event);
+    updateNextEvent();
+}
+void mos6502::cancelEvents(void *context)
 {
-    if (state)
+    // The heap cannot be searched, rebuild it without the device's events
+    std::vector<Event> kept;
+    while (!events.empty())
     {
-        statusRegister |= (1 << static_cast<uint8_t>(flag));
+        if (!events.top().callback || events.top().context != context)
+            kept.push_back(events.top());
+        events.pop();
     }
+
+    for (size_t i = 0; i < kept.size(); i++)
+        events.push(kept[i]);
+
+    updateNextEvent();
+}
+void mos6502::updateNextEvent()
+{
+    // An asserted IRQ line is looked at after every instruction, as the program may enable interrupts at any time
+    if (nmiPending || irqLines)
+        nextEventCycle = 0;
+    else if (!events.empty())
+        nextEventCycle = events.top().cycle + 1;
     else
+        nextEventCycle = UINT64_MAX;
+}
+void mos6502::serviceEvents()
+{
+    // Lines are sampled in the last cycle of the instruction that just finished
+    while (!events.empty() && events.top().cycle < cycleCount)
+    {
+        Event event = events.top();
+        events.pop();
+
+        // Devices may change memory, an idle loop has to be seen again from scratch
+        idle.branch = -1;
+
+        // Callbacks record the lines they drive themselves
+        if (recorder && !event.callback)
+            recordInput(event.nmi ? REPLAY_NMI_LINE : REPLAY_IRQ_LINE, event.source, 0, event.asserted);
+
+        if (event.callback)
+            event.callback(*this, event.context, event.cycle);
+        else if (event.nmi)
+        {
+            if (event.asserted && !nmiLine)
+                nmiPending = true;
+            nmiLine = event.asserted;
+        }
+        else if (event.asserted)
+            irqLines |= 1u << event.source;
+        else
+            irqLines &= ~(1u << event.source);
+    }
+
+    // NMI takes priority over IRQ
+    if (nmiPending)
     {
-        statusRegister &= ~(1 << static_cast<uint8_t>(flag));
+        nmiPending = false;
+        interrupt(NMI_VECTOR_L, NMI_VECTOR_H);
+        idle.branch = -1;
     }
-};
-uint8_t mos6502::getFlag(flag_bits flag)
-{
-    switch (flag)
-    {
-    case flag_bits::CARRY_FLAG_BIT:
-        return (statusRegister >> static_cast<uint8_t>(flag)) & 0x01;
-    case flag_bits::ZERO_FLAG_BIT:
-        return (statusRegister >> static_cast<uint8_t>(flag)) & 0x01;
-    case flag_bits::INTDISABLE_FLAG_BIT:
-        return (statusRegister >> static_cast<uint8_t>(flag)) & 0x01;
-    case flag_bits::DECIMAL_FLAG_BIT:
-        return (statusRegister >> static_cast<uint8_t>(flag)) & 0x01;
-    case flag_bits::BREAK_FLAG_BIT:
-        return (statusRegister >> static_cast<uint8_t>(flag)) & 0x01;
-    case flag_bits::UNUSED_FLAG_BIT:
-        return (statusRegister >> static_cast<uint8_t>(flag)) & 0x01;
-    case flag_bits::OVERFLOW_FLAG_BIT:
-        return (statusRegister >> static_cast<uint8_t>(flag)) & 0x01;
-    case flag_bits::NEGATIVE_FLAG_BIT:
-        return (statusRegister >> static_cast<uint8_t>(flag)) & 0x01;
-    default:
-        return 0; // Default value if an invalid flag is provided
+    else if (irqLines && !getFlag(INTDISABLE_FLAG_BIT))
+    {
+        interrupt(IRQ_VECTOR_L, IRQ_VECTOR_H);
+        idle.branch = -1;
     }
-};
 
-// Memory helper functions
+    updateNextEvent();
+}
+
+#pragma endregion
+#pragma region Breakpoints
 
-uint8_t mos6502::readByte(uint16_t address)
+void mos6502::checkWatchpoint(uint16_t address, bool write)
 {
-    // Get data from memory
-    uint8_t byte = Memory[address];
-    // Return data from memory
-    return byte;
-};
-void mos6502::writeByte(uint16_t address, uint8_t byte)
+    const uint64_t *bits = write ? debugger->writeWatchBits : debugger->readWatchBits;
+
+    if ((bits[address >> 6] >> (address & 63)) & 1)
+    {
+        watchHit = true;
+        watchWrite = write;
+        watchAddress = address;
+    }
+}
+bool mos6502::hitBreakpoint(uint16_t address)
 {
-    // Write data to address
-    Memory[address] = byte;
+    std::map<uint16_t, std::vector<Breakpoint> >::const_iterator found = debugger->breakpoints.find(address);
+    if (found == debugger->breakpoints.end())
+        return false;
 
-    return;
-};
+    const std::vector<Breakpoint> &atAddress = found->second;
 
-// Stack helper functions
+    for (size_t i = 0; i < atAddress.size(); i++)
+    {
+        const Breakpoint &breakpoint = atAddress[i];
+        if (!breakpoint.conditional)
+            return true;
 
-void mos6502::pushStack(uint8_t byte)
+        uint8_t value;
+        switch (breakpoint.reg)
+        {
+        case BREAK_AC:
+            value = accumulator;
+            break;
+        case BREAK_XR:
+            value = xRegister;
+            break;
+        case BREAK_YR:
+            value = yRegister;
+            break;
+        case BREAK_SP:
+            value = stackPointer;
+            break;
+        default:
+            value = getSR();
+            break;
+        }
+
+        switch (breakpoint.compare)
+        {
+        case BREAK_EQUAL:
+            if (value == breakpoint.value)
+                return true;
+            break;
+        case BREAK_NOT_EQUAL:
+            if (value != breakpoint.value)
+                return true;
+            break;
+        case BREAK_LESS:
+            if (value < breakpoint.value)
+                return true;
+            break;
+        case BREAK_GREATER:
+            if (value > breakpoint.value)
+                return true;
+            break;
+        default:
+            if ((value & breakpoint.value) == breakpoint.value)
+                return true;
+            break;
+        }
+    }
+
+    return false;
+}
+void mos6502::updateDebugger()
+{
+    debugArmed = !debugger->breakpoints.empty();
+    for (int i = 0; i < 1024 && !debugArmed; i++)
+        debugArmed = debugger->readWatchBits[i] || debugger->writeWatchBits[i];
+}
+void mos6502::addBreakpoint(uint16_t address)
 {
-    Memory[0x0100 + stackPointer] = byte;
-    stackPointer = (stackPointer - 1) & 0xFF;
+    Breakpoint breakpoint = {false, 0, 0, 0};
+
+    if (!debugger)
+        debugger.reset(new Debugger());
 
-    return;
+    debugger->breakpoints[address].push_back(breakpoint);
+    debugger->breakpointBits[address >> 6] |= 1ULL << (address & 63);
+    debugArmed = true;
 }
-uint8_t mos6502::popStack()
+void mos6502::addBreakpoint(uint16_t address, break_register reg, break_compare compare, uint8_t value)
 {
-    stackPointer = (stackPointer + 1) & 0xFF;
-    return Memory[0x0100 + stackPointer];
+    Breakpoint breakpoint = {true, reg, compare, value};
+
+    if (!debugger)
+        debugger.reset(new Debugger());
+
+    debugger->breakpoints[address].push_back(breakpoint);
+    debugger->breakpointBits[address >> 6] |= 1ULL << (address & 63);
+    debugArmed = true;
 }
+void mos6502::removeBreakpoint(uint16_t address)
+{
+    if (!debugger)
+        return;
 
-// Emulation helper functions
-void mos6502::loadMemory(std::vector<uint8_t> data)
+    debugger->breakpoints.erase(address);
+    debugger->breakpointBits[address >> 6] &= ~(1ULL << (address & 63));
+    updateDebugger();
+}
+void mos6502::addWatchpoint(uint16_t first, uint16_t last, bool onRead, bool onWrite)
 {
-    if (data.size() > 65536)
+    if (first > last)
+        return;
+
+    if (!debugger)
+        debugger.reset(new Debugger());
+
+    for (uint32_t address = first; address <= last; address++)
     {
-        std::cerr << "Exceeding max load size of 65536";
+        if (onRead)
+            debugger->readWatchBits[address >> 6] |= 1ULL << (address & 63);
+        if (onWrite)
+            debugger->writeWatchBits[address >> 6] |= 1ULL << (address & 63);
+    }
+
+    updateDebugger();
+    for (int page = first >> 8; page <= last >> 8; page++)
+        refreshPage(page);
+}
+void mos6502::removeWatchpoint(uint16_t first, uint16_t last)
+{
+    if (!debugger || first > last)
         return;
+
+    for (uint32_t address = first; address <= last; address++)
+    {
+        debugger->readWatchBits[address >> 6] &= ~(1ULL << (address & 63));
+        debugger->writeWatchBits[address >> 6] &= ~(1ULL << (address & 63));
     }
-    Memory = data;
-};
-void mos6502::dumpMemory(std::string localDir)
+
+    updateDebugger();
+    for (int page = first >> 8; page <= last >> 8; page++)
+        refreshPage(page);
+}
+void mos6502::clearDebugger()
 {
-    std::ofstream dumpFile(localDir); // Open the file for writing
-    if (!dumpFile.is_open())
+    debugger.reset();
+    debugArmed = false;
+    watchHit = false;
+
+    for (int page = 0; page < 256; page++)
+        refreshPage(page);
+}
+bool mos6502::atBreakpoint()
+{
+    return debugger && hitBreakpoint(programCounter);
+}
+uint16_t mos6502::getWatchAddress()
+{
+    return watchAddress;
+}
+bool mos6502::getWatchWrite()
+{
+    return watchWrite;
+}
+
+#pragma endregion
+
+#pragma region Tracing
+
+void mos6502::setTrace(TraceBuffer *buffer)
+{
+    trace = buffer;
+}
+void mos6502::traceInstruction(uint16_t opcodeAddress, uint8_t opcode, uint16_t address, uint64_t startCycles)
+{
+    TraceRecord &record = trace->next();
+    uint8_t length = Instructions[opcode].bytes;
+
+    record.cycles = static_cast<uint32_t>(startCycles);
+    record.PC = opcodeAddress;
+    record.address = address;
+    record.opcode = opcode;
+    record.operands[0] = length > 1 ? peekByte(opcodeAddress + 1) : 0;
+    record.operands[1] = length > 2 ? peekByte(opcodeAddress + 2) : 0;
+    record.AC = accumulator;
+    record.XR = xRegister;
+    record.YR = yRegister;
+    record.SP = stackPointer;
+    record.SR = getSR();
+
+    trace->commit();
+}
+uint8_t mos6502::getInstructionLength(uint8_t opcode)
+{
+    return Instructions[opcode].bytes;
+}
+std::string mos6502::disassemble(uint16_t address, const uint8_t *bytes)
+{
+    const Instruction &instruction = Instructions[bytes[0]];
+    const char *mode = opcodeModes[bytes[0]];
+
+    std::ostringstream out;
+    out << std::hex << std::uppercase << std::setfill('0');
+
+    if (!mode)
     {
-        std::cerr << "Error: Unable to open file " << localDir << " for writing." << std::endl;
-        return;
+        out << ".BYTE $" << std::setw(2) << static_cast<int>(bytes[0]);
+        return out.str();
     }
 
-    for (size_t i = 0; i < Memory.size(); i++)
+    // Accumulator forms are separate methods named like ASL_ACC
+    std::string alias = instruction.alias;
+    if (alias.size() > 4 && alias.compare(alias.size() - 4, 4, "_ACC") == 0)
+        return alias.substr(0, alias.size() - 4) + " A";
+
+    out << alias;
+
+    uint16_t word = bytes[1] | (bytes[2] << 8);
+    std::string addressing = mode;
+
+    if (addressing == "IMM")
+        out << " #$" << std::setw(2) << static_cast<int>(bytes[1]);
+    else if (addressing == "ZER")
+        out << " $" << std::setw(2) << static_cast<int>(bytes[1]);
+    else if (addressing == "ZEX")
+        out << " $" << std::setw(2) << static_cast<int>(bytes[1]) << ",X";
+    else if (addressing == "ZEY")
+        out << " $" << std::setw(2) << static_cast<int>(bytes[1]) << ",Y";
+    else if (addressing == "ABS")
+        out << " $" << std::setw(4) << word;
+    else if (addressing == "ABX")
+        out << " $" << std::setw(4) << word << ",X";
+    else if (addressing == "ABY")
+        out << " $" << std::setw(4) << word << ",Y";
+    else if (addressing == "IND")
+        out << " ($" << std::setw(4) << word << ")";
+    else if (addressing == "INX")
+        out << " ($" << std::setw(2) << static_cast<int>(bytes[1]) << ",X)";
+    else if (addressing == "INY")
+        out << " ($" << std::setw(2) << static_cast<int>(bytes[1]) << "),Y";
+    else if (addressing == "REL")
+        out << " $" << std::setw(4) << static_cast<uint16_t>(address + 2 + static_cast<int8_t>(bytes[1]));
+
+    return out.str();
+}
+
+#pragma endregion
+
+#pragma region Profiler
+
+#ifdef MOS6502_PROFILE
+
+void mos6502::profileInstruction(uint16_t address, uint8_t opcode, uint64_t cycles)
+{
+    Profile &counters = *profile;
+
+    counters.instructions++;
+    counters.cycles += cycles;
+    counters.opcodeCounts[opcode]++;
+    counters.opcodeCycles[opcode] += cycles;
+    counters.addressCounts[address]++;
+    counters.addressCycles[address] += cycles;
+    counters.addressOpcodes[address] = opcode;
+
+    if (counters.previousOpcode >= 0)
+        counters.pairCounts[(counters.previousOpcode << 8) | opcode]++;
+    counters.previousOpcode = opcode;
+
+    // Charged to the subroutine the instruction ran in, an RTS still belongs to its subroutine
+    size_t node = counters.frames.empty() ? 0 : counters.frames.back().node;
+    counters.nodes[node].cycles += cycles;
+
+    if (opcode == 0x20)
     {
-        dumpFile << std::setw(2) << std::setfill('0') << std::hex << static_cast<int>(Memory[i]);
-        if (i < Memory.size() - 1) // If not the last byte, add a space
-            dumpFile << " ";
+        // Frames at or above the new return address were left without an RTS
+        profileReturn(stackPointer + 1);
+        node = counters.frames.empty() ? 0 : counters.frames.back().node;
+
+        std::map<uint16_t, size_t>::iterator child = counters.nodes[node].children.find(programCounter);
+        if (child == counters.nodes[node].children.end())
+        {
+            Profile::CallNode callee = {programCounter, node, 0, std::map<uint16_t, size_t>()};
+            counters.nodes.push_back(callee);
+            child = counters.nodes[node].children.insert(std::make_pair(programCounter, counters.nodes.size() - 1)).first;
+        }
+
+        Profile::CallFrame frame = {child->second, stackPointer, cycleCount, 0};
+        counters.frames.push_back(frame);
+        counters.calls[programCounter].calls++;
+    }
+    else if (opcode == 0x60)
+    {
+        profileReturn(stackPointer);
     }
-    dumpFile.close();
 }
-void mos6502::step()
+void mos6502::profileReturn(uint16_t limit)
 {
-    // Get opcode
-    uint8_t opcode = Memory[programCounter++];
+    Profile &counters = *profile;
 
-    // Decode opcode
-    Instruction instruction = Instructions[opcode];
+    while (!counters.frames.empty() && counters.frames.back().stackPointer < limit)
+    {
+        Profile::CallFrame frame = counters.frames.back();
+        counters.frames.pop_back();
 
-    // Execute opcode
-    (this->*instruction.code)((this->*instruction.addr)());
+        uint64_t inclusive = cycleCount - frame.startCycles;
+
+        Profile::CallTotals &totals = counters.calls[counters.nodes[frame.node].address];
+        totals.inclusiveCycles += inclusive;
+        totals.exclusiveCycles += inclusive - frame.childCycles;
+
+        if (!counters.frames.empty())
+            counters.frames.back().childCycles += inclusive;
+    }
 }
 
-void mos6502::reset()
+// Sort (key, cycles, count) rows by cycles, busiest first
+template <typename Key>
+static bool busierRow(const std::pair<Key, std::pair<uint64_t, uint64_t> > &a,
+                      const std::pair<Key, std::pair<uint64_t, uint64_t> > &b)
 {
-    accumulator = 0x00;
-    yRegister = 0x00;
-    xRegister = 0x00;
-    stackPointer = 0xFF;
+    return a.second.first > b.second.first;
+}
 
-    statusRegister = 0x36; // 00110110 status register
+static double percentOf(uint64_t part, uint64_t total)
+{
+    return total ? 100.0 * part / total : 0;
+}
 
-    // load PC from reset vector
-    uint8_t addressLow = readByte(RESET_VECTOR_L);
-    uint8_t addressHigh = readByte(RESET_VECTOR_H);
-    programCounter = (addressHigh << 8) + addressLow;
-    return;
-};
-void mos6502::IRQ()
+bool mos6502::startProfile()
 {
-    if (!getFlag(INTDISABLE_FLAG_BIT))
+    profile.reset(new Profile());
+
+    profile->instructions = 0;
+    profile->cycles = 0;
+    std::fill(profile->opcodeCounts, profile->opcodeCounts + 256, 0);
+    std::fill(profile->opcodeCycles, profile->opcodeCycles + 256, 0);
+    profile->addressCounts.assign(0x10000, 0);
+    profile->addressCycles.assign(0x10000, 0);
+    profile->addressOpcodes.assign(0x10000, 0);
+    profile->pairCounts.assign(0x10000, 0);
+    profile->previousOpcode = -1;
+
+    // The root of the call tree is whatever is running now
+    Profile::CallNode root = {programCounter, 0, 0, std::map<uint16_t, size_t>()};
+    profile->nodes.push_back(root);
+
+    profiling = true;
+    return true;
+}
+void mos6502::stopProfile()
+{
+    profiling = false;
+}
+bool mos6502::writeProfile(std::ostream &out)
+{
+    if (!profile)
     {
+        std::cerr << "Error: No profile has been started." << std::endl;
+        return false;
+    }
 
-        // Save PC and status to stack
-        pushStack((programCounter >> 8) & 0xFF);
-        pushStack(programCounter & 0xFF);
-        pushStack(statusRegister | (1 << static_cast<uint8_t>(BREAK_FLAG_BIT)) | (1 << static_cast<uint8_t>(UNUSED_FLAG_BIT)));
+    const Profile &counters = *profile;
+    typedef std::pair<uint64_t, uint64_t> CyclesAndCount;
 
-        // Set intterupt flag
-        setFlag(INTDISABLE_FLAG_BIT, true);
+    out << "Instructions: " << counters.instructions << std::endl;
+    out << "Cycles: " << counters.cycles << std::endl;
 
-        // load PC from interrupt request vector
-        uint8_t addressLow = readByte(IRQ_VECTOR_L);
-        uint8_t addressHigh = readByte(IRQ_VECTOR_H);
-        programCounter = (addressHigh << 8) + addressLow;
+    // Per opcode
+    std::vector<std::pair<int, CyclesAndCount> > opcodes;
+    for (int opcode = 0; opcode < 256; opcode++)
+    {
+        if (counters.opcodeCounts[opcode])
+            opcodes.push_back(std::make_pair(opcode, CyclesAndCount(counters.opcodeCycles[opcode], counters.opcodeCounts[opcode])));
     }
-};
-void mos6502::NMI()
+    std::stable_sort(opcodes.begin(), opcodes.end(), busierRow<int>);
+
+    out << std::endl
+        << "Opcode  Mnemonic        Count          Cycles       %" << std::endl;
+    for (size_t i = 0; i < opcodes.size(); i++)
+    {
+        out << "    " << std::hex << std::uppercase << std::setw(2) << std::setfill('0') << opcodes[i].first
+            << std::dec << std::setfill(' ') << "  " << std::left << std::setw(8) << Instructions[opcodes[i].first].alias << std::right
+            << std::setw(14) << opcodes[i].second.second << std::setw(16) << opcodes[i].second.first
+            << std::fixed << std::setprecision(2) << std::setw(8) << percentOf(opcodes[i].second.first, counters.cycles) << std::endl;
+    }
+
+    // Per mnemonic, summed over the addressing modes
+    std::map<std::string, CyclesAndCount> aliasTotals;
+    for (size_t i = 0; i < opcodes.size(); i++)
+    {
+        CyclesAndCount &totals = aliasTotals[Instructions[opcodes[i].first].alias];
+        totals.first += opcodes[i].second.first;
+        totals.second += opcodes[i].second.second;
+    }
+    std::vector<std::pair<std::string, CyclesAndCount> > aliases(aliasTotals.begin(), aliasTotals.end());
+    std::stable_sort(aliases.begin(), aliases.end(), busierRow<std::string>);
+
+    out << std::endl
+        << "Mnemonic        Count          Cycles       %" << std::endl;
+    for (size_t i = 0; i < aliases.size(); i++)
+    {
+        out << std::left << std::setw(8) << aliases[i].first << std::right
+            << std::setw(14) << aliases[i].second.second << std::setw(16) << aliases[i].second.first
+            << std::fixed << std::setprecision(2) << std::setw(8) << percentOf(aliases[i].second.first, counters.cycles) << std::endl;
+    }
+
+    // Per opcode pair, the candidates for superinstructions
+    std::vector<std::pair<int, CyclesAndCount> > pairs;
+    for (int pair = 0; pair < 0x10000; pair++)
+    {
+        if (counters.pairCounts[pair])
+            pairs.push_back(std::make_pair(pair, CyclesAndCount(counters.pairCounts[pair], 0)));
+    }
+    std::stable_sort(pairs.begin(), pairs.end(), busierRow<int>);
+
+    out << std::endl
+        << "Pair   Mnemonics               Count       %" << std::endl;
+    for (size_t i = 0; i < pairs.size() && i < 32; i++)
+    {
+        int first = pairs[i].first >> 8;
+        int second = pairs[i].first & 0xFF;
+        out << std::hex << std::uppercase << std::setfill('0') << std::setw(2) << first << " " << std::setw(2) << second
+            << std::dec << std::setfill(' ') << "  " << Instructions[first].alias << " " << Instructions[second].alias
+            << (fusionPartner(first) == second ? " fused" : "      ")
+            << std::setw(16) << pairs[i].second.first
+            << std::fixed << std::setprecision(2) << std::setw(8) << percentOf(pairs[i].second.first, counters.instructions) << std::endl;
+    }
+
+    // Per address
+    std::vector<std::pair<int, CyclesAndCount> > addresses;
+    for (int address = 0; address < 0x10000; address++)
+    {
+        if (counters.addressCounts[address])
+            addresses.push_back(std::make_pair(address, CyclesAndCount(counters.addressCycles[address], counters.addressCounts[address])));
+    }
+    std::stable_sort(addresses.begin(), addresses.end(), busierRow<int>);
+
+    out << std::endl
+        << "Address  Mnemonic        Count          Cycles       %" << std::endl;
+    for (size_t i = 0; i < addresses.size(); i++)
+    {
+        uint8_t opcode = counters.addressOpcodes[addresses[i].first];
+        out << "  $" << std::hex << std::uppercase << std::setw(4) << std::setfill('0') << addresses[i].first
+            << std::dec << std::setfill(' ') << "  " << std::left << std::setw(8) << Instructions[opcode].alias << std::right
+            << std::setw(14) << addresses[i].second.second << std::setw(16) << addresses[i].second.first
+            << std::fixed << std::setprecision(2) << std::setw(8) << percentOf(addresses[i].second.first, counters.cycles) << std::endl;
+    }
+
+    // Per JSR target
+    std::vector<std::pair<uint16_t, CyclesAndCount> > calls;
+    for (std::map<uint16_t, Profile::CallTotals>::const_iterator call = counters.calls.begin(); call != counters.calls.end(); ++call)
+        calls.push_back(std::make_pair(call->first, CyclesAndCount(call->second.inclusiveCycles, call->second.calls)));
+    std::stable_sort(calls.begin(), calls.end(), busierRow<uint16_t>);
+
+    out << std::endl
+        << "Subroutine         Calls       Inclusive       Exclusive" << std::endl;
+    for (size_t i = 0; i < calls.size(); i++)
+    {
+        out << "     $" << std::hex << std::uppercase << std::setw(4) << std::setfill('0') << calls[i].first
+            << std::dec << std::setfill(' ') << std::setw(14) << calls[i].second.second
+            << std::setw(16) << calls[i].second.first << std::setw(16) << counters.calls.find(calls[i].first)->second.exclusiveCycles << std::endl;
+    }
+
+    return true;
+}
+bool mos6502::writeFlameGraph(std::ostream &out)
 {
-    pushStack((programCounter >> 8) & 0xFF);
-    pushStack(programCounter & 0xFF);
-    pushStack(statusRegister | (1 << static_cast<uint8_t>(BREAK_FLAG_BIT)) | (1 << static_cast<uint8_t>(UNUSED_FLAG_BIT)));
+    if (!profile)
+    {
+        std::cerr << "Error: No profile has been started." << std::endl;
+        return false;
+    }
 
-    setFlag(INTDISABLE_FLAG_BIT, true);
+    const std::vector<Profile::CallNode> &nodes = profile->nodes;
 
-    uint8_t addressLow = readByte(NMI_VECTOR_L);
-    uint8_t addressHigh = readByte(NMI_VECTOR_H);
-    programCounter = (addressHigh << 8) + addressLow;
-};
+    // Children are always added after their parent, so names can be built in one pass
+    std::vector<std::string> stacks(nodes.size());
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        std::ostringstream frame;
+        frame << "$" << std::hex << std::uppercase << std::setw(4) << std::setfill('0') << nodes[i].address;
+
+        stacks[i] = i == 0 ? "main" : stacks[nodes[i].parent] + ";" + frame.str();
+
+        if (nodes[i].cycles)
+            out << stacks[i] << " " << nodes[i].cycles << std::endl;
+    }
+
+    return true;
+}
+
+#else
+
+bool mos6502::startProfile()
+{
+    std::cerr << "Error: Profiling is not compiled in, build with MOS6502_PROFILE defined." << std::endl;
+    return false;
+}
+void mos6502::stopProfile()
+{
+}
+bool mos6502::writeProfile(std::ostream &out)
+{
+    std::cerr << "Error: Profiling is not compiled in, build with MOS6502_PROFILE defined." << std::endl;
+    return false;
+}
+bool mos6502::writeFlameGraph(std::ostream &out)
+{
+    std::cerr << "Error: Profiling is not compiled in, build with MOS6502_PROFILE defined." << std::endl;
+    return false;
+}
+
+#endif
 
 #pragma endregion
\ No newline at end of file
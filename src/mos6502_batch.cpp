@@ -0,0 +1,185 @@
+#include "../include/mos6502_batch.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+BatchRunner::BatchRunner(unsigned threads)
+{
+    threadCount = threads ? threads : std::thread::hardware_concurrency();
+    if (threadCount == 0)
+        threadCount = 1;
+
+    seconds = 0;
+    totalInstructions = 0;
+    totalCycles = 0;
+}
+
+size_t BatchRunner::addJob(const BatchJob &job)
+{
+    jobs.push_back(job);
+    return jobs.size() - 1;
+}
+
+bool BatchRunner::takeJob(std::vector<WorkQueue> &queues, unsigned worker, size_t &job)
+{
+    // Own queue first, newest job first
+    {
+        std::lock_guard<std::mutex> guard(queues[worker].lock);
+        if (!queues[worker].jobs.empty())
+        {
+            job = queues[worker].jobs.back();
+            queues[worker].jobs.pop_back();
+            return true;
+        }
+    }
+
+    // Steal the oldest job of the next worker that still has some
+    for (size_t i = 1; i < queues.size(); i++)
+    {
+        WorkQueue &victim = queues[(worker + i) % queues.size()];
+
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.jobs.empty())
+        {
+            job = victim.jobs.front();
+            victim.jobs.pop_front();
+            return true;
+        }
+    }
+
+    // Nothing is ever added once the run started, so empty queues stay empty
+    return false;
+}
+
+void BatchRunner::work(std::vector<WorkQueue> &queues, unsigned worker)
+{
+    size_t job;
+    while (takeJob(queues, worker, job))
+        runJob(jobs[job], results[job]);
+}
+
+void BatchRunner::runJob(const BatchJob &job, BatchResult &result)
+{
+    mos6502 cpu;
+    if (job.prototype)
+        cpu = *job.prototype;
+
+    if (job.image)
+        cpu.loadMemory(job.image, job.length, job.base);
+
+    cpu.setPC(job.PC);
+    cpu.setSP(job.SP);
+    cpu.setSR(job.SR);
+    cpu.setAC(job.AC);
+    cpu.setXR(job.XR);
+    cpu.setYR(job.YR);
+
+    uint64_t startCycles = cpu.getCycles();
+    uint64_t startInstructions = cpu.getInstructionCount();
+
+    // A job starts afresh rather than resuming, so a breakpoint on its first instruction stops it too
+    if (cpu.atBreakpoint())
+        result.status = mos6502::RUN_BREAKPOINT;
+    else if (!job.maxInstructions)
+        result.status = cpu.run(job.maxCycles);
+    else
+    {
+        // Every instruction takes at least 2 cycles, so a budget of twice the instructions
+        // left can never overshoot them and the limit is reached in a few runs
+        uint64_t endCycles = startCycles + job.maxCycles;
+        uint64_t endInstructions = startInstructions + job.maxInstructions;
+
+        result.status = mos6502::RUN_BUDGET_EXHAUSTED;
+        while (result.status == mos6502::RUN_BUDGET_EXHAUSTED && cpu.getCycles() < endCycles && cpu.getInstructionCount() < endInstructions)
+        {
+            uint64_t budget = std::min(endCycles - cpu.getCycles(), 2 * (endInstructions - cpu.getInstructionCount()));
+            result.status = cpu.run(budget);
+        }
+    }
+    result.PC = cpu.getPC();
+    result.SP = cpu.getSP();
+    result.SR = cpu.getSR();
+    result.AC = cpu.getAC();
+    result.XR = cpu.getXR();
+    result.YR = cpu.getYR();
+    result.cycles = cpu.getCycles() - startCycles;
+    result.instructions = cpu.getInstructionCount() - startInstructions;
+    result.memoryDigest = cpu.digestMemory();
+}
+
+void BatchRunner::run()
+{
+    results.assign(jobs.size(), BatchResult());
+
+    // Copies of a prototype with devices share their state, those jobs run on this thread alone
+    std::vector<size_t> parallel;
+    std::vector<size_t> serial;
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        if (jobs[i].prototype && jobs[i].prototype->sharesDevices())
+            serial.push_back(i);
+        else
+            parallel.push_back(i);
+    }
+
+    // Deal contiguous runs of jobs to the workers
+    std::vector<WorkQueue> queues(threadCount);
+    for (size_t i = 0; i < parallel.size(); i++)
+        queues[i * threadCount / parallel.size()].jobs.push_back(parallel[i]);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for (unsigned worker = 1; worker < threadCount; worker++)
+        threads.push_back(std::thread(&BatchRunner::work, this, std::ref(queues), worker));
+
+    // The calling thread is worker 0
+    work(queues, 0);
+
+    for (size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+
+    for (size_t i = 0; i < serial.size(); i++)
+        runJob(jobs[serial[i]], results[serial[i]]);
+
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    totalInstructions = 0;
+    totalCycles = 0;
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        totalInstructions += results[i].instructions;
+        totalCycles += results[i].cycles;
+    }
+}
+
+const std::vector<BatchResult> &BatchRunner::getResults()
+{
+    return results;
+}
+
+unsigned BatchRunner::getThreadCount()
+{
+    return threadCount;
+}
+
+double BatchRunner::getSeconds()
+{
+    return seconds;
+}
+
+uint64_t BatchRunner::getInstructions()
+{
+    return totalInstructions;
+}
+
+uint64_t BatchRunner::getCycles()
+{
+    return totalCycles;
+}
+
+double BatchRunner::getInstructionsPerSecond()
+{
+    return seconds > 0 ? totalInstructions / seconds : 0;
+}
@@ -0,0 +1,1081 @@
+#include "../include/mos6502.h"
+
+#include <cstring>
+#include <functional>
+
+#include <sys/mman.h>
+
+/*
+ * x86-64 translation of the blocks in the block cache, used by ENGINE_JIT.
+ *
+ * A translated block keeps A, X and Y in callee-saved host registers and the
+ * lazily kept flags in their usual members, so fallbacks and I/O handlers see
+ * the same state the interpreter would give them. Loads, stores, arithmetic,
+ * compares, register transfers and branches are emitted inline with the bus
+ * fast path; every other instruction calls its executeDecoded() handler.
+ *
+ * run() only enters native code when the whole block fits before the cycle
+ * budget and the next event, so the code never checks either between
+ * instructions. It returns to run() after the instruction that took a slow
+ * path whenever that wrote cached code, requested a stop or scheduled an
+ * event, and loops in place while the block branches back to its start.
+ */
+
+#if defined(__x86_64__)
+
+namespace
+{
+
+// Size of the executable buffer, the cache is flushed when it fills up
+const size_t jitBufferSize = 4 << 20;
+
+/**
+ * @brief Operation of every opcode, named after the mos6502 method executing it.
+ */
+enum Operation
+{
+    OPERATION_ADC, OPERATION_AND, OPERATION_ASL, OPERATION_ASL_ACC, OPERATION_BCC, OPERATION_BCS,
+    OPERATION_BEQ, OPERATION_BIT, OPERATION_BMI, OPERATION_BNE, OPERATION_BPL, OPERATION_BRK,
+    OPERATION_BVC, OPERATION_BVS, OPERATION_CLC, OPERATION_CLD, OPERATION_CLI, OPERATION_CLV,
+    OPERATION_CMP, OPERATION_CPX, OPERATION_CPY, OPERATION_DEC, OPERATION_DEX, OPERATION_DEY,
+    OPERATION_EOR, OPERATION_INC, OPERATION_INX, OPERATION_INY, OPERATION_JMP, OPERATION_JSR,
+    OPERATION_LDA, OPERATION_LDX, OPERATION_LDY, OPERATION_LSR, OPERATION_LSR_ACC, OPERATION_NOP,
+    OPERATION_ORA, OPERATION_PHA, OPERATION_PHP, OPERATION_PLA, OPERATION_PLP, OPERATION_ROL,
+    OPERATION_ROL_ACC, OPERATION_ROR, OPERATION_ROR_ACC, OPERATION_RTI, OPERATION_RTS, OPERATION_SBC,
+    OPERATION_SEC, OPERATION_SED, OPERATION_SEI, OPERATION_STA, OPERATION_STX, OPERATION_STY,
+    OPERATION_TAX, OPERATION_TAY, OPERATION_TSX, OPERATION_TXA, OPERATION_TXS, OPERATION_TYA,
+    OPERATION_ILLEGAL
+};
+
+enum Mode
+{
+    MODE_ACC, MODE_IMM, MODE_ABS, MODE_ZER, MODE_ZEX, MODE_ZEY, MODE_ABX,
+    MODE_ABY, MODE_IMP, MODE_REL, MODE_INX, MODE_INY, MODE_IND
+};
+
+struct OpcodeInfo
+{
+    Operation operation;
+    Mode mode;
+};
+
+const OpcodeInfo opcodeInfo[256] = {
+#define MOS6502_OPCODE(opcode, alias, code, mode, cycles, bytes, pageCycles) {OPERATION_##code, MODE_##mode},
+#define MOS6502_ILLEGAL(opcode) {OPERATION_ILLEGAL, MODE_IMP},
+#include "../include/mos6502_opcodes.h"
+#undef MOS6502_OPCODE
+#undef MOS6502_ILLEGAL
+};
+
+/**
+ * @brief Where the translated code finds the CPU state, as offsets from the mos6502 object.
+ */
+struct CpuLayout
+{
+    int32_t programCounter;
+    int32_t stackPointer;
+    int32_t statusRegister;
+    int32_t accumulator;
+    int32_t xRegister;
+    int32_t yRegister;
+    int32_t carryFlag;
+    int32_t zeroResult;
+    int32_t negativeResult;
+    int32_t overflowResult;
+    int32_t readPages;
+    int32_t writePages;
+    int32_t instructionCount;
+    int32_t cycleCount;
+    int32_t pageCrossed;
+
+    // Addresses of the call-outs
+    uint64_t read;
+    uint64_t write;
+    uint64_t execute;
+};
+
+/**
+ * @brief One instruction of the block being translated.
+ */
+struct Step
+{
+    Operation operation;
+    Mode mode;
+    uint8_t opcode;
+    uint16_t operand;
+    uint16_t address;
+    uint16_t next;
+    uint8_t cycles;
+    uint8_t pageCycles;
+};
+
+enum HostRegister
+{
+    RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+    R8 = 8, R12 = 12, R13 = 13, R14 = 14, R15 = 15
+};
+
+// Condition codes of jcc, ALWAYS emits jmp
+enum Condition
+{
+    BELOW = 0x2,
+    EQUAL = 0x4,
+    NOT_EQUAL = 0x5,
+    ALWAYS = -1
+};
+
+// The 6502 registers while a block runs, the CPU pointer, the loop limit and the exit flag
+const int REG_A = R12;
+const int REG_X = R13;
+const int REG_Y = R14;
+const int REG_CPU = RBX;
+const int REG_LIMIT = RBP;
+const int REG_EXIT = R15;
+
+/**
+ * @brief Just enough of an x86-64 assembler for the translator.
+ *
+ * Memory operands are always [base + disp32] or [base + index * scale + disp32].
+ */
+class Assembler
+{
+public:
+    std::vector<uint8_t> code;
+
+    void byte(uint8_t value)
+    {
+        code.push_back(value);
+    }
+    void word(uint16_t value)
+    {
+        byte(value & 0xFF);
+        byte(value >> 8);
+    }
+    void dword(uint32_t value)
+    {
+        for (int i = 0; i < 32; i += 8)
+            byte(value >> i);
+    }
+    void qword(uint64_t value)
+    {
+        for (int i = 0; i < 64; i += 8)
+            byte(value >> i);
+    }
+
+    // op reg, rm with both operands registers, reg may be an opcode extension
+    void regReg(std::initializer_list<uint8_t> opcode, int reg, int rm, bool wide = false)
+    {
+        rex(wide, reg, 0, rm);
+        for (uint8_t value : opcode)
+            byte(value);
+        byte(0xC0 | (reg & 7) << 3 | (rm & 7));
+    }
+
+    // op reg, [base + disp]
+    void regMem(std::initializer_list<uint8_t> opcode, int reg, int base, int32_t disp, bool wide = false)
+    {
+        rex(wide, reg, 0, base);
+        for (uint8_t value : opcode)
+            byte(value);
+        byte(0x80 | (reg & 7) << 3 | (base & 7));
+        if ((base & 7) == RSP)
+            byte(0x24);
+        dword(disp);
+    }
+
+    // op reg, [base + index * (1 << scale) + disp]
+    void regIndex(std::initializer_list<uint8_t> opcode, int reg, int base, int index, int scale, int32_t disp, bool wide = false)
+    {
+        rex(wide, reg, index, base);
+        for (uint8_t value : opcode)
+            byte(value);
+        byte(0x80 | (reg & 7) << 3 | RSP);
+        byte(scale << 6 | (index & 7) << 3 | (base & 7));
+        dword(disp);
+    }
+
+    // mov reg32, imm32
+    void moveImmediate(int reg, uint32_t value)
+    {
+        rex(false, 0, 0, reg);
+        byte(0xB8 + (reg & 7));
+        dword(value);
+    }
+
+    void push(int reg)
+    {
+        rex(false, 0, 0, reg);
+        byte(0x50 + (reg & 7));
+    }
+    void pop(int reg)
+    {
+        rex(false, 0, 0, reg);
+        byte(0x58 + (reg & 7));
+    }
+
+    // Absolute call through RAX, the buffer can be anywhere in the address space
+    void call(uint64_t target)
+    {
+        byte(0x48);
+        byte(0xB8);
+        qword(target);
+        byte(0xFF);
+        byte(0xD0);
+    }
+
+    int label()
+    {
+        labels.push_back(-1);
+        return labels.size() - 1;
+    }
+    void bind(int label)
+    {
+        labels[label] = code.size();
+    }
+    void jump(int condition, int label)
+    {
+        if (condition == ALWAYS)
+            byte(0xE9);
+        else
+        {
+            byte(0x0F);
+            byte(0x80 | condition);
+        }
+
+        Fixup fixup = {code.size(), label};
+        fixups.push_back(fixup);
+        dword(0);
+    }
+
+    // Patch the jumps once every label is bound
+    void resolve()
+    {
+        for (size_t i = 0; i < fixups.size(); i++)
+        {
+            int32_t displacement = labels[fixups[i].label] - static_cast<int32_t>(fixups[i].position + 4);
+            std::memcpy(&code[fixups[i].position], &displacement, 4);
+        }
+    }
+
+private:
+    struct Fixup
+    {
+        size_t position;
+        int label;
+    };
+
+    std::vector<int> labels;
+    std::vector<Fixup> fixups;
+
+    void rex(bool wide, int reg, int index, int base)
+    {
+        uint8_t prefix = 0x40 | (wide << 3) | ((reg & 8) >> 1) | ((index & 8) >> 2) | ((base & 8) >> 3);
+        if (prefix != 0x40)
+            byte(prefix);
+    }
+};
+
+/**
+ * @brief Emits the host code of one block.
+ */
+class Translator
+{
+public:
+    Assembler assembler;
+
+    Translator(const CpuLayout &cpu) : cpu(cpu) {}
+
+    void translate(const std::vector<Step> &steps, uint16_t start)
+    {
+        Assembler &a = assembler;
+        epilogue = a.label();
+        int loop = a.label();
+
+        // Six pushes and the scratch slot at [rsp] keep calls 16-byte aligned
+        a.push(RBX);
+        a.push(RBP);
+        a.push(R12);
+        a.push(R13);
+        a.push(R14);
+        a.push(R15);
+        a.regReg({0x83}, 5, RSP, true); // sub rsp, 8
+        a.byte(8);
+        a.regReg({0x89}, RDI, REG_CPU, true);
+        a.regReg({0x89}, RSI, REG_LIMIT, true);
+        reload();
+        a.regReg({0x31}, REG_EXIT, REG_EXIT);
+        a.bind(loop);
+
+        for (size_t i = 0; i < steps.size(); i++)
+        {
+            const Step &step = steps[i];
+            uint32_t count = i + 1;
+            bool last = count == steps.size();
+
+            if (step.mode == MODE_REL)
+            {
+                branch(step, count, start, loop);
+                continue;
+            }
+            if (step.operation == OPERATION_JMP && step.mode == MODE_ABS)
+            {
+                addCycles(step.cycles);
+                loopOrExit(step.operand, step.address, count, start, loop);
+                continue;
+            }
+
+            bool callsOut = instruction(step);
+
+            addCycles(step.cycles);
+            if (step.pageCycles)
+            {
+                int same = a.label();
+                a.regMem({0x80}, 7, REG_CPU, cpu.pageCrossed); // cmp byte [pageCrossed], 0
+                a.byte(0);
+                a.jump(EQUAL, same);
+                addCycles(step.pageCycles);
+                a.bind(same);
+            }
+
+            if (last)
+            {
+                // Calls, returns and BRK already set PC
+                bool jumps = step.operation == OPERATION_JSR || step.operation == OPERATION_RTS || step.operation == OPERATION_RTI ||
+                             step.operation == OPERATION_BRK || step.operation == OPERATION_JMP;
+                exit(jumps ? -1 : step.next, step.address, count);
+            }
+            else if (callsOut)
+            {
+                int stay = a.label();
+                a.regReg({0x85}, REG_EXIT, REG_EXIT);
+                a.jump(EQUAL, stay);
+                exit(step.next, step.address, count);
+                a.bind(stay);
+            }
+        }
+
+        a.bind(epilogue);
+        spill();
+        a.regReg({0x83}, 0, RSP, true); // add rsp, 8
+        a.byte(8);
+        a.pop(R15);
+        a.pop(R14);
+        a.pop(R13);
+        a.pop(R12);
+        a.pop(RBP);
+        a.pop(RBX);
+        a.byte(0xC3);
+
+        // Slow paths go after the block so the fast paths fall straight through
+        for (size_t i = 0; i < stubs.size(); i++)
+            stubs[i]();
+
+        a.resolve();
+    }
+
+private:
+    const CpuLayout &cpu;
+    int epilogue;
+    std::vector<std::function<void()> > stubs;
+
+    void setZeroNegative(int reg)
+    {
+        assembler.regMem({0x88}, reg, REG_CPU, cpu.zeroResult);
+        assembler.regMem({0x88}, reg, REG_CPU, cpu.negativeResult);
+    }
+
+    void spill()
+    {
+        assembler.regMem({0x88}, REG_A, REG_CPU, cpu.accumulator);
+        assembler.regMem({0x88}, REG_X, REG_CPU, cpu.xRegister);
+        assembler.regMem({0x88}, REG_Y, REG_CPU, cpu.yRegister);
+    }
+
+    void reload()
+    {
+        assembler.regMem({0x0F, 0xB6}, REG_A, REG_CPU, cpu.accumulator);
+        assembler.regMem({0x0F, 0xB6}, REG_X, REG_CPU, cpu.xRegister);
+        assembler.regMem({0x0F, 0xB6}, REG_Y, REG_CPU, cpu.yRegister);
+    }
+
+    void storePC(uint16_t value)
+    {
+        assembler.byte(0x66);
+        assembler.regMem({0xC7}, 0, REG_CPU, cpu.programCounter);
+        assembler.word(value);
+    }
+
+    void addCycles(uint8_t cycles)
+    {
+        assembler.regMem({0x83}, 0, REG_CPU, cpu.cycleCount, true);
+        assembler.byte(cycles);
+    }
+
+    // Call out with the registers in memory, the arguments after the CPU are already in ESI and EDX
+    void callOut(uint64_t function)
+    {
+        spill();
+        assembler.regReg({0x89}, REG_CPU, RDI, true);
+        assembler.call(function);
+        reload();
+    }
+
+    // Leave with PC after the last instruction, unless it set PC itself
+    void exit(int32_t programCounter, uint16_t address, uint32_t count)
+    {
+        if (programCounter >= 0)
+            storePC(programCounter);
+        assembler.regMem({0x81}, 0, REG_CPU, cpu.instructionCount, true);
+        assembler.dword(count);
+        assembler.moveImmediate(RAX, address);
+        assembler.jump(ALWAYS, epilogue);
+    }
+
+    // A jump back to the start of the block runs it again while it still fits in the budget
+    void loopOrExit(uint16_t target, uint16_t address, uint32_t count, uint16_t start, int loop)
+    {
+        // A single instruction jumping to itself is a trap, run() has to see it
+        if (target != start || count == 1)
+        {
+            exit(target, address, count);
+            return;
+        }
+
+        Assembler &a = assembler;
+        a.regMem({0x81}, 0, REG_CPU, cpu.instructionCount, true);
+        a.dword(count);
+        a.regMem({0x8B}, RAX, REG_CPU, cpu.cycleCount, true);
+        a.regReg({0x39}, REG_LIMIT, RAX, true); // cmp rax, rbp
+        a.jump(BELOW, loop);
+        storePC(target);
+        a.moveImmediate(RAX, address);
+        a.jump(ALWAYS, epilogue);
+    }
+
+    void branch(const Step &step, uint32_t count, uint16_t start, int loop)
+    {
+        Assembler &a = assembler;
+        int taken = a.label();
+
+        int32_t flag;
+        bool bit7;
+        bool whenSet;
+        switch (step.operation)
+        {
+        case OPERATION_BCC: flag = cpu.carryFlag; bit7 = false; whenSet = false; break;
+        case OPERATION_BCS: flag = cpu.carryFlag; bit7 = false; whenSet = true; break;
+        case OPERATION_BEQ: flag = cpu.zeroResult; bit7 = false; whenSet = false; break;
+        case OPERATION_BNE: flag = cpu.zeroResult; bit7 = false; whenSet = true; break;
+        case OPERATION_BPL: flag = cpu.negativeResult; bit7 = true; whenSet = false; break;
+        case OPERATION_BMI: flag = cpu.negativeResult; bit7 = true; whenSet = true; break;
+        case OPERATION_BVC: flag = cpu.overflowResult; bit7 = true; whenSet = false; break;
+        default: flag = cpu.overflowResult; bit7 = true; whenSet = true; break;
+        }
+
+        if (bit7)
+        {
+            a.regMem({0xF6}, 0, REG_CPU, flag); // test byte [flag], 0x80
+            a.byte(0x80);
+        }
+        else
+        {
+            a.regMem({0x80}, 7, REG_CPU, flag); // cmp byte [flag], 0
+            a.byte(0);
+        }
+        a.jump(whenSet ? NOT_EQUAL : EQUAL, taken);
+
+        addCycles(step.cycles);
+        exit(step.next, step.address, count);
+
+        // One extra cycle for a taken branch, two if it lands on another page
+        uint16_t target = step.next + static_cast<int8_t>(step.operand);
+        a.bind(taken);
+        addCycles(step.cycles + (((step.next ^ target) > 0xFF) ? 2 : 1));
+        loopOrExit(target, step.address, count, start, loop);
+    }
+
+    // Read the byte at the address in EAX into EAX
+    void read(uint16_t next)
+    {
+        Assembler &a = assembler;
+        int slow = a.label();
+        int done = a.label();
+
+        a.regReg({0x89}, RAX, RCX);
+        a.regReg({0xC1}, 5, RCX); // shr ecx, 8
+        a.byte(8);
+        a.regIndex({0x8B}, RDX, REG_CPU, RCX, 3, cpu.readPages, true);
+        a.regReg({0x85}, RDX, RDX, true);
+        a.jump(EQUAL, slow);
+        a.regReg({0x0F, 0xB6}, RCX, RAX);
+        a.regIndex({0x0F, 0xB6}, RAX, RDX, RCX, 0, 0);
+        a.bind(done);
+
+        stubs.push_back([=]() { readStub(slow, done, next); });
+    }
+
+    // Read the byte at a fixed address into EAX
+    void readConstant(uint16_t address, uint16_t next)
+    {
+        Assembler &a = assembler;
+        int slow = a.label();
+        int done = a.label();
+
+        a.regMem({0x8B}, RDX, REG_CPU, cpu.readPages + (address >> 8) * 8, true);
+        a.regReg({0x85}, RDX, RDX, true);
+        a.jump(EQUAL, slow);
+        a.regMem({0x0F, 0xB6}, RAX, RDX, address & 0xFF);
+        a.bind(done);
+
+        stubs.push_back([=]() {
+            assembler.bind(slow);
+            assembler.moveImmediate(RAX, address);
+            readStub(-1, done, next);
+        });
+    }
+
+    void readStub(int slow, int done, uint16_t next)
+    {
+        Assembler &a = assembler;
+        if (slow >= 0)
+            a.bind(slow);
+
+        a.regReg({0x89}, RAX, RSI);
+        storePC(next);
+        callOut(cpu.read);
+        a.regReg({0x89}, RAX, RCX);
+        a.regReg({0xC1}, 5, RCX); // shr ecx, 8
+        a.byte(8);
+        a.regReg({0x09}, RCX, REG_EXIT);
+        a.regReg({0x0F, 0xB6}, RAX, RAX);
+        a.jump(ALWAYS, done);
+    }
+
+    // Write the low byte of a register to the address in EAX
+    void write(int value, uint16_t next)
+    {
+        Assembler &a = assembler;
+        int slow = a.label();
+        int done = a.label();
+
+        a.regReg({0x89}, RAX, RCX);
+        a.regReg({0xC1}, 5, RCX); // shr ecx, 8
+        a.byte(8);
+        a.regIndex({0x8B}, RDX, REG_CPU, RCX, 3, cpu.writePages, true);
+        a.regReg({0x85}, RDX, RDX, true);
+        a.jump(EQUAL, slow);
+        a.regReg({0x0F, 0xB6}, RCX, RAX);
+        a.regIndex({0x88}, value, RDX, RCX, 0, 0);
+        a.bind(done);
+
+        stubs.push_back([=]() { writeStub(slow, done, value, next); });
+    }
+
+    // Write the low byte of a register to a fixed address
+    void writeConstant(uint16_t address, int value, uint16_t next)
+    {
+        Assembler &a = assembler;
+        int slow = a.label();
+        int done = a.label();
+
+        a.regMem({0x8B}, RDX, REG_CPU, cpu.writePages + (address >> 8) * 8, true);
+        a.regReg({0x85}, RDX, RDX, true);
+        a.jump(EQUAL, slow);
+        a.regMem({0x88}, value, RDX, address & 0xFF);
+        a.bind(done);
+
+        stubs.push_back([=]() {
+            assembler.bind(slow);
+            assembler.moveImmediate(RAX, address);
+            writeStub(-1, done, value, next);
+        });
+    }
+
+    void writeStub(int slow, int done, int value, uint16_t next)
+    {
+        Assembler &a = assembler;
+        if (slow >= 0)
+            a.bind(slow);
+
+        a.regReg({0x89}, RAX, RSI);
+        a.regReg({0x89}, value, RDX);
+        storePC(next);
+        callOut(cpu.write);
+        a.regReg({0x09}, RAX, REG_EXIT);
+        a.jump(ALWAYS, done);
+    }
+
+    void fallback(const Step &step)
+    {
+        storePC(step.next);
+        assembler.moveImmediate(RSI, step.operand);
+        assembler.moveImmediate(RDX, step.opcode);
+        callOut(cpu.execute);
+        assembler.regReg({0x09}, RAX, REG_EXIT);
+    }
+
+    /**
+     * @brief Compute the effective address of a memory operand.
+     *
+     * @return true with the address in constant when it does not depend on the
+     *         registers, false with the address in EAX.
+     */
+    bool address(const Step &step, uint16_t &constant)
+    {
+        Assembler &a = assembler;
+
+        switch (step.mode)
+        {
+        case MODE_ZER:
+        case MODE_ABS:
+            constant = step.operand;
+            return true;
+        case MODE_ZEX:
+        case MODE_ZEY:
+            a.regMem({0x8D}, RAX, step.mode == MODE_ZEX ? REG_X : REG_Y, step.operand);
+            a.regReg({0x0F, 0xB6}, RAX, RAX);
+            return false;
+        case MODE_ABX:
+        case MODE_ABY:
+            a.regMem({0x8D}, RAX, step.mode == MODE_ABX ? REG_X : REG_Y, step.operand);
+            a.regReg({0x0F, 0xB7}, RAX, RAX);
+            if (step.pageCycles)
+            {
+                a.regReg({0x89}, RAX, RCX);
+                a.regReg({0x81}, 6, RCX); // xor ecx, base
+                a.dword(step.operand);
+                pageCrossed();
+            }
+            return false;
+        case MODE_INX:
+            // The pointer wraps around in the zero page
+            a.regMem({0x8D}, RAX, REG_X, step.operand);
+            a.regReg({0x0F, 0xB6}, RAX, RAX);
+            a.regMem({0x89}, RAX, RSP, 0);
+            read(step.next);
+            a.regMem({0x89}, RAX, RSP, 4);
+            a.regMem({0x8B}, RAX, RSP, 0);
+            a.regReg({0xFE}, 0, RAX); // inc al
+            read(step.next);
+            pointer();
+            return false;
+        default:
+            // MODE_INY
+            readConstant(step.operand, step.next);
+            a.regMem({0x89}, RAX, RSP, 4);
+            readConstant((step.operand + 1) & 0xFF, step.next);
+            pointer();
+            a.regMem({0x89}, RAX, RSP, 0);
+            a.regReg({0x01}, REG_Y, RAX);
+            a.regReg({0x0F, 0xB7}, RAX, RAX);
+            if (step.pageCycles)
+            {
+                a.regReg({0x89}, RAX, RCX);
+                a.regMem({0x33}, RCX, RSP, 0); // xor ecx, [rsp]
+                pageCrossed();
+            }
+            return false;
+        }
+    }
+
+    // Combine the high byte in EAX with the low byte at [rsp + 4]
+    void pointer()
+    {
+        assembler.regReg({0xC1}, 4, RAX); // shl eax, 8
+        assembler.byte(8);
+        assembler.regMem({0x0B}, RAX, RSP, 4);
+    }
+
+    // Set pageCrossed from the base address XOR the effective address in ECX
+    void pageCrossed()
+    {
+        assembler.regReg({0x81}, 7, RCX); // cmp ecx, 0xFF
+        assembler.dword(0xFF);
+        assembler.regMem({0x0F, 0x97}, 0, REG_CPU, cpu.pageCrossed); // seta
+    }
+
+    // Fetch the operand of a read into EAX
+    void operand(const Step &step)
+    {
+        if (step.mode == MODE_IMM)
+        {
+            assembler.moveImmediate(RAX, step.operand);
+            return;
+        }
+
+        uint16_t constant;
+        if (address(step, constant))
+            readConstant(constant, step.next);
+        else
+            read(step.next);
+    }
+
+    static bool readsMemory(Mode mode)
+    {
+        return mode == MODE_IMM || mode == MODE_ZER || mode == MODE_ZEX || mode == MODE_ZEY || mode == MODE_ABS ||
+               mode == MODE_ABX || mode == MODE_ABY || mode == MODE_INX || mode == MODE_INY;
+    }
+
+    /**
+     * @brief Emit one instruction that does not change the flow.
+     *
+     * @return true if it may call out and so set the exit flag.
+     */
+    bool instruction(const Step &step)
+    {
+        Assembler &a = assembler;
+        size_t stubCount = stubs.size();
+
+        switch (step.operation)
+        {
+        case OPERATION_LDA:
+        case OPERATION_LDX:
+        case OPERATION_LDY:
+        {
+            if (!readsMemory(step.mode))
+                break;
+            int reg = step.operation == OPERATION_LDA ? REG_A : step.operation == OPERATION_LDX ? REG_X : REG_Y;
+            operand(step);
+            a.regReg({0x89}, RAX, reg);
+            setZeroNegative(reg);
+            return stubs.size() != stubCount;
+        }
+        case OPERATION_AND:
+        case OPERATION_ORA:
+        case OPERATION_EOR:
+            if (!readsMemory(step.mode))
+                break;
+            operand(step);
+            a.regReg({static_cast<uint8_t>(step.operation == OPERATION_AND ? 0x21 : step.operation == OPERATION_ORA ? 0x09 : 0x31)}, RAX, REG_A);
+            setZeroNegative(REG_A);
+            return stubs.size() != stubCount;
+        case OPERATION_CMP:
+        case OPERATION_CPX:
+        case OPERATION_CPY:
+        {
+            if (!readsMemory(step.mode))
+                break;
+            int reg = step.operation == OPERATION_CMP ? REG_A : step.operation == OPERATION_CPX ? REG_X : REG_Y;
+            operand(step);
+            a.regReg({0x89}, reg, RCX);
+            a.regReg({0x29}, RAX, RCX);
+            a.regMem({0x0F, 0x93}, 0, REG_CPU, cpu.carryFlag); // setae
+            setZeroNegative(RCX);
+            return stubs.size() != stubCount;
+        }
+        case OPERATION_ADC:
+        case OPERATION_SBC:
+        {
+            if (!readsMemory(step.mode))
+                break;
+
+            // Decimal mode goes through the handler before anything is read
+            int decimal = a.label();
+            int done = a.label();
+            a.regMem({0xF6}, 0, REG_CPU, cpu.statusRegister); // test byte [status], D
+            a.byte(1 << mos6502::DECIMAL_FLAG_BIT);
+            a.jump(NOT_EQUAL, decimal);
+
+            operand(step);
+            if (step.operation == OPERATION_SBC)
+            {
+                a.byte(0x34); // xor al, 0xFF
+                a.byte(0xFF);
+            }
+            add();
+            a.bind(done);
+
+            Step decimalStep = step;
+            stubs.push_back([=]() {
+                assembler.bind(decimal);
+                fallback(decimalStep);
+                assembler.jump(ALWAYS, done);
+            });
+            return true;
+        }
+        case OPERATION_STA:
+        case OPERATION_STX:
+        case OPERATION_STY:
+        {
+            if (!readsMemory(step.mode) || step.mode == MODE_IMM)
+                break;
+            int reg = step.operation == OPERATION_STA ? REG_A : step.operation == OPERATION_STX ? REG_X : REG_Y;
+            uint16_t constant;
+            if (address(step, constant))
+                writeConstant(constant, reg, step.next);
+            else
+                write(reg, step.next);
+            return true;
+        }
+        case OPERATION_INC:
+        case OPERATION_DEC:
+        {
+            uint16_t constant;
+            bool fixed = address(step, constant);
+            if (fixed)
+                readConstant(constant, step.next);
+            else
+            {
+                a.regMem({0x89}, RAX, RSP, 0);
+                read(step.next);
+            }
+            a.regReg({0xFE}, step.operation == OPERATION_INC ? 0 : 1, RAX); // inc al / dec al
+            a.regReg({0x0F, 0xB6}, R8, RAX);
+            setZeroNegative(R8);
+            if (fixed)
+                writeConstant(constant, R8, step.next);
+            else
+            {
+                a.regMem({0x8B}, RAX, RSP, 0);
+                write(R8, step.next);
+            }
+            return true;
+        }
+        case OPERATION_INX:
+        case OPERATION_DEX:
+            a.regReg({0xFE}, step.operation == OPERATION_INX ? 0 : 1, REG_X);
+            setZeroNegative(REG_X);
+            return false;
+        case OPERATION_INY:
+        case OPERATION_DEY:
+            a.regReg({0xFE}, step.operation == OPERATION_INY ? 0 : 1, REG_Y);
+            setZeroNegative(REG_Y);
+            return false;
+        case OPERATION_TAX:
+            a.regReg({0x89}, REG_A, REG_X);
+            setZeroNegative(REG_X);
+            return false;
+        case OPERATION_TAY:
+            a.regReg({0x89}, REG_A, REG_Y);
+            setZeroNegative(REG_Y);
+            return false;
+        case OPERATION_TXA:
+            a.regReg({0x89}, REG_X, REG_A);
+            setZeroNegative(REG_A);
+            return false;
+        case OPERATION_TYA:
+            a.regReg({0x89}, REG_Y, REG_A);
+            setZeroNegative(REG_A);
+            return false;
+        case OPERATION_TSX:
+            a.regMem({0x0F, 0xB6}, REG_X, REG_CPU, cpu.stackPointer);
+            setZeroNegative(REG_X);
+            return false;
+        case OPERATION_TXS:
+            a.regMem({0x88}, REG_X, REG_CPU, cpu.stackPointer);
+            return false;
+        case OPERATION_CLC:
+        case OPERATION_SEC:
+            a.regMem({0xC6}, 0, REG_CPU, cpu.carryFlag);
+            a.byte(step.operation == OPERATION_SEC);
+            return false;
+        case OPERATION_NOP:
+        {
+            // Indexed NOPs still take the page crossing cycle
+            uint16_t constant;
+            if (step.pageCycles)
+                address(step, constant);
+            return false;
+        }
+        case OPERATION_ASL_ACC:
+            a.regReg({0x89}, REG_A, RAX);
+            a.regReg({0xC1}, 5, RAX); // shr eax, 7
+            a.byte(7);
+            a.regMem({0x88}, RAX, REG_CPU, cpu.carryFlag);
+            a.regReg({0xD0}, 4, REG_A); // shl a, 1
+            setZeroNegative(REG_A);
+            return false;
+        case OPERATION_LSR_ACC:
+            a.regReg({0x89}, REG_A, RAX);
+            a.regReg({0x83}, 4, RAX); // and eax, 1
+            a.byte(1);
+            a.regMem({0x88}, RAX, REG_CPU, cpu.carryFlag);
+            a.regReg({0xD0}, 5, REG_A); // shr a, 1
+            setZeroNegative(REG_A);
+            return false;
+        case OPERATION_ROL_ACC:
+            a.regMem({0x0F, 0xB6}, RAX, REG_CPU, cpu.carryFlag);
+            a.regReg({0x89}, REG_A, RCX);
+            a.regReg({0xC1}, 5, RCX); // shr ecx, 7
+            a.byte(7);
+            a.regMem({0x88}, RCX, REG_CPU, cpu.carryFlag);
+            a.regReg({0xD0}, 4, REG_A);
+            a.regReg({0x09}, RAX, REG_A);
+            setZeroNegative(REG_A);
+            return false;
+        case OPERATION_ROR_ACC:
+            a.regMem({0x0F, 0xB6}, RAX, REG_CPU, cpu.carryFlag);
+            a.regReg({0xC1}, 4, RAX); // shl eax, 7
+            a.byte(7);
+            a.regReg({0x89}, REG_A, RCX);
+            a.regReg({0x83}, 4, RCX); // and ecx, 1
+            a.byte(1);
+            a.regMem({0x88}, RCX, REG_CPU, cpu.carryFlag);
+            a.regReg({0xD0}, 5, REG_A);
+            a.regReg({0x09}, RAX, REG_A);
+            setZeroNegative(REG_A);
+            return false;
+        case OPERATION_PHA:
+            // Write, then decrement SP, like pushStack()
+            a.regMem({0x0F, 0xB6}, RAX, REG_CPU, cpu.stackPointer);
+            a.regReg({0x81}, 1, RAX); // or eax, 0x100
+            a.dword(0x100);
+            write(REG_A, step.next);
+            a.regMem({0xFE}, 1, REG_CPU, cpu.stackPointer);
+            return true;
+        case OPERATION_PLA:
+            a.regMem({0xFE}, 0, REG_CPU, cpu.stackPointer);
+            a.regMem({0x0F, 0xB6}, RAX, REG_CPU, cpu.stackPointer);
+            a.regReg({0x81}, 1, RAX);
+            a.dword(0x100);
+            read(step.next);
+            a.regReg({0x89}, RAX, REG_A);
+            setZeroNegative(REG_A);
+            return true;
+        default:
+            break;
+        }
+
+        fallback(step);
+        return true;
+    }
+
+    // Binary ADC of the operand in EAX, same as mos6502::addBinary()
+    void add()
+    {
+        Assembler &a = assembler;
+
+        a.regMem({0x0F, 0xB6}, RDX, REG_CPU, cpu.carryFlag);
+        a.regReg({0x89}, REG_A, RCX);
+        a.regReg({0x01}, RAX, RCX);
+        a.regReg({0x01}, RDX, RCX);
+
+        // V from ~(A ^ operand) & (A ^ result)
+        a.regReg({0x89}, REG_A, RDX);
+        a.regReg({0x31}, RAX, RDX);
+        a.regReg({0xF7}, 2, RDX); // not edx
+        a.regReg({0x89}, REG_A, R8);
+        a.regReg({0x31}, RCX, R8);
+        a.regReg({0x21}, R8, RDX);
+        a.regMem({0x88}, RDX, REG_CPU, cpu.overflowResult);
+
+        a.regReg({0x89}, RCX, RDX);
+        a.regReg({0xC1}, 5, RDX); // shr edx, 8
+        a.byte(8);
+        a.regMem({0x88}, RDX, REG_CPU, cpu.carryFlag);
+
+        a.regReg({0x0F, 0xB6}, REG_A, RCX);
+        setZeroNegative(REG_A);
+    }
+};
+
+} // namespace
+
+#endif
+
+mos6502::BlockCache::~BlockCache()
+{
+    if (code)
+        munmap(code, codeCapacity);
+}
+
+bool mos6502::jitMustExit()
+{
+    return blockCache->invalidated || stopRequested || nextEventCycle != blockCache->eventCycle;
+}
+uint32_t mos6502::jitRead(mos6502 *cpu, uint32_t address)
+{
+    uint8_t value = cpu->readSlow(address);
+    return value | (cpu->jitMustExit() ? 0x100 : 0);
+}
+uint32_t mos6502::jitWrite(mos6502 *cpu, uint32_t address, uint32_t data)
+{
+    cpu->writeSlow(address, data);
+    return cpu->jitMustExit();
+}
+uint32_t mos6502::jitExecute(mos6502 *cpu, uint32_t operand, uint32_t opcode)
+{
+    DecodedHandlers[opcode](*cpu, operand);
+    return cpu->jitMustExit();
+}
+
+mos6502::NativeBlock mos6502::translateBlock(const Block &block)
+{
+#if defined(__x86_64__)
+    BlockCache &cache = *blockCache;
+
+    if (cache.jitUnavailable)
+        return NULL;
+
+    if (!cache.code)
+    {
+        void *buffer = mmap(NULL, jitBufferSize, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buffer == MAP_FAILED)
+        {
+            std::cerr << "Error: Unable to allocate executable memory, blocks run without the JIT." << std::endl;
+            cache.jitUnavailable = true;
+            return NULL;
+        }
+
+        cache.code = static_cast<uint8_t *>(buffer);
+        cache.codeCapacity = jitBufferSize;
+    }
+
+#define JIT_OFFSET(member) static_cast<int32_t>(reinterpret_cast<const char *>(&member) - reinterpret_cast<const char *>(this))
+    CpuLayout layout;
+    layout.programCounter = JIT_OFFSET(programCounter);
+    layout.stackPointer = JIT_OFFSET(stackPointer);
+    layout.statusRegister = JIT_OFFSET(statusRegister);
+    layout.accumulator = JIT_OFFSET(accumulator);
+    layout.xRegister = JIT_OFFSET(xRegister);
+    layout.yRegister = JIT_OFFSET(yRegister);
+    layout.carryFlag = JIT_OFFSET(carryFlag);
+    layout.zeroResult = JIT_OFFSET(zeroResult);
+    layout.negativeResult = JIT_OFFSET(negativeResult);
+    layout.overflowResult = JIT_OFFSET(overflowResult);
+    layout.readPages = JIT_OFFSET(bus.readPages);
+    layout.writePages = JIT_OFFSET(bus.writePages);
+    layout.instructionCount = JIT_OFFSET(instructionCount);
+    layout.cycleCount = JIT_OFFSET(cycleCount);
+    layout.pageCrossed = JIT_OFFSET(pageCrossed);
+#undef JIT_OFFSET
+    layout.read = reinterpret_cast<uint64_t>(&mos6502::jitRead);
+    layout.write = reinterpret_cast<uint64_t>(&mos6502::jitWrite);
+    layout.execute = reinterpret_cast<uint64_t>(&mos6502::jitExecute);
+
+    // The opcodes were read from memory by decodeBlock() just before
+    std::vector<Step> steps(block.count);
+    for (uint32_t i = 0; i < block.count; i++)
+    {
+        const DecodedInstruction &decoded = cache.instructions[block.first + i];
+        Step &step = steps[i];
+
+        step.opcode = bus.readPages[decoded.address >> 8][decoded.address & 0xFF];
+        step.operation = opcodeInfo[step.opcode].operation;
+        step.mode = opcodeInfo[step.opcode].mode;
+        step.operand = decoded.operand;
+        step.address = decoded.address;
+        step.next = decoded.next;
+        step.cycles = decoded.cycles;
+        step.pageCycles = decoded.pageCycles;
+    }
+
+    Translator translator(layout);
+    translator.translate(steps, block.start);
+    const std::vector<uint8_t> &code = translator.assembler.code;
+
+    if (cache.codeUsed + code.size() > cache.codeCapacity)
+    {
+        cache.codeFull = true;
+        return NULL;
+    }
+
+    uint8_t *entry = cache.code + cache.codeUsed;
+    std::memcpy(entry, code.data(), code.size());
+    cache.codeUsed = (cache.codeUsed + code.size() + 15) & ~static_cast<size_t>(15);
+
+    return reinterpret_cast<NativeBlock>(entry);
+#else
+    return NULL;
+#endif
+}
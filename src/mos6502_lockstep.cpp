@@ -0,0 +1,1390 @@
+#include "../include/mos6502_lockstep.h"
+
+#include <chrono>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// The lanes are compiled for AVX2 and for the SSE2 baseline of x86-64, picked when the program loads
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__)
+#define LANE_TARGETS __attribute__((target_clones("avx2", "default")))
+#else
+#define LANE_TARGETS
+#endif
+
+#define LANE_INLINE inline __attribute__((always_inline))
+
+namespace
+{
+
+const int LANES = LockstepRunner::LANES;
+
+// A lane waiting 1 << SPILL_SHIFT vector steps for the other lanes has its job finished on a scalar CPU
+const int SPILL_SHIFT = 10;
+
+// The cycle budgets are checked in batches, the lane counters since the last check stay below this
+const uint32_t FLUSH_CYCLES = 0xF000;
+
+// One byte or word per lane. Masks are all ones in the selected lanes.
+typedef uint8_t LaneBytes __attribute__((vector_size(LANES)));
+typedef int8_t LaneMask __attribute__((vector_size(LANES)));
+typedef uint16_t LaneWords __attribute__((vector_size(2 * LANES)));
+typedef int16_t LaneWordMask __attribute__((vector_size(2 * LANES)));
+
+LANE_INLINE uint32_t laneBits(const LaneMask &mask)
+{
+#if defined(__SSE2__)
+    __m128i low;
+    __m128i high;
+    std::memcpy(&low, &mask, 16);
+    std::memcpy(&high, reinterpret_cast<const uint8_t *>(&mask) + 16, 16);
+    return static_cast<uint32_t>(_mm_movemask_epi8(low)) | static_cast<uint32_t>(_mm_movemask_epi8(high)) << 16;
+#else
+    uint32_t bits = 0;
+    for (int lane = 0; lane < LANES; lane++)
+        bits |= static_cast<uint32_t>(mask[lane] & 1) << lane;
+    return bits;
+#endif
+}
+
+// Narrow 16-bit lanes to their low byte, the compiler would otherwise do it one lane at a time
+LANE_INLINE void narrow(const LaneWords &words, LaneBytes &bytes)
+{
+#if defined(__SSE2__)
+    LaneWords low = words & 0xFF;
+    __m128i parts[4];
+    std::memcpy(parts, &low, sizeof(parts));
+
+    __m128i packed[2] = {_mm_packus_epi16(parts[0], parts[1]), _mm_packus_epi16(parts[2], parts[3])};
+    std::memcpy(&bytes, packed, sizeof(packed));
+#else
+    bytes = __builtin_convertvector(words, LaneBytes);
+#endif
+}
+
+LANE_INLINE void narrow(const LaneWordMask &words, LaneMask &mask)
+{
+    LaneBytes bytes;
+    narrow((LaneWords)words, bytes);
+    mask = (LaneMask)bytes;
+}
+
+// Masks and selections are built from bit operations, subtractions and shifts, which the compiler
+// splits to the vector width of the target. Comparisons and ?: on vectors wider than that would go lane by lane.
+
+LANE_INLINE void blend(const LaneMask &mask, const LaneBytes &value, LaneBytes &target)
+{
+    target = (value & (LaneBytes)mask) | (target & ~(LaneBytes)mask);
+}
+
+LANE_INLINE void blend(const LaneWordMask &mask, const LaneWords &value, LaneWords &target)
+{
+    target = (value & (LaneWords)mask) | (target & ~(LaneWords)mask);
+}
+
+// All ones in the lanes where the value is not zero
+LANE_INLINE void nonZero(const LaneBytes &value, LaneMask &mask)
+{
+    mask = (LaneMask)(LaneBytes() - ((value | (LaneBytes() - value)) >> 7));
+}
+
+LANE_INLINE void nonZero(const LaneWords &value, LaneWordMask &mask)
+{
+    mask = (LaneWordMask)(LaneWords() - ((value | (LaneWords() - value)) >> 15));
+}
+
+LANE_INLINE void equal(const LaneBytes &value, uint8_t other, LaneMask &mask)
+{
+    nonZero(value ^ other, mask);
+    mask = ~mask;
+}
+
+LANE_INLINE void equal(const LaneWords &value, uint16_t other, LaneMask &mask)
+{
+    LaneWordMask different;
+    nonZero(value ^ other, different);
+    narrow(~different, mask);
+}
+
+// All ones in the lanes where bit 0 of the value is set
+LANE_INLINE void bitMask(const LaneBytes &value, LaneMask &mask)
+{
+    mask = (LaneMask)(LaneBytes() - (value & 0x01));
+}
+
+/**
+ * @brief The effective address of an instruction in every lane.
+ *
+ * @param uniform Whether all executing lanes use the same address.
+ * @param address The address when uniform.
+ * @param addresses The address of each lane.
+ * @param crossed The lanes whose indexed address crossed a page.
+ */
+struct LaneAddress
+{
+    bool uniform;
+    uint16_t address;
+    LaneWords addresses;
+    LaneMask crossed;
+};
+
+/**
+ * @brief The state of LANES CPUs executing together.
+ *
+ * The instruction methods mirror Core6502 and keep the flags the same lazy
+ * way, only the lanes in the active mask are changed.
+ */
+struct LaneGroup
+{
+    // The address spaces of all lanes interleaved, byte address * LANES + lane
+    uint8_t *memory;
+
+    LaneWords programCounter;
+    LaneBytes stackPointer;
+    LaneBytes accumulator;
+    LaneBytes xRegister;
+    LaneBytes yRegister;
+
+    // Flags as in Core6502: carry is 0 or 1, Z is set while zeroResult is 0, N and V are bit 7 of theirs
+    LaneBytes statusRegister;
+    LaneBytes carryFlag;
+    LaneBytes zeroResult;
+    LaneBytes negativeResult;
+    LaneBytes overflowResult;
+
+    // Counts since the last flush(), no lane ran more cycles than guard since then
+    LaneWords cycleDelta;
+    LaneWords instructionDelta;
+    uint32_t guard;
+
+    // flush() is due once guard reaches this, the least cycles left in the budget of a running lane
+    uint32_t slack;
+
+    uint64_t cycles[LANES];
+    uint64_t instructions[LANES];
+    uint64_t maxCycles[LANES];
+
+    // Vector steps each running lane has been waiting for the others
+    LaneWords waited;
+
+    LaneMask running;
+    uint32_t runningBits;
+    mos6502::run_status status[LANES];
+
+    // Lanes that waited too long, set when runLanes() returns for them to be finished on a scalar CPU
+    uint32_t spillBits;
+
+    uint64_t steps;
+    uint64_t laneInstructions;
+
+    // The instruction executing and the lanes executing it
+    LaneMask active;
+    LaneWordMask activeWords;
+    uint32_t activeBits;
+    int firstLane;
+    uint16_t opcodeAddress;
+    uint16_t operand;
+
+    // The PC after the instruction and the cycles taken on top of the base count
+    LaneWords next;
+    LaneBytes extraCycles;
+
+    LANE_INLINE uint8_t *row(uint16_t address)
+    {
+        return memory + static_cast<size_t>(address) * LANES;
+    }
+
+    LANE_INLINE void loadRow(uint16_t address, LaneBytes &value)
+    {
+        std::memcpy(&value, row(address), LANES);
+    }
+
+    LANE_INLINE void assign(LaneBytes &reg, const LaneBytes &value)
+    {
+        blend(active, value, reg);
+    }
+
+    LANE_INLINE void setZN(const LaneBytes &value)
+    {
+        blend(active, value, zeroResult);
+        blend(active, value, negativeResult);
+    }
+
+    // Memory
+
+    LANE_INLINE void makeUniform(LaneAddress &ea)
+    {
+        ea.address = ea.addresses[firstLane];
+
+        LaneMask same;
+        equal(ea.addresses, ea.address, same);
+        ea.uniform = (laneBits(same) & activeBits) == activeBits;
+    }
+
+    LANE_INLINE void load(const LaneAddress &ea, LaneBytes &value)
+    {
+        if (ea.uniform)
+        {
+            loadRow(ea.address, value);
+            return;
+        }
+
+        gather(ea, value);
+    }
+
+    // Lane by lane, when the lanes access different addresses
+    __attribute__((noinline)) void gather(const LaneAddress &ea, LaneBytes &value)
+    {
+        value = LaneBytes();
+        for (uint32_t bits = activeBits; bits; bits &= bits - 1)
+        {
+            int lane = __builtin_ctz(bits);
+            value[lane] = memory[static_cast<size_t>(ea.addresses[lane]) * LANES + lane];
+        }
+    }
+
+    LANE_INLINE void store(const LaneAddress &ea, const LaneBytes &value)
+    {
+        if (ea.uniform)
+        {
+            LaneBytes old;
+            loadRow(ea.address, old);
+            blend(active, value, old);
+            std::memcpy(row(ea.address), &old, LANES);
+            return;
+        }
+
+        scatter(ea, value);
+    }
+
+    __attribute__((noinline)) void scatter(const LaneAddress &ea, const LaneBytes &value)
+    {
+        for (uint32_t bits = activeBits; bits; bits &= bits - 1)
+        {
+            int lane = __builtin_ctz(bits);
+            memory[static_cast<size_t>(ea.addresses[lane]) * LANES + lane] = value[lane];
+        }
+    }
+
+    LANE_INLINE void stackAddress(LaneAddress &ea)
+    {
+        ea.addresses = __builtin_convertvector(stackPointer, LaneWords) + 0x0100;
+        makeUniform(ea);
+    }
+
+    LANE_INLINE void pushStack(const LaneBytes &value)
+    {
+        LaneAddress ea;
+        stackAddress(ea);
+        store(ea, value);
+        assign(stackPointer, stackPointer - 1);
+    }
+
+    LANE_INLINE void popStack(LaneBytes &value)
+    {
+        assign(stackPointer, stackPointer + 1);
+        LaneAddress ea;
+        stackAddress(ea);
+        load(ea, value);
+    }
+
+    LANE_INLINE void getSR(LaneBytes &value)
+    {
+        LaneMask notZero;
+        nonZero(zeroResult, notZero);
+
+        value = (negativeResult & 0x80) |
+                (overflowResult & 0x80) >> 1 |
+                (statusRegister & 0x3C) |
+                ((LaneBytes)~notZero & 0x02) |
+                carryFlag;
+    }
+
+    LANE_INLINE void setSR(const LaneBytes &value)
+    {
+        assign(statusRegister, value & 0x3C);
+        assign(carryFlag, value & 0x01);
+        assign(zeroResult, ((value >> 1) & 0x01) ^ 0x01);
+        assign(negativeResult, value);
+        assign(overflowResult, value << 1);
+    }
+
+    LANE_INLINE void retire(uint32_t bits, mos6502::run_status reason)
+    {
+        for (uint32_t left = bits; left; left &= left - 1)
+        {
+            int lane = __builtin_ctz(left);
+            status[lane] = reason;
+            running[lane] = 0;
+        }
+        runningBits &= ~bits;
+    }
+
+    /**
+     * @brief Add the counts since the last call to the totals and stop the lanes that used up their budget.
+     */
+    void flush()
+    {
+        for (int lane = 0; lane < LANES; lane++)
+        {
+            cycles[lane] += cycleDelta[lane];
+            instructions[lane] += instructionDelta[lane];
+        }
+        cycleDelta = LaneWords();
+        instructionDelta = LaneWords();
+        guard = 0;
+
+        uint64_t least = FLUSH_CYCLES;
+        uint32_t exhausted = 0;
+        for (uint32_t bits = runningBits; bits; bits &= bits - 1)
+        {
+            int lane = __builtin_ctz(bits);
+            if (cycles[lane] >= maxCycles[lane])
+                exhausted |= 1u << lane;
+            else if (maxCycles[lane] - cycles[lane] < least)
+                least = maxCycles[lane] - cycles[lane];
+        }
+        retire(exhausted, mos6502::RUN_BUDGET_EXHAUSTED);
+
+        slack = least;
+    }
+
+    // Instruction boundaries
+
+    /**
+     * @brief Drop the lanes whose operand bytes differ from the first lane's and set up the instruction.
+     *
+     * @param bytes The length of the instruction.
+     */
+    LANE_INLINE void fetch(int bytes)
+    {
+        operand = 0;
+        if (bytes > 1)
+        {
+            LaneBytes low;
+            loadRow(opcodeAddress + 1, low);
+            uint8_t lowByte = low[firstLane];
+
+            LaneMask same;
+            equal(low, lowByte, same);
+            active &= same;
+            operand = lowByte;
+        }
+        if (bytes > 2)
+        {
+            LaneBytes high;
+            loadRow(opcodeAddress + 2, high);
+            uint8_t highByte = high[firstLane];
+
+            LaneMask same;
+            equal(high, highByte, same);
+            active &= same;
+            operand |= highByte << 8;
+        }
+
+        activeBits = laneBits(active);
+        activeWords = __builtin_convertvector(active, LaneWordMask);
+        next = LaneWords() + static_cast<uint16_t>(opcodeAddress + bytes);
+        extraCycles = LaneBytes();
+    }
+
+    LANE_INLINE void finish(uint8_t baseCycles)
+    {
+        blend(activeWords, next, programCounter);
+        cycleDelta += (LaneWords)activeWords & (__builtin_convertvector(extraCycles, LaneWords) + baseCycles);
+        instructionDelta -= (LaneWords)activeWords;
+
+        // At most one page crossing or two branch cycles on top of the base count
+        guard += baseCycles + 2;
+
+        steps++;
+        laneInstructions += __builtin_popcount(activeBits);
+
+        // Without interrupts an instruction that lands on itself never makes progress
+        LaneMask trapped;
+        equal(next, opcodeAddress, trapped);
+        trapped &= active;
+        uint32_t trappedBits = laneBits(trapped);
+        if (trappedBits)
+        {
+            retire(trappedBits, mos6502::RUN_TRAPPED);
+            active &= ~trapped;
+            activeBits &= ~trappedBits;
+        }
+    }
+
+    // Addressing modes
+
+    LANE_INLINE void addressingIMP(LaneAddress &ea)
+    {
+    }
+    LANE_INLINE void addressingIMM(LaneAddress &ea)
+    {
+        ea.uniform = true;
+        ea.address = opcodeAddress + 1;
+    }
+    LANE_INLINE void addressingABS(LaneAddress &ea)
+    {
+        ea.uniform = true;
+        ea.address = operand;
+    }
+    LANE_INLINE void addressingZER(LaneAddress &ea)
+    {
+        ea.uniform = true;
+        ea.address = operand;
+    }
+    LANE_INLINE void addressingZEX(LaneAddress &ea)
+    {
+        ea.addresses = (__builtin_convertvector(xRegister, LaneWords) + operand) & 0xFF;
+        makeUniform(ea);
+    }
+    LANE_INLINE void addressingZEY(LaneAddress &ea)
+    {
+        ea.addresses = (__builtin_convertvector(yRegister, LaneWords) + operand) & 0xFF;
+        makeUniform(ea);
+    }
+    LANE_INLINE void addressingABX(LaneAddress &ea)
+    {
+        ea.addresses = __builtin_convertvector(xRegister, LaneWords) + operand;
+        LaneWordMask crossed;
+        nonZero((ea.addresses ^ operand) >> 8, crossed);
+        narrow(crossed, ea.crossed);
+        makeUniform(ea);
+    }
+    LANE_INLINE void addressingABY(LaneAddress &ea)
+    {
+        ea.addresses = __builtin_convertvector(yRegister, LaneWords) + operand;
+        LaneWordMask crossed;
+        nonZero((ea.addresses ^ operand) >> 8, crossed);
+        narrow(crossed, ea.crossed);
+        makeUniform(ea);
+    }
+    LANE_INLINE void addressingREL(LaneAddress &ea)
+    {
+        ea.uniform = true;
+        ea.address = opcodeAddress + 2 + static_cast<int8_t>(operand);
+    }
+    LANE_INLINE void addressingINX(LaneAddress &ea)
+    {
+        LaneAddress pointer;
+        pointer.addresses = (__builtin_convertvector(xRegister, LaneWords) + operand) & 0xFF;
+        makeUniform(pointer);
+
+        LaneBytes lowByte;
+        load(pointer, lowByte);
+
+        pointer.address = (pointer.address + 1) & 0xFF;
+        pointer.addresses = (pointer.addresses + 1) & 0xFF;
+
+        LaneBytes highByte;
+        load(pointer, highByte);
+
+        ea.addresses = __builtin_convertvector(highByte, LaneWords) << 8 | __builtin_convertvector(lowByte, LaneWords);
+        makeUniform(ea);
+    }
+    LANE_INLINE void addressingINY(LaneAddress &ea)
+    {
+        LaneBytes lowByte;
+        LaneBytes highByte;
+        loadRow(operand, lowByte);
+        loadRow((operand + 1) & 0xFF, highByte);
+
+        LaneWords pointer = __builtin_convertvector(highByte, LaneWords) << 8 | __builtin_convertvector(lowByte, LaneWords);
+
+        ea.addresses = pointer + __builtin_convertvector(yRegister, LaneWords);
+        LaneWordMask crossed;
+        nonZero((pointer ^ ea.addresses) >> 8, crossed);
+        narrow(crossed, ea.crossed);
+        makeUniform(ea);
+    }
+    LANE_INLINE void addressingIND(LaneAddress &ea)
+    {
+        LaneBytes lowByte;
+        LaneBytes highByte;
+        loadRow(operand, lowByte);
+        loadRow(operand + 1, highByte);
+
+        ea.addresses = __builtin_convertvector(highByte, LaneWords) << 8 | __builtin_convertvector(lowByte, LaneWords);
+        makeUniform(ea);
+    }
+
+    // Arithmetic shared by ADC and SBC
+
+    LANE_INLINE void add(const LaneBytes &operand, uint8_t invert, const uint16_t *table)
+    {
+        // A - M - borrow is A + ~M + carry in binary, the decimal table takes M as it is
+        LaneBytes value = operand ^ invert;
+
+        LaneWords sum = __builtin_convertvector(accumulator, LaneWords) +
+                        __builtin_convertvector(value, LaneWords) +
+                        __builtin_convertvector(carryFlag, LaneWords);
+
+        LaneBytes result;
+        LaneBytes carry;
+        narrow(sum, result);
+        narrow(sum >> 8, carry);
+        LaneBytes overflow = ~(accumulator ^ value) & (accumulator ^ result);
+        LaneBytes zero = result;
+        LaneBytes negative = result;
+
+        // Lanes in decimal mode look their result up one by one
+        LaneMask decimal;
+        bitMask(statusRegister >> 3, decimal);
+
+        uint32_t decimalBits = laneBits(active & decimal);
+        for (uint32_t bits = decimalBits; bits; bits &= bits - 1)
+        {
+            int lane = __builtin_ctz(bits);
+            uint16_t entry = table[carryFlag[lane] << 16 | accumulator[lane] << 8 | operand[lane]];
+
+            result[lane] = entry & 0xFF;
+            carry[lane] = (entry >> 8) & 1;
+            negative[lane] = (entry & ALU_NEGATIVE) >> 2;
+            overflow[lane] = (entry & ALU_OVERFLOW) >> 3;
+            zero[lane] = (~entry & ALU_ZERO) >> 11;
+        }
+
+        assign(accumulator, result);
+        assign(carryFlag, carry);
+        assign(overflowResult, overflow);
+        assign(zeroResult, zero);
+        assign(negativeResult, negative);
+    }
+
+    LANE_INLINE void compare(const LaneBytes &reg, const LaneAddress &ea)
+    {
+        LaneBytes value;
+        load(ea, value);
+
+        // The borrow out of bit 7 of reg - value
+        LaneBytes borrow = ((~reg & value) | (~(reg ^ value) & (reg - value))) >> 7;
+
+        assign(carryFlag, borrow ^ 0x01);
+        setZN(reg - value);
+    }
+
+    LANE_INLINE void branch(const LaneMask &condition, const LaneAddress &ea)
+    {
+        LaneMask taken = active & condition;
+        LaneWordMask takenWords = __builtin_convertvector(taken, LaneWordMask);
+
+        // One extra cycle for a taken branch, two if it lands on another page
+        uint8_t extra = ((static_cast<uint16_t>(opcodeAddress + 2) ^ ea.address) > 0xFF) ? 2 : 1;
+
+        blend(takenWords, LaneWords() + ea.address, next);
+        extraCycles = (LaneBytes)taken & extra;
+    }
+
+    // Opcodes
+
+    LANE_INLINE void ADC(const LaneAddress &ea)
+    {
+        LaneBytes value;
+        load(ea, value);
+        add(value, 0x00, DecimalTables::get().adc);
+    }
+    LANE_INLINE void AND(const LaneAddress &ea)
+    {
+        LaneBytes value;
+        load(ea, value);
+        assign(accumulator, accumulator & value);
+        setZN(accumulator);
+    }
+    LANE_INLINE void ASL(const LaneAddress &ea)
+    {
+        LaneBytes value;
+        load(ea, value);
+        assign(carryFlag, value >> 7);
+        value <<= 1;
+        setZN(value);
+        store(ea, value);
+    }
+    LANE_INLINE void ASL_ACC(const LaneAddress &ea)
+    {
+        assign(carryFlag, accumulator >> 7);
+        assign(accumulator, accumulator << 1);
+        setZN(accumulator);
+    }
+    LANE_INLINE void BCC(const LaneAddress &ea)
+    {
+        LaneMask carrySet;
+        bitMask(carryFlag, carrySet);
+        branch(~carrySet, ea);
+    }
+    LANE_INLINE void BCS(const LaneAddress &ea)
+    {
+        LaneMask carrySet;
+        bitMask(carryFlag, carrySet);
+        branch(carrySet, ea);
+    }
+    LANE_INLINE void BEQ(const LaneAddress &ea)
+    {
+        LaneMask notZero;
+        nonZero(zeroResult, notZero);
+        branch(~notZero, ea);
+    }
+    LANE_INLINE void BIT(const LaneAddress &ea)
+    {
+        LaneBytes value;
+        load(ea, value);
+
+        // N and V come straight from bits 7 and 6 of the operand
+        assign(negativeResult, value);
+        assign(overflowResult, value << 1);
+        assign(zeroResult, accumulator & value);
+    }
+    LANE_INLINE void BMI(const LaneAddress &ea)
+    {
+        LaneMask negative;
+        bitMask(negativeResult >> 7, negative);
+        branch(negative, ea);
+    }
+    LANE_INLINE void BNE(const LaneAddress &ea)
+    {
+        LaneMask notZero;
+        nonZero(zeroResult, notZero);
+        branch(notZero, ea);
+    }
+    LANE_INLINE void BPL(const LaneAddress &ea)
+    {
+        LaneMask negative;
+        bitMask(negativeResult >> 7, negative);
+        branch(~negative, ea);
+    }
+    LANE_INLINE void BRK(const LaneAddress &ea)
+    {
+        uint16_t returnAddress = opcodeAddress + 2;
+        pushStack(LaneBytes() + static_cast<uint8_t>(returnAddress >> 8));
+        pushStack(LaneBytes() + static_cast<uint8_t>(returnAddress));
+
+        LaneBytes status;
+        getSR(status);
+        pushStack(status | 0x30);
+        assign(statusRegister, statusRegister | 0x04);
+
+        LaneBytes lowByte;
+        LaneBytes highByte;
+        loadRow(IRQ_VECTOR_L, lowByte);
+        loadRow(IRQ_VECTOR_H, highByte);
+        next = __builtin_convertvector(highByte, LaneWords) << 8 | __builtin_convertvector(lowByte, LaneWords);
+    }
+    LANE_INLINE void BVC(const LaneAddress &ea)
+    {
+        LaneMask overflow;
+        bitMask(overflowResult >> 7, overflow);
+        branch(~overflow, ea);
+    }
+    LANE_INLINE void BVS(const LaneAddress &ea)
+    {
+        LaneMask overflow;
+        bitMask(overflowResult >> 7, overflow);
+        branch(overflow, ea);
+    }
+    LANE_INLINE void CLC(const LaneAddress &ea)
+    {
+        assign(carryFlag, LaneBytes());
+    }
+    LANE_INLINE void CLD(const LaneAddress &ea)
+    {
+        assign(statusRegister, statusRegister & ~0x08);
+    }
+    LANE_INLINE void CLI(const LaneAddress &ea)
+    {
+        assign(statusRegister, statusRegister & ~0x04);
+    }
+    LANE_INLINE void CLV(const LaneAddress &ea)
+    {
+        assign(overflowResult, LaneBytes());
+    }
+    LANE_INLINE void CMP(const LaneAddress &ea)
+    {
+        compare(accumulator, ea);
+    }
+    LANE_INLINE void CPX(const LaneAddress &ea)
+    {
+        compare(xRegister, ea);
+    }
+    LANE_INLINE void CPY(const LaneAddress &ea)
+    {
+        compare(yRegister, ea);
+    }
+    LANE_INLINE void DEC(const LaneAddress &ea)
+    {
+        LaneBytes value;
+        load(ea, value);
+        value -= 1;
+        setZN(value);
+        store(ea, value);
+    }
+    LANE_INLINE void DEX(const LaneAddress &ea)
+    {
+        assign(xRegister, xRegister - 1);
+        setZN(xRegister);
+    }
+    LANE_INLINE void DEY(const LaneAddress &ea)
+    {
+        assign(yRegister, yRegister - 1);
+        setZN(yRegister);
+    }
+    LANE_INLINE void EOR(const LaneAddress &ea)
+    {
+        LaneBytes value;
+        load(ea, value);
+        assign(accumulator, accumulator ^ value);
+        setZN(accumulator);
+    }
+    LANE_INLINE void INC(const LaneAddress &ea)
+    {
+        LaneBytes value;
+        load(ea, value);
+        value += 1;
+        setZN(value);
+        store(ea, value);
+    }
+    LANE_INLINE void INX(const LaneAddress &ea)
+    {
+        assign(xRegister, xRegister + 1);
+        setZN(xRegister);
+    }
+    LANE_INLINE void INY(const LaneAddress &ea)
+    {
+        assign(yRegister, yRegister + 1);
+        setZN(yRegister);
+    }
+    LANE_INLINE void JMP(const LaneAddress &ea)
+    {
+        next = ea.uniform ? LaneWords() + ea.address : ea.addresses;
+    }
+    LANE_INLINE void JSR(const LaneAddress &ea)
+    {
+        uint16_t returnAddress = opcodeAddress + 2;
+        pushStack(LaneBytes() + static_cast<uint8_t>(returnAddress >> 8));
+        pushStack(LaneBytes() + static_cast<uint8_t>(returnAddress));
+
+        next = LaneWords() + ea.address;
+    }
+    LANE_INLINE void LDA(const LaneAddress &ea)
+    {
+        LaneBytes value;
+        load(ea, value);
+        assign(accumulator, value);
+        setZN(value);
+    }
+    LANE_INLINE void LDX(const LaneAddress &ea)
+    {
+        LaneBytes value;
+        load(ea, value);
+        assign(xRegister, value);
+        setZN(value);
+    }
+    LANE_INLINE void LDY(const LaneAddress &ea)
+    {
+        LaneBytes value;
+        load(ea, value);
+        assign(yRegister, value);
+        setZN(value);
+    }
+    LANE_INLINE void LSR(const LaneAddress &ea)
+    {
+        LaneBytes value;
+        load(ea, value);
+        assign(carryFlag, value & 0x01);
+        value >>= 1;
+        setZN(value);
+        store(ea, value);
+    }
+    LANE_INLINE void LSR_ACC(const LaneAddress &ea)
+    {
+        assign(carryFlag, accumulator & 0x01);
+        assign(accumulator, accumulator >> 1);
+        setZN(accumulator);
+    }
+    LANE_INLINE void NOP(const LaneAddress &ea)
+    {
+    }
+    LANE_INLINE void ORA(const LaneAddress &ea)
+    {
+        LaneBytes value;
+        load(ea, value);
+        assign(accumulator, accumulator | value);
+        setZN(accumulator);
+    }
+    LANE_INLINE void PHA(const LaneAddress &ea)
+    {
+        pushStack(accumulator);
+    }
+    LANE_INLINE void PHP(const LaneAddress &ea)
+    {
+        LaneBytes status;
+        getSR(status);
+        pushStack(status | 0x30);
+    }
+    LANE_INLINE void PLA(const LaneAddress &ea)
+    {
+        LaneBytes value;
+        popStack(value);
+        assign(accumulator, value);
+        setZN(value);
+    }
+    LANE_INLINE void PLP(const LaneAddress &ea)
+    {
+        LaneBytes value;
+        popStack(value);
+        setSR(value & ~0x30);
+    }
+    LANE_INLINE void ROL(const LaneAddress &ea)
+    {
+        LaneBytes value;
+        load(ea, value);
+        LaneBytes result = value << 1 | carryFlag;
+        assign(carryFlag, value >> 7);
+        setZN(result);
+        store(ea, result);
+    }
+    LANE_INLINE void ROL_ACC(const LaneAddress &ea)
+    {
+        LaneBytes result = accumulator << 1 | carryFlag;
+        assign(carryFlag, accumulator >> 7);
+        assign(accumulator, result);
+        setZN(result);
+    }
+    LANE_INLINE void ROR(const LaneAddress &ea)
+    {
+        LaneBytes value;
+        load(ea, value);
+        LaneBytes result = value >> 1 | carryFlag << 7;
+        assign(carryFlag, value & 0x01);
+        setZN(result);
+        store(ea, result);
+    }
+    LANE_INLINE void ROR_ACC(const LaneAddress &ea)
+    {
+        LaneBytes result = accumulator >> 1 | carryFlag << 7;
+        assign(carryFlag, accumulator & 0x01);
+        assign(accumulator, result);
+        setZN(result);
+    }
+    LANE_INLINE void RTI(const LaneAddress &ea)
+    {
+        LaneBytes status;
+        popStack(status);
+        setSR(status);
+
+        LaneBytes lowByte;
+        LaneBytes highByte;
+        popStack(lowByte);
+        popStack(highByte);
+        next = __builtin_convertvector(highByte, LaneWords) << 8 | __builtin_convertvector(lowByte, LaneWords);
+    }
+    LANE_INLINE void RTS(const LaneAddress &ea)
+    {
+        LaneBytes lowByte;
+        LaneBytes highByte;
+        popStack(lowByte);
+        popStack(highByte);
+        next = (__builtin_convertvector(highByte, LaneWords) << 8 | __builtin_convertvector(lowByte, LaneWords)) + 1;
+    }
+    LANE_INLINE void SBC(const LaneAddress &ea)
+    {
+        LaneBytes value;
+        load(ea, value);
+        add(value, 0xFF, DecimalTables::get().sbc);
+    }
+    LANE_INLINE void SEC(const LaneAddress &ea)
+    {
+        assign(carryFlag, LaneBytes() + 1);
+    }
+    LANE_INLINE void SED(const LaneAddress &ea)
+    {
+        assign(statusRegister, statusRegister | 0x08);
+    }
+    LANE_INLINE void SEI(const LaneAddress &ea)
+    {
+        assign(statusRegister, statusRegister | 0x04);
+    }
+    LANE_INLINE void STA(const LaneAddress &ea)
+    {
+        store(ea, accumulator);
+    }
+    LANE_INLINE void STX(const LaneAddress &ea)
+    {
+        store(ea, xRegister);
+    }
+    LANE_INLINE void STY(const LaneAddress &ea)
+    {
+        store(ea, yRegister);
+    }
+    LANE_INLINE void TAX(const LaneAddress &ea)
+    {
+        assign(xRegister, accumulator);
+        setZN(accumulator);
+    }
+    LANE_INLINE void TAY(const LaneAddress &ea)
+    {
+        assign(yRegister, accumulator);
+        setZN(accumulator);
+    }
+    LANE_INLINE void TSX(const LaneAddress &ea)
+    {
+        assign(xRegister, stackPointer);
+        setZN(stackPointer);
+    }
+    LANE_INLINE void TXA(const LaneAddress &ea)
+    {
+        assign(accumulator, xRegister);
+        setZN(xRegister);
+    }
+    LANE_INLINE void TXS(const LaneAddress &ea)
+    {
+        assign(stackPointer, xRegister);
+    }
+    LANE_INLINE void TYA(const LaneAddress &ea)
+    {
+        assign(accumulator, yRegister);
+        setZN(yRegister);
+    }
+};
+
+/**
+ * @brief Execute one opcode for the active lanes of a group.
+ *
+ * Every legal opcode gets its own function with the addressing mode and the
+ * operation fused, compiled once per instruction set.
+ */
+template <uint8_t opcode>
+void executeLanes(LaneGroup &group);
+
+#define MOS6502_OPCODE(opcode, alias, code, mode, cycles, bytes, pageCycles)        \
+    template <>                                                                     \
+    LANE_TARGETS void executeLanes<opcode>(LaneGroup & group)                       \
+    {                                                                               \
+        LaneAddress address;                                                        \
+        group.fetch(bytes);                                                         \
+        group.addressing##mode(address);                                            \
+        group.code(address);                                                        \
+        if (pageCycles)                                                             \
+            group.extraCycles += (LaneBytes)address.crossed & (uint8_t)pageCycles; \
+        group.finish(cycles);                                                       \
+    }
+#define MOS6502_ILLEGAL(opcode)
+#include "../include/mos6502_opcodes.h"
+#undef MOS6502_OPCODE
+#undef MOS6502_ILLEGAL
+
+typedef void (*LaneHandler)(LaneGroup &group);
+
+// The handler of every opcode, NULL for illegal ones
+const LaneHandler laneHandlers[256] = {
+#define MOS6502_OPCODE(opcode, alias, code, mode, cycles, bytes, pageCycles) &executeLanes<opcode>,
+#define MOS6502_ILLEGAL(opcode) NULL,
+#include "../include/mos6502_opcodes.h"
+#undef MOS6502_OPCODE
+#undef MOS6502_ILLEGAL
+};
+
+/**
+ * @brief Run the lanes of a group until every lane stopped or some have to be finished on a scalar CPU.
+ *
+ * Each step executes the instruction at the lowest PC of the running lanes
+ * for every lane sitting there with the same bytes. Lanes that are ahead
+ * wait for the others, so lanes that took different sides of a branch come
+ * back together where the paths join.
+ */
+void runLanes(LaneGroup &group)
+{
+    bool converged = false;
+    uint16_t groupPC = 0;
+
+    group.spillBits = 0;
+
+    while (group.runningBits)
+    {
+        if (converged)
+        {
+            group.active = group.running;
+            group.activeBits = group.runningBits;
+        }
+        else
+        {
+            groupPC = 0xFFFF;
+            for (uint32_t bits = group.runningBits; bits; bits &= bits - 1)
+            {
+                int lane = __builtin_ctz(bits);
+                if (group.programCounter[lane] < groupPC)
+                    groupPC = group.programCounter[lane];
+            }
+
+            equal(group.programCounter, groupPC, group.active);
+            group.active &= group.running;
+            group.activeBits = laneBits(group.active);
+
+            LaneWordMask waiting = __builtin_convertvector(group.running & ~group.active, LaneWordMask);
+            group.waited = (LaneWords)waiting & (group.waited + 1);
+
+            LaneWordMask waitedTooLongWords;
+            nonZero(group.waited >> SPILL_SHIFT, waitedTooLongWords);
+
+            LaneMask waitedTooLong;
+            narrow(waitedTooLongWords, waitedTooLong);
+
+            uint32_t tired = laneBits(waitedTooLong) & group.runningBits;
+            if (tired)
+            {
+                group.spillBits = tired;
+                return;
+            }
+        }
+
+        group.firstLane = __builtin_ctz(group.activeBits);
+        group.opcodeAddress = groupPC;
+
+        LaneBytes opcodes;
+        group.loadRow(groupPC, opcodes);
+
+        uint8_t opcode = opcodes[group.firstLane];
+        LaneMask same;
+        equal(opcodes, opcode, same);
+        group.active &= same;
+
+        LaneHandler handler = laneHandlers[opcode];
+        if (!handler)
+        {
+            // Leave illegal opcodes to the host, PC still points at them
+            group.retire(laneBits(group.active), mos6502::RUN_ILLEGAL_OPCODE);
+            converged = false;
+            continue;
+        }
+
+        handler(group);
+
+        // Stay on the fast path while every running lane executed and they all went to the same place
+        converged = false;
+        if (group.activeBits && group.activeBits == group.runningBits)
+        {
+            groupPC = group.next[__builtin_ctz(group.activeBits)];
+
+            equal(group.next, groupPC, same);
+            converged = (laneBits(same) & group.activeBits) == group.activeBits;
+        }
+
+        if (group.guard >= group.slack)
+            group.flush();
+    }
+}
+
+} // namespace
+
+LockstepRunner::LockstepRunner()
+{
+    seconds = 0;
+    totalInstructions = 0;
+    totalCycles = 0;
+    laneInstructions = 0;
+    vectorSteps = 0;
+    scalarJobs = 0;
+}
+
+size_t LockstepRunner::addJob(const BatchJob &job)
+{
+    jobs.push_back(job);
+    return jobs.size() - 1;
+}
+
+bool LockstepRunner::fitsLane(const BatchJob &job)
+{
+    if ((job.image && job.base + job.length > 65536) || job.maxInstructions)
+        return false;
+
+    const mos6502 *cpu = job.prototype;
+    if (!cpu)
+        return true;
+
+    if (cpu->debugArmed || cpu->trace || !cpu->events.empty() || cpu->irqLines || cpu->nmiPending)
+        return false;
+
+#ifdef MOS6502_PROFILE
+    if (cpu->profiling)
+        return false;
+#endif
+
+    for (int page = 0; page < 256; page++)
+    {
+        if (!cpu->pages[page].internal)
+            return false;
+    }
+
+    return true;
+}
+
+void LockstepRunner::runGroup(const size_t *group, size_t count)
+{
+    memory.resize(static_cast<size_t>(LANES) * 65536);
+
+    LaneGroup lanes = LaneGroup();
+    lanes.memory = memory.data();
+
+    // RAM of the prototypes, one byte broadcast to all lanes when they share it
+    bool samePrototype = true;
+    bool sameImage = true;
+    for (size_t i = 1; i < count; i++)
+    {
+        const BatchJob &first = jobs[group[0]];
+        const BatchJob &job = jobs[group[i]];
+
+        samePrototype = samePrototype && job.prototype == first.prototype;
+        sameImage = sameImage && job.image == first.image && job.length == first.length && job.base == first.base;
+    }
+
+    if (samePrototype)
+    {
+        const mos6502 *prototype = jobs[group[0]].prototype;
+        if (!prototype)
+            std::memset(memory.data(), 0, memory.size());
+
+        for (int page = 0; prototype && page < 256; page++)
+        {
+            const uint8_t *data = prototype->ramPage(page);
+            for (int i = 0; i < 256; i++)
+                std::memset(lanes.row(page << 8 | i), data[i], LANES);
+        }
+    }
+    else
+    {
+        for (size_t lane = 0; lane < count; lane++)
+        {
+            const mos6502 *prototype = jobs[group[lane]].prototype;
+            for (size_t address = 0; address < 65536; address++)
+                memory[address * LANES + lane] = prototype ? prototype->ramPage(address >> 8)[address & 0xFF] : 0;
+        }
+    }
+
+    if (sameImage)
+    {
+        const BatchJob &job = jobs[group[0]];
+        for (size_t i = 0; job.image && i < job.length; i++)
+            std::memset(lanes.row(job.base + i), job.image[i], LANES);
+    }
+    else
+    {
+        for (size_t lane = 0; lane < count; lane++)
+        {
+            const BatchJob &job = jobs[group[lane]];
+            for (size_t i = 0; job.image && i < job.length; i++)
+                memory[(job.base + i) * LANES + lane] = job.image[i];
+        }
+    }
+
+    for (size_t lane = 0; lane < count; lane++)
+    {
+        const BatchJob &job = jobs[group[lane]];
+
+        lanes.programCounter[lane] = job.PC;
+        lanes.stackPointer[lane] = job.SP;
+        lanes.accumulator[lane] = job.AC;
+        lanes.xRegister[lane] = job.XR;
+        lanes.yRegister[lane] = job.YR;
+
+        lanes.statusRegister[lane] = job.SR & 0x3C;
+        lanes.carryFlag[lane] = job.SR & 0x01;
+        lanes.zeroResult[lane] = (job.SR & 0x02) ? 0 : 1;
+        lanes.negativeResult[lane] = job.SR;
+        lanes.overflowResult[lane] = job.SR << 1;
+
+        lanes.maxCycles[lane] = job.maxCycles;
+        lanes.running[lane] = -1;
+        lanes.runningBits |= 1u << lane;
+    }
+
+    uint32_t scalarBits = 0;
+
+    lanes.flush();
+    for (;;)
+    {
+        runLanes(lanes);
+        if (!lanes.spillBits)
+            break;
+
+        // Bring the counts up to date, which may also stop some of the lanes
+        lanes.flush();
+
+        uint32_t spill = lanes.spillBits & lanes.runningBits;
+        std::vector<uint8_t> column(65536);
+
+        for (uint32_t bits = spill; bits; bits &= bits - 1)
+        {
+            int lane = __builtin_ctz(bits);
+            const BatchJob &job = jobs[group[lane]];
+            BatchResult &result = results[group[lane]];
+
+            for (size_t address = 0; address < 65536; address++)
+                column[address] = memory[address * LANES + lane];
+
+            mos6502 cpu;
+            cpu.loadMemory(column.data(), column.size(), 0);
+
+            cpu.setPC(lanes.programCounter[lane]);
+            cpu.setSP(lanes.stackPointer[lane]);
+            cpu.setSR((lanes.negativeResult[lane] & 0x80) | (lanes.overflowResult[lane] & 0x80) >> 1 |
+                      lanes.statusRegister[lane] | (lanes.zeroResult[lane] ? 0 : 0x02) | lanes.carryFlag[lane]);
+            cpu.setAC(lanes.accumulator[lane]);
+            cpu.setXR(lanes.xRegister[lane]);
+            cpu.setYR(lanes.yRegister[lane]);
+
+            result.status = cpu.run(job.maxCycles - lanes.cycles[lane]);
+            result.PC = cpu.getPC();
+            result.SP = cpu.getSP();
+            result.SR = cpu.getSR();
+            result.AC = cpu.getAC();
+            result.XR = cpu.getXR();
+            result.YR = cpu.getYR();
+            result.cycles = lanes.cycles[lane] + cpu.getCycles();
+            result.instructions = lanes.instructions[lane] + cpu.getInstructionCount();
+            result.memoryDigest = cpu.digestMemory();
+
+            scalarJobs++;
+        }
+
+        lanes.retire(spill, mos6502::RUN_BUDGET_EXHAUSTED);
+        scalarBits |= spill;
+    }
+    lanes.flush();
+
+    laneInstructions += lanes.laneInstructions;
+    vectorSteps += lanes.steps;
+
+    // digestMemory() of every lane at once
+    static const uint64_t offsetBasis = 0xCBF29CE484222325ULL;
+    static const uint64_t prime = 0x100000001B3ULL;
+
+    uint64_t digests[LANES];
+    uint64_t hashes[LANES];
+    for (unsigned lane = 0; lane < LANES; lane++)
+        digests[lane] = offsetBasis;
+
+    for (int page = 0; page < 256; page++)
+    {
+        for (unsigned lane = 0; lane < LANES; lane++)
+            hashes[lane] = offsetBasis;
+
+        for (int i = 0; i < 256; i++)
+        {
+            const uint8_t *bytes = lanes.row(page << 8 | i);
+            for (unsigned lane = 0; lane < LANES; lane++)
+                hashes[lane] = (hashes[lane] ^ bytes[lane]) * prime;
+        }
+
+        for (unsigned lane = 0; lane < LANES; lane++)
+            digests[lane] = (digests[lane] ^ hashes[lane] ^ page) * prime;
+    }
+
+    for (size_t lane = 0; lane < count; lane++)
+    {
+        if (scalarBits & (1u << lane))
+            continue;
+
+        BatchResult &result = results[group[lane]];
+
+        result.status = lanes.status[lane];
+        result.PC = lanes.programCounter[lane];
+        result.SP = lanes.stackPointer[lane];
+        result.SR = (lanes.negativeResult[lane] & 0x80) | (lanes.overflowResult[lane] & 0x80) >> 1 |
+                    lanes.statusRegister[lane] | (lanes.zeroResult[lane] ? 0 : 0x02) | lanes.carryFlag[lane];
+        result.AC = lanes.accumulator[lane];
+        result.XR = lanes.xRegister[lane];
+        result.YR = lanes.yRegister[lane];
+        result.cycles = lanes.cycles[lane];
+        result.instructions = lanes.instructions[lane];
+        result.memoryDigest = digests[lane];
+    }
+}
+
+void LockstepRunner::run()
+{
+    results.assign(jobs.size(), BatchResult());
+    laneInstructions = 0;
+    vectorSteps = 0;
+    scalarJobs = 0;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    // Jobs are grouped in the order they were added, the ones needing more than RAM run on their own
+    size_t group[LANES];
+    size_t count = 0;
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        if (!fitsLane(jobs[i]))
+        {
+            BatchRunner::runJob(jobs[i], results[i]);
+            scalarJobs++;
+            continue;
+        }
+
+        group[count++] = i;
+        if (count == LANES)
+        {
+            runGroup(group, count);
+            count = 0;
+        }
+    }
+    if (count)
+        runGroup(group, count);
+
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    totalInstructions = 0;
+    totalCycles = 0;
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        totalInstructions += results[i].instructions;
+        totalCycles += results[i].cycles;
+    }
+}
+
+const std::vector<BatchResult> &LockstepRunner::getResults()
+{
+    return results;
+}
+
+double LockstepRunner::getSeconds()
+{
+    return seconds;
+}
+
+uint64_t LockstepRunner::getInstructions()
+{
+    return totalInstructions;
+}
+
+uint64_t LockstepRunner::getCycles()
+{
+    return totalCycles;
+}
+
+double LockstepRunner::getInstructionsPerSecond()
+{
+    return seconds > 0 ? totalInstructions / seconds : 0;
+}
+
+double LockstepRunner::getActiveLanes()
+{
+    return vectorSteps ? static_cast<double>(laneInstructions) / vectorSteps : 0;
+}
+
+size_t LockstepRunner::getScalarJobs()
+{
+    return scalarJobs;
+}
+
+const char *LockstepRunner::getVectorISA()
+{
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? "avx2" : "sse2";
+#elif defined(__SSE2__)
+    return "sse2";
+#else
+    return "generic";
+#endif
+}
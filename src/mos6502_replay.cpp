@@ -0,0 +1,564 @@
+#include "../include/mos6502_replay.h"
+
+#include <cstring>
+#include <iterator>
+
+// Replay file layout, all values little-endian:
+//   "M6RP", version u16, reserved u16, entry count u64, data size u64
+// followed by the entries, oldest first:
+//   kind, cycles since the previous entry as a LEB128 number, then the payload of the kind:
+//     READ, HOST_READ, WRITE address u16, value
+//     PC                   address u16
+//     REGISTER, FLAG       index, value
+//     IRQ_LINE             source | state << 7
+//     NMI_LINE             state
+//     IRQ, NMI, RESET, TRAP nothing
+#define REPLAY_HEADER_SIZE 24
+#define REPLAY_KINDS 12
+
+static void putLittleEndian(uint8_t *out, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+        out[i] = (value >> (8 * i)) & 0xFF;
+}
+static uint64_t getLittleEndian(const uint8_t *data, int bytes)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++)
+        value |= static_cast<uint64_t>(data[i]) << (8 * i);
+    return value;
+}
+
+/**
+ * @brief Decode the entry at a position.
+ *
+ * @param data The encoded entries.
+ * @param position Where the entry starts, moved past it.
+ * @param cycle The cycle of the entry before, changed to the cycle of this one.
+ * @param entry Set to the entry.
+ * @return false if the data ends inside the entry or the kind is unknown.
+ */
+static bool decodeEntry(const std::vector<uint8_t> &data, size_t &position, uint64_t &cycle, ReplayEntry &entry)
+{
+    size_t at = position;
+    if (at >= data.size() || data[at] >= REPLAY_KINDS)
+        return false;
+
+    entry.kind = data[at++];
+    entry.index = 0;
+    entry.address = 0;
+    entry.value = 0;
+
+    uint64_t delta = 0;
+    for (int shift = 0;; shift += 7)
+    {
+        if (at >= data.size() || shift > 63)
+            return false;
+
+        delta |= static_cast<uint64_t>(data[at] & 0x7F) << shift;
+        if (!(data[at++] & 0x80))
+            break;
+    }
+
+    size_t payload = 0;
+    switch (entry.kind)
+    {
+    case REPLAY_READ:
+    case REPLAY_HOST_READ:
+    case REPLAY_WRITE:
+        payload = 3;
+        break;
+    case REPLAY_PC:
+    case REPLAY_REGISTER:
+    case REPLAY_FLAG:
+        payload = 2;
+        break;
+    case REPLAY_IRQ_LINE:
+    case REPLAY_NMI_LINE:
+        payload = 1;
+        break;
+    }
+    if (data.size() - at < payload)
+        return false;
+
+    switch (entry.kind)
+    {
+    case REPLAY_READ:
+    case REPLAY_HOST_READ:
+    case REPLAY_WRITE:
+        entry.address = getLittleEndian(&data[at], 2);
+        entry.value = data[at + 2];
+        break;
+    case REPLAY_PC:
+        entry.address = getLittleEndian(&data[at], 2);
+        break;
+    case REPLAY_REGISTER:
+    case REPLAY_FLAG:
+        entry.index = data[at];
+        entry.value = data[at + 1];
+        break;
+    case REPLAY_IRQ_LINE:
+        entry.index = data[at] & 0x1F;
+        entry.value = data[at] >> 7;
+        break;
+    case REPLAY_NMI_LINE:
+        entry.value = data[at];
+        break;
+    }
+
+    cycle += delta;
+    entry.cycle = cycle;
+    position = at + payload;
+    return true;
+}
+
+ReplayLog::ReplayLog()
+{
+    clear();
+}
+
+void ReplayLog::append(const ReplayEntry &entry)
+{
+    data.push_back(entry.kind);
+
+    uint64_t delta = entry.cycle - lastCycle;
+    while (delta >= 0x80)
+    {
+        data.push_back((delta & 0x7F) | 0x80);
+        delta >>= 7;
+    }
+    data.push_back(delta);
+
+    switch (entry.kind)
+    {
+    case REPLAY_READ:
+    case REPLAY_HOST_READ:
+    case REPLAY_WRITE:
+        data.push_back(entry.address & 0xFF);
+        data.push_back(entry.address >> 8);
+        data.push_back(entry.value);
+        break;
+    case REPLAY_PC:
+        data.push_back(entry.address & 0xFF);
+        data.push_back(entry.address >> 8);
+        break;
+    case REPLAY_REGISTER:
+    case REPLAY_FLAG:
+        data.push_back(entry.index);
+        data.push_back(entry.value);
+        break;
+    case REPLAY_IRQ_LINE:
+        data.push_back((entry.index & 0x1F) | (entry.value ? 0x80 : 0));
+        break;
+    case REPLAY_NMI_LINE:
+        data.push_back(entry.value ? 1 : 0);
+        break;
+    }
+
+    lastCycle = entry.cycle;
+    count++;
+}
+
+bool ReplayLog::peek(ReplayEntry &entry)
+{
+    if (diverged)
+        return false;
+
+    if (!peeked)
+    {
+        nextPosition = position;
+        uint64_t cycle = positionCycle;
+        if (!decodeEntry(data, nextPosition, cycle, next))
+            return false;
+        peeked = true;
+    }
+
+    entry = next;
+    return true;
+}
+
+void ReplayLog::skip()
+{
+    if (!peeked)
+        return;
+
+    position = nextPosition;
+    positionCycle = next.cycle;
+    replayed++;
+    peeked = false;
+}
+
+void ReplayLog::rewind()
+{
+    position = 0;
+    positionCycle = 0;
+    replayed = 0;
+    diverged = false;
+    peeked = false;
+}
+
+void ReplayLog::setDiverged()
+{
+    diverged = true;
+}
+
+bool ReplayLog::getDiverged()
+{
+    return diverged;
+}
+
+void ReplayLog::clear()
+{
+    data.clear();
+    count = 0;
+    lastCycle = 0;
+    rewind();
+}
+
+uint64_t ReplayLog::getCount()
+{
+    return count;
+}
+
+uint64_t ReplayLog::getReplayed()
+{
+    return replayed;
+}
+
+size_t ReplayLog::getSize()
+{
+    return data.size();
+}
+
+bool ReplayLog::save(const std::string &path)
+{
+    uint8_t header[REPLAY_HEADER_SIZE];
+    std::memcpy(header, "M6RP", 4);
+    putLittleEndian(&header[4], REPLAY_VERSION, 2);
+    putLittleEndian(&header[6], 0, 2);
+    putLittleEndian(&header[8], count, 8);
+    putLittleEndian(&header[16], data.size(), 8);
+
+    std::ofstream file(path.c_str(), std::ios::binary);
+    if (!file.is_open())
+    {
+        std::cerr << "Error: Unable to open file " << path << " for writing." << std::endl;
+        return false;
+    }
+
+    file.write(reinterpret_cast<const char *>(header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(data.data()), data.size());
+    return file.good();
+}
+
+bool ReplayLog::load(const std::string &path)
+{
+    std::ifstream file(path.c_str(), std::ios::binary);
+    if (!file)
+    {
+        std::cerr << "Error: Unable to open file " << path << " for reading." << std::endl;
+        return false;
+    }
+
+    std::vector<uint8_t> contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    if (contents.size() < REPLAY_HEADER_SIZE || std::memcmp(contents.data(), "M6RP", 4) != 0)
+    {
+        std::cerr << "Error: Not a replay log." << std::endl;
+        return false;
+    }
+    if (getLittleEndian(&contents[4], 2) != REPLAY_VERSION)
+    {
+        std::cerr << "Error: Unsupported replay log version " << getLittleEndian(&contents[4], 2) << "." << std::endl;
+        return false;
+    }
+
+    uint64_t entries = getLittleEndian(&contents[8], 8);
+    uint64_t size = getLittleEndian(&contents[16], 8);
+    if (size > contents.size() - REPLAY_HEADER_SIZE)
+    {
+        std::cerr << "Error: Replay log is truncated." << std::endl;
+        return false;
+    }
+
+    std::vector<uint8_t> loaded(contents.begin() + REPLAY_HEADER_SIZE, contents.begin() + REPLAY_HEADER_SIZE + size);
+
+    // Every entry has to decode, and the last cycle is needed to append more
+    size_t at = 0;
+    uint64_t cycle = 0;
+    uint64_t decoded = 0;
+    ReplayEntry entry;
+    while (at < loaded.size() && decodeEntry(loaded, at, cycle, entry))
+        decoded++;
+
+    if (at != loaded.size() || decoded != entries)
+    {
+        std::cerr << "Error: Replay log is corrupt." << std::endl;
+        return false;
+    }
+
+    data.swap(loaded);
+    count = entries;
+    lastCycle = cycle;
+    rewind();
+    return true;
+}
+
+// The recording and replaying side of mos6502, in its own file like the JIT so the run loop in mos6502.cpp is inlined as before
+
+void mos6502::setRecorder(ReplayLog *log)
+{
+    recorder = log;
+    if (recorder)
+        recorder->clear();
+}
+void mos6502::setReplay(ReplayLog *log)
+{
+    if (replayer)
+        cancelEvents(replayer);
+
+    replayer = log;
+    replayScheduled = UINT64_MAX;
+    if (!replayer)
+        return;
+
+    // What the devices' events did is in the log, left scheduled they would do it twice
+    while (!events.empty())
+        events.pop();
+    updateNextEvent();
+
+    replayer->rewind();
+    replayInputs();
+}
+void mos6502::recordInput(uint8_t kind, uint8_t index, uint16_t address, uint8_t value)
+{
+    ReplayEntry entry = {cycleCount, kind, index, address, value};
+    recorder->append(entry);
+}
+void mos6502::replayInputs()
+{
+    ReplayEntry entry;
+    while (replayer->peek(entry))
+    {
+        // The program's own reads and traps are matched when it gets to them
+        bool program = entry.kind == REPLAY_READ || entry.kind == REPLAY_TRAP;
+
+        if (entry.cycle < cycleCount)
+        {
+            replayDiverged();
+            break;
+        }
+
+        if (entry.cycle > cycleCount || program)
+        {
+            // Due at the first instruction boundary at or after its cycle, like any event scheduled one cycle before
+            if (!program && replayScheduled != entry.cycle - 1)
+            {
+                replayScheduled = entry.cycle - 1;
+                scheduleEvent(replayScheduled, replayEvent, replayer);
+            }
+            break;
+        }
+
+        replayer->skip();
+
+        switch (entry.kind)
+        {
+        case REPLAY_IRQ_LINE:
+            if (entry.value)
+                irqLines |= 1u << entry.index;
+            else
+                irqLines &= ~(1u << entry.index);
+            break;
+        case REPLAY_NMI_LINE:
+            if (entry.value && !nmiLine)
+                nmiPending = true;
+            nmiLine = entry.value;
+            break;
+        case REPLAY_IRQ:
+            Core6502<PagedBus>::IRQ();
+            break;
+        case REPLAY_NMI:
+            Core6502<PagedBus>::NMI();
+            break;
+        case REPLAY_RESET:
+            Core6502<PagedBus>::reset();
+            break;
+        case REPLAY_PC:
+            Core6502<PagedBus>::setPC(entry.address);
+            break;
+        case REPLAY_REGISTER:
+            switch (entry.index)
+            {
+            case BREAK_AC:
+                Core6502<PagedBus>::setAC(entry.value);
+                break;
+            case BREAK_XR:
+                Core6502<PagedBus>::setXR(entry.value);
+                break;
+            case BREAK_YR:
+                Core6502<PagedBus>::setYR(entry.value);
+                break;
+            case BREAK_SP:
+                Core6502<PagedBus>::setSP(entry.value);
+                break;
+            case BREAK_SR:
+                Core6502<PagedBus>::setSR(entry.value);
+                break;
+            }
+            break;
+        case REPLAY_FLAG:
+            Core6502<PagedBus>::setFlag(static_cast<flag_bits>(entry.index), entry.value);
+            break;
+        case REPLAY_HOST_READ:
+            // Only a record of what the host saw, the host does not run along with a replay
+            break;
+        case REPLAY_WRITE:
+            bus.write(entry.address, entry.value);
+            break;
+        }
+    }
+
+    updateNextEvent();
+}
+void mos6502::replayEvent(mos6502 &cpu, void *context, uint64_t cycle)
+{
+    (void)cycle;
+
+    // A fork keeps the events of a replay it does not take part in
+    if (cpu.replayer != context)
+        return;
+
+    cpu.replayScheduled = UINT64_MAX;
+    cpu.replayInputs();
+}
+uint8_t mos6502::replayRead(uint16_t address)
+{
+    ReplayEntry entry;
+
+    // Host reads are not replayed, replayInputs() skips what they returned while recording
+    if (hostRead)
+        return 0xFF;
+
+    // Inputs a read handler made come before its byte
+    replayInputs();
+
+    if (!replayer->peek(entry))
+        return 0xFF;
+
+    if (entry.kind != REPLAY_READ || entry.cycle != cycleCount || entry.address != address)
+    {
+        replayDiverged();
+        return 0xFF;
+    }
+
+    replayer->skip();
+    replayInputs();
+    return entry.value;
+}
+bool mos6502::replayTrap()
+{
+    if (recorder)
+        recordInput(REPLAY_TRAP, 0, 0, 0);
+
+    // A replay only has its own event pending when an input is due, so it gets here where the recording trapped
+    ReplayEntry entry;
+    if (replayer && replayer->peek(entry))
+    {
+        if (entry.kind != REPLAY_TRAP || entry.cycle != cycleCount)
+        {
+            replayDiverged();
+            return true;
+        }
+
+        replayer->skip();
+        replayInputs();
+    }
+
+    return true;
+}
+void mos6502::replayDiverged()
+{
+    if (replayer->getDiverged())
+        return;
+
+    std::cerr << "Error: Replay diverged at cycle " << cycleCount << " PC $" << std::hex << std::uppercase << std::setw(4)
+              << std::setfill('0') << programCounter << std::dec << std::setfill(' ') << " after " << replayer->getReplayed()
+              << " inputs." << std::endl;
+
+    replayer->setDiverged();
+    stopRequested = true;
+}
+void mos6502::setPC(uint16_t data)
+{
+    if (recorder)
+        recordInput(REPLAY_PC, 0, data, 0);
+    Core6502<PagedBus>::setPC(data);
+}
+void mos6502::setSP(uint8_t data)
+{
+    if (recorder)
+        recordInput(REPLAY_REGISTER, BREAK_SP, 0, data);
+    Core6502<PagedBus>::setSP(data);
+}
+void mos6502::setSR(uint8_t data)
+{
+    if (recorder)
+        recordInput(REPLAY_REGISTER, BREAK_SR, 0, data);
+    Core6502<PagedBus>::setSR(data);
+}
+void mos6502::setAC(uint8_t data)
+{
+    if (recorder)
+        recordInput(REPLAY_REGISTER, BREAK_AC, 0, data);
+    Core6502<PagedBus>::setAC(data);
+}
+void mos6502::setXR(uint8_t data)
+{
+    if (recorder)
+        recordInput(REPLAY_REGISTER, BREAK_XR, 0, data);
+    Core6502<PagedBus>::setXR(data);
+}
+void mos6502::setYR(uint8_t data)
+{
+    if (recorder)
+        recordInput(REPLAY_REGISTER, BREAK_YR, 0, data);
+    Core6502<PagedBus>::setYR(data);
+}
+void mos6502::setFlag(flag_bits flag, bool state)
+{
+    if (recorder)
+        recordInput(REPLAY_FLAG, flag, 0, state);
+    Core6502<PagedBus>::setFlag(flag, state);
+}
+uint8_t mos6502::readByte(uint16_t address)
+{
+    hostRead = true;
+    uint8_t value = bus.read(address);
+    hostRead = false;
+    return value;
+}
+void mos6502::writeByte(uint16_t address, uint8_t data)
+{
+    if (recorder)
+        recordInput(REPLAY_WRITE, 0, address, data);
+    bus.write(address, data);
+}
+void mos6502::reset()
+{
+    if (recorder)
+        recordInput(REPLAY_RESET, 0, 0, 0);
+    Core6502<PagedBus>::reset();
+}
+void mos6502::IRQ()
+{
+    if (recorder)
+        recordInput(REPLAY_IRQ, 0, 0, 0);
+    Core6502<PagedBus>::IRQ();
+}
+void mos6502::NMI()
+{
+    if (recorder)
+        recordInput(REPLAY_NMI, 0, 0, 0);
+    Core6502<PagedBus>::NMI();
+}
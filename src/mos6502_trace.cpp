@@ -0,0 +1,195 @@
+#include "../include/mos6502_trace.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Trace file layout, all values little-endian:
+//   "M6TR", version u16, record size u16, record count u64
+// followed by the records, oldest first:
+//   cycles u32, PC u16, address u16, opcode, 2 operand bytes, A, X, Y, SP, SR
+#define TRACE_HEADER_SIZE 16
+#define TRACE_RECORD_SIZE 16
+
+static void putLittleEndian(uint8_t *out, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+        out[i] = (value >> (8 * i)) & 0xFF;
+}
+static uint64_t getLittleEndian(const uint8_t *data, int bytes)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++)
+        value |= static_cast<uint64_t>(data[i]) << (8 * i);
+    return value;
+}
+
+TraceBuffer::TraceBuffer(size_t capacity)
+{
+    size_t size = 1;
+    while (size < capacity)
+        size <<= 1;
+
+    records.assign(size, TraceRecord());
+    mask = size - 1;
+    head.store(0);
+}
+
+size_t TraceBuffer::getCapacity()
+{
+    return records.size();
+}
+
+uint64_t TraceBuffer::getCount()
+{
+    return head.load(std::memory_order_acquire);
+}
+
+void TraceBuffer::clear()
+{
+    head.store(0, std::memory_order_release);
+}
+
+void TraceBuffer::copyLast(std::vector<TraceRecord> &out, size_t count)
+{
+    uint64_t end = head.load(std::memory_order_acquire);
+    uint64_t start = end > count ? end - count : 0;
+    if (end - start > records.size())
+        start = end - records.size();
+
+    out.clear();
+    for (uint64_t i = start; i < end; i++)
+        out.push_back(records[i & mask]);
+
+    // The writer may have lapped the oldest records while they were copied,
+    // the slot of record i is reused once record i + capacity is being written
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t written = head.load(std::memory_order_relaxed);
+    uint64_t firstIntact = written + 1 > records.size() ? written + 1 - records.size() : 0;
+
+    if (firstIntact > start)
+        out.erase(out.begin(), out.begin() + std::min<uint64_t>(firstIntact - start, out.size()));
+}
+
+bool TraceBuffer::save(const std::string &path, size_t count)
+{
+    std::vector<TraceRecord> last;
+    copyLast(last, count);
+
+    std::vector<uint8_t> buffer(TRACE_HEADER_SIZE + last.size() * TRACE_RECORD_SIZE);
+    std::memcpy(buffer.data(), "M6TR", 4);
+    putLittleEndian(&buffer[4], TRACE_VERSION, 2);
+    putLittleEndian(&buffer[6], TRACE_RECORD_SIZE, 2);
+    putLittleEndian(&buffer[8], last.size(), 8);
+
+    for (size_t i = 0; i < last.size(); i++)
+    {
+        uint8_t *out = &buffer[TRACE_HEADER_SIZE + i * TRACE_RECORD_SIZE];
+        putLittleEndian(out, last[i].cycles, 4);
+        putLittleEndian(out + 4, last[i].PC, 2);
+        putLittleEndian(out + 6, last[i].address, 2);
+        out[8] = last[i].opcode;
+        out[9] = last[i].operands[0];
+        out[10] = last[i].operands[1];
+        out[11] = last[i].AC;
+        out[12] = last[i].XR;
+        out[13] = last[i].YR;
+        out[14] = last[i].SP;
+        out[15] = last[i].SR;
+    }
+
+    std::ofstream file(path.c_str(), std::ios::binary);
+    if (!file.is_open())
+    {
+        std::cerr << "Error: Unable to open file " << path << " for writing." << std::endl;
+        return false;
+    }
+
+    file.write(reinterpret_cast<const char *>(buffer.data()), buffer.size());
+    return file.good();
+}
+
+bool TraceBuffer::load(const std::string &path, std::vector<TraceRecord> &out)
+{
+    std::ifstream file(path.c_str(), std::ios::binary);
+    if (!file)
+    {
+        std::cerr << "Error: Unable to open file " << path << " for reading." << std::endl;
+        return false;
+    }
+
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    if (data.size() < TRACE_HEADER_SIZE || std::memcmp(data.data(), "M6TR", 4) != 0)
+    {
+        std::cerr << "Error: Not a trace." << std::endl;
+        return false;
+    }
+    if (getLittleEndian(&data[4], 2) != TRACE_VERSION || getLittleEndian(&data[6], 2) != TRACE_RECORD_SIZE)
+    {
+        std::cerr << "Error: Unsupported trace version " << getLittleEndian(&data[4], 2) << "." << std::endl;
+        return false;
+    }
+
+    uint64_t count = getLittleEndian(&data[8], 8);
+    if (count > (data.size() - TRACE_HEADER_SIZE) / TRACE_RECORD_SIZE)
+    {
+        std::cerr << "Error: Trace is truncated." << std::endl;
+        return false;
+    }
+
+    out.resize(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        const uint8_t *in = &data[TRACE_HEADER_SIZE + i * TRACE_RECORD_SIZE];
+        out[i].cycles = getLittleEndian(in, 4);
+        out[i].PC = getLittleEndian(in + 4, 2);
+        out[i].address = getLittleEndian(in + 6, 2);
+        out[i].opcode = in[8];
+        out[i].operands[0] = in[9];
+        out[i].operands[1] = in[10];
+        out[i].AC = in[11];
+        out[i].XR = in[12];
+        out[i].YR = in[13];
+        out[i].SP = in[14];
+        out[i].SR = in[15];
+    }
+
+    return true;
+}
+
+void TraceBuffer::print(std::ostream &out, const std::vector<TraceRecord> &records)
+{
+    std::ios::fmtflags flags = out.flags();
+    char fill = out.fill();
+
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        const TraceRecord &record = records[i];
+        uint8_t bytes[3] = {record.opcode, record.operands[0], record.operands[1]};
+        uint8_t length = mos6502::getInstructionLength(record.opcode);
+
+        out << std::dec << std::setfill(' ') << std::setw(10) << record.cycles
+            << std::hex << std::uppercase << std::setfill('0')
+            << "  $" << std::setw(4) << record.PC << "  ";
+
+        for (int b = 0; b < 3; b++)
+        {
+            if (b < length)
+                out << std::setw(2) << static_cast<int>(bytes[b]) << " ";
+            else
+                out << "   ";
+        }
+
+        out << " " << std::left << std::setfill(' ') << std::setw(14) << mos6502::disassemble(record.PC, bytes)
+            << std::right << std::setfill('0')
+            << " EA=$" << std::setw(4) << record.address
+            << " A=" << std::setw(2) << static_cast<int>(record.AC)
+            << " X=" << std::setw(2) << static_cast<int>(record.XR)
+            << " Y=" << std::setw(2) << static_cast<int>(record.YR)
+            << " SP=" << std::setw(2) << static_cast<int>(record.SP)
+            << " SR=" << std::setw(2) << static_cast<int>(record.SR) << std::endl;
+    }
+
+    out.flags(flags);
+    out.fill(fill);
+}
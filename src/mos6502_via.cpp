@@ -0,0 +1,245 @@
+#include "../include/mos6502_via.h"
+
+#include <cstring>
+
+// Register numbers
+#define VIA_ORB 0x0
+#define VIA_ORA 0x1
+#define VIA_DDRB 0x2
+#define VIA_DDRA 0x3
+#define VIA_T1CL 0x4
+#define VIA_T1CH 0x5
+#define VIA_T1LL 0x6
+#define VIA_T1LH 0x7
+#define VIA_T2CL 0x8
+#define VIA_T2CH 0x9
+#define VIA_ACR 0xB
+#define VIA_IFR 0xD
+#define VIA_IER 0xE
+#define VIA_ORA_NO_HANDSHAKE 0xF
+
+// ACR bit selecting free-running timer 1
+#define VIA_T1_FREE_RUN 0x40
+
+#define VIA_NO_DEADLINE UINT64_MAX
+
+Via6522::Via6522(mos6502 &cpu, uint8_t irqSource) : cpu(cpu), irqSource(irqSource)
+{
+    mapped = false;
+    page = 0;
+
+    std::memset(registers, 0, sizeof(registers));
+    auxiliaryControl = 0;
+    interruptFlags = 0;
+    interruptEnable = 0;
+
+    timer1Latch = 0xFFFF;
+    timer1Count = 0xFFFF;
+    timer1Start = 0;
+    timer1Deadline = VIA_NO_DEADLINE;
+
+    timer2LatchLow = 0xFF;
+    timer2Count = 0xFFFF;
+    timer2Start = 0;
+    timer2Deadline = VIA_NO_DEADLINE;
+}
+
+Via6522::~Via6522()
+{
+    cpu.cancelEvents(this);
+    cpu.setIRQLine(irqSource, false);
+
+    if (mapped)
+        cpu.unmap(page, 1);
+}
+
+void Via6522::map(uint8_t page)
+{
+    if (mapped)
+        cpu.unmap(this->page, 1);
+
+    cpu.mapIO(page, 1, readRegister, writeRegister, this);
+    mapped = true;
+    this->page = page;
+}
+
+uint16_t Via6522::timer1At(uint64_t cycle)
+{
+    if (cycle < timer1Start)
+        return timer1Count;
+
+    uint64_t elapsed = cycle - timer1Start;
+
+    // Past the reload of a free-running timer whose event has not been serviced yet
+    if ((auxiliaryControl & VIA_T1_FREE_RUN) && elapsed > static_cast<uint64_t>(timer1Count) + 1)
+    {
+        elapsed = (elapsed - timer1Count - 2) % (static_cast<uint64_t>(timer1Latch) + 2);
+        return elapsed <= timer1Latch ? timer1Latch - elapsed : 0xFFFF;
+    }
+
+    return (timer1Count - elapsed) & 0xFFFF;
+}
+
+uint16_t Via6522::timer2At(uint64_t cycle)
+{
+    if (cycle < timer2Start)
+        return timer2Count;
+
+    return (timer2Count - (cycle - timer2Start)) & 0xFFFF;
+}
+
+void Via6522::startTimer1(uint64_t start, uint16_t count)
+{
+    // The counter holds count on the start cycle, 0 count cycles later and
+    // $FFFF on the cycle after that, which is when the flag is set
+    timer1Start = start;
+    timer1Count = count;
+    timer1Deadline = start + count + 1;
+
+    cpu.scheduleEvent(timer1Deadline, timer1Expired, this);
+}
+
+void Via6522::setFlags(uint8_t set, uint8_t clear)
+{
+    interruptFlags = (interruptFlags | set) & ~clear & 0x7F;
+    cpu.setIRQLine(irqSource, (interruptFlags & interruptEnable) != 0);
+}
+
+void Via6522::timer1Expired(mos6502 &cpu, void *context, uint64_t cycle)
+{
+    Via6522 *via = static_cast<Via6522 *>(context);
+
+    // Rewriting the counter leaves the old event in the queue, it is ignored here
+    if (cycle != via->timer1Deadline)
+        return;
+
+    via->timer1Deadline = VIA_NO_DEADLINE;
+    via->setFlags(VIA_TIMER1, 0);
+
+    // A free-running timer reloads from the latch on the next cycle, a one-shot keeps counting down silently
+    if (via->auxiliaryControl & VIA_T1_FREE_RUN)
+        via->startTimer1(cycle + 1, via->timer1Latch);
+}
+
+void Via6522::timer2Expired(mos6502 &cpu, void *context, uint64_t cycle)
+{
+    Via6522 *via = static_cast<Via6522 *>(context);
+
+    if (cycle != via->timer2Deadline)
+        return;
+
+    via->timer2Deadline = VIA_NO_DEADLINE;
+    via->setFlags(VIA_TIMER2, 0);
+}
+
+uint8_t Via6522::read(uint8_t reg)
+{
+    uint64_t now = cpu.getCycles();
+
+    switch (reg & 0x0F)
+    {
+    case VIA_ORB:
+        return (registers[VIA_ORB] & registers[VIA_DDRB]) | ~registers[VIA_DDRB];
+    case VIA_ORA:
+    case VIA_ORA_NO_HANDSHAKE:
+        return (registers[VIA_ORA] & registers[VIA_DDRA]) | ~registers[VIA_DDRA];
+    case VIA_T1CL:
+        setFlags(0, VIA_TIMER1);
+        return timer1At(now) & 0xFF;
+    case VIA_T1CH:
+        return timer1At(now) >> 8;
+    case VIA_T1LL:
+        return timer1Latch & 0xFF;
+    case VIA_T1LH:
+        return timer1Latch >> 8;
+    case VIA_T2CL:
+        setFlags(0, VIA_TIMER2);
+        return timer2At(now) & 0xFF;
+    case VIA_T2CH:
+        return timer2At(now) >> 8;
+    case VIA_ACR:
+        return auxiliaryControl;
+    case VIA_IFR:
+        return getInterruptFlags();
+    case VIA_IER:
+        return interruptEnable | 0x80;
+    default:
+        return registers[reg & 0x0F];
+    }
+}
+
+void Via6522::write(uint8_t reg, uint8_t data)
+{
+    uint64_t now = cpu.getCycles();
+
+    switch (reg & 0x0F)
+    {
+    case VIA_T1CL:
+    case VIA_T1LL:
+        timer1Latch = (timer1Latch & 0xFF00) | data;
+        break;
+    case VIA_T1CH:
+        // Loads the counter from the latch and starts it
+        timer1Latch = (timer1Latch & 0x00FF) | (data << 8);
+        setFlags(0, VIA_TIMER1);
+        startTimer1(now + 1, timer1Latch);
+        break;
+    case VIA_T1LH:
+        timer1Latch = (timer1Latch & 0x00FF) | (data << 8);
+        setFlags(0, VIA_TIMER1);
+        break;
+    case VIA_T2CL:
+        timer2LatchLow = data;
+        break;
+    case VIA_T2CH:
+        setFlags(0, VIA_TIMER2);
+        timer2Start = now + 1;
+        timer2Count = (data << 8) | timer2LatchLow;
+        timer2Deadline = timer2Start + timer2Count + 1;
+        cpu.scheduleEvent(timer2Deadline, timer2Expired, this);
+        break;
+    case VIA_ACR:
+        auxiliaryControl = data;
+        break;
+    case VIA_IFR:
+        // Writing a 1 clears a flag
+        setFlags(0, data);
+        break;
+    case VIA_IER:
+        // Bit 7 selects whether the other set bits enable or disable their interrupt
+        if (data & 0x80)
+            interruptEnable |= data & 0x7F;
+        else
+            interruptEnable &= ~data;
+        setFlags(0, 0);
+        break;
+    default:
+        registers[reg & 0x0F] = data;
+        break;
+    }
+}
+
+uint8_t Via6522::readRegister(void *context, uint16_t address)
+{
+    return static_cast<Via6522 *>(context)->read(address & 0x0F);
+}
+
+void Via6522::writeRegister(void *context, uint16_t address, uint8_t data)
+{
+    static_cast<Via6522 *>(context)->write(address & 0x0F, data);
+}
+
+uint16_t Via6522::getTimer1()
+{
+    return timer1At(cpu.getCycles());
+}
+
+uint16_t Via6522::getTimer2()
+{
+    return timer2At(cpu.getCycles());
+}
+
+uint8_t Via6522::getInterruptFlags()
+{
+    return interruptFlags | ((interruptFlags & interruptEnable) ? 0x80 : 0);
+}
@@ -0,0 +1,307 @@
+#include "../include/mos6502_batch.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <dirent.h>
+#include <sys/stat.h>
+#define RUN6502_HAVE_DIRENT
+#endif
+
+/**
+ * @brief Command line settings of the runner.
+ */
+struct Options
+{
+    std::string path;
+    uint16_t base;
+    bool haveStart;
+    uint16_t start;
+    bool haveStop;
+    uint16_t stop;
+    uint64_t cycles;
+    uint64_t instructions;
+    mos6502::run_engine engine;
+    unsigned threads;
+};
+
+/**
+ * @brief A ROM image read from a file.
+ */
+struct Rom
+{
+    std::string path;
+    std::vector<uint8_t> data;
+};
+
+static const char *statusName(mos6502::run_status status)
+{
+    switch (status)
+    {
+    case mos6502::RUN_BUDGET_EXHAUSTED:
+        return "limit";
+    case mos6502::RUN_ILLEGAL_OPCODE:
+        return "illegal";
+    case mos6502::RUN_TRAPPED:
+        return "trapped";
+    case mos6502::RUN_STOP_REQUESTED:
+        return "stopped";
+    case mos6502::RUN_BREAKPOINT:
+        return "stop-pc";
+    case mos6502::RUN_WATCHPOINT:
+        return "watch";
+    }
+
+    return "?";
+}
+
+static void usage(const char *program)
+{
+    std::cerr << "Usage: " << program << " [options] <ROM file or directory of ROM files>" << std::endl
+              << "  --base ADDR          hex address the ROM is loaded at (default 0000)" << std::endl
+              << "  --start ADDR         hex address to start at (default the reset vector in the ROM)" << std::endl
+              << "  --stop-pc ADDR       stop before executing the instruction at a hex address" << std::endl
+              << "  --cycles N           stop after N cycles (default 1000000000)" << std::endl
+              << "  --instructions N     stop after N instructions (default no limit)" << std::endl
+              << "  --engine NAME        switch, blocks or jit (default jit)" << std::endl
+              << "  --threads N          threads running a directory of ROMs, 0 for every hardware thread (default 0)" << std::endl
+              << "Every ROM also stops on an illegal opcode or a jump to itself. Exits with 1 if a ROM" << std::endl
+              << "could not be loaded, hit an illegal opcode, or did not reach the --stop-pc address." << std::endl;
+}
+
+static bool parseAddress(const char *value, uint16_t &address)
+{
+    if (value[0] == '$')
+        value++;
+
+    char *end = NULL;
+    unsigned long parsed = strtoul(value, &end, 16);
+    if (end == value || *end != '\0' || parsed > 0xFFFF)
+        return false;
+
+    address = parsed;
+    return true;
+}
+
+static bool parseOptions(int argc, char **argv, Options &options)
+{
+    options.base = 0x0000;
+    options.haveStart = false;
+    options.start = 0;
+    options.haveStop = false;
+    options.stop = 0;
+    options.cycles = 1000000000;
+    options.instructions = 0;
+    options.engine = mos6502::ENGINE_JIT;
+    options.threads = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string argument = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        char *end = NULL;
+
+        if (value && argument == "--base")
+        {
+            if (!parseAddress(argv[++i], options.base))
+                return false;
+        }
+        else if (value && argument == "--start")
+        {
+            if (!parseAddress(argv[++i], options.start))
+                return false;
+            options.haveStart = true;
+        }
+        else if (value && argument == "--stop-pc")
+        {
+            if (!parseAddress(argv[++i], options.stop))
+                return false;
+            options.haveStop = true;
+        }
+        else if (value && argument == "--cycles")
+        {
+            options.cycles = strtoull(value, &end, 10);
+            if (*end != '\0' || options.cycles == 0)
+                return false;
+            i++;
+        }
+        else if (value && argument == "--instructions")
+        {
+            options.instructions = strtoull(value, &end, 10);
+            if (*end != '\0' || options.instructions == 0)
+                return false;
+            i++;
+        }
+        else if (value && argument == "--engine")
+        {
+            std::string engine = argv[++i];
+            if (engine == "switch")
+                options.engine = mos6502::ENGINE_SWITCH;
+            else if (engine == "blocks")
+                options.engine = mos6502::ENGINE_BLOCKS;
+            else if (engine == "jit")
+                options.engine = mos6502::ENGINE_JIT;
+            else
+                return false;
+        }
+        else if (value && argument == "--threads")
+        {
+            options.threads = strtoul(value, &end, 10);
+            if (*end != '\0')
+                return false;
+            i++;
+        }
+        else if (argument.compare(0, 2, "--") != 0 && options.path.empty())
+            options.path = argument;
+        else
+            return false;
+    }
+
+    return !options.path.empty();
+}
+
+static bool readRom(const std::string &path, uint16_t base, Rom &rom)
+{
+    std::ifstream file(path.c_str(), std::ios::binary);
+    if (!file)
+    {
+        std::cerr << "Error: Could not open " << path << "." << std::endl;
+        return false;
+    }
+
+    rom.path = path;
+    rom.data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+    if (rom.data.empty() || base + rom.data.size() > 0x10000)
+    {
+        std::cerr << "Error: " << path << " is empty or does not fit in memory at $" << std::hex << std::uppercase
+                  << std::setw(4) << std::setfill('0') << base << "." << std::dec << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief List the regular files in a directory, sorted by name.
+ *
+ * @param path The directory.
+ * @param files Set to the paths of the files.
+ * @return false if path is not a directory.
+ */
+static bool listDirectory(const std::string &path, std::vector<std::string> &files)
+{
+#ifdef RUN6502_HAVE_DIRENT
+    DIR *directory = opendir(path.c_str());
+    if (!directory)
+        return false;
+
+    while (struct dirent *entry = readdir(directory))
+    {
+        std::string file = path + "/" + entry->d_name;
+
+        struct stat info;
+        if (entry->d_name[0] != '.' && stat(file.c_str(), &info) == 0 && S_ISREG(info.st_mode))
+            files.push_back(file);
+    }
+    closedir(directory);
+
+    std::sort(files.begin(), files.end());
+    return true;
+#else
+    (void)path;
+    (void)files;
+    return false;
+#endif
+}
+
+// Load a ROM, or every ROM in a directory, at full speed and report how each run ended
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    std::vector<std::string> paths;
+    if (!listDirectory(options.path, paths))
+        paths.push_back(options.path);
+    else if (paths.empty())
+    {
+        std::cerr << "Error: " << options.path << " holds no ROM files." << std::endl;
+        return 1;
+    }
+
+    bool ok = true;
+
+    std::vector<Rom> roms;
+    for (size_t i = 0; i < paths.size(); i++)
+    {
+        Rom rom;
+        if (readRom(paths[i], options.base, rom))
+            roms.push_back(rom);
+        else
+            ok = false;
+    }
+
+    if (roms.empty())
+        return 1;
+
+    // Every job forks the engine and the stop address from here
+    mos6502 prototype;
+    prototype.setEngine(options.engine);
+    if (options.haveStop)
+        prototype.addBreakpoint(options.stop);
+
+    BatchRunner runner(roms.size() == 1 ? 1 : options.threads);
+    for (size_t i = 0; i < roms.size(); i++)
+    {
+        const Rom &rom = roms[i];
+
+        uint16_t start = options.start;
+        if (!options.haveStart)
+        {
+            uint32_t vector = 0xFFFC - options.base;
+            if (options.base > 0xFFFC || vector + 1 >= rom.data.size())
+            {
+                std::cerr << "Error: " << rom.path << " does not cover the reset vector, give --start." << std::endl;
+                return 1;
+            }
+            start = rom.data[vector] | (rom.data[vector + 1] << 8);
+        }
+
+        BatchJob job = {&prototype, rom.data.data(), rom.data.size(), options.base, start, 0xFF, 0x36, 0, 0, 0, options.cycles, options.instructions};
+        runner.addJob(job);
+    }
+
+    runner.run();
+
+    const std::vector<BatchResult> &results = runner.getResults();
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BatchResult &result = results[i];
+
+        std::cout << roms[i].path << ": " << statusName(result.status) << std::hex << std::uppercase << std::setfill('0')
+                  << " PC=$" << std::setw(4) << result.PC << " A=$" << std::setw(2) << static_cast<int>(result.AC)
+                  << " X=$" << std::setw(2) << static_cast<int>(result.XR) << " Y=$" << std::setw(2) << static_cast<int>(result.YR)
+                  << " SP=$" << std::setw(2) << static_cast<int>(result.SP) << " SR=$" << std::setw(2) << static_cast<int>(result.SR)
+                  << std::dec << std::setfill(' ') << " cycles=" << result.cycles << " instructions=" << result.instructions << std::endl;
+
+        if (result.status == mos6502::RUN_ILLEGAL_OPCODE || (options.haveStop && result.status != mos6502::RUN_BREAKPOINT))
+            ok = false;
+    }
+
+    double seconds = runner.getSeconds();
+    std::cout << results.size() << (results.size() == 1 ? " ROM, " : " ROMs, ") << runner.getCycles() << " cycles, "
+              << runner.getInstructions() << " instructions in " << std::fixed << std::setprecision(3) << seconds << " s on "
+              << runner.getThreadCount() << (runner.getThreadCount() == 1 ? " thread: " : " threads: ") << std::setprecision(2)
+              << runner.getInstructionsPerSecond() / 1e6 << " MIPS, "
+              << (seconds > 0 ? runner.getCycles() / seconds / 1e6 : 0) << " MHz emulated" << std::endl;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,27 @@
+#include "../include/mos6502_trace.h"
+
+// Print a binary trace file written by TraceBuffer::save() as disassembly
+int main(int argc, char **argv)
+{
+    if (argc < 2 || argc > 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " <trace file> [last N records]" << std::endl;
+        return 2;
+    }
+
+    std::vector<TraceRecord> records;
+    if (!TraceBuffer::load(argv[1], records))
+        return 1;
+
+    if (argc == 3)
+    {
+        size_t last = strtoul(argv[2], NULL, 10);
+        if (last < records.size())
+            records.erase(records.begin(), records.end() - last);
+    }
+
+    std::cout << "    cycles  PC     bytes     instruction    state after" << std::endl;
+    TraceBuffer::print(std::cout, records);
+
+    return 0;
+}